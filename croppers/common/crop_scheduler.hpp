@@ -0,0 +1,259 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "hailo_objects.hpp"
+
+namespace common
+{
+
+    //-------------------------------
+    // CROP CANDIDATES
+    //-------------------------------
+
+    /**
+     * @brief An ROI a cropper would like to send to the second stage network.
+     */
+    struct CropCandidate
+    {
+        HailoROIPtr roi;
+        float priority;
+    };
+
+    /**
+     * @brief The priority of a crop: tracks that waited longer, bigger boxes and sharper crops first.
+     *
+     * @param quality  -  float
+     *        The quality score of the crop, 1 if the cropper does not measure it
+     *
+     * @param frames_since_crop  -  uint32_t
+     *        Frames since the track was last cropped, 0 for untracked ROIs
+     *
+     * @param bbox  -  HailoBBox
+     *        The box of the ROI, normalized to the frame
+     */
+    inline float crop_priority(float quality, uint32_t frames_since_crop, const HailoBBox &bbox)
+    {
+        float area = std::max(bbox.width(), 0.0f) * std::max(bbox.height(), 0.0f);
+        return std::max(quality, 0.0f) * float(1 + frames_since_crop) * (area + 0.01f);
+    }
+
+    //-------------------------------
+    // CROP SCHEDULER
+    //-------------------------------
+
+    /**
+     * @brief Shares the crop budget of a second stage network between the streams.
+     *        Croppers hand their candidates to schedule() and crop only what it returns:
+     *        at most max_per_frame crops of a frame and at most max_per_second crops per second
+     *        over all the streams (a token bucket), highest priority first.
+     *        The streams are served by weighted fair queuing: every crop advances the virtual
+     *        time of its stream by 1 / weight, and a stream may not get ahead of the slowest
+     *        backlogged stream by more than one frame budget, so a crowded camera cannot starve the others.
+     *        Streams that did not get all their candidates are backlogged, the others do not hold anyone back.
+     *        The counters of every stream are kept, read them with counters() or have them logged
+     *        periodically with a stats period.
+     */
+    class CropScheduler
+    {
+    public:
+        struct Counters
+        {
+            uint64_t frames = 0;
+            uint64_t candidates = 0;
+            uint64_t granted = 0;
+            uint64_t deferred = 0; // candidates left out by the budget
+        };
+
+    private:
+        using Clock = std::chrono::steady_clock;
+        static constexpr auto ACTIVE_PERIOD = std::chrono::seconds(1);
+
+        struct Stream
+        {
+            double virtual_time = 0.0;
+            bool backlogged = false;
+            Clock::time_point last_frame;
+            Counters counters;
+        };
+
+        std::string m_name;
+        uint32_t m_max_per_frame;
+        uint32_t m_max_per_second;
+        double m_tokens;
+        Clock::time_point m_last_refill;
+        std::chrono::duration<double> m_stats_period;
+        Clock::time_point m_last_stats;
+        std::map<std::string, Stream> m_streams;
+        std::mutex m_mutex;
+
+        void refill(Clock::time_point now)
+        {
+            double elapsed = std::chrono::duration<double>(now - m_last_refill).count();
+            m_last_refill = now;
+            m_tokens = std::min(double(m_max_per_second), m_tokens + elapsed * m_max_per_second);
+        }
+
+        // The virtual time of the slowest backlogged stream, other than the given one
+        double fair_virtual_time(const Stream &current, Clock::time_point now) const
+        {
+            double virtual_time = current.virtual_time;
+            bool found = false;
+            for (const auto &stream : m_streams)
+            {
+                const Stream &other = stream.second;
+                if (&other == &current || !other.backlogged || now - other.last_frame > ACTIVE_PERIOD)
+                    continue;
+                virtual_time = found ? std::min(virtual_time, other.virtual_time) : other.virtual_time;
+                found = true;
+            }
+            return virtual_time;
+        }
+
+        void log_counters() const
+        {
+            for (const auto &stream : m_streams)
+            {
+                const Counters &counters = stream.second.counters;
+                std::cerr << "crop scheduler " << m_name << ", stream " << stream.first << ": " << counters.frames << " frames, "
+                          << counters.candidates << " candidates, " << counters.granted << " cropped, "
+                          << counters.deferred << " deferred by the budget" << std::endl;
+            }
+        }
+
+    public:
+        /**
+         * @param max_per_frame  -  uint32_t
+         *        Maximum crops of a single frame, 0 for no limit
+         *
+         * @param max_per_second  -  uint32_t
+         *        Maximum crops per second of all the streams, 0 for no limit
+         *
+         * @param name  -  std::string
+         *        The name of the scheduler in the logged counters
+         *
+         * @param stats_period  -  double
+         *        Seconds between logs of the counters to stderr, 0 to never log them
+         */
+        CropScheduler(uint32_t max_per_frame, uint32_t max_per_second, const std::string &name = "", double stats_period = 0.0)
+            : m_name(name), m_max_per_frame(max_per_frame), m_max_per_second(max_per_second),
+              m_tokens(max_per_second), m_last_refill(Clock::now()),
+              m_stats_period(stats_period), m_last_stats(m_last_refill) {}
+
+        /**
+         * @brief Choose the candidates of a frame to crop.
+         *
+         * @param stream_id  -  std::string
+         *        The stream of the frame, roi->get_stream_id()
+         *
+         * @param candidates  -  std::vector<CropCandidate>
+         *        The candidates of the frame, reordered by priority
+         *
+         * @param weight  -  float
+         *        The share of the stream relative to the other streams
+         *
+         * @return std::vector<HailoROIPtr>
+         *         The ROIs to crop, highest priority first
+         */
+        std::vector<HailoROIPtr> schedule(const std::string &stream_id, std::vector<CropCandidate> &candidates, float weight = 1.0f)
+        {
+            std::vector<HailoROIPtr> crop_rois;
+            size_t frame_budget = m_max_per_frame > 0 ? std::min<size_t>(m_max_per_frame, candidates.size()) : candidates.size();
+            std::partial_sort(candidates.begin(), candidates.begin() + frame_budget, candidates.end(),
+                              [](const CropCandidate &a, const CropCandidate &b)
+                              { return a.priority > b.priority; });
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            Clock::time_point now = Clock::now();
+            if (m_max_per_second > 0)
+                refill(now);
+
+            Stream &stream = m_streams[stream_id];
+            double fair_time = fair_virtual_time(stream, now);
+            // A stream that was idle or fully served does not keep credit from the past
+            if (!stream.backlogged || now - stream.last_frame > ACTIVE_PERIOD)
+                stream.virtual_time = std::max(stream.virtual_time, fair_time);
+            double step = 1.0 / std::max(weight, 1e-3f);
+            double lead = double(m_max_per_frame > 0 ? m_max_per_frame : frame_budget) * step;
+
+            for (size_t i = 0; i < frame_budget; i++)
+            {
+                if (m_max_per_second > 0 && m_tokens < 1.0)
+                    break;
+                if (stream.virtual_time + step > fair_time + lead)
+                    break;
+                crop_rois.emplace_back(candidates[i].roi);
+                stream.virtual_time += step;
+                if (m_max_per_second > 0)
+                    m_tokens -= 1.0;
+            }
+
+            stream.backlogged = crop_rois.size() < candidates.size();
+            stream.last_frame = now;
+            stream.counters.frames++;
+            stream.counters.candidates += candidates.size();
+            stream.counters.granted += crop_rois.size();
+            stream.counters.deferred += candidates.size() - crop_rois.size();
+            if (m_stats_period.count() > 0.0 && now - m_last_stats >= m_stats_period)
+            {
+                m_last_stats = now;
+                log_counters();
+            }
+            return crop_rois;
+        }
+
+        /**
+         * @brief The counters of every stream the scheduler has seen.
+         */
+        std::map<std::string, Counters> counters()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::map<std::string, Counters> counters;
+            for (const auto &stream : m_streams)
+                counters.emplace(stream.first, stream.second.counters);
+            return counters;
+        }
+
+        /**
+         * @brief Get the scheduler of a second stage network, shared by all the croppers of the process.
+         *        The budgets are read from the CROP_BUDGET_PER_FRAME and CROP_BUDGET_PER_SECOND
+         *        environment variables, unset or 0 for no limit, so by default every candidate is cropped.
+         *        CROP_SCHEDULER_STATS sets the seconds between logs of the counters (unset: never).
+         *
+         * @param name  -  std::string
+         *        The name of the second stage network
+         *
+         * @return CropScheduler&
+         */
+        static CropScheduler &get(const std::string &name)
+        {
+            static std::mutex schedulers_mutex;
+            static std::map<std::string, std::unique_ptr<CropScheduler>> schedulers;
+            std::lock_guard<std::mutex> lock(schedulers_mutex);
+            std::unique_ptr<CropScheduler> &scheduler = schedulers[name];
+            if (!scheduler)
+            {
+                const char *per_frame = std::getenv("CROP_BUDGET_PER_FRAME");
+                const char *per_second = std::getenv("CROP_BUDGET_PER_SECOND");
+                const char *stats = std::getenv("CROP_SCHEDULER_STATS");
+                scheduler = std::make_unique<CropScheduler>(per_frame ? std::strtoul(per_frame, nullptr, 10) : 0,
+                                                            per_second ? std::strtoul(per_second, nullptr, 10) : 0,
+                                                            name, stats ? std::strtod(stats, nullptr) : 0.0);
+            }
+            return *scheduler;
+        }
+    };
+
+}
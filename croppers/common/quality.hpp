@@ -0,0 +1,457 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "hailo_objects.hpp"
+#include "hailomat.hpp"
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace common
+{
+
+    //-------------------------------
+    // LUMA PLANE ACCESS
+    //-------------------------------
+
+    /**
+     * @brief A read only view of the luma samples of an image.
+     *        The samples of a row are pixel_step bytes apart (1 for a Y plane, 2 for packed YUY2).
+     */
+    struct LumaView
+    {
+        const uint8_t *data = nullptr;
+        size_t row_step = 0;
+        size_t pixel_step = 1;
+        int width = 0;
+        int height = 0;
+    };
+
+    /**
+     * @brief Get the luma of a HailoMat without copying or converting it.
+     *
+     * @param mat  -  HailoMat
+     *        The image
+     *
+     * @return LumaView
+     *         The luma of NV12 and YUY2 images, an empty view for the RGB formats
+     */
+    inline LumaView luma_view(HailoMat &mat)
+    {
+        LumaView view;
+        switch (mat.get_type())
+        {
+        case HAILO_MAT_NV12:
+        {
+            const cv::Mat &y_plane = mat.get_matrices()[0];
+            view = {y_plane.data, y_plane.step, 1, int(mat.native_width()), int(mat.native_height())};
+            break;
+        }
+        case HAILO_MAT_YUY2:
+        {
+            // Y0 U Y1 V, every other byte is a luma sample
+            const cv::Mat &packed = mat.get_matrices()[0];
+            view = {packed.data, packed.step, 2, int(mat.native_width()), int(mat.native_height())};
+            break;
+        }
+        default:
+            break;
+        }
+        return view;
+    }
+
+    //-------------------------------
+    // SHARPNESS ESTIMATION
+    //-------------------------------
+
+    /**
+     * @brief Sum and sum of squares of the 3x3 Laplacian ([0 1 0; 1 -4 1; 0 1 0]) of the
+     *        inner samples of a row, accumulated in integers.
+     *
+     * @param up, center, down  -  const uint8_t*
+     *        Three consecutive rows of width samples
+     *
+     * @param width  -  int
+     *        The row width, at most 4096 so that the per-lane sums do not overflow
+     */
+    inline void laplacian_row_sums(const uint8_t *up, const uint8_t *center, const uint8_t *down, int width,
+                                   int64_t &sum, int64_t &sum_sq)
+    {
+        int x = 1;
+        int32_t row_sum = 0;
+        int64_t row_sum_sq = 0;
+#if defined(__aarch64__)
+        int32x4_t acc_sum = vdupq_n_s32(0);
+        int32x4_t acc_sum_sq = vdupq_n_s32(0);
+        for (; x + 8 <= width - 1; x += 8)
+        {
+            int16x8_t u = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(up + x)));
+            int16x8_t d = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(down + x)));
+            int16x8_t l = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(center + x - 1)));
+            int16x8_t r = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(center + x + 1)));
+            int16x8_t c = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(center + x)));
+            int16x8_t laplacian = vsubq_s16(vaddq_s16(vaddq_s16(u, d), vaddq_s16(l, r)), vshlq_n_s16(c, 2));
+            acc_sum = vpadalq_s16(acc_sum, laplacian);
+            acc_sum_sq = vmlal_s16(acc_sum_sq, vget_low_s16(laplacian), vget_low_s16(laplacian));
+            acc_sum_sq = vmlal_s16(acc_sum_sq, vget_high_s16(laplacian), vget_high_s16(laplacian));
+        }
+        row_sum = vaddvq_s32(acc_sum);
+        row_sum_sq = vaddlvq_s32(acc_sum_sq);
+#elif defined(__SSE2__)
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i ones = _mm_set1_epi16(1);
+        __m128i acc_sum = _mm_setzero_si128();
+        __m128i acc_sum_sq = _mm_setzero_si128();
+        for (; x + 8 <= width - 1; x += 8)
+        {
+            __m128i u = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(up + x)), zero);
+            __m128i d = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(down + x)), zero);
+            __m128i l = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(center + x - 1)), zero);
+            __m128i r = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(center + x + 1)), zero);
+            __m128i c = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(center + x)), zero);
+            __m128i laplacian = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(u, d), _mm_add_epi16(l, r)), _mm_slli_epi16(c, 2));
+            acc_sum = _mm_add_epi32(acc_sum, _mm_madd_epi16(laplacian, ones));
+            acc_sum_sq = _mm_add_epi32(acc_sum_sq, _mm_madd_epi16(laplacian, laplacian));
+        }
+        int32_t lanes[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), acc_sum);
+        row_sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), acc_sum_sq);
+        row_sum_sq = int64_t(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+#endif
+        for (; x < width - 1; x++)
+        {
+            int32_t laplacian = up[x] + down[x] + center[x - 1] + center[x + 1] - 4 * center[x];
+            row_sum += laplacian;
+            row_sum_sq += laplacian * laplacian;
+        }
+        sum += row_sum;
+        sum_sq += row_sum_sq;
+    }
+
+    /**
+     * @brief 3x3 Laplacian of a grid sample, with the borders reflected like cv::Laplacian (BORDER_REFLECT_101).
+     */
+    inline int32_t laplacian_at(const uint8_t *grid, int width, int height, int x, int y)
+    {
+        auto reflect = [](int i, int size)
+        { return i < 0 ? std::min(1, size - 1) : (i >= size ? std::max(size - 2, 0) : i); };
+        const uint8_t *center = grid + size_t(y) * width;
+        return grid[size_t(reflect(y - 1, height)) * width + x] + grid[size_t(reflect(y + 1, height)) * width + x] +
+               center[reflect(x - 1, width)] + center[reflect(x + 1, width)] - 4 * center[x];
+    }
+
+    /**
+     * @brief Variance of the Laplacian of a grid of luma samples, in a single pass.
+     *        Same as cv::Laplacian (ksize 1, reflected borders) followed by cv::meanStdDev.
+     *
+     * @param grid  -  const uint8_t*
+     *        height rows of width samples
+     *
+     * @return double
+     *         The variance, 0 for an empty grid
+     */
+    inline double laplacian_variance(const uint8_t *grid, int width, int height)
+    {
+        if (width < 1 || height < 1)
+            return 0.0;
+        int64_t sum = 0;
+        int64_t sum_sq = 0;
+        // Inner samples of each row, the first and last rows reflect their only neighbour row
+        for (int y = 0; y < height; y++)
+        {
+            int up = y > 0 ? y - 1 : std::min(1, height - 1);
+            int down = y < height - 1 ? y + 1 : std::max(height - 2, 0);
+            laplacian_row_sums(grid + size_t(up) * width, grid + size_t(y) * width, grid + size_t(down) * width, width, sum, sum_sq);
+        }
+        // First and last columns
+        for (int y = 0; y < height; y++)
+        {
+            for (int x : {0, width - 1})
+            {
+                int32_t laplacian = laplacian_at(grid, width, height, x, y);
+                sum += laplacian;
+                sum_sq += laplacian * laplacian;
+                if (width == 1)
+                    break;
+            }
+        }
+        double count = double(width) * double(height);
+        double mean = double(sum) / count;
+        return std::max(0.0, double(sum_sq) / count - mean * mean);
+    }
+
+    //-------------------------------
+    // LUMA RESAMPLING
+    //-------------------------------
+
+    /**
+     * @brief The source samples and weights of every destination sample of a resize along one axis.
+     *        Destination sample i is the sum of weights[k] * source[first[i] + k - offsets[i]]
+     *        for k in [offsets[i], offsets[i + 1]).
+     */
+    struct ResizeTaps
+    {
+        std::vector<int> first;
+        std::vector<int> offsets;
+        std::vector<float> weights;
+
+        void add(int source, float weight)
+        {
+            if (offsets.back() == int(weights.size()))
+                first.push_back(source);
+            weights.push_back(weight);
+        }
+        void next() { offsets.push_back(weights.size()); }
+    };
+
+    /**
+     * @brief The taps of cv::resize along an axis of src_size samples resized to dst_size.
+     *
+     * @param area_shrink  -  bool
+     *        INTER_AREA when both axes shrink: every sample is the average of the source area it covers
+     *
+     * @param area  -  bool
+     *        INTER_AREA otherwise: OpenCV's linear interpolation that only blends at source sample edges.
+     *        Both false is INTER_LINEAR.
+     */
+    inline void resize_taps(int src_size, int dst_size, bool area_shrink, bool area, ResizeTaps &taps)
+    {
+        taps.first.clear();
+        taps.weights.clear();
+        taps.offsets.assign(1, 0);
+        double scale = double(src_size) / dst_size;
+        for (int d = 0; d < dst_size; d++)
+        {
+            if (area_shrink)
+            {
+                // cv::resize INTER_AREA pixel area relation (computeResizeAreaTab)
+                double start = d * scale, end = start + scale;
+                double cell = std::min(scale, src_size - start);
+                int inner_start = std::ceil(start), inner_end = std::min(int(std::floor(end)), src_size - 1);
+                inner_start = std::min(inner_start, inner_end);
+                if (inner_start - start > 1e-3)
+                    taps.add(inner_start - 1, float((inner_start - start) / cell));
+                for (int s = inner_start; s < inner_end; s++)
+                    taps.add(s, float(1.0 / cell));
+                if (end - inner_end > 1e-3)
+                    taps.add(inner_end, float(std::min(std::min(end - inner_end, 1.0), cell) / cell));
+            }
+            else
+            {
+                int source;
+                float fraction;
+                if (area)
+                {
+                    source = int(std::floor(d * scale));
+                    fraction = float((d + 1) - (source + 1) / scale);
+                    fraction = fraction <= 0 ? 0.0f : fraction - std::floor(fraction);
+                }
+                else
+                {
+                    double position = (d + 0.5) * scale - 0.5;
+                    source = int(std::floor(position));
+                    fraction = float(position - source);
+                }
+                // Replicate the border samples
+                if (source < 0)
+                {
+                    source = 0;
+                    fraction = 0.0f;
+                }
+                if (source >= src_size - 1)
+                {
+                    source = src_size - 1;
+                    fraction = 0.0f;
+                }
+                taps.add(source, 1.0f - fraction);
+                if (fraction > 0.0f)
+                    taps.add(source + 1, fraction);
+            }
+            taps.next();
+        }
+    }
+
+    /**
+     * @brief Resize a luma view to a grid, like cv::resize of the crop (INTER_AREA or INTER_LINEAR).
+     *        Separable: the rows are resized horizontally, then blended vertically.
+     *
+     * @param levels  -  const uint8_t[256]
+     *        Applied to the source samples before they are resized
+     */
+    inline void resize_luma_grid(const LumaView &luma, const uint8_t *levels, int grid_width, int grid_height, int interpolation,
+                                 std::vector<uint8_t> &grid)
+    {
+        thread_local ResizeTaps horizontal, vertical;
+        thread_local std::vector<float> rows, line;
+        thread_local std::vector<bool> used;
+        bool area = interpolation == cv::INTER_AREA;
+        bool area_shrink = area && luma.width >= grid_width && luma.height >= grid_height;
+        resize_taps(luma.width, grid_width, area_shrink, area, horizontal);
+        resize_taps(luma.height, grid_height, area_shrink, area, vertical);
+
+        // Horizontally resized source rows, only the rows the vertical taps read
+        int first_row = vertical.first.front();
+        int last_row = vertical.first.back() + (vertical.offsets.back() - vertical.offsets[grid_height - 1]) - 1;
+        rows.resize(size_t(last_row - first_row + 1) * grid_width);
+        used.assign(last_row - first_row + 1, false);
+        for (int y = 0; y < grid_height; y++)
+        {
+            for (int k = vertical.offsets[y]; k < vertical.offsets[y + 1]; k++)
+                used[vertical.first[y] + k - vertical.offsets[y] - first_row] = true;
+        }
+        for (int r = first_row; r <= last_row; r++)
+        {
+            if (!used[r - first_row])
+                continue;
+            const uint8_t *source = luma.data + size_t(r) * luma.row_step;
+            float *row = rows.data() + size_t(r - first_row) * grid_width;
+            for (int x = 0; x < grid_width; x++)
+            {
+                float value = 0.0f;
+                const uint8_t *samples = source + size_t(horizontal.first[x]) * luma.pixel_step;
+                for (int k = horizontal.offsets[x]; k < horizontal.offsets[x + 1]; k++, samples += luma.pixel_step)
+                    value += horizontal.weights[k] * levels[*samples];
+                row[x] = value;
+            }
+        }
+
+        grid.resize(size_t(grid_width) * grid_height);
+        line.resize(grid_width);
+        for (int y = 0; y < grid_height; y++)
+        {
+            std::fill(line.begin(), line.end(), 0.0f);
+            for (int k = vertical.offsets[y]; k < vertical.offsets[y + 1]; k++)
+            {
+                const float *row = rows.data() + size_t(vertical.first[y] + k - vertical.offsets[y] - first_row) * grid_width;
+                float weight = vertical.weights[k];
+                for (int x = 0; x < grid_width; x++)
+                    line[x] += weight * row[x];
+            }
+            uint8_t *sample = grid.data() + size_t(y) * grid_width;
+            for (int x = 0; x < grid_width; x++)
+                sample[x] = uint8_t(CLAMP(std::lrint(line[x]), 0, 255));
+        }
+    }
+
+    /**
+     * @brief 3x3 Gaussian blur of a grid in place, bit exact with cv::GaussianBlur(ksize 3x3, sigma 0) on 8 bit data.
+     */
+    inline void gaussian_blur_3x3(std::vector<uint8_t> &grid, int width, int height)
+    {
+        if (width < 2 || height < 2)
+            return;
+        thread_local std::vector<uint16_t> rows;
+        rows.resize(grid.size());
+        // [1 2 1] along the rows, reflected borders
+        for (int y = 0; y < height; y++)
+        {
+            const uint8_t *source = grid.data() + size_t(y) * width;
+            uint16_t *row = rows.data() + size_t(y) * width;
+            row[0] = 2 * source[0] + 2 * source[1];
+            for (int x = 1; x < width - 1; x++)
+                row[x] = source[x - 1] + 2 * source[x] + source[x + 1];
+            row[width - 1] = 2 * source[width - 1] + 2 * source[width - 2];
+        }
+        // [1 2 1] along the columns, then divide by 16 rounding half up
+        for (int y = 0; y < height; y++)
+        {
+            const uint16_t *up = rows.data() + size_t(y > 0 ? y - 1 : 1) * width;
+            const uint16_t *center = rows.data() + size_t(y) * width;
+            const uint16_t *down = rows.data() + size_t(y < height - 1 ? y + 1 : height - 2) * width;
+            uint8_t *sample = grid.data() + size_t(y) * width;
+            for (int x = 0; x < width; x++)
+                sample[x] = uint8_t((up[x] + 2 * center[x] + down[x] + 8) >> 4);
+        }
+    }
+
+    //-------------------------------
+    // SHARPNESS ESTIMATION
+    //-------------------------------
+
+    /**
+     * @brief Estimate the sharpness of a region as the variance of the Laplacian of its gray levels.
+     *        Gives the scores of the OpenCV path (crop, cvtColor to BGR, cv::resize, optional 3x3
+     *        GaussianBlur, cvtColor to gray, optional cv::normalize NORM_INF, cv::Laplacian, cv::meanStdDev),
+     *        so the quality thresholds keep their scale, but works on the Y samples of NV12 and YUY2 images
+     *        in place: no crop, color conversion or full color resize is made.
+     *        The gray of a YUV image is its video range luma stretched to full range, like in cvtColor.
+     *        RGB images are converted to gray first.
+     *
+     * @param mat  -  std::shared_ptr<HailoMat>
+     *        The image
+     *
+     * @param bbox  -  HailoBBox
+     *        The region, normalized to the image
+     *
+     * @param grid_size  -  cv::Size
+     *        The resolution the sharpness is measured at, the resize of the OpenCV path
+     *
+     * @param interpolation  -  int
+     *        The interpolation of the resize, cv::INTER_AREA or cv::INTER_LINEAR
+     *
+     * @param blur  -  bool
+     *        Blur with a 3x3 Gaussian before measuring
+     *
+     * @param normalize  -  bool
+     *        Stretch the gray levels so their maximum is 255 (cv::normalize NORM_INF) before measuring
+     *
+     * @return float
+     *         The variance of the Laplacian, -1 if the region is empty
+     */
+    inline float luma_sharpness(std::shared_ptr<HailoMat> mat, const HailoBBox &bbox, cv::Size grid_size, int interpolation,
+                                bool blur, bool normalize)
+    {
+        thread_local std::vector<uint8_t> grid;
+        LumaView luma = luma_view(*mat);
+        // The region of the crop of the OpenCV path
+        cv::Rect rect = mat->get_crop_rect(std::make_shared<HailoROI>(bbox));
+        cv::Mat gray;
+        if (luma.data == nullptr)
+        {
+            // RGB formats have no luma plane, convert only the region
+            cv::cvtColor(mat->get_matrices()[0](rect), gray, mat->get_type() == HAILO_MAT_RGBA ? cv::COLOR_RGBA2GRAY : cv::COLOR_RGB2GRAY);
+            luma = {gray.data, gray.step, 1, gray.cols, gray.rows};
+        }
+        else
+        {
+            // YUY2 rects are in macro pixels of 2 luma samples
+            int samples_per_unit = int(luma.pixel_step);
+            luma.data += size_t(rect.y) * luma.row_step + size_t(rect.x) * samples_per_unit * luma.pixel_step;
+            luma.width = rect.width * samples_per_unit;
+            luma.height = rect.height;
+        }
+        if (luma.width <= 0 || luma.height <= 0 || grid_size.width <= 0 || grid_size.height <= 0)
+            return -1.0f;
+
+        // The gray of a video range luma sample is 255 / 219 * (Y - 16), like the BGR conversion of the OpenCV path
+        uint8_t levels[256];
+        for (int value = 0; value < 256; value++)
+            levels[value] = gray.empty() ? uint8_t(CLAMP(std::lrint((value - 16) * 255.0 / 219.0), 0, 255)) : uint8_t(value);
+
+        int grid_width = std::min(grid_size.width, 4096);
+        int grid_height = grid_size.height;
+        resize_luma_grid(luma, levels, grid_width, grid_height, interpolation, grid);
+        if (blur)
+            gaussian_blur_3x3(grid, grid_width, grid_height);
+        if (normalize)
+        {
+            uint8_t max_sample = *std::max_element(grid.begin(), grid.end());
+            double scale = max_sample > 0 ? 255.0 / max_sample : 0.0;
+            for (uint8_t &sample : grid)
+                sample = uint8_t(CLAMP(std::lrint(sample * scale), 0, 255));
+        }
+        return float(laplacian_variance(grid.data(), grid_width, grid_height));
+    }
+
+}
@@ -0,0 +1,259 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace common
+{
+
+    //-------------------------------
+    // TRACK STATE TABLE
+    //-------------------------------
+
+    /**
+     * @brief Per-track state of a single stream, in an open-addressing (linear probing) hash table.
+     *        Frames are counted with next_frame(), a track that was not seen for ttl frames is
+     *        expired, and when max_tracks are alive the least recently seen track is evicted,
+     *        so the table never grows past its initial allocation.
+     *        Not thread-safe, see TrackStates.
+     */
+    template <typename V>
+    class TrackStateTable
+    {
+    private:
+        struct Entry
+        {
+            bool used = false;
+            int track_id = 0;
+            uint64_t last_frame = 0;
+            V value{};
+        };
+
+        std::vector<Entry> m_entries;
+        std::vector<Entry> m_live; // scratch of sweep()
+        size_t m_mask;
+        size_t m_size = 0;
+        size_t m_max_tracks;
+        uint64_t m_ttl;
+        uint64_t m_frame = 0;
+        uint64_t m_last_sweep = 0;
+
+        size_t home(int track_id) const
+        {
+            // Tracking ids are sequential, scatter them over the table
+            uint32_t hash = uint32_t(track_id) * 0x9E3779B1u;
+            return (hash ^ (hash >> 16)) & m_mask;
+        }
+
+        size_t find_slot(int track_id) const
+        {
+            size_t slot = home(track_id);
+            while (m_entries[slot].used && m_entries[slot].track_id != track_id)
+                slot = (slot + 1) & m_mask;
+            return slot;
+        }
+
+        // Backward shift deletion, keeps the probe sequences intact without tombstones
+        void erase_slot(size_t slot)
+        {
+            size_t next = slot;
+            while (true)
+            {
+                next = (next + 1) & m_mask;
+                if (!m_entries[next].used)
+                    break;
+                size_t next_home = home(m_entries[next].track_id);
+                bool stays = (slot <= next) ? (slot < next_home && next_home <= next)
+                                            : (slot < next_home || next_home <= next);
+                if (stays)
+                    continue;
+                m_entries[slot] = std::move(m_entries[next]);
+                slot = next;
+            }
+            m_entries[slot].used = false;
+            m_size--;
+        }
+
+        bool expired(const Entry &entry) const
+        {
+            return m_frame - entry.last_frame > m_ttl;
+        }
+
+        // Drop the expired tracks by re-inserting the live ones
+        void sweep()
+        {
+            m_last_sweep = m_frame;
+            m_live.clear();
+            for (Entry &entry : m_entries)
+            {
+                if (entry.used && !expired(entry))
+                    m_live.push_back(std::move(entry));
+                entry.used = false;
+            }
+            m_size = 0;
+            for (Entry &entry : m_live)
+            {
+                m_entries[find_slot(entry.track_id)] = std::move(entry);
+                m_size++;
+            }
+        }
+
+        void evict_least_recent()
+        {
+            size_t oldest = m_entries.size();
+            for (size_t slot = 0; slot < m_entries.size(); slot++)
+            {
+                if (m_entries[slot].used && (oldest == m_entries.size() || m_entries[slot].last_frame < m_entries[oldest].last_frame))
+                    oldest = slot;
+            }
+            if (oldest != m_entries.size())
+                erase_slot(oldest);
+        }
+
+    public:
+        /**
+         * @param max_tracks  -  size_t
+         *        Maximum number of tracks kept alive
+         *
+         * @param ttl  -  uint64_t
+         *        Number of frames a track is kept after it was last seen
+         */
+        TrackStateTable(size_t max_tracks, uint64_t ttl)
+            : m_max_tracks(max_tracks > 0 ? max_tracks : 1), m_ttl(ttl)
+        {
+            // Keep the load factor under 0.5 so that probe sequences stay short
+            size_t capacity = 2;
+            while (capacity < 2 * m_max_tracks)
+                capacity <<= 1;
+            m_entries.resize(capacity);
+            m_live.reserve(m_max_tracks);
+            m_mask = capacity - 1;
+        }
+
+        /**
+         * @brief Start a new frame of the stream, expired tracks are swept once every ttl frames.
+         */
+        void next_frame()
+        {
+            m_frame++;
+            if (m_frame - m_last_sweep > m_ttl)
+                sweep();
+        }
+
+        /**
+         * @brief Get the state of a track and mark it as seen in the current frame.
+         *        An unknown or expired track gets a default constructed state.
+         *
+         * @param track_id  -  int
+         *        The tracking id
+         *
+         * @param inserted  -  bool&
+         *        Set to true if the track is new
+         *
+         * @return V&
+         *         The state of the track, valid until the next call
+         */
+        V &get(int track_id, bool &inserted)
+        {
+            size_t slot = find_slot(track_id);
+            inserted = !m_entries[slot].used || expired(m_entries[slot]);
+            if (!m_entries[slot].used)
+            {
+                if (m_size >= m_max_tracks)
+                {
+                    sweep();
+                    if (m_size >= m_max_tracks)
+                        evict_least_recent();
+                    slot = find_slot(track_id);
+                }
+                m_entries[slot].used = true;
+                m_entries[slot].track_id = track_id;
+                m_size++;
+            }
+            Entry &entry = m_entries[slot];
+            if (inserted)
+                entry.value = V{};
+            entry.last_frame = m_frame;
+            return entry.value;
+        }
+
+        size_t size() const { return m_size; }
+    };
+
+    //-------------------------------
+    // PER STREAM TRACK STATES
+    //-------------------------------
+
+    /**
+     * @brief Track states of all the streams of the process, one table and one lock per stream,
+     *        so croppers of different streams never contend and tracking ids of different
+     *        streams never collide.
+     */
+    template <typename V>
+    class TrackStates
+    {
+    private:
+        struct Stream
+        {
+            std::mutex mutex;
+            TrackStateTable<V> table;
+            Stream(size_t max_tracks, uint64_t ttl) : table(max_tracks, ttl) {}
+        };
+
+        size_t m_max_tracks;
+        uint64_t m_ttl;
+        std::mutex m_streams_mutex;
+        std::unordered_map<std::string, std::unique_ptr<Stream>> m_streams;
+
+    public:
+        /**
+         * @brief The tracks of one stream in one frame, locked for the lifetime of the object.
+         */
+        class Frame
+        {
+        private:
+            std::unique_lock<std::mutex> m_lock;
+            TrackStateTable<V> &m_table;
+
+        public:
+            Frame(std::mutex &mutex, TrackStateTable<V> &table) : m_lock(mutex), m_table(table) {}
+
+            V &get(int track_id, bool &inserted) { return m_table.get(track_id, inserted); }
+        };
+
+        TrackStates(size_t max_tracks, uint64_t ttl) : m_max_tracks(max_tracks), m_ttl(ttl) {}
+
+        /**
+         * @brief Lock the tracks of a stream and advance its frame count.
+         *        Call once per frame and keep the returned object while handling the frame.
+         *
+         * @param stream_id  -  std::string
+         *        The stream of the frame, roi->get_stream_id()
+         *
+         * @return Frame
+         */
+        Frame begin_frame(const std::string &stream_id)
+        {
+            Stream *stream;
+            {
+                std::lock_guard<std::mutex> lock(m_streams_mutex);
+                std::unique_ptr<Stream> &entry = m_streams[stream_id];
+                if (!entry)
+                    entry = std::make_unique<Stream>(m_max_tracks, m_ttl);
+                stream = entry.get();
+            }
+            Frame frame(stream->mutex, stream->table);
+            stream->table.next_frame();
+            return frame;
+        }
+    };
+
+}
@@ -3,11 +3,16 @@
  * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
  **/
 #include "lpr_croppers.hpp"
+#include "crop_scheduler.hpp"
+#include "quality.hpp"
 #include <iostream>
 
 #define VEHICLE_LABEL "car"
 #define LICENSE_PLATE_LABEL "license_plate"
 #define OCR_LABEL "ocr"
+#define LPR_QUALITY_SIZE (cv::Size(200, 40))
+#define LICENSE_PLATE_DETECTION_SCHEDULER "license_plate_detection"
+#define OCR_SCHEDULER "ocr"
 
 /**
  * @brief Returns the calculate the variance of edges.
@@ -48,58 +53,9 @@ float quality_estimation(std::shared_ptr<HailoMat> hailo_mat, const HailoBBox &r
     if (cropped_width <= CROP_WIDTH_LIMIT || cropped_height <= CROP_HEIGHT_LIMIT)
         return -1.0;
 
-    // If it is not too small then we can make the crop
-    HailoROIPtr crop_roi = std::make_shared<HailoROI>(HailoBBox(cropped_xmin, cropped_ymin, cropped_width_n, cropped_height_n));
-    std::vector<cv::Mat> cropped_image_vec = hailo_mat->crop(crop_roi);
-
-    // Convert image to BGR
-    cv::Mat bgr_image;
-    switch (hailo_mat->get_type())
-    {
-    case HAILO_MAT_YUY2:
-    {
-        cv::Mat cropped_image = cropped_image_vec[0];
-        cv::Mat yuy2_image = cv::Mat(cropped_image.rows, cropped_image.cols * 2, CV_8UC2, (char *)cropped_image.data, cropped_image.step);
-        cv::cvtColor(yuy2_image, bgr_image, cv::COLOR_YUV2BGR_YUY2);
-        break;
-    }
-    case HAILO_MAT_NV12:
-    {
-        cv::Mat full_mat = cv::Mat(cropped_image_vec[0].rows + cropped_image_vec[1].rows, cropped_image_vec[0].cols, CV_8UC1);
-        memcpy(full_mat.data, cropped_image_vec[0].data, cropped_image_vec[0].rows * cropped_image_vec[0].cols);
-        memcpy(full_mat.data + cropped_image_vec[0].rows * cropped_image_vec[0].cols, cropped_image_vec[1].data, cropped_image_vec[1].rows * cropped_image_vec[1].cols);
-        cv::cvtColor(full_mat, bgr_image, cv::COLOR_YUV2BGR_NV12);
-
-        break;
-    }
-    default:
-        bgr_image = cropped_image_vec[0];
-        break;
-    }
-
-    // Resize the frame
-    cv::Mat resized_image;
-    cv::resize(bgr_image, resized_image, cv::Size(200, 40), 0, 0, cv::INTER_AREA);
-
-    // Gaussian Blur
-    cv::Mat gaussian_image;
-    cv::GaussianBlur(resized_image, gaussian_image, cv::Size(3, 3), 0);
-
-    // Convert to grayscale
-    cv::Mat gray_image;
-    cv::Mat gray_image_normalized;
-    cv::cvtColor(gaussian_image, gray_image, cv::COLOR_BGR2GRAY);
-    cv::normalize(gray_image, gray_image_normalized, 255, 0, cv::NORM_INF);
-
-    // Compute the Laplacian of the gray image
-    cv::Mat laplacian_image;
-    cv::Laplacian(gray_image_normalized, laplacian_image, CV_64F);
-
-    // Calculate the variance of edges
-    cv::Scalar mean, stddev;
-    cv::meanStdDev(laplacian_image, mean, stddev, cv::Mat());
-    float variance = stddev.val[0] * stddev.val[0];
-    return variance;
+    // Measure the edges on the luma of the crop: area resized to the plate resolution, blurred and normalized
+    return common::luma_sharpness(hailo_mat, HailoBBox(cropped_xmin, cropped_ymin, cropped_width_n, cropped_height_n),
+                                  LPR_QUALITY_SIZE, cv::INTER_AREA, true, true);
 }
 
 /**
@@ -118,7 +74,7 @@ float quality_estimation(std::shared_ptr<HailoMat> hailo_mat, const HailoBBox &r
  */
 std::vector<HailoROIPtr> license_plate_quality_estimation(std::shared_ptr<HailoMat> image, HailoROIPtr roi)
 {
-    std::vector<HailoROIPtr> crop_rois;
+    std::vector<common::CropCandidate> candidates;
     float variance;
     // Get all detections.
     std::vector<HailoDetectionPtr> vehicle_ptrs = hailo_common::get_hailo_detections(roi);
@@ -139,7 +95,7 @@ std::vector<HailoROIPtr> license_plate_quality_estimation(std::shared_ptr<HailoM
 
             if (variance >= QUALITY_THRESHOLD)
             {
-                crop_rois.emplace_back(license_plate);
+                candidates.push_back({license_plate, common::crop_priority(variance, 0, license_plate_box)});
             }
             else
             {
@@ -147,7 +103,8 @@ std::vector<HailoROIPtr> license_plate_quality_estimation(std::shared_ptr<HailoM
             }
         }
     }
-    return crop_rois;
+    // The sharpest plates go first
+    return common::CropScheduler::get(OCR_SCHEDULER).schedule(roi->get_stream_id(), candidates);
 }
 
 /**
@@ -169,7 +126,7 @@ std::vector<HailoROIPtr> license_plate_quality_estimation(std::shared_ptr<HailoM
  */
 std::vector<HailoROIPtr> vehicles_without_ocr(std::shared_ptr<HailoMat> image, HailoROIPtr roi)
 {
-    std::vector<HailoROIPtr> crop_rois;
+    std::vector<common::CropCandidate> candidates;
     bool has_ocr = false;
     // Get all detections.
     std::vector<HailoDetectionPtr> detections_ptrs = hailo_common::get_hailo_detections(roi);
@@ -204,7 +161,8 @@ std::vector<HailoROIPtr> vehicles_without_ocr(std::shared_ptr<HailoMat> image, H
             }
         }
         if (!has_ocr)
-            crop_rois.emplace_back(detection);
+            candidates.push_back({detection, common::crop_priority(1.0f, 0, vehicle_bbox)});
     }
-    return crop_rois;
+    // The biggest vehicles go first
+    return common::CropScheduler::get(LICENSE_PLATE_DETECTION_SCHEDULER).schedule(roi->get_stream_id(), candidates);
 }
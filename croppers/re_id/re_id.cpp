@@ -5,6 +5,9 @@
 #include <vector>
 #include <iostream>
 #include "re_id.hpp"
+#include "quality.hpp"
+#include "crop_scheduler.hpp"
+#include "track_state.hpp"
 
 #define PERSON_LABEL "person"
 #define MIN_RATIO (1.7f)
@@ -16,7 +19,18 @@
 #define TRACK_DELAY (1)
 #define MIN_QUALITY (400)
 #define RE_ID_NETWORK_SIZE (cv::Size(128, 256))
-std::map<int, int> track_counter;
+#define MAX_TRACKS_PER_STREAM (1024)
+#define TRACK_TTL_FRAMES (300)
+#define RE_ID_SCHEDULER "re_id"
+
+struct ReIdTrack
+{
+    int frames_seen = 0;            // saturates at TRACK_DELAY
+    uint32_t frames_since_crop = 0;
+};
+
+// The re-id tracks of each stream
+static common::TrackStates<ReIdTrack> re_id_tracks(MAX_TRACKS_PER_STREAM, TRACK_TTL_FRAMES);
 
 cv::Mat convertNV12toGray(const cv::Mat& nv12Mat, int width, int height) {
     cv::Mat grayMat(height, width, CV_8UC1);
@@ -109,63 +123,9 @@ float quality_estimation_nv12(std::shared_ptr<HailoMat> hailo_mat, const HailoBB
     if (cropped_width <= 10 || cropped_height <= 10)
         return -1.0;
 
-    // If it is not too small then we can make the crop
-    HailoROIPtr crop_roi = std::make_shared<HailoROI>(HailoBBox(cropped_xmin, cropped_ymin, cropped_width_n, cropped_height_n));
-    std::vector<cv::Mat> cropped_image_vec = hailo_mat->crop(crop_roi);
-
-    // Convert image to BGR
-    cv::Mat bgr_image;
-    switch (hailo_mat->get_type())
-    {
-    case HAILO_MAT_YUY2:
-    {
-        cv::Mat cropped_image = cropped_image_vec[0];
-        cv::Mat yuy2_image = cv::Mat(cropped_image.rows, cropped_image.cols * 2, CV_8UC2, (char *)cropped_image.data, cropped_image.step);
-        cv::cvtColor(yuy2_image, bgr_image, cv::COLOR_YUV2BGR_YUY2);
-        break;
-    }
-    case HAILO_MAT_NV12:
-    {
-        std::cout << "convert nv12 to bgr!" << std::endl;
-        cv::Mat full_mat = cv::Mat(cropped_image_vec[0].rows + cropped_image_vec[1].rows, cropped_image_vec[0].cols, CV_8UC1);
-        memcpy(full_mat.data, cropped_image_vec[0].data, cropped_image_vec[0].rows * cropped_image_vec[0].cols);
-        memcpy(full_mat.data + cropped_image_vec[0].rows * cropped_image_vec[0].cols, cropped_image_vec[1].data, cropped_image_vec[1].rows * cropped_image_vec[1].cols);
-        cv::cvtColor(full_mat, bgr_image, cv::COLOR_YUV2BGR_NV12);
-        std::cout << "bug in nv12!" << std::endl;
-
-        break;
-    }
-    default:
-        bgr_image = cropped_image_vec[0];
-        break;
-    }
-
-    // Resize the frame
-    cv::Mat resized_image;
-    cv::resize(bgr_image, resized_image, RE_ID_NETWORK_SIZE, 0, 0, cv::INTER_LINEAR);
-
-    // Convert to grayscale
-    // cv::Mat gray_image = convertNV12toGray(resized_image, 128, 256);
-    cv::Mat gray_image;
-    std::cout << "Maybe bug here!" << std::endl;
-    cv::cvtColor(resized_image, gray_image, cv::COLOR_BGR2GRAY);
-    std::cout << "Here is not bug!" << std::endl;
-
-    // Compute the Laplacian of the gray image
-    cv::Mat laplacian_image;
-    cv::Laplacian(gray_image, laplacian_image, CV_64F);
-
-    // Calculate the quality of person
-    cv::Scalar mean, stddev;
-    cv::meanStdDev(laplacian_image, mean, stddev, cv::Mat());
-    float quality = stddev.val[0] * stddev.val[0];
-
-    // Release resources
-    resized_image.release();
-    gray_image.release();
-    laplacian_image.release();
-
-    return quality;
+    // Measure the edges on the luma of the crop, at the resolution of the network
+    return common::luma_sharpness(hailo_mat, HailoBBox(cropped_xmin, cropped_ymin, cropped_width_n, cropped_height_n),
+                                  RE_ID_NETWORK_SIZE, cv::INTER_LINEAR, false, false);
 }
 
 HailoUniqueIDPtr get_tracking_id(HailoDetectionPtr detection)
@@ -190,9 +150,10 @@ HailoUniqueIDPtr get_tracking_id(HailoDetectionPtr detection)
  */
 std::vector<HailoROIPtr> create_crops(std::shared_ptr<HailoMat> image, HailoROIPtr roi)
 {
-    std::vector<HailoROIPtr> crop_rois;
+    std::vector<common::CropCandidate> candidates;
     // Get all detections.
     std::vector<HailoDetectionPtr> detections_ptrs = hailo_common::get_hailo_detections(roi);
+    auto tracks = re_id_tracks.begin_frame(roi->get_stream_id());
     for (HailoDetectionPtr &detection : detections_ptrs)
     {
         // Modify only detections with "person" label.
@@ -201,16 +162,20 @@ std::vector<HailoROIPtr> create_crops(std::shared_ptr<HailoMat> image, HailoROIP
             // Remove previous matrices
             roi->remove_objects_typed(HAILO_MATRIX);
 
-            int tracking_id = get_tracking_id(detection)->get_id();
+            HailoUniqueIDPtr tracking_obj = get_tracking_id(detection);
+            if (!tracking_obj)
+                continue;
 
-            auto counter = track_counter.find(tracking_id);
-            if (counter == track_counter.end())
+            bool new_track;
+            ReIdTrack &track = tracks.get(tracking_obj->get_id(), new_track);
+            track.frames_since_crop += 1;
+            if (new_track)
             {
-                track_counter[tracking_id] = 0;
+                track.frames_seen = 0;
             }
-            else if (counter->second < TRACK_DELAY)
+            else if (track.frames_seen < TRACK_DELAY)
             {
-                track_counter[tracking_id] += 1;
+                track.frames_seen += 1;
             }
             else
             {
@@ -230,9 +195,17 @@ std::vector<HailoROIPtr> create_crops(std::shared_ptr<HailoMat> image, HailoROIP
                 // {
                 //     crop_rois.emplace_back(detection);
                 // }
-                crop_rois.emplace_back(detection);
+                candidates.push_back({detection, common::crop_priority(1.0f, track.frames_since_crop, detection->get_bbox())});
             }
         }
     }
+
+    // The tracks that waited longest since their last crop go first
+    std::vector<HailoROIPtr> crop_rois = common::CropScheduler::get(RE_ID_SCHEDULER).schedule(roi->get_stream_id(), candidates);
+    for (HailoROIPtr &crop_roi : crop_rois)
+    {
+        bool new_track;
+        tracks.get(get_tracking_id(std::dynamic_pointer_cast<HailoDetection>(crop_roi))->get_id(), new_track).frames_since_crop = 0;
+    }
     return crop_rois;
 }
@@ -5,14 +5,21 @@
 #include <vector>
 #include <cmath>
 #include "vms_croppers.hpp"
+#include "crop_scheduler.hpp"
+#include "track_state.hpp"
 
 #define PERSON_LABEL "person"
 #define FACE_LABEL "face"
 #define FACE_ATTRIBUTES_CROP_SCALE_FACTOR (1.58f)
 #define FACE_ATTRIBUTES_CROP_HIGHT_OFFSET_FACTOR (0.10f)
 #define TRACK_UPDATE 60
+#define MAX_TRACKS_PER_STREAM (1024)
+#define TRACK_TTL_FRAMES (5 * TRACK_UPDATE)
+#define PERSON_ATTRIBUTES_SCHEDULER "person_attributes"
 
-std::map<int, int> track_counter;
+// Frames since the last update of each track, per stream
+static common::TrackStates<int> person_track_counters(MAX_TRACKS_PER_STREAM, TRACK_TTL_FRAMES);
+static common::TrackStates<int> face_track_counters(MAX_TRACKS_PER_STREAM, TRACK_TTL_FRAMES);
 
 /**
 * @brief Get the tracking Hailo Unique Id object from a Hailo Detection.
@@ -45,47 +52,75 @@ bool box_contains_nan(HailoBBox box)
 }
 
 /**
-* @brief Returns a boolean indicating if traker update is required for a given detection.
+* @brief Returns a boolean indicating if traker update is due for a given detection.
 *       It is determined by the number of frames since the last update.
 *       How many frames to wait for an update are defined in TRACK_UPDATE.
+*       The counter restarts only once the update is made, see track_updated.
 * 
 * @param detection HailoDetectionPtr
+* @param tracks The tracks of the stream in the current frame
 * @param use_track_update boolean can override the default behaviour, false will always require an update
-* @return boolean indicating if traker update is required.
+* @param frames_since_update [out] frames since the last update of the track, 0 if it is not tracked
+* @return boolean indicating if traker update is due.
 */
-bool track_update(HailoDetectionPtr detection, bool use_track_update)
+bool track_update_due(HailoDetectionPtr detection, common::TrackStates<int>::Frame &tracks, bool use_track_update, int &frames_since_update)
 {
+    frames_since_update = 0;
     auto tracking_obj = get_tracking_id(detection);
     if (tracking_obj && use_track_update)
     {
-        int tracking_id = tracking_obj->get_id();
-        auto counter = track_counter.find(tracking_id);
-        if (counter == track_counter.end())
-        {
-            // Emplace new element to the track_counter map. track update required.
-            track_counter.emplace(tracking_id, 0);
-            return true;
-        }
-        else if (counter->second >= TRACK_UPDATE)
-        {
-            // Counter passed the TRACK_UPDATE limit - set existing track to 0. track update required.
-            track_counter[tracking_id] = 0;
-            return true;
-        }
-        else if (counter->second < TRACK_UPDATE)
-        {
-            // Counter is still below TRACK_UPDATE_LIMIT - increasing the exising value. track update should be skipped. 
-            track_counter[tracking_id] += 1;
-        }
+        bool new_track;
+        int &counter = tracks.get(tracking_obj->get_id(), new_track);
+        // A new track is due right away
+        if (new_track)
+            counter = TRACK_UPDATE;
+        frames_since_update = counter;
+        counter += 1;
+        return frames_since_update >= TRACK_UPDATE;
+    }
 
-        return false;
+    return true;
+}
+
+/**
+* @brief Restart the update counter of a detection's track after it was updated.
+* 
+* @param detection HailoDetectionPtr
+* @param tracks The tracks of the stream in the current frame
+*/
+void track_updated(HailoDetectionPtr detection, common::TrackStates<int>::Frame &tracks)
+{
+    auto tracking_obj = get_tracking_id(detection);
+    if (tracking_obj)
+    {
+        bool new_track;
+        tracks.get(tracking_obj->get_id(), new_track) = 0;
     }
+}
 
+/**
+* @brief Returns a boolean indicating if traker update is required for a given detection,
+*       and restarts its counter if it is.
+* 
+* @param detection HailoDetectionPtr
+* @param tracks The tracks of the stream in the current frame
+* @param use_track_update boolean can override the default behaviour, false will always require an update
+* @return boolean indicating if traker update is required.
+*/
+bool track_update(HailoDetectionPtr detection, common::TrackStates<int>::Frame &tracks, bool use_track_update)
+{
+    int frames_since_update;
+    if (!track_update_due(detection, tracks, use_track_update, frames_since_update))
+        return false;
+    if (use_track_update)
+        track_updated(detection, tracks);
     return true;
 }
 
 /**
  * @brief Returns a vector of Person detections to crop and resize.
+ *        The detections due for an update compete for the crop budget of
+ *        the person attributes network, the most overdue and biggest first.
  *
  * @param image The original picture (cv::Mat).
  * @param roi The main ROI of this picture.
@@ -93,18 +128,27 @@ bool track_update(HailoDetectionPtr detection, bool use_track_update)
  */
 std::vector<HailoROIPtr> person_crop(std::shared_ptr<HailoMat> image, HailoROIPtr roi, bool use_track_update=false)
 {
-    std::vector<HailoROIPtr> crop_rois;
+    std::vector<common::CropCandidate> candidates;
     // Get all detections.
     std::vector<HailoDetectionPtr> detections_ptrs = hailo_common::get_hailo_detections(roi);
+    auto tracks = person_track_counters.begin_frame(roi->get_stream_id());
     for (HailoDetectionPtr &detection : detections_ptrs)
     {
         // Modify only detections with "person" label.
         if (std::string(PERSON_LABEL) == detection->get_label())
         {
-            if (track_update(detection, use_track_update))
-                crop_rois.emplace_back(detection);
+            int frames_since_update;
+            if (track_update_due(detection, tracks, use_track_update, frames_since_update))
+                candidates.push_back({detection, common::crop_priority(1.0f, frames_since_update, detection->get_bbox())});
         }
     }
+
+    std::vector<HailoROIPtr> crop_rois = common::CropScheduler::get(PERSON_ATTRIBUTES_SCHEDULER).schedule(roi->get_stream_id(), candidates);
+    if (use_track_update)
+    {
+        for (HailoROIPtr &crop_roi : crop_rois)
+            track_updated(std::dynamic_pointer_cast<HailoDetection>(crop_roi), tracks);
+    }
     return crop_rois;
 }
 
@@ -195,12 +239,13 @@ std::vector<HailoROIPtr> face_crop(std::shared_ptr<HailoMat> image, HailoROIPtr
     std::vector<HailoROIPtr> crop_rois;
     // Get all detections.
     std::vector<HailoDetectionPtr> detections_ptrs = hailo_common::get_hailo_detections(roi);
+    auto tracks = face_track_counters.begin_frame(roi->get_stream_id());
     for (HailoDetectionPtr &detection : detections_ptrs)
     {
         // Modify only detections with "face" label.
         if (std::string(FACE_LABEL) == detection->get_label() && !box_contains_nan(detection->get_bbox()))
         {
-            if (track_update(detection, use_track_update))
+            if (track_update(detection, tracks, use_track_update))
             {
                 // Modifies a rectengle according to a cropping algorithm only on faces
                 auto new_bbox = algorithm_face_crop(image->native_width(), image->native_height(), detection->get_bbox(), FACE_ATTRIBUTES_CROP_SCALE_FACTOR, FACE_ATTRIBUTES_CROP_HIGHT_OFFSET_FACTOR);
@@ -15,6 +15,9 @@
 // Hailo includes
 #include "person_attributes_overlay.hpp"
 #include "hailo_common.hpp"
+#include "common/hailomat.hpp"
+#include "common/image.hpp"
+#include "common/overlay_compositor.hpp"
 
 // Open source includes
 #include <opencv2/opencv.hpp>
@@ -27,6 +30,7 @@
 #define TEXT_CLS_THICKNESS (2)
 #define TEXT_FONT_FACTOR (0.12f)
 #define DEFAULT_DETECTION_COLOR (cv::Scalar(255, 255, 255))
+#define PRELOADED_GLOBAL_IDS (256)
 
 static const std::vector<cv::Scalar> color_table = {
     cv::Scalar(255, 0, 0), cv::Scalar(0, 255, 0), cv::Scalar(0, 0, 255), cv::Scalar(255, 255, 0), cv::Scalar(0, 255, 255),
@@ -79,63 +83,32 @@ HailoUniqueIDPtr get_global_id(HailoDetectionPtr detection)
 //     }
 // }
 
-static void draw_detection(cv::Mat &image_planes, HailoDetectionPtr detection, HailoROIPtr roi, int font_thickness = 1, int line_thickness = 1)
-{
+// Rasterize the first global ids whole (larger ids are composed from glyphs), once, when the overlay is loaded
+static const bool text_atlas_preloaded = (common::preload_overlay_text(common::number_texts(1, PRELOADED_GLOBAL_IDS), TEXT_CLS_THICKNESS, TEXT_FONT_FACTOR), true);
 
-    HailoBBox roi_bbox = hailo_common::create_flattened_bbox(roi->get_bbox(), roi->get_scaling_bbox());
-    auto detection_bbox = detection->get_bbox();
+static common::DetectionStyle detection_style(const HailoDetectionPtr &detection)
+{
+    common::DetectionStyle style;
     auto global_id = get_global_id(detection);
-
-    auto bbox_min = cv::Point(((detection_bbox.xmin() * roi_bbox.width()) + roi_bbox.xmin()) * image_planes.cols,
-                              ((detection_bbox.ymin() * roi_bbox.height()) + roi_bbox.ymin()) * image_planes.rows);
-    auto bbox_max = cv::Point(((detection_bbox.xmax() * roi_bbox.width()) + roi_bbox.xmin()) * image_planes.cols,
-                              ((detection_bbox.ymax() * roi_bbox.height()) + roi_bbox.ymin()) * image_planes.rows);
-    auto bbox_width = bbox_max.x - bbox_min.x;
-
-    // Draw the detection box
-    auto color_rgb = (!global_id) ? DEFAULT_DETECTION_COLOR : indexToColor(global_id->get_id());
-    cv::rectangle(image_planes, bbox_min, bbox_max, color_rgb, line_thickness);
-
+    style.color = (!global_id) ? DEFAULT_DETECTION_COLOR : indexToColor(global_id->get_id());
+    // Draw the global id on the box
     if (global_id)
-    {
-        std::string id_text = std::to_string(global_id->get_id());
-        // Calculating the font size according to the box width.
-        float font_scale = TEXT_FONT_FACTOR * log(bbox_width);
-        auto text_position = cv::Point(bbox_min.x + log(bbox_width), bbox_max.y - log(bbox_width));
-        // Draw the class and confidence text
-        cv::putText(image_planes, id_text, text_position, cv::FONT_HERSHEY_SIMPLEX, font_scale, color_rgb, font_thickness);
-    }
+        style.text = std::to_string(global_id->get_id());
+    return style;
 }
 
 void filter(HailoROIPtr roi, GstVideoFrame *frame, gchar *current_stream_id)
-// void filter(HailoROIPtr roi, cv::Mat& frame)
 {
-    gint cv2_format = CV_8UC3;
-    int font_thickness = 2;
+    int font_thickness = TEXT_CLS_THICKNESS;
     int line_thickness = 2;
-    guint matrix_width = (guint)GST_VIDEO_FRAME_WIDTH(frame);
-    std::cout << "frame width: "<< frame->info.width << "height: " << frame->info.height << " format: " << frame->info.finfo->format << std::endl;
 
-    auto mat = cv::Mat(GST_VIDEO_FRAME_HEIGHT(frame), matrix_width, cv2_format,
-                       GST_VIDEO_FRAME_PLANE_DATA(frame, 1), GST_VIDEO_FRAME_PLANE_STRIDE(frame, 1));
-    // face_blur(frame, roi);
+    // Draw straight into the planes of the frame, whatever its format
+    std::shared_ptr<HailoMat> hmat = get_mat_by_format(frame, line_thickness, font_thickness);
+    if (!hmat)
+        throw std::runtime_error("Unsupported pixel format");
 
-    for (auto obj : roi->get_objects())
-    {
-        switch (obj->get_type())
-        {
-        case HAILO_DETECTION:
-        {
-            std::cout << "------------detection-----------------";
-            HailoDetectionPtr detection = std::dynamic_pointer_cast<HailoDetection>(obj);
-            draw_detection(mat, detection, roi, font_thickness, line_thickness);
-            break;
-        }
-        default:
-            continue;
-            // break;
-        }
-    }
-
-    mat.release();
-}
\ No newline at end of file
+    // Flatten the ROI into drawings, then draw them band by band on the overlay threads
+    common::OverlayCompositor compositor(*hmat);
+    compositor.add_roi(roi, detection_style, TEXT_FONT_FACTOR);
+    compositor.render();
+}
@@ -0,0 +1,205 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+#include <cstdlib>
+#include <iostream>
+#include <utility>
+#include <pqxx/pqxx>
+
+#include "person_tracking_db.hpp"
+
+static const char *DEFAULT_CONNECTION_STRING = "dbname = testdb user = postgres password = postgres hostaddr = 127.0.0.1 port = 5432";
+static const char *UPSERT_STATEMENT = "person_tracking_upsert";
+
+// The attribute columns of person_tracking, in the order of the network outputs
+static const std::array<const char *, PERSON_TRACKING_NUM_ATTRIBUTES> ATTRIBUTE_COLUMNS = {
+    "Age_Young", "Age_Adult", "Age_Old", "Gender_Male", "Gender_Female",
+    "Hair_Length_Short", "Hair_Length_Long", "Hair_Length_Bald",
+    "UpperBody_Length_Short", "UpperBody_Length_Long",
+    "UpperBody_Color_Black", "UpperBody_Color_Blue", "UpperBody_Color_Brown", "UpperBody_Color_Green",
+    "UpperBody_Color_Grey", "UpperBody_Color_Orange", "UpperBody_Color_Pink", "UpperBody_Color_Purple",
+    "UpperBody_Color_Red", "UpperBody_Color_White", "UpperBody_Color_Yellow", "UpperBody_Color_Other",
+    "LowerBody_Length_Short", "LowerBody_Length_Long",
+    "LowerBody_Color_Black", "LowerBody_Color_Blue", "LowerBody_Color_Brown", "LowerBody_Color_Green",
+    "LowerBody_Color_Grey", "LowerBody_Color_Orange", "LowerBody_Color_Pink", "LowerBody_Color_Purple",
+    "LowerBody_Color_Red", "LowerBody_Color_White", "LowerBody_Color_Yellow", "LowerBody_Color_Other",
+    "LowerBody_Type_Trousers_And_Shorts", "LowerBody_Type_Skirt_And_Dress",
+    "Accessory_Backpack", "Accessory_NoBackpack", "Accessory_Bag", "Accessory_NoBag",
+    "Accessory_Glasses_Normal", "Accessory_Glasses_Sun", "Accessory_NoGlasses", "Accessory_Hat", "Accessory_NoHat"};
+
+/**
+ * @brief The upsert of one record: a new track inserts a row with its start_time and end_time,
+ *        a known track updates its attributes and end_time (its start_time is kept).
+ */
+static std::string upsert_sql()
+{
+    std::string columns = "tracking_id";
+    std::string values = "$1";
+    std::string updates;
+    for (size_t i = 0; i < ATTRIBUTE_COLUMNS.size(); i++)
+    {
+        columns += std::string(",") + ATTRIBUTE_COLUMNS[i];
+        values += ",$" + std::to_string(i + 2);
+        updates += std::string(ATTRIBUTE_COLUMNS[i]) + " = EXCLUDED." + ATTRIBUTE_COLUMNS[i] + ", ";
+    }
+    columns += ",start_time,end_time";
+    values += ",$" + std::to_string(ATTRIBUTE_COLUMNS.size() + 2) + ",$" + std::to_string(ATTRIBUTE_COLUMNS.size() + 3);
+    updates += "end_time = EXCLUDED.end_time";
+    return "INSERT INTO person_tracking (" + columns + ") VALUES (" + values + ") " +
+           "ON CONFLICT (tracking_id) DO UPDATE SET " + updates + ";";
+}
+
+template <size_t... I>
+static void exec_upsert(pqxx::work &work, const PersonTrackingRecord &record, std::index_sequence<I...>)
+{
+    work.exec_prepared(UPSERT_STATEMENT, record.tracking_id, record.attributes[I]..., record.start_time, record.end_time);
+}
+
+//******************************************************************
+// POSTGRES BACKEND
+//******************************************************************
+struct PostgresPersonTrackingBackend::Connection
+{
+    pqxx::connection connection;
+    explicit Connection(const std::string &connection_string) : connection(connection_string) {}
+};
+
+PostgresPersonTrackingBackend::PostgresPersonTrackingBackend(const std::string &connection_string)
+    : m_connection_string(connection_string)
+{
+}
+
+PostgresPersonTrackingBackend::~PostgresPersonTrackingBackend() = default;
+
+void PostgresPersonTrackingBackend::connect()
+{
+    // Only keep a connection the statement was prepared on, a failed prepare is retried with the next batch
+    auto connection = std::make_unique<Connection>(m_connection_string);
+    connection->connection.prepare(UPSERT_STATEMENT, upsert_sql());
+    std::cout << "Opened database successfully: " << connection->connection.dbname() << std::endl;
+    m_connection = std::move(connection);
+}
+
+void PostgresPersonTrackingBackend::upsert(const std::vector<PersonTrackingRecord> &records)
+{
+    if (!m_connection || !m_connection->connection.is_open())
+        connect();
+    try
+    {
+        pqxx::work work(m_connection->connection);
+        for (const PersonTrackingRecord &record : records)
+            exec_upsert(work, record, std::make_index_sequence<PERSON_TRACKING_NUM_ATTRIBUTES>());
+        work.commit();
+    }
+    catch (const pqxx::broken_connection &)
+    {
+        // Reconnect on the next batch
+        m_connection.reset();
+        throw;
+    }
+}
+
+//******************************************************************
+// WRITER
+//******************************************************************
+PersonTrackingWriter::PersonTrackingWriter(std::unique_ptr<PersonTrackingBackend> backend,
+                                           size_t max_pending,
+                                           std::chrono::milliseconds flush_period)
+    : m_backend(std::move(backend)), m_max_pending(max_pending), m_flush_period(flush_period)
+{
+    m_thread = std::thread(&PersonTrackingWriter::run, this);
+}
+
+PersonTrackingWriter::~PersonTrackingWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+    }
+    m_wake.notify_one();
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+bool PersonTrackingWriter::submit(PersonTrackingRecord record)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto pending_it = m_pending.find(record.tracking_id);
+    if (pending_it != m_pending.end())
+    {
+        // The pending record may be the first one of the track, its start_time must be written
+        record.start_time = std::move(pending_it->second.start_time);
+        pending_it->second = std::move(record);
+        return true;
+    }
+    if (m_pending.size() >= m_max_pending)
+    {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    m_pending.emplace(record.tracking_id, std::move(record));
+    return true;
+}
+
+void PersonTrackingWriter::run()
+{
+    std::vector<PersonTrackingRecord> batch;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        // Collect the updates of a whole flush period into one transaction
+        m_wake.wait_for(lock, m_flush_period, [this]
+                        { return !m_running; });
+        bool running = m_running;
+        if (m_pending.empty())
+        {
+            if (!running)
+                break;
+            continue;
+        }
+
+        batch.clear();
+        for (auto &pending : m_pending)
+            batch.push_back(std::move(pending.second));
+        m_pending.clear();
+
+        lock.unlock();
+        bool failed = false;
+        try
+        {
+            m_backend->upsert(batch);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "person tracking db: " << e.what() << std::endl;
+            failed = true;
+        }
+        lock.lock();
+
+        if (failed)
+        {
+            // Retry on the next period. A newer record of the track submitted meanwhile
+            // replaces the failed one, but takes over its earlier start_time.
+            for (PersonTrackingRecord &record : batch)
+            {
+                auto pending_it = m_pending.find(record.tracking_id);
+                if (pending_it != m_pending.end())
+                    pending_it->second.start_time = std::move(record.start_time);
+                else if (m_pending.size() < m_max_pending)
+                    m_pending.emplace(record.tracking_id, std::move(record));
+            }
+        }
+        // On shutdown, give up on a failing database instead of retrying forever
+        if (!running && (failed || m_pending.empty()))
+            break;
+    }
+}
+
+PersonTrackingWriter &PersonTrackingWriter::get()
+{
+    const char *connection_string = std::getenv("PERSON_TRACKING_DB");
+    static PersonTrackingWriter writer(std::make_unique<PostgresPersonTrackingBackend>(
+        connection_string ? connection_string : DEFAULT_CONNECTION_STRING));
+    return writer;
+}
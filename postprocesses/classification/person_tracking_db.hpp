@@ -0,0 +1,114 @@
+/**
+* Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+* Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+**/
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define PERSON_TRACKING_NUM_ATTRIBUTES 47
+
+/**
+ * @brief The attributes of one tracked person, one row of the person_tracking table.
+ */
+struct PersonTrackingRecord
+{
+    int tracking_id = 0;
+    std::array<int, PERSON_TRACKING_NUM_ATTRIBUTES> attributes{};
+    std::string start_time; // first update of the record, start_time of a new row
+    std::string end_time;   // latest update of the record, end_time of the row
+};
+
+/**
+ * @brief Storage of the person tracking records.
+ *        The writer only talks to this interface, so it can run against a mock backend.
+ */
+class PersonTrackingBackend
+{
+public:
+    virtual ~PersonTrackingBackend() = default;
+
+    /**
+     * @brief Insert or update the records in a single transaction.
+     *        Throws on failure, the writer then retries the batch.
+     */
+    virtual void upsert(const std::vector<PersonTrackingRecord> &records) = 0;
+};
+
+/**
+ * @brief PostgreSQL backend: one persistent connection and a prepared
+ *        INSERT ... ON CONFLICT (tracking_id) DO UPDATE statement.
+ *        Requires a unique constraint on person_tracking.tracking_id.
+ */
+class PostgresPersonTrackingBackend : public PersonTrackingBackend
+{
+private:
+    std::string m_connection_string;
+    struct Connection;
+    std::unique_ptr<Connection> m_connection;
+
+    void connect();
+
+public:
+    explicit PostgresPersonTrackingBackend(const std::string &connection_string);
+    ~PostgresPersonTrackingBackend() override;
+    void upsert(const std::vector<PersonTrackingRecord> &records) override;
+};
+
+/**
+ * @brief Writes person tracking records from a background thread.
+ *        Submitted records are coalesced per tracking id (the latest attributes and
+ *        end_time of a track are written with the earliest unwritten start_time)
+ *        and flushed in batched transactions, so the streaming
+ *        threads never wait for the database. When max_pending tracks are already
+ *        waiting, records of new tracks are dropped.
+ */
+class PersonTrackingWriter
+{
+private:
+    std::unique_ptr<PersonTrackingBackend> m_backend;
+    size_t m_max_pending;
+    std::chrono::milliseconds m_flush_period;
+    std::unordered_map<int, PersonTrackingRecord> m_pending;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_running = true;
+    std::atomic<size_t> m_dropped{0};
+    std::thread m_thread;
+
+    void run();
+
+public:
+    PersonTrackingWriter(std::unique_ptr<PersonTrackingBackend> backend,
+                         size_t max_pending = 1024,
+                         std::chrono::milliseconds flush_period = std::chrono::milliseconds(500));
+    ~PersonTrackingWriter();
+
+    PersonTrackingWriter(const PersonTrackingWriter &) = delete;
+    PersonTrackingWriter &operator=(const PersonTrackingWriter &) = delete;
+
+    /**
+     * @brief Queue a record, replacing the pending record of the same track
+     *        but keeping its start_time.
+     *
+     * @return bool False if the record was dropped because the queue is full.
+     */
+    bool submit(PersonTrackingRecord record);
+
+    size_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief The writer of the process, connected to the database of
+     *        the PERSON_TRACKING_DB environment variable (libpq connection string)
+     *        or to the local testdb.
+     */
+    static PersonTrackingWriter &get();
+};
@@ -0,0 +1,100 @@
+/**
+* Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+* Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+**/
+#pragma once
+#include <array>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * @brief Attributes of the tracks of one stream, aggregated over the frames.
+ *        Each attribute keeps an exponential moving average of its confidence,
+ *        and its label is the thresholded average, so a single noisy frame does not flip it.
+ *        Tracks that were not updated for stale_after are evicted.
+ */
+template <size_t N>
+class TrackAttributeStore
+{
+public:
+    struct Track
+    {
+        std::array<float, N> average;
+        std::array<bool, N> labels;
+        std::chrono::steady_clock::time_point last_seen;
+        std::chrono::system_clock::time_point last_seen_time; // wall clock, for the db
+    };
+
+private:
+    float m_alpha;
+    float m_threshold;
+    std::chrono::steady_clock::duration m_stale_after;
+    std::chrono::steady_clock::time_point m_last_sweep;
+    std::unordered_map<int, Track> m_tracks;
+    std::mutex m_mutex;
+
+public:
+    TrackAttributeStore(float alpha, float threshold, std::chrono::steady_clock::duration stale_after)
+        : m_alpha(alpha), m_threshold(threshold), m_stale_after(stale_after), m_last_sweep(std::chrono::steady_clock::now()) {}
+
+    /**
+     * @brief Add the confidences of a frame to a track.
+     *
+     * @param track_id The tracking id.
+     * @param confidences N attribute confidences.
+     * @param[out] track A copy of the track after the update.
+     * @return true If the track is new or one of its labels changed.
+     */
+    bool update(int track_id, const float *confidences, Track &track)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto track_it = m_tracks.find(track_id);
+        bool changed = (track_it == m_tracks.end());
+        if (changed)
+        {
+            track_it = m_tracks.emplace(track_id, Track()).first;
+            for (size_t i = 0; i < N; i++)
+                track_it->second.average[i] = confidences[i];
+        }
+        Track &current = track_it->second;
+        for (size_t i = 0; i < N; i++)
+        {
+            if (!changed)
+                current.average[i] += m_alpha * (confidences[i] - current.average[i]);
+            bool label = current.average[i] > m_threshold;
+            changed |= (label != current.labels[i]);
+            current.labels[i] = label;
+        }
+        current.last_seen = std::chrono::steady_clock::now();
+        current.last_seen_time = std::chrono::system_clock::now();
+        track = current;
+        return changed;
+    }
+
+    /**
+     * @brief Evict the tracks that were not updated for stale_after.
+     *        Sweeps at most twice per stale_after, so it can be called every frame.
+     *
+     * @param on_evicted Called with (track id, track) for every evicted track.
+     */
+    template <typename Callback>
+    void evict_stale(Callback on_evicted)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto now = std::chrono::steady_clock::now();
+        if (now - m_last_sweep < m_stale_after / 2)
+            return;
+        m_last_sweep = now;
+        for (auto track_it = m_tracks.begin(); track_it != m_tracks.end();)
+        {
+            if (now - track_it->second.last_seen < m_stale_after)
+            {
+                ++track_it;
+                continue;
+            }
+            on_evicted(track_it->first, track_it->second);
+            track_it = m_tracks.erase(track_it);
+        }
+    }
+};
@@ -0,0 +1,145 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "hailo_objects.hpp"
+
+namespace common
+{
+
+    //-------------------------------
+    // LABELS
+    //-------------------------------
+
+    /**
+     * @brief Labels interned by class id in a flat array.
+     *        Looking up a label is an index instead of a map search, and unknown
+     *        class ids resolve to an empty label instead of being inserted.
+     */
+    class LabelTable
+    {
+    private:
+        std::vector<std::string> m_labels;
+        std::string m_empty;
+
+    public:
+        LabelTable() = default;
+        explicit LabelTable(const std::map<uint8_t, std::string> &labels_dict)
+        {
+            if (labels_dict.empty())
+                return;
+            m_labels.resize(labels_dict.rbegin()->first + 1);
+            for (const auto &label : labels_dict)
+                m_labels[label.first] = label.second;
+        }
+
+        const std::string &operator[](uint class_id) const
+        {
+            return class_id < m_labels.size() ? m_labels[class_id] : m_empty;
+        }
+
+        size_t size() const { return m_labels.size(); }
+
+        /**
+         * @brief Whether the table holds the labels of labels_dict, compared without allocating.
+         */
+        bool matches(const std::map<uint8_t, std::string> &labels_dict) const
+        {
+            size_t index = 0;
+            for (const auto &label : labels_dict)
+            {
+                // Class ids missing from the map have empty labels
+                for (; index < label.first; index++)
+                {
+                    if (index >= m_labels.size() || !m_labels[index].empty())
+                        return false;
+                }
+                if (index >= m_labels.size() || m_labels[index] != label.second)
+                    return false;
+                index++;
+            }
+            return index == m_labels.size();
+        }
+    };
+
+    /**
+     * @brief Get the interned table of a labels map.
+     *        Tables are cached per thread by the address of the map, so the label maps
+     *        of the post-processes (static, or owned by params) are interned once per stream.
+     *        A cached table is checked against the map on every lookup, so a map that was
+     *        changed, or re-created at the address of a freed one, is interned again.
+     *
+     * @param labels_dict  -  std::map<uint8_t, std::string>
+     *        The labels map
+     *
+     * @return const LabelTable&
+     *         Valid until the map is interned again with other labels
+     */
+    inline const LabelTable &intern_labels(const std::map<uint8_t, std::string> &labels_dict)
+    {
+        thread_local std::unordered_map<const void *, LabelTable> tables;
+        auto table_it = tables.find(&labels_dict);
+        if (table_it == tables.end() || !table_it->second.matches(labels_dict))
+            table_it = tables.insert_or_assign(&labels_dict, LabelTable(labels_dict)).first;
+        return table_it->second;
+    }
+
+    //-------------------------------
+    // DETECTION ARENA
+    //-------------------------------
+
+    /**
+     * @brief Detection storage reused across frames.
+     *        The detections vector keeps its capacity between frames, so once the
+     *        arena grew to the busiest frame a post-process allocates nothing while decoding.
+     *        Keep one arena per filter and stream (a thread_local in the filter function).
+     */
+    class DetectionArena
+    {
+    private:
+        std::vector<HailoDetection> m_detections;
+
+    public:
+        /**
+         * @brief Start a new frame, dropping the detections of the previous one.
+         *
+         * @param capacity  -  size_t
+         *        Expected number of detections, reserved on the first frames
+         *
+         * @return std::vector<HailoDetection>&
+         *         The (empty) detections of the frame
+         */
+        std::vector<HailoDetection> &begin_frame(size_t capacity = 0)
+        {
+            m_detections.clear();
+            if (m_detections.capacity() < capacity)
+                m_detections.reserve(capacity);
+            return m_detections;
+        }
+
+        std::vector<HailoDetection> &detections() { return m_detections; }
+
+        /**
+         * @brief Attach the detections of the frame to the roi.
+         *        Unlike hailo_common::add_detections, the detections vector is not copied,
+         *        every detection is moved into the object the roi holds.
+         *
+         * @param roi  -  HailoROIPtr
+         *        The roi to add the detections to
+         */
+        void add_to_roi(HailoROIPtr roi)
+        {
+            for (HailoDetection &detection : m_detections)
+                roi->add_object(std::make_shared<HailoDetection>(std::move(detection)));
+            m_detections.clear();
+        }
+    };
+
+}
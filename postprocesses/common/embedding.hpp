@@ -0,0 +1,245 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "hailo_objects.hpp"
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace common
+{
+
+    //-------------------------------
+    // EMBEDDINGS
+    //-------------------------------
+
+    /**
+     * @brief Sum of (data[i] - zp)^2 over a quantized vector, exactly, in the integer domain.
+     *        uint8 data is accumulated 16 values at a time (SSE2 madd / NEON widening multiply-accumulate)
+     *        in 32 bit lanes, which are flushed to 64 bits before they can overflow.
+     *
+     * @param data  -  const T *
+     *        uint8_t or uint16_t quantized values
+     *
+     * @param zp  -  int32_t
+     *        The zero point
+     *
+     * @return uint64_t
+     */
+    template <typename T>
+    uint64_t quantized_squared_norm(const T *data, uint32_t size, int32_t zp)
+    {
+        static_assert(std::is_same<T, uint8_t>::value || std::is_same<T, uint16_t>::value, "Only uint8 and uint16 data is supported");
+        uint64_t sum = 0;
+        uint32_t i = 0;
+        if (sizeof(T) == 1 && zp >= 0 && zp <= 255)
+        {
+            // A 32 bit lane gets 4 squares of at most 255^2 per 16 values, so it holds 8192 of them
+            constexpr uint32_t block = 8192 * 16;
+#if defined(__aarch64__)
+            int16x8_t zero_points = vdupq_n_s16(zp);
+            while (i + 16 <= size)
+            {
+                int32x4_t lanes = vdupq_n_s32(0);
+                uint32_t end = std::min(size - size % 16, i + block);
+                for (; i < end; i += 16)
+                {
+                    uint8x16_t values = vld1q_u8((const uint8_t *)(data + i));
+                    int16x8_t low = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(values))), zero_points);
+                    int16x8_t high = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(values))), zero_points);
+                    lanes = vmlal_s16(lanes, vget_low_s16(low), vget_low_s16(low));
+                    lanes = vmlal_s16(lanes, vget_high_s16(low), vget_high_s16(low));
+                    lanes = vmlal_s16(lanes, vget_low_s16(high), vget_low_s16(high));
+                    lanes = vmlal_s16(lanes, vget_high_s16(high), vget_high_s16(high));
+                }
+                sum += vaddlvq_u32(vreinterpretq_u32_s32(lanes));
+            }
+#elif defined(__SSE2__)
+            __m128i zero = _mm_setzero_si128();
+            __m128i zero_points = _mm_set1_epi16((short)zp);
+            while (i + 16 <= size)
+            {
+                __m128i lanes = _mm_setzero_si128();
+                uint32_t end = std::min(size - size % 16, i + block);
+                for (; i < end; i += 16)
+                {
+                    __m128i values = _mm_loadu_si128((const __m128i *)(data + i));
+                    __m128i low = _mm_sub_epi16(_mm_unpacklo_epi8(values, zero), zero_points);
+                    __m128i high = _mm_sub_epi16(_mm_unpackhi_epi8(values, zero), zero_points);
+                    lanes = _mm_add_epi32(lanes, _mm_add_epi32(_mm_madd_epi16(low, low), _mm_madd_epi16(high, high)));
+                }
+                alignas(16) uint32_t partial[4];
+                _mm_store_si128((__m128i *)partial, lanes);
+                sum += uint64_t(partial[0]) + partial[1] + partial[2] + partial[3];
+            }
+#endif
+        }
+        for (; i < size; i++)
+        {
+            int64_t value = int64_t(data[i]) - zp;
+            sum += uint64_t(value * value);
+        }
+        return sum;
+    }
+
+    /**
+     * @brief Dequantize and L2-normalize a quantized embedding in one pass over it:
+     *        out[i] = (data[i] - zp) * scale / ||(data - zp) * scale||.
+     *        The norm is summed on the integers, and since the scale is common to all the values it
+     *        cancels out, so the values are only decoded once, already normalized.
+     *        A zero vector is written as zeros.
+     *
+     * @param data  -  const T *
+     *        uint8_t or uint16_t quantized values
+     *
+     * @param qp_zp  -  float
+     *        The quantization zero point
+     *
+     * @param qp_scale  -  float
+     *        The quantization scale, only its sign matters
+     *
+     * @param out  -  float *
+     *        size normalized floats
+     */
+    template <typename T>
+    void normalize_embedding(const T *data, uint32_t size, float qp_zp, float qp_scale, float *out)
+    {
+        float inverse_norm;
+        if (qp_zp == std::floor(qp_zp))
+        {
+            uint64_t squared_norm = quantized_squared_norm(data, size, int32_t(qp_zp));
+            inverse_norm = squared_norm ? float(1.0 / std::sqrt(double(squared_norm))) : 0.0f;
+        }
+        else
+        {
+            double squared_norm = 0.0;
+            for (uint32_t i = 0; i < size; i++)
+                squared_norm += (double(data[i]) - qp_zp) * (double(data[i]) - qp_zp);
+            inverse_norm = squared_norm > 0.0 ? float(1.0 / std::sqrt(squared_norm)) : 0.0f;
+        }
+        if (qp_scale < 0.0f)
+            inverse_norm = -inverse_norm;
+
+        uint32_t i = 0;
+        if (sizeof(T) == 1)
+        {
+#if defined(__aarch64__)
+            float32x4_t zero_points = vdupq_n_f32(qp_zp);
+            float32x4_t factors = vdupq_n_f32(inverse_norm);
+            for (; i + 16 <= size; i += 16)
+            {
+                uint8x16_t values = vld1q_u8((const uint8_t *)(data + i));
+                uint16x8_t low = vmovl_u8(vget_low_u8(values));
+                uint16x8_t high = vmovl_u8(vget_high_u8(values));
+                uint32x4_t words[4] = {vmovl_u16(vget_low_u16(low)), vmovl_u16(vget_high_u16(low)),
+                                       vmovl_u16(vget_low_u16(high)), vmovl_u16(vget_high_u16(high))};
+                for (int part = 0; part < 4; part++)
+                    vst1q_f32(out + i + part * 4, vmulq_f32(vsubq_f32(vcvtq_f32_u32(words[part]), zero_points), factors));
+            }
+#elif defined(__SSE2__)
+            __m128i zero = _mm_setzero_si128();
+            __m128 zero_points = _mm_set1_ps(qp_zp);
+            __m128 factors = _mm_set1_ps(inverse_norm);
+            for (; i + 16 <= size; i += 16)
+            {
+                __m128i values = _mm_loadu_si128((const __m128i *)(data + i));
+                __m128i low = _mm_unpacklo_epi8(values, zero);
+                __m128i high = _mm_unpackhi_epi8(values, zero);
+                __m128i words[4] = {_mm_unpacklo_epi16(low, zero), _mm_unpackhi_epi16(low, zero),
+                                    _mm_unpacklo_epi16(high, zero), _mm_unpackhi_epi16(high, zero)};
+                for (int part = 0; part < 4; part++)
+                    _mm_storeu_ps(out + i + part * 4, _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(words[part]), zero_points), factors));
+            }
+#endif
+        }
+        for (; i < size; i++)
+            out[i] = (float(data[i]) - qp_zp) * inverse_norm;
+    }
+
+    /**
+     * @brief Quantize a float vector to int8 so its largest magnitude maps to 127.
+     *        The values stay in [-127, 127], never -128, which the int8 dot products rely on.
+     *
+     * @return float
+     *         The scale of the int8 values, 0 for a zero vector
+     */
+    inline float quantize_symmetric_s8(const float *data, uint32_t size, int8_t *out)
+    {
+        float max_value = 0.0f;
+        for (uint32_t i = 0; i < size; i++)
+            max_value = std::max(max_value, std::abs(data[i]));
+        if (max_value == 0.0f)
+        {
+            std::fill(out, out + size, int8_t(0));
+            return 0.0f;
+        }
+        float factor = 127.0f / max_value;
+        for (uint32_t i = 0; i < size; i++)
+            out[i] = int8_t(std::lrint(data[i] * factor));
+        return max_value / 127.0f;
+    }
+
+    /**
+     * @brief Decode the L2-normalized embedding of a tensor into size floats, with its own zero point and scale.
+     */
+    inline void normalize_embedding_tensor(HailoTensorPtr tensor, uint32_t size, float *out)
+    {
+        float qp_zp = tensor->vstream_info().quant_info.qp_zp;
+        float qp_scale = tensor->vstream_info().quant_info.qp_scale;
+        if (tensor->vstream_info().format.type == HAILO_FORMAT_TYPE_UINT16)
+            normalize_embedding(reinterpret_cast<const uint16_t *>(tensor->data()), size, qp_zp, qp_scale, out);
+        else
+            normalize_embedding(tensor->data(), size, qp_zp, qp_scale, out);
+    }
+
+    /**
+     * @brief Create the L2-normalized embedding of a tensor as a HailoMatrix of the tensor's shape,
+     *        decoding the tensor straight into the storage of the matrix.
+     *
+     * @param tensor  -  HailoTensorPtr
+     *        The quantized embedding (uint8 or uint16)
+     *
+     * @return HailoMatrixPtr
+     */
+    inline HailoMatrixPtr embedding_matrix(HailoTensorPtr tensor)
+    {
+        uint32_t size = tensor->width() * tensor->height() * tensor->features();
+        auto matrix = std::make_shared<HailoMatrix>(std::vector<float>(size), tensor->height(), tensor->width(), tensor->features());
+        normalize_embedding_tensor(tensor, size, matrix->get_data().data());
+        return matrix;
+    }
+
+    /**
+     * @brief Create the L2-normalized embedding of a tensor quantized to int8 (see quantize_symmetric_s8),
+     *        a quarter of the size of embedding_matrix, as a HailoUserMeta: its string holds the int8 values,
+     *        its float the scale (normalized[i] ~= values[i] * scale, 0 for a zero vector) and its int their number.
+     *
+     * @param tensor  -  HailoTensorPtr
+     *        The quantized embedding (uint8 or uint16)
+     *
+     * @return HailoUserMetaPtr
+     */
+    inline HailoUserMetaPtr embedding_int8(HailoTensorPtr tensor)
+    {
+        uint32_t size = tensor->width() * tensor->height() * tensor->features();
+        thread_local std::vector<float> normalized;
+        normalized.resize(size);
+        normalize_embedding_tensor(tensor, size, normalized.data());
+        std::string values(size, '\0');
+        float scale = quantize_symmetric_s8(normalized.data(), size, reinterpret_cast<int8_t *>(&values[0]));
+        return std::make_shared<HailoUserMeta>(int(size), std::move(values), scale);
+    }
+
+}
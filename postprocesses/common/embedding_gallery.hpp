@@ -0,0 +1,495 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "embedding.hpp"
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+namespace common
+{
+
+    //-------------------------------
+    // SIMILARITY KERNELS
+    //-------------------------------
+
+#if !defined(__aarch64__) && defined(__SSE2__)
+    /**
+     * @brief Whether the CPU running the process has AVX2. The tree is built for SSE2 only,
+     *        so the AVX2 kernels are compiled with a target attribute and picked at runtime.
+     */
+    inline bool cpu_has_avx2()
+    {
+        static const bool avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+        return avx2;
+    }
+
+    __attribute__((target("avx2"))) inline float dot_product_f32_avx2(const float *a, const float *b, uint32_t size)
+    {
+        uint32_t i = 0;
+        __m256 sums[2] = {_mm256_setzero_ps(), _mm256_setzero_ps()};
+        for (; i + 16 <= size; i += 16)
+        {
+            sums[0] = _mm256_add_ps(sums[0], _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+            sums[1] = _mm256_add_ps(sums[1], _mm256_mul_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
+        }
+        __m256 total = _mm256_add_ps(sums[0], sums[1]);
+        __m128 half = _mm_add_ps(_mm256_castps256_ps128(total), _mm256_extractf128_ps(total, 1));
+        alignas(16) float partial[4];
+        _mm_store_ps(partial, half);
+        float sum = (partial[0] + partial[1]) + (partial[2] + partial[3]);
+        for (; i < size; i++)
+            sum += a[i] * b[i];
+        return sum;
+    }
+
+    __attribute__((target("avx2"))) inline int32_t dot_product_s8_avx2(const int8_t *a, const int8_t *b, uint32_t size)
+    {
+        uint32_t i = 0;
+        __m256i sums = _mm256_setzero_si256();
+        for (; i + 16 <= size; i += 16)
+        {
+            // Sign extend 16 values to 16 bits, then multiply and add pairs into 32 bit lanes
+            __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(a + i)));
+            __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(b + i)));
+            sums = _mm256_add_epi32(sums, _mm256_madd_epi16(va, vb));
+        }
+        __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+        alignas(16) int32_t partial[4];
+        _mm_store_si128((__m128i *)partial, half);
+        int32_t sum = partial[0] + partial[1] + partial[2] + partial[3];
+        for (; i < size; i++)
+            sum += int32_t(a[i]) * int32_t(b[i]);
+        return sum;
+    }
+#endif
+
+    /**
+     * @brief Dot product of two float vectors whose size is a multiple of 16.
+     */
+    inline float dot_product_f32(const float *a, const float *b, uint32_t size)
+    {
+        uint32_t i = 0;
+        float sum = 0.0f;
+#if defined(__aarch64__)
+        float32x4_t sums[4] = {vdupq_n_f32(0), vdupq_n_f32(0), vdupq_n_f32(0), vdupq_n_f32(0)};
+        for (; i + 16 <= size; i += 16)
+        {
+            for (int part = 0; part < 4; part++)
+                sums[part] = vfmaq_f32(sums[part], vld1q_f32(a + i + part * 4), vld1q_f32(b + i + part * 4));
+        }
+        sum = vaddvq_f32(vaddq_f32(vaddq_f32(sums[0], sums[1]), vaddq_f32(sums[2], sums[3])));
+#elif defined(__SSE2__)
+        if (cpu_has_avx2())
+            return dot_product_f32_avx2(a, b, size);
+        __m128 sums[4] = {_mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps()};
+        for (; i + 16 <= size; i += 16)
+        {
+            for (int part = 0; part < 4; part++)
+                sums[part] = _mm_add_ps(sums[part], _mm_mul_ps(_mm_load_ps(a + i + part * 4), _mm_load_ps(b + i + part * 4)));
+        }
+        alignas(16) float partial[4];
+        _mm_store_ps(partial, _mm_add_ps(_mm_add_ps(sums[0], sums[1]), _mm_add_ps(sums[2], sums[3])));
+        sum = (partial[0] + partial[1]) + (partial[2] + partial[3]);
+#endif
+        for (; i < size; i++)
+            sum += a[i] * b[i];
+        return sum;
+    }
+
+    /**
+     * @brief Dot product of two int8 vectors whose size is a multiple of 16, exact in 32 bits
+     *        for vectors of up to 2^16 values. The values must be in [-127, 127], as quantize_symmetric_s8 writes them.
+     */
+    inline int32_t dot_product_s8(const int8_t *a, const int8_t *b, uint32_t size)
+    {
+        uint32_t i = 0;
+        int32_t sum = 0;
+#if defined(__aarch64__)
+        int32x4_t sums = vdupq_n_s32(0);
+        for (; i + 16 <= size; i += 16)
+        {
+            int8x16_t va = vld1q_s8(a + i);
+            int8x16_t vb = vld1q_s8(b + i);
+            // Two products of at most 127^2 fit a 16 bit lane (two of -128 * -128 would overflow it)
+            int16x8_t products = vmull_s8(vget_low_s8(va), vget_low_s8(vb));
+            products = vmlal_s8(products, vget_high_s8(va), vget_high_s8(vb));
+            sums = vpadalq_s16(sums, products);
+        }
+        sum = vaddvq_s32(sums);
+#elif defined(__SSE2__)
+        if (cpu_has_avx2())
+            return dot_product_s8_avx2(a, b, size);
+        __m128i sums = _mm_setzero_si128();
+        for (; i + 16 <= size; i += 16)
+        {
+            __m128i va = _mm_load_si128((const __m128i *)(a + i));
+            __m128i vb = _mm_load_si128((const __m128i *)(b + i));
+            // Sign extend to 16 bits: duplicate every byte into the high half, then shift it down arithmetically
+            __m128i a_low = _mm_srai_epi16(_mm_unpacklo_epi8(va, va), 8);
+            __m128i a_high = _mm_srai_epi16(_mm_unpackhi_epi8(va, va), 8);
+            __m128i b_low = _mm_srai_epi16(_mm_unpacklo_epi8(vb, vb), 8);
+            __m128i b_high = _mm_srai_epi16(_mm_unpackhi_epi8(vb, vb), 8);
+            sums = _mm_add_epi32(sums, _mm_add_epi32(_mm_madd_epi16(a_low, b_low), _mm_madd_epi16(a_high, b_high)));
+        }
+        alignas(16) int32_t partial[4];
+        _mm_store_si128((__m128i *)partial, sums);
+        sum = partial[0] + partial[1] + partial[2] + partial[3];
+#endif
+        for (; i < size; i++)
+            sum += int32_t(a[i]) * int32_t(b[i]);
+        return sum;
+    }
+
+    //-------------------------------
+    // EMBEDDING GALLERY
+    //-------------------------------
+
+    typedef enum
+    {
+        GALLERY_PRECISION_FLOAT32,
+        GALLERY_PRECISION_INT8,
+    } gallery_precision_t;
+
+    struct GalleryParams
+    {
+        uint32_t dimension;
+        // The maximal number of identities, the least recently seen one is evicted for a new one
+        uint32_t capacity = 1000;
+        // Every identity keeps its last embeddings in a ring buffer
+        uint32_t embeddings_per_identity = 4;
+        // An embedding matches an identity when its cosine similarity to one of its embeddings reaches this
+        float similarity_threshold = 0.5f;
+        // Identities not seen for this long are forgotten
+        float ttl_seconds = 300.0f;
+        gallery_precision_t precision = GALLERY_PRECISION_FLOAT32;
+    };
+
+    /**
+     * @brief A gallery of identities, matched by the cosine similarity of L2-normalized embeddings,
+     *        that assigns global ids to the embeddings of each frame.
+     *        The embeddings of all the identities are rows of one contiguous, 64 byte aligned matrix
+     *        (float32, or int8 with a scale per row), identity i owning the rows of its ring buffer.
+     *        A frame is matched as a batch: the matrix is streamed once and every row is compared
+     *        with all the queries while it is in cache.
+     *        Several streams may share a gallery, so it is locked while a frame is assigned.
+     */
+    class EmbeddingGallery
+    {
+    public:
+        typedef std::chrono::steady_clock clock;
+
+    private:
+        struct Identity
+        {
+            int global_id = -1;
+            uint32_t count = 0; // valid rows
+            uint32_t next = 0;  // the next row of the ring buffer to write
+            clock::time_point last_seen;
+            uint64_t assigned_in = 0; // the frame that last assigned this identity
+        };
+
+        struct AlignedFree
+        {
+            void operator()(void *data) const { std::free(data); }
+        };
+
+        struct Match
+        {
+            float similarity;
+            uint32_t query;
+            uint32_t identity;
+        };
+
+        GalleryParams m_params;
+        uint32_t m_stride; // values per row, padded to 64 bytes
+        std::unique_ptr<uint8_t, AlignedFree> m_rows;
+        std::vector<float> m_row_scales;
+        std::vector<Identity> m_identities;
+        std::vector<uint32_t> m_free;
+        uint32_t m_active = 0;
+        int m_next_global_id = 1;
+        uint64_t m_frame = 0;
+        std::mutex m_mutex;
+
+        // Per frame buffers
+        std::unique_ptr<uint8_t, AlignedFree> m_queries;
+        uint32_t m_queries_capacity = 0;
+        std::vector<float> m_query_scales;
+        std::vector<float> m_best;
+        std::vector<Match> m_matches;
+
+        size_t value_size() const { return m_params.precision == GALLERY_PRECISION_INT8 ? 1 : 4; }
+
+        uint8_t *row(uint8_t *base, size_t index) const { return base + index * m_stride * value_size(); }
+
+        static uint8_t *allocate(size_t bytes)
+        {
+            bytes = std::max<size_t>(64, (bytes + 63) / 64 * 64);
+            void *data = std::aligned_alloc(64, bytes);
+            if (!data)
+                throw std::bad_alloc();
+            std::fill((uint8_t *)data, (uint8_t *)data + bytes, uint8_t(0));
+            return (uint8_t *)data;
+        }
+
+        // Write an embedding into a row, padded with zeros, and return its scale (1 for float32)
+        float store(const float *embedding, uint8_t *destination) const
+        {
+            if (m_params.precision == GALLERY_PRECISION_INT8)
+                return quantize_symmetric_s8(embedding, m_params.dimension, (int8_t *)destination);
+            std::copy(embedding, embedding + m_params.dimension, (float *)destination);
+            return 1.0f;
+        }
+
+        float similarity(const uint8_t *a, float a_scale, const uint8_t *b, float b_scale) const
+        {
+            if (m_params.precision == GALLERY_PRECISION_INT8)
+                return float(dot_product_s8((const int8_t *)a, (const int8_t *)b, m_stride)) * a_scale * b_scale;
+            return dot_product_f32((const float *)a, (const float *)b, m_stride);
+        }
+
+        void release(uint32_t identity)
+        {
+            m_identities[identity] = Identity();
+            m_free.push_back(identity);
+            m_active--;
+        }
+
+        // A slot for a new identity: a free one, or the least recently seen one not assigned in this frame
+        int64_t acquire()
+        {
+            if (m_free.empty())
+            {
+                int64_t oldest = -1;
+                for (uint32_t i = 0; i < m_identities.size(); i++)
+                {
+                    if (m_identities[i].assigned_in == m_frame)
+                        continue;
+                    if (oldest < 0 || m_identities[i].last_seen < m_identities[oldest].last_seen)
+                        oldest = i;
+                }
+                if (oldest < 0)
+                    return -1;
+                release(oldest);
+            }
+            uint32_t identity = m_free.back();
+            m_free.pop_back();
+            m_active++;
+            m_identities[identity].global_id = m_next_global_id++;
+            return identity;
+        }
+
+        void remember(uint32_t identity, uint32_t query, clock::time_point now)
+        {
+            Identity &entry = m_identities[identity];
+            size_t index = size_t(identity) * m_params.embeddings_per_identity + entry.next;
+            std::copy(row(m_queries.get(), query), row(m_queries.get(), query + 1), row(m_rows.get(), index));
+            m_row_scales[index] = m_query_scales[query];
+            entry.next = (entry.next + 1) % m_params.embeddings_per_identity;
+            entry.count = std::min(entry.count + 1, m_params.embeddings_per_identity);
+            entry.last_seen = now;
+            entry.assigned_in = m_frame;
+        }
+
+    public:
+        explicit EmbeddingGallery(const GalleryParams &params) : m_params(params)
+        {
+            if (params.dimension == 0 || params.capacity == 0 || params.embeddings_per_identity == 0)
+                throw std::invalid_argument("EmbeddingGallery error: dimension, capacity and embeddings per identity must be positive");
+            uint32_t values_per_line = 64 / value_size();
+            m_stride = (params.dimension + values_per_line - 1) / values_per_line * values_per_line;
+            size_t rows = size_t(params.capacity) * params.embeddings_per_identity;
+            m_rows.reset(allocate(rows * m_stride * value_size()));
+            m_row_scales.assign(rows, 0.0f);
+            m_identities.resize(params.capacity);
+            m_free.reserve(params.capacity);
+            for (uint32_t i = params.capacity; i > 0; i--)
+                m_free.push_back(i - 1);
+        }
+
+        EmbeddingGallery(const EmbeddingGallery &) = delete;
+        EmbeddingGallery &operator=(const EmbeddingGallery &) = delete;
+
+        const GalleryParams &params() const { return m_params; }
+
+        /**
+         * @brief The number of identities in the gallery.
+         */
+        uint32_t size()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_active;
+        }
+
+        /**
+         * @brief Add an identity for an embedding without matching it, e.g. to enroll the known identities
+         *        of a database. When the gallery is full, the least recently seen identity is evicted.
+         *
+         * @param embedding  -  const float *
+         *        A dimension L2-normalized embedding
+         *
+         * @return int
+         *         The global id of the new identity
+         */
+        int enroll(const float *embedding, clock::time_point now = clock::now())
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_frame++;
+            if (m_queries_capacity == 0)
+            {
+                m_queries.reset(allocate(size_t(m_stride) * value_size()));
+                m_queries_capacity = 1;
+            }
+            m_query_scales.resize(std::max<size_t>(m_query_scales.size(), 1));
+            m_query_scales[0] = store(embedding, row(m_queries.get(), 0));
+            uint32_t identity = acquire();
+            remember(identity, 0, now);
+            return m_identities[identity].global_id;
+        }
+
+        /**
+         * @brief Assign global ids to the embeddings of a frame, and remember the embeddings.
+         *        Every embedding takes the identity it is most similar to, most similar pairs first,
+         *        each identity going to at most one embedding of the frame; embeddings that match no
+         *        identity above the threshold start a new one.
+         *
+         * @param embeddings  -  const float *
+         *        count x dimension L2-normalized embeddings
+         *
+         * @param count  -  uint32_t
+         *        The number of embeddings
+         *
+         * @param ids  -  int *
+         *        The global ids of the embeddings, -1 when the frame has more new identities than the gallery can hold
+         *
+         * @param now  -  clock::time_point
+         *        The time of the frame, for the LRU and TTL policies
+         */
+        void assign(const float *embeddings, uint32_t count, int *ids, clock::time_point now = clock::now())
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_frame++;
+
+            // Forget the identities that were not seen for too long
+            auto ttl = std::chrono::duration_cast<clock::duration>(std::chrono::duration<float>(m_params.ttl_seconds));
+            for (uint32_t i = 0; i < m_identities.size(); i++)
+            {
+                if (m_identities[i].global_id >= 0 && now - m_identities[i].last_seen > ttl)
+                    release(i);
+            }
+
+            // Pad the queries to rows of the gallery's precision
+            if (count > m_queries_capacity)
+            {
+                m_queries.reset(allocate(size_t(count) * m_stride * value_size()));
+                m_queries_capacity = count;
+            }
+            m_query_scales.resize(count);
+            for (uint32_t q = 0; q < count; q++)
+                m_query_scales[q] = store(embeddings + size_t(q) * m_params.dimension, row(m_queries.get(), q));
+
+            // The best similarity of every query to every identity, with the gallery streamed once
+            uint32_t capacity = m_params.capacity;
+            m_best.assign(size_t(count) * capacity, -2.0f);
+            for (uint32_t i = 0; i < capacity; i++)
+            {
+                const Identity &identity = m_identities[i];
+                for (uint32_t r = 0; r < identity.count; r++)
+                {
+                    size_t index = size_t(i) * m_params.embeddings_per_identity + r;
+                    const uint8_t *gallery_row = row(m_rows.get(), index);
+                    for (uint32_t q = 0; q < count; q++)
+                    {
+                        float value = similarity(row(m_queries.get(), q), m_query_scales[q], gallery_row, m_row_scales[index]);
+                        float &best = m_best[size_t(q) * capacity + i];
+                        best = std::max(best, value);
+                    }
+                }
+            }
+
+            // Greedy one to one assignment, most similar pairs first
+            m_matches.clear();
+            for (uint32_t q = 0; q < count; q++)
+            {
+                for (uint32_t i = 0; i < capacity; i++)
+                {
+                    float value = m_best[size_t(q) * capacity + i];
+                    if (value >= m_params.similarity_threshold)
+                        m_matches.push_back(Match{value, q, i});
+                }
+            }
+            std::sort(m_matches.begin(), m_matches.end(), [](const Match &a, const Match &b)
+                      { return a.similarity > b.similarity || (a.similarity == b.similarity && (a.query < b.query || (a.query == b.query && a.identity < b.identity))); });
+            std::fill(ids, ids + count, -1);
+            for (const Match &match : m_matches)
+            {
+                if (ids[match.query] >= 0 || m_identities[match.identity].assigned_in == m_frame)
+                    continue;
+                ids[match.query] = m_identities[match.identity].global_id;
+                remember(match.identity, match.query, now);
+            }
+
+            for (uint32_t q = 0; q < count; q++)
+            {
+                if (ids[q] >= 0)
+                    continue;
+                int64_t identity = acquire();
+                if (identity < 0)
+                    continue;
+                ids[q] = m_identities[identity].global_id;
+                remember(identity, q, now);
+            }
+        }
+
+        /**
+         * @brief The gallery of the re-id embeddings of a given dimension, shared by all the streams of the process.
+         *        It is configured by the environment variables REID_GALLERY_CAPACITY, REID_GALLERY_EMBEDDINGS
+         *        (per identity), REID_GALLERY_THRESHOLD, REID_GALLERY_TTL (seconds) and REID_GALLERY_INT8 (1 for int8 rows).
+         *
+         * @return EmbeddingGallery&
+         */
+        static EmbeddingGallery &reid(uint32_t dimension)
+        {
+            static std::mutex mutex;
+            static std::map<uint32_t, std::unique_ptr<EmbeddingGallery>> galleries;
+            std::lock_guard<std::mutex> lock(mutex);
+            std::unique_ptr<EmbeddingGallery> &gallery = galleries[dimension];
+            if (!gallery)
+            {
+                GalleryParams params;
+                params.dimension = dimension;
+                if (const char *capacity = std::getenv("REID_GALLERY_CAPACITY"))
+                    params.capacity = std::max<uint32_t>(1, std::strtoul(capacity, nullptr, 10));
+                if (const char *embeddings = std::getenv("REID_GALLERY_EMBEDDINGS"))
+                    params.embeddings_per_identity = std::max<uint32_t>(1, std::strtoul(embeddings, nullptr, 10));
+                if (const char *threshold = std::getenv("REID_GALLERY_THRESHOLD"))
+                    params.similarity_threshold = std::strtof(threshold, nullptr);
+                if (const char *ttl = std::getenv("REID_GALLERY_TTL"))
+                    params.ttl_seconds = std::strtof(ttl, nullptr);
+                if (const char *int8 = std::getenv("REID_GALLERY_INT8"))
+                    params.precision = std::string(int8) == "1" ? GALLERY_PRECISION_INT8 : GALLERY_PRECISION_FLOAT32;
+                gallery = std::make_unique<EmbeddingGallery>(params);
+            }
+            return *gallery;
+        }
+    };
+
+}
@@ -0,0 +1,231 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace common
+{
+
+    //-------------------------------
+    // EVENT SINK
+    //-------------------------------
+
+    /**
+     * @brief Bounded lock-free multi producer queue (Vyukov's ring of sequenced slots).
+     *        Producers never block: push fails when the ring is full.
+     */
+    template <typename T>
+    class MpscQueue
+    {
+    private:
+        struct Slot
+        {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+        std::vector<Slot> m_slots;
+        size_t m_mask;
+        alignas(64) std::atomic<size_t> m_head{0}; // next slot to push
+        alignas(64) size_t m_tail = 0;             // next slot to pop, only touched by the consumer
+
+    public:
+        explicit MpscQueue(size_t capacity)
+        {
+            size_t size = 2;
+            while (size < capacity)
+                size <<= 1;
+            m_slots = std::vector<Slot>(size);
+            m_mask = size - 1;
+            for (size_t i = 0; i < size; i++)
+                m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        bool push(T &&value)
+        {
+            size_t position = m_head.load(std::memory_order_relaxed);
+            while (true)
+            {
+                Slot &slot = m_slots[position & m_mask];
+                size_t sequence = slot.sequence.load(std::memory_order_acquire);
+                intptr_t difference = intptr_t(sequence) - intptr_t(position);
+                if (difference == 0)
+                {
+                    if (m_head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        slot.value = std::move(value);
+                        slot.sequence.store(position + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (difference < 0)
+                {
+                    return false; // full
+                }
+                else
+                {
+                    position = m_head.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        bool pop(T &value)
+        {
+            Slot &slot = m_slots[m_tail & m_mask];
+            if (slot.sequence.load(std::memory_order_acquire) != m_tail + 1)
+                return false; // empty
+            value = std::move(slot.value);
+            slot.sequence.store(m_tail + m_mask + 1, std::memory_order_release);
+            m_tail++;
+            return true;
+        }
+    };
+
+    /**
+     * @brief Appends lines to a file from a background writer thread.
+     *        Post-processes push lines without touching the file system, the writer
+     *        drains them in batches into a file it keeps open, and rotates the file
+     *        (to <path>.1) once it grows over max_bytes. Lines pushed while the queue
+     *        is full are dropped and counted, so a slow disk never stalls the pipeline.
+     */
+    class EventSink
+    {
+    private:
+        static constexpr size_t QUEUE_CAPACITY = 1024;
+        static constexpr auto FLUSH_PERIOD = std::chrono::milliseconds(200);
+
+        std::string m_path;
+        size_t m_max_bytes;
+        MpscQueue<std::string> m_queue;
+        std::ofstream m_file;
+        size_t m_file_bytes = 0;
+        std::atomic<size_t> m_dropped{0};
+        std::atomic<bool> m_running{true};
+        std::mutex m_wake_mutex;
+        std::condition_variable m_wake;
+        std::thread m_writer;
+
+        void open()
+        {
+            m_file.open(m_path, std::ios::app);
+            m_file.seekp(0, std::ios::end);
+            std::streamoff size = m_file.tellp();
+            m_file_bytes = size > 0 ? size_t(size) : 0;
+        }
+
+        void rotate()
+        {
+            m_file.close();
+            std::rename(m_path.c_str(), (m_path + ".1").c_str());
+            open();
+        }
+
+        void drain()
+        {
+            std::string line;
+            bool wrote = false;
+            while (m_queue.pop(line))
+            {
+                if (!m_file.is_open())
+                    open();
+                m_file << line << '\n';
+                m_file_bytes += line.size() + 1;
+                wrote = true;
+                if (m_max_bytes > 0 && m_file_bytes >= m_max_bytes)
+                    rotate();
+            }
+            // One flush per batch instead of one per line
+            if (wrote)
+                m_file.flush();
+        }
+
+        void run()
+        {
+            while (m_running.load(std::memory_order_acquire))
+            {
+                {
+                    std::unique_lock<std::mutex> lock(m_wake_mutex);
+                    m_wake.wait_for(lock, FLUSH_PERIOD);
+                }
+                drain();
+            }
+            drain();
+        }
+
+    public:
+        EventSink(const std::string &path, size_t max_bytes)
+            : m_path(path), m_max_bytes(max_bytes), m_queue(QUEUE_CAPACITY)
+        {
+            m_writer = std::thread(&EventSink::run, this);
+        }
+
+        ~EventSink()
+        {
+            m_running.store(false, std::memory_order_release);
+            m_wake.notify_one();
+            if (m_writer.joinable())
+                m_writer.join();
+        }
+
+        EventSink(const EventSink &) = delete;
+        EventSink &operator=(const EventSink &) = delete;
+
+        /**
+         * @brief Queue a line to be appended to the file.
+         *
+         * @param line  -  std::string
+         *        The line, without the line break
+         *
+         * @return bool
+         *         False if the queue was full and the line was dropped
+         */
+        bool push(std::string line)
+        {
+            if (!m_queue.push(std::move(line)))
+            {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            m_wake.notify_one();
+            return true;
+        }
+
+        size_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+        /**
+         * @brief Get the sink of a file, shared by all the post-processes of the process.
+         *        The first call creates the sink and its writer thread, cache the reference.
+         *
+         * @param path  -  std::string
+         *        The file to append to
+         *
+         * @param max_bytes  -  size_t
+         *        Rotate the file once it reaches this size, 0 to never rotate. Default 8MB.
+         *
+         * @return EventSink&
+         */
+        static EventSink &get(const std::string &path, size_t max_bytes = 8 * 1024 * 1024)
+        {
+            static std::mutex sinks_mutex;
+            static std::map<std::string, std::unique_ptr<EventSink>> sinks;
+            std::lock_guard<std::mutex> lock(sinks_mutex);
+            std::unique_ptr<EventSink> &sink = sinks[path];
+            if (!sink)
+                sink = std::make_unique<EventSink>(path, max_bytes);
+            return *sink;
+        }
+    };
+
+}
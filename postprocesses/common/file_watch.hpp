@@ -0,0 +1,128 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace common
+{
+
+    //-------------------------------
+    // WATCHED CONFIG FILES
+    //-------------------------------
+
+    /**
+     * @brief A value parsed from a file, re-parsed by a background thread when inotify reports
+     *        that the file changed. Readers get the current value with one atomic load,
+     *        so a post-process can read its config every frame without touching the file system.
+     */
+    template <typename T>
+    class WatchedFile
+    {
+    public:
+        // Parse the file into value, which holds the previous value. Called from the watcher thread.
+        using Parser = std::function<void(const std::string &path, T &value)>;
+
+    private:
+        static constexpr int POLL_TIMEOUT_MS = 200;
+
+        std::string m_path;
+        Parser m_parser;
+        std::shared_ptr<const T> m_value;
+        std::atomic<bool> m_running{true};
+        int m_inotify_fd = -1;
+        std::thread m_watcher;
+
+        void reload()
+        {
+            T value = *get();
+            m_parser(m_path, value);
+            std::atomic_store(&m_value, std::shared_ptr<const T>(std::make_shared<T>(std::move(value))));
+        }
+
+        void run(std::string file_name)
+        {
+            alignas(struct inotify_event) char events[4096];
+            struct pollfd poll_fd = {m_inotify_fd, POLLIN, 0};
+            while (m_running.load(std::memory_order_acquire))
+            {
+                if (poll(&poll_fd, 1, POLL_TIMEOUT_MS) <= 0)
+                    continue;
+                ssize_t length = read(m_inotify_fd, events, sizeof(events));
+                bool changed = false;
+                for (ssize_t offset = 0; offset < length;)
+                {
+                    const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(events + offset);
+                    if (event->len > 0 && file_name == event->name)
+                        changed = true;
+                    offset += sizeof(struct inotify_event) + event->len;
+                }
+                if (changed)
+                    reload();
+            }
+        }
+
+    public:
+        /**
+         * @brief Parse the file and start watching it.
+         *
+         * @param path  -  std::string
+         *        The watched file, it may not exist yet
+         *
+         * @param initial  -  T
+         *        The value used until the file is parsed (the parser gets it as previous value)
+         *
+         * @param parser  -  Parser
+         *        Updates the value from the file
+         */
+        WatchedFile(const std::string &path, T initial, Parser parser)
+            : m_path(path), m_parser(std::move(parser)), m_value(std::make_shared<T>(std::move(initial)))
+        {
+            reload();
+            // Watch the directory, editors and config tools replace the file instead of writing it in place
+            size_t separator = m_path.find_last_of('/');
+            std::string directory = separator == std::string::npos ? "." : m_path.substr(0, separator + 1);
+            std::string file_name = separator == std::string::npos ? m_path : m_path.substr(separator + 1);
+            m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (m_inotify_fd < 0)
+                return;
+            if (inotify_add_watch(m_inotify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE) < 0)
+            {
+                close(m_inotify_fd);
+                m_inotify_fd = -1;
+                return;
+            }
+            m_watcher = std::thread(&WatchedFile::run, this, file_name);
+        }
+
+        ~WatchedFile()
+        {
+            m_running.store(false, std::memory_order_release);
+            if (m_watcher.joinable())
+                m_watcher.join();
+            if (m_inotify_fd >= 0)
+                close(m_inotify_fd);
+        }
+
+        WatchedFile(const WatchedFile &) = delete;
+        WatchedFile &operator=(const WatchedFile &) = delete;
+
+        /**
+         * @brief Get the current value, keep the pointer for the whole frame to see a consistent value.
+         */
+        std::shared_ptr<const T> get() const
+        {
+            return std::atomic_load(&m_value);
+        }
+    };
+
+}
@@ -18,6 +18,7 @@
 #include <opencv2/opencv.hpp>
 #include "hailo_common.hpp"
 #include "hailo_objects.hpp"
+#include "text_atlas.hpp"
 
 // Transformations were taken from https://stackoverflow.com/questions/17892346/how-to-convert-rgb-yuv-rgb-both-ways.
 #define RGB2Y(R, G, B) CLIP((0.257 * (R) + 0.504 * (G) + 0.098 * (B)) + 16)
@@ -106,12 +107,41 @@ public:
     uint height() { return m_height; };
     uint native_width() { return m_native_width; };
     uint native_height() { return m_native_height; };
+    int line_thickness() { return m_line_thickness; };
+    int font_thickness() { return m_font_thickness; };
     std::vector<cv::Mat> &get_matrices() { return m_matrices; }
     virtual void draw_rectangle(cv::Rect rect, const cv::Scalar color) = 0;
     virtual void draw_text(std::string text, cv::Point position, double font_scale, const cv::Scalar color) = 0;
     virtual void draw_line(cv::Point point1, cv::Point point2, const cv::Scalar color, int thickness, int line_type) = 0;
     virtual void draw_ellipse(cv::Point center, cv::Size axes, double angle, double start_angle, double end_angle, const cv::Scalar color, int thickness) = 0;
     virtual void blur(cv::Rect rect, cv::Size ksize) = 0;
+    /**
+     * @brief Blend a color into the mat through a coverage bitmap, like rendered text or a mask.
+     *
+     * @param alpha  -  cv::Mat
+     *        CV_8UC1 coverage, 0 (transparent) to 255 (opaque), in pixels
+     *
+     * @param top_left  -  cv::Point
+     *        Where the top-left of the bitmap lands, it may be partly outside the mat
+     *
+     * @param color  -  cv::Scalar
+     *        The RGB color
+     */
+    virtual void draw_alpha(const cv::Mat &alpha, cv::Point top_left, const cv::Scalar color) = 0;
+    /**
+     * @brief Get a mat of a band of rows of this one, over the same buffer.
+     *        Drawing on the band with coordinates shifted up by top changes the same pixels
+     *        as drawing on this mat, clipped to the band, so bands can be drawn in parallel.
+     *
+     * @param top  -  uint
+     *        The first row of the band, even for subsampled formats
+     *
+     * @param height  -  uint
+     *        The number of rows of the band
+     *
+     * @return std::shared_ptr<HailoMat>
+     */
+    virtual std::shared_ptr<HailoMat> rows(uint top, uint height) = 0;
     /*
      * @brief Crop ROIs from the mat, note the present implementation is valid
      *        for interlaced formats. Planar formats such as NV12 should override.
@@ -185,7 +215,16 @@ public:
     }
     virtual void draw_text(std::string text, cv::Point position, double font_scale, const cv::Scalar color)
     {
-        cv::putText(m_matrices[0], text, position, cv::FONT_HERSHEY_SIMPLEX, font_scale, color, m_font_thickness);
+        const common::TextBitmap &text_bitmap = common::TextAtlas::get().render(text, font_scale, m_font_thickness);
+        draw_alpha(text_bitmap.alpha, position - text_bitmap.origin, color);
+    }
+    virtual void draw_alpha(const cv::Mat &alpha, cv::Point top_left, const cv::Scalar color)
+    {
+        common::blend_alpha(m_matrices[0], alpha, top_left, color);
+    }
+    virtual std::shared_ptr<HailoMat> rows(uint top, uint height)
+    {
+        return std::make_shared<HailoRGBMat>(m_matrices[0].ptr<uint8_t>(top), height, m_width, m_stride, m_line_thickness, m_font_thickness, m_name);
     }
     virtual void draw_line(cv::Point point1, cv::Point point2, const cv::Scalar color, int thickness, int line_type)
     {
@@ -236,7 +275,16 @@ public:
     }
     virtual void draw_text(std::string text, cv::Point position, double font_scale, const cv::Scalar color)
     {
-        cv::putText(m_matrices[0], text, position, cv::FONT_HERSHEY_SIMPLEX, font_scale, get_rgba_color(color), m_font_thickness);
+        const common::TextBitmap &text_bitmap = common::TextAtlas::get().render(text, font_scale, m_font_thickness);
+        draw_alpha(text_bitmap.alpha, position - text_bitmap.origin, color);
+    }
+    virtual void draw_alpha(const cv::Mat &alpha, cv::Point top_left, const cv::Scalar color)
+    {
+        common::blend_alpha(m_matrices[0], alpha, top_left, get_rgba_color(color));
+    }
+    virtual std::shared_ptr<HailoMat> rows(uint top, uint height)
+    {
+        return std::make_shared<HailoRGBAMat>(m_matrices[0].ptr<uint8_t>(top), height, m_width, m_stride, m_line_thickness, m_font_thickness);
     }
     virtual void draw_line(cv::Point point1, cv::Point point2, const cv::Scalar color, int thickness, int line_type)
     {
@@ -287,7 +335,20 @@ public:
         cv::Rect fixed_rect = cv::Rect(rect.x / 2, rect.y, rect.width / 2, rect.height);
         cv::rectangle(m_matrices[0], fixed_rect, get_yuy2_color(color), m_line_thickness);
     }
-    virtual void draw_text(std::string text, cv::Point position, double font_scale, const cv::Scalar color){};
+    virtual void draw_text(std::string text, cv::Point position, double font_scale, const cv::Scalar color)
+    {
+        const common::TextBitmap &text_bitmap = common::TextAtlas::get().render(text, font_scale, m_font_thickness);
+        draw_alpha(text_bitmap.alpha, position - text_bitmap.origin, color);
+    };
+    virtual void draw_alpha(const cv::Mat &alpha, cv::Point top_left, const cv::Scalar color)
+    {
+        cv::Scalar yuy2_color = get_yuy2_color(color);
+        common::blend_alpha_yuy2(m_matrices[0], alpha, top_left, cv::Scalar(yuy2_color[0], yuy2_color[1], yuy2_color[3]));
+    }
+    virtual std::shared_ptr<HailoMat> rows(uint top, uint height)
+    {
+        return std::make_shared<HailoYUY2Mat>(m_matrices[0].ptr<uint8_t>(top), height, m_native_width, m_stride, m_line_thickness, m_font_thickness);
+    }
     virtual void draw_line(cv::Point point1, cv::Point point2, const cv::Scalar color, int thickness, int line_type){};
     virtual void draw_ellipse(cv::Point center, cv::Size axes, double angle, double start_angle, double end_angle, const cv::Scalar color, int thickness){};
     virtual void blur(cv::Rect rect, cv::Size ksize){};
@@ -379,16 +440,33 @@ public:
 
     virtual void draw_text(std::string text, cv::Point position, double font_scale, const cv::Scalar color)
     {
-        cv::Scalar yuv_color = get_nv12_color(color);
-        cv::Point y_position = cv::Point(position.x, position.y);
-        cv::Point uv_position = cv::Point(position.x / 2, position.y / 2);
-        cv::putText(m_matrices[0], text, y_position, cv::FONT_HERSHEY_SIMPLEX, font_scale, cv::Scalar(yuv_color[0]), m_font_thickness);
-        cv::putText(m_matrices[1], text, uv_position, cv::FONT_HERSHEY_SIMPLEX, font_scale / 2, cv::Scalar(yuv_color[1], yuv_color[2]), m_font_thickness / 2);
+        const common::TextBitmap &text_bitmap = common::TextAtlas::get().render(text, font_scale, m_font_thickness);
+        draw_alpha(text_bitmap.alpha, position - text_bitmap.origin, color);
     };
 
+    virtual void draw_alpha(const cv::Mat &alpha, cv::Point top_left, const cv::Scalar color)
+    {
+        thread_local cv::Mat uv_alpha;
+        cv::Scalar yuv_color = get_nv12_color(color);
+        common::blend_alpha(m_matrices[0], alpha, top_left, cv::Scalar(yuv_color[0]));
+        // Every UV sample is blended with the average coverage of the 2x2 Y samples it belongs to
+        cv::Point uv_top_left = common::downsample_alpha(alpha, top_left, 2, uv_alpha);
+        common::blend_alpha(m_matrices[1], uv_alpha, uv_top_left, cv::Scalar(yuv_color[1], yuv_color[2]));
+    }
+
+    virtual std::shared_ptr<HailoMat> rows(uint top, uint height)
+    {
+        uint8_t *y_rows = m_matrices[0].ptr<uint8_t>(top);
+        uint8_t *uv_rows = m_matrices[1].ptr<uint8_t>(top / 2);
+        return std::make_shared<HailoNV12Mat>(y_rows, height, m_native_width, m_y_stride, m_uv_stride, m_line_thickness, m_font_thickness, y_rows, uv_rows);
+    }
+
     virtual void draw_line(cv::Point point1, cv::Point point2, const cv::Scalar color, int thickness, int line_type)
     {
         cv::Scalar yuv_color = get_nv12_color(color);
+        // Draw from left to right, so every line has an orientation
+        if (point1.x > point2.x)
+            std::swap(point1, point2);
 
         int y_plane_x1_value = floor_to_even_number(point1.x);
         int y_plane_y1_value = floor_to_even_number(point1.y);
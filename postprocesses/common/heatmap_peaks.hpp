@@ -0,0 +1,166 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+#include "quantization.hpp"
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace common
+{
+
+    //-------------------------------
+    // HEATMAP PEAKS
+    //-------------------------------
+
+    /**
+     * @brief A peak of a heatmap channel: its quantized value and its cell (y * width + x).
+     */
+    struct HeatmapPeak
+    {
+        uint32_t value;
+        uint32_t cell;
+    };
+
+    /**
+     * @brief out[i] = max(a[i], b[i]), 16 bytes at a time.
+     */
+    template <typename T>
+    inline void elementwise_max(const T *a, const T *b, T *out, uint32_t size)
+    {
+        static_assert(std::is_same<T, uint8_t>::value || std::is_same<T, uint16_t>::value, "Only uint8 and uint16 data is supported");
+        uint32_t i = 0;
+        constexpr uint32_t lanes = 16 / sizeof(T);
+#if defined(__aarch64__)
+        for (; i + lanes <= size; i += lanes)
+        {
+            if (sizeof(T) == 1)
+                vst1q_u8((uint8_t *)(out + i), vmaxq_u8(vld1q_u8((const uint8_t *)(a + i)), vld1q_u8((const uint8_t *)(b + i))));
+            else
+                vst1q_u16((uint16_t *)(out + i), vmaxq_u16(vld1q_u16((const uint16_t *)(a + i)), vld1q_u16((const uint16_t *)(b + i))));
+        }
+#elif defined(__SSE2__)
+        for (; i + lanes <= size; i += lanes)
+        {
+            __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+            __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+            __m128i result;
+            if (sizeof(T) == 1)
+                result = _mm_max_epu8(va, vb);
+            else
+            {
+                // No unsigned 16 bit max in SSE2, flip the sign bit and take the signed max
+                __m128i sign = _mm_set1_epi16((short)0x8000);
+                result = _mm_xor_si128(_mm_max_epi16(_mm_xor_si128(va, sign), _mm_xor_si128(vb, sign)), sign);
+            }
+            _mm_storeu_si128((__m128i *)(out + i), result);
+        }
+#endif
+        for (; i < size; i++)
+            out[i] = std::max(a[i], b[i]);
+    }
+
+    /**
+     * @brief Find the top k peaks of every channel of a quantized heatmap, without dequantizing or transposing it.
+     *        A cell is a peak when no cell of its 3x3 neighbourhood in the same channel is greater (3x3 max-pool NMS).
+     *        The max-pool runs on whole interleaved rows (the neighbours of a value are `channels` and
+     *        `width * channels` values away), and only the values that can enter the top k of their channel
+     *        are tested, so the peaks of each channel are kept in a bounded heap of size k.
+     *        Equal peaks are ordered by cell.
+     *
+     * @param data  -  const T *
+     *        uint8_t or uint16_t heatmap, height x width x channels
+     *
+     * @param k  -  uint32_t
+     *        The number of peaks per channel, channels with fewer peaks are padded with {0, 0}
+     *
+     * @param peaks  -  std::vector<HeatmapPeak>
+     *        Resized to channels x k: the peaks of each channel, highest first
+     */
+    template <typename T>
+    void top_k_peaks(const T *data, uint32_t height, uint32_t width, uint32_t channels, uint32_t k, std::vector<HeatmapPeak> &peaks)
+    {
+        const uint32_t row_size = width * channels;
+        thread_local std::vector<T> column_max;
+        thread_local std::vector<T> pair_max;
+        thread_local std::vector<T> pooled;
+        thread_local std::vector<uint32_t> counts;
+        thread_local std::vector<uint32_t> admission;
+        column_max.resize(row_size);
+        pair_max.resize(row_size);
+        pooled.resize(row_size);
+        counts.assign(channels, 0);
+        admission.assign(channels, 0); // the smallest value that enters the heap of a channel
+        peaks.assign(size_t(channels) * k, HeatmapPeak{0, 0});
+        if (k == 0)
+            return;
+
+        // In heap order the worst peak is on top: lowest value, latest cell
+        auto better = [](const HeatmapPeak &a, const HeatmapPeak &b)
+        { return a.value > b.value || (a.value == b.value && a.cell < b.cell); };
+
+        for (uint32_t y = 0; y < height; y++)
+        {
+            const T *row = data + size_t(y) * row_size;
+            // Vertical max of the rows around this one
+            if (y > 0)
+                elementwise_max(row - row_size, row, column_max.data(), row_size);
+            else
+                std::copy(row, row + row_size, column_max.begin());
+            if (y + 1 < height)
+                elementwise_max(column_max.data(), row + row_size, column_max.data(), row_size);
+            // Horizontal max: pair_max[i] = max(column_max[i], column_max[i + channels]),
+            // then pooled[i] = max(pair_max[i - channels], pair_max[i])
+            if (width > 1)
+            {
+                uint32_t pairs = row_size - channels;
+                elementwise_max(column_max.data(), column_max.data() + channels, pair_max.data(), pairs);
+                std::copy(pair_max.begin(), pair_max.begin() + channels, pooled.begin());
+                elementwise_max(pair_max.data(), pair_max.data() + channels, pooled.data() + channels, pairs - channels);
+                std::copy(pair_max.begin() + pairs - channels, pair_max.begin() + pairs, pooled.begin() + pairs);
+            }
+            else
+                std::copy(column_max.begin(), column_max.end(), pooled.begin());
+
+            uint32_t row_threshold = *std::min_element(admission.begin(), admission.end());
+            for_each_above_threshold(row, row_size, row_threshold, [&](uint32_t i)
+                                     {
+                                         uint32_t channel = i % channels;
+                                         uint32_t value = row[i];
+                                         if (value < admission[channel] || value < pooled[i])
+                                             return;
+                                         HeatmapPeak *heap = peaks.data() + size_t(channel) * k;
+                                         HeatmapPeak peak{value, y * width + i / channels};
+                                         if (counts[channel] < k)
+                                         {
+                                             heap[counts[channel]++] = peak;
+                                             std::push_heap(heap, heap + counts[channel], better);
+                                         }
+                                         else
+                                         {
+                                             std::pop_heap(heap, heap + k, better);
+                                             heap[k - 1] = peak;
+                                             std::push_heap(heap, heap + k, better);
+                                         }
+                                         // Cells come in increasing order, so once full only greater values enter
+                                         if (counts[channel] == k)
+                                             admission[channel] = heap[0].value + 1; });
+        }
+
+        for (uint32_t channel = 0; channel < channels; channel++)
+        {
+            HeatmapPeak *heap = peaks.data() + size_t(channel) * k;
+            std::sort_heap(heap, heap + counts[channel], better);
+        }
+    }
+
+}
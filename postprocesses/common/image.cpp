@@ -3,8 +3,24 @@
  * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
  **/
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "common/image.hpp"
 
+// Fixed point bits of the bilinear weights, the horizontal pass keeps 7 bits so its results fit int16
+#define RESIZE_WEIGHT_BITS_X (7)
+#define RESIZE_WEIGHT_BITS_Y (11)
+#define RESIZE_TABLES_CACHE_SIZE (32)
+
 size_t get_size(GstCaps *caps)
 {
     size_t size;
@@ -82,8 +98,26 @@ void resize_yuy2(cv::Mat &cropped_image, cv::Mat &resized_image, int interpolati
     resized_y_channels_2_split.release();
 }
 
+static NV12Planes nv12_planes(std::vector<cv::Mat> &image_vec)
+{
+    if (image_vec.size() < 2 || image_vec[0].empty() || image_vec[1].empty())
+        throw std::invalid_argument("NV12 images need allocated Y and UV mats");
+    return {image_vec[0].data, image_vec[0].step, image_vec[1].data, image_vec[1].step, image_vec[0].cols, image_vec[0].rows};
+}
+
+static HailoBBox crop_resize_nv12_rect(const NV12Planes &src, const cv::Rect &crop, NV12Planes &dst, bool letterbox, cv::Scalar color);
+
 void resize_nv12(std::vector<cv::Mat> &cropped_image_vec, std::vector<cv::Mat> &resized_image_vec, int interpolation)
 {
+    if (interpolation == cv::INTER_LINEAR)
+    {
+        NV12Planes cropped = nv12_planes(cropped_image_vec);
+        NV12Planes resized = nv12_planes(resized_image_vec);
+        crop_resize_nv12_rect(cropped, cv::Rect(0, 0, floor_to_even_number(cropped.width), floor_to_even_number(cropped.height)),
+                              resized, false, cv::Scalar(0, 0, 0));
+        return;
+    }
+
     uint resize_width_y = resized_image_vec[0].cols;
     uint resize_height_y = resized_image_vec[0].rows;
 
@@ -124,19 +158,321 @@ HailoBBox resize_letterbox_rgb(cv::Mat &cropped_image, cv::Mat &resized_image, c
 
 HailoBBox resize_letterbox_nv12(std::vector<cv::Mat> &cropped_image_vec, std::vector<cv::Mat> &resized_image_vec, cv::Scalar color, int interpolation)
 {
+    if (interpolation == cv::INTER_LINEAR)
+    {
+        NV12Planes cropped = nv12_planes(cropped_image_vec);
+        NV12Planes resized = nv12_planes(resized_image_vec);
+        return crop_resize_nv12_rect(cropped, cv::Rect(0, 0, floor_to_even_number(cropped.width), floor_to_even_number(cropped.height)),
+                                     resized, true, color);
+    }
+
     // Convert the color to YUV pixel format
     uint y = RGB2Y(color[0], color[1], color[2]);
     uint u = RGB2U(color[0], color[1], color[2]);
     uint v = RGB2V(color[0], color[1], color[2]);
-    cv::Scalar nv12_color(y, u, v);
 
     // Perform the letterbox resize on the Y and UV channels separately
-    HailoBBox letterboxed_scale = resize_letterbox_rgb(cropped_image_vec[0], resized_image_vec[0], nv12_color, interpolation);
-    resize_letterbox_rgb(cropped_image_vec[1], resized_image_vec[1], nv12_color, interpolation);
+    HailoBBox letterboxed_scale = resize_letterbox_rgb(cropped_image_vec[0], resized_image_vec[0], cv::Scalar(y), interpolation);
+    resize_letterbox_rgb(cropped_image_vec[1], resized_image_vec[1], cv::Scalar(u, v), interpolation);
+
+    return letterboxed_scale;
+}
+
+//******************************************************************
+// FUSED NV12 CROP + RESIZE + LETTERBOX
+//******************************************************************
+/**
+ * @brief Bilinear coefficients of one axis: every destination sample blends
+ *        source samples index0 and index1 with fixed point weights.
+ */
+struct ResizeAxis
+{
+    std::vector<int> index0;
+    std::vector<int> index1;
+    std::vector<int16_t> weight0;
+    std::vector<int16_t> weight1;
+};
+
+struct NV12ResizeTables
+{
+    ResizeAxis y_columns;
+    ResizeAxis y_rows;
+    ResizeAxis uv_columns;
+    ResizeAxis uv_rows;
+};
+
+static ResizeAxis make_resize_axis(int src_size, int dst_size, int weight_bits)
+{
+    // Same sampling as cv::resize INTER_LINEAR: pixel centers aligned, borders replicated
+    ResizeAxis axis;
+    axis.index0.resize(dst_size);
+    axis.index1.resize(dst_size);
+    axis.weight0.resize(dst_size);
+    axis.weight1.resize(dst_size);
+    const int one = 1 << weight_bits;
+    double scale = double(src_size) / dst_size;
+    for (int i = 0; i < dst_size; i++)
+    {
+        double position = (i + 0.5) * scale - 0.5;
+        int index = int(std::floor(position));
+        double fraction = position - index;
+        if (index < 0)
+        {
+            index = 0;
+            fraction = 0;
+        }
+        if (index >= src_size - 1)
+        {
+            index = src_size - 1;
+            fraction = 0;
+        }
+        int weight1 = int(std::lround(fraction * one));
+        axis.index0[i] = index;
+        axis.index1[i] = std::min(index + 1, src_size - 1);
+        axis.weight0[i] = int16_t(one - weight1);
+        axis.weight1[i] = int16_t(weight1);
+    }
+    return axis;
+}
+
+/**
+ * @brief Get the coefficient tables of a crop size to window sizes resize,
+ *        cached per thread since cascaded pipelines resize many crops to the same network size.
+ *        The UV window is given apart, as a letterbox sizes it from the UV plane like the Y one.
+ */
+static const NV12ResizeTables &get_resize_tables(int src_width, int src_height, cv::Size y_window, cv::Size uv_window)
+{
+    thread_local std::map<std::array<int, 6>, NV12ResizeTables> cache;
+    std::array<int, 6> key = {src_width, src_height, y_window.width, y_window.height, uv_window.width, uv_window.height};
+    auto tables = cache.find(key);
+    if (tables != cache.end())
+        return tables->second;
+    if (cache.size() >= RESIZE_TABLES_CACHE_SIZE)
+        cache.clear();
+    NV12ResizeTables &new_tables = cache[key];
+    new_tables.y_columns = make_resize_axis(src_width, y_window.width, RESIZE_WEIGHT_BITS_X);
+    new_tables.y_rows = make_resize_axis(src_height, y_window.height, RESIZE_WEIGHT_BITS_Y);
+    new_tables.uv_columns = make_resize_axis(src_width / 2, uv_window.width, RESIZE_WEIGHT_BITS_X);
+    new_tables.uv_rows = make_resize_axis(src_height / 2, uv_window.height, RESIZE_WEIGHT_BITS_Y);
+    return new_tables;
+}
+
+// Horizontal pass of one source row, interleaved channels blended with the same weights
+template <int CHANNELS>
+static void resize_row_horizontal(const uint8_t *src, const ResizeAxis &columns, int16_t *dst)
+{
+    const int size = int(columns.index0.size());
+    for (int i = 0; i < size; i++)
+    {
+        const uint8_t *sample0 = src + columns.index0[i] * CHANNELS;
+        const uint8_t *sample1 = src + columns.index1[i] * CHANNELS;
+        for (int c = 0; c < CHANNELS; c++)
+            dst[i * CHANNELS + c] = int16_t(sample0[c] * columns.weight0[i] + sample1[c] * columns.weight1[i]);
+    }
+}
+
+// Vertical pass: blend two horizontally resized rows into the destination row
+static void resize_row_vertical(const int16_t *row0, const int16_t *row1, int16_t weight0, int16_t weight1, uint8_t *dst, int count)
+{
+    constexpr int SHIFT = RESIZE_WEIGHT_BITS_X + RESIZE_WEIGHT_BITS_Y;
+    int i = 0;
+#if defined(__aarch64__)
+    for (; i + 8 <= count; i += 8)
+    {
+        int16x8_t top = vld1q_s16(row0 + i);
+        int16x8_t bottom = vld1q_s16(row1 + i);
+        int32x4_t low = vmlal_n_s16(vmull_n_s16(vget_low_s16(top), weight0), vget_low_s16(bottom), weight1);
+        int32x4_t high = vmlal_n_s16(vmull_n_s16(vget_high_s16(top), weight0), vget_high_s16(bottom), weight1);
+        int16x8_t blended = vcombine_s16(vqmovn_s32(vrshrq_n_s32(low, SHIFT)), vqmovn_s32(vrshrq_n_s32(high, SHIFT)));
+        vst1_u8(dst + i, vqmovun_s16(blended));
+    }
+#elif defined(__SSE2__)
+    const __m128i weights = _mm_set1_epi32((int32_t(uint16_t(weight1)) << 16) | uint16_t(weight0));
+    const __m128i rounding = _mm_set1_epi32(1 << (SHIFT - 1));
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i top = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + i));
+        __m128i bottom = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + i));
+        // Interleave the rows so that madd computes top * weight0 + bottom * weight1
+        __m128i low = _mm_madd_epi16(_mm_unpacklo_epi16(top, bottom), weights);
+        __m128i high = _mm_madd_epi16(_mm_unpackhi_epi16(top, bottom), weights);
+        low = _mm_srai_epi32(_mm_add_epi32(low, rounding), SHIFT);
+        high = _mm_srai_epi32(_mm_add_epi32(high, rounding), SHIFT);
+        __m128i blended = _mm_packs_epi32(low, high);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + i), _mm_packus_epi16(blended, blended));
+    }
+#endif
+    for (; i < count; i++)
+    {
+        int32_t value = (row0[i] * weight0 + row1[i] * weight1 + (1 << (SHIFT - 1))) >> SHIFT;
+        dst[i] = uint8_t(std::min(std::max(value, 0), 255));
+    }
+}
 
+/**
+ * @brief Bilinear resize of one plane, from a crop of the source into a window of the destination.
+ *        The horizontal pass of each source row is computed once and kept while it is needed.
+ */
+template <int CHANNELS>
+static void resize_plane(const uint8_t *src, size_t src_stride, const ResizeAxis &columns, const ResizeAxis &rows,
+                         uint8_t *dst, size_t dst_stride)
+{
+    const int row_size = int(columns.index0.size()) * CHANNELS;
+    thread_local std::vector<int16_t> buffer;
+    buffer.resize(size_t(row_size) * 2);
+    int16_t *cached_rows[2] = {buffer.data(), buffer.data() + row_size};
+    int cached_index[2] = {-1, -1};
+
+    auto horizontal_row = [&](int index) -> const int16_t *
+    {
+        for (int slot = 0; slot < 2; slot++)
+        {
+            if (cached_index[slot] == index)
+                return cached_rows[slot];
+        }
+        // Replace the row that is not the other input of the current output row
+        int slot = (cached_index[0] < cached_index[1]) ? 0 : 1;
+        resize_row_horizontal<CHANNELS>(src + size_t(index) * src_stride, columns, cached_rows[slot]);
+        cached_index[slot] = index;
+        return cached_rows[slot];
+    };
+
+    for (size_t i = 0; i < rows.index0.size(); i++)
+    {
+        const int16_t *row0 = horizontal_row(rows.index0[i]);
+        const int16_t *row1 = horizontal_row(rows.index1[i]);
+        resize_row_vertical(row0, row1, rows.weight0[i], rows.weight1[i], dst + i * dst_stride, row_size);
+    }
+}
+
+static void fill_plane(uint8_t *dst, size_t stride, int x, int y, int width, int height, const uint8_t *value, int channels)
+{
+    for (int row = y; row < y + height; row++)
+    {
+        uint8_t *pixel = dst + size_t(row) * stride + size_t(x) * channels;
+        if (channels == 1)
+        {
+            std::memset(pixel, value[0], width);
+            continue;
+        }
+        for (int column = 0; column < width; column++, pixel += channels)
+            std::memcpy(pixel, value, channels);
+    }
+}
+
+// Paint the part of a width x height plane around the window
+static void fill_border(uint8_t *dst, size_t stride, int width, int height, const cv::Rect &window, const uint8_t *value, int channels)
+{
+    int bottom = window.y + window.height;
+    int right = window.x + window.width;
+    fill_plane(dst, stride, 0, 0, width, window.y, value, channels);
+    fill_plane(dst, stride, 0, bottom, width, height - bottom, value, channels);
+    fill_plane(dst, stride, 0, window.y, window.x, window.height, value, channels);
+    fill_plane(dst, stride, right, window.y, width - right, window.height, value, channels);
+}
+
+/**
+ * @brief The window of a width x height plane that a crop is letterboxed into,
+ *        sized and centered like resize_letterbox_rgb does.
+ *        When the margin is odd the window is one pixel closer to the top left,
+ *        the extra bottom / right pixel is painted as border.
+ */
+static cv::Rect letterbox_window(int crop_width, int crop_height, int width, int height)
+{
+    float ratio = std::min(float(height) / crop_height, float(width) / crop_width);
+    int new_width = std::max(1, int(std::round(crop_width * ratio)));
+    int new_height = std::max(1, int(std::round(crop_height * ratio)));
+    return cv::Rect((width - new_width) / 2, (height - new_height) / 2, new_width, new_height);
+}
+
+/**
+ * @brief Crop, resize and letterbox an even rectangle of the source (see crop_resize_nv12).
+ */
+static HailoBBox crop_resize_nv12_rect(const NV12Planes &src, const cv::Rect &crop, NV12Planes &dst, bool letterbox, cv::Scalar color)
+{
+    if (dst.width < 2 || dst.height < 2)
+        throw std::invalid_argument("crop_resize_nv12 needs an allocated destination of at least 2x2 pixels");
+    if (crop.width < 2 || crop.height < 2)
+        return HailoBBox(0, 0, 1, 1);
+
+    // The windows of the destination planes the crop is resized into
+    const int uv_width = dst.width / 2;
+    const int uv_height = dst.height / 2;
+    cv::Rect y_window(0, 0, dst.width, dst.height);
+    cv::Rect uv_window(0, 0, uv_width, uv_height);
+    HailoBBox letterboxed_scale(0, 0, 1, 1);
+    if (letterbox)
+    {
+        // Each plane is letterboxed on its own, as resize_letterbox_nv12 did with its two mats
+        y_window = letterbox_window(crop.width, crop.height, dst.width, dst.height);
+        uv_window = letterbox_window(crop.width / 2, crop.height / 2, uv_width, uv_height);
+        letterboxed_scale = HailoBBox(-(y_window.x / float(y_window.width)),
+                                      -(y_window.y / float(y_window.height)),
+                                      1.0 / (y_window.width / float(dst.width)),
+                                      1.0 / (y_window.height / float(dst.height)));
+
+        // Paint only the borders around the windows
+        const uint8_t y_color[1] = {uint8_t(RGB2Y(color[0], color[1], color[2]))};
+        const uint8_t uv_color[2] = {uint8_t(RGB2U(color[0], color[1], color[2])), uint8_t(RGB2V(color[0], color[1], color[2]))};
+        fill_border(dst.y, dst.y_stride, dst.width, dst.height, y_window, y_color, 1);
+        fill_border(dst.uv, dst.uv_stride, uv_width, uv_height, uv_window, uv_color, 2);
+    }
+
+    const NV12ResizeTables &tables = get_resize_tables(crop.width, crop.height, y_window.size(), uv_window.size());
+    resize_plane<1>(src.y + size_t(crop.y) * src.y_stride + crop.x, src.y_stride,
+                    tables.y_columns, tables.y_rows,
+                    dst.y + size_t(y_window.y) * dst.y_stride + y_window.x, dst.y_stride);
+    resize_plane<2>(src.uv + size_t(crop.y / 2) * src.uv_stride + crop.x, src.uv_stride,
+                    tables.uv_columns, tables.uv_rows,
+                    dst.uv + size_t(uv_window.y) * dst.uv_stride + size_t(uv_window.x) * 2, dst.uv_stride);
     return letterboxed_scale;
 }
 
+HailoBBox crop_resize_nv12(const NV12Planes &src, const HailoBBox &crop, NV12Planes &dst, bool letterbox, cv::Scalar color)
+{
+    // The crop in source pixels, rounded like HailoNV12Mat::get_crop_rect, even so that it maps exactly onto the UV plane
+    cv::Rect rect;
+    rect.x = CLAMP(crop.xmin() * src.width, 0, src.width);
+    rect.y = CLAMP(crop.ymin() * src.height, 0, src.height);
+    rect.width = floor_to_even_number(CLAMP(crop.width() * src.width, 0, src.width - rect.x));
+    rect.height = floor_to_even_number(CLAMP(crop.height() * src.height, 0, src.height - rect.y));
+    rect.x = floor_to_even_number(rect.x);
+    rect.y = floor_to_even_number(rect.y);
+    return crop_resize_nv12_rect(src, rect, dst, letterbox, color);
+}
+
+// The planes of an NV12 HailoMat, read in place
+static NV12Planes nv12_planes(HailoMat &image)
+{
+    if (image.get_type() != HAILO_MAT_NV12)
+        throw std::invalid_argument("Expected an NV12 image");
+    std::vector<cv::Mat> &planes = image.get_matrices();
+    return {planes[0].data, planes[0].step, planes[1].data, planes[1].step, int(image.native_width()), int(image.native_height())};
+}
+
+void crop_and_resize_nv12(HailoMat &image, HailoROIPtr crop_roi, std::vector<cv::Mat> &resized_image_vec, int interpolation)
+{
+    if (interpolation != cv::INTER_LINEAR)
+    {
+        std::vector<cv::Mat> cropped_image_vec = image.crop(crop_roi);
+        resize_nv12(cropped_image_vec, resized_image_vec, interpolation);
+        return;
+    }
+    NV12Planes resized = nv12_planes(resized_image_vec);
+    crop_resize_nv12_rect(nv12_planes(image), image.get_crop_rect(crop_roi), resized, false, cv::Scalar(0, 0, 0));
+}
+
+HailoBBox crop_and_resize_letterbox_nv12(HailoMat &image, HailoROIPtr crop_roi, std::vector<cv::Mat> &resized_image_vec, cv::Scalar color, int interpolation)
+{
+    if (interpolation != cv::INTER_LINEAR)
+    {
+        std::vector<cv::Mat> cropped_image_vec = image.crop(crop_roi);
+        return resize_letterbox_nv12(cropped_image_vec, resized_image_vec, color, interpolation);
+    }
+    NV12Planes resized = nv12_planes(resized_image_vec);
+    return crop_resize_nv12_rect(nv12_planes(image), image.get_crop_rect(crop_roi), resized, true, color);
+}
+
 std::shared_ptr<HailoMat> get_mat_by_format(GstBuffer *buffer, GstVideoInfo *info, int line_thickness, int font_thickness)
 {
     std::shared_ptr<HailoMat> hmat = nullptr;
@@ -128,9 +128,102 @@ HailoBBox resize_letterbox_rgb(cv::Mat &cropped_image, cv::Mat &resized_image, c
  *        (bilinear, nearest neighbors, etc...)
  */
 HailoBBox resize_letterbox_nv12(std::vector<cv::Mat> &cropped_image_vec, std::vector<cv::Mat> &resized_image_vec, cv::Scalar color, int interpolation = cv::INTER_LINEAR);
+
+/**
+ * @brief The planes of an NV12 image: a Y plane of width x height bytes
+ *        and an interleaved UV plane of (width / 2) x (height / 2) pairs.
+ */
+struct NV12Planes
+{
+    uint8_t *y;
+    size_t y_stride;
+    uint8_t *uv;
+    size_t uv_stride;
+    int width;
+    int height;
+};
+
+/**
+ * @brief Crop, bilinear resize and optionally letterbox an NV12 image in a single pass.
+ *        The source planes are read in place and the result is written straight into
+ *        the destination planes, without intermediate mats.
+ *        The bilinear coefficients of each source and destination size are computed once
+ *        and reused by the following crops of the same size.
+ *        The output and the letterbox geometry are those of cropping and then calling
+ *        resize_nv12 / resize_letterbox_nv12 with cv::INTER_LINEAR.
+ *
+ * @param src - const NV12Planes &
+ *        The source image
+ *
+ * @param crop - const HailoBBox &
+ *        The region to crop, normalized to the source image
+ *        (floored to even pixels like HailoNV12Mat::get_crop_rect, so the UV plane stays aligned)
+ *
+ * @param dst - NV12Planes &
+ *        The destination image, its size is the resize target.
+ *        It must be allocated by the caller, std::invalid_argument is thrown for a destination under 2x2 pixels
+ *        (a crop under 2x2 pixels leaves the destination untouched)
+ *
+ * @param letterbox - bool
+ *        Keep the aspect ratio and pad the destination with color
+ *
+ * @param color - cv::Scalar
+ *        The RGB color to fill the letterbox with
+ *
+ * @return HailoBBox
+ *         The letterbox scale, as returned by resize_letterbox_nv12 (the full image when not letterboxing)
+ */
+HailoBBox crop_resize_nv12(const NV12Planes &src, const HailoBBox &crop, NV12Planes &dst, bool letterbox, cv::Scalar color = cv::Scalar(0, 0, 0));
+
+/**
+ * @brief Crop an ROI of an NV12 image and resize it, reading the crop in place
+ *        instead of copying it out first with HailoMat::crop (see crop_resize_nv12).
+ *        Same output as crop followed by resize_nv12.
+ *
+ * @param image - HailoMat &
+ *        The uncropped NV12 image
+ *
+ * @param crop_roi - HailoROIPtr
+ *        The ROI to crop
+ *
+ * @param resized_image_vec - std::vector<cv::Mat> &
+ *        The resized Y (CV_8UC1) and UV (CV_8UC2) mats to fill
+ *        (dims for resizing are assumed from here)
+ *
+ * @param interpolation - int
+ *        The interpolation type to resize by, only cv::INTER_LINEAR is done in place
+ */
+void crop_and_resize_nv12(HailoMat &image, HailoROIPtr crop_roi, std::vector<cv::Mat> &resized_image_vec, int interpolation = cv::INTER_LINEAR);
+
+/**
+ * @brief Crop an ROI of an NV12 image and resize it using Letterbox strategy,
+ *        reading the crop in place (see crop_resize_nv12).
+ *        Same output as crop followed by resize_letterbox_nv12.
+ *
+ * @param image - HailoMat &
+ *        The uncropped NV12 image
+ *
+ * @param crop_roi - HailoROIPtr
+ *        The ROI to crop
+ *
+ * @param resized_image_vec - std::vector<cv::Mat> &
+ *        The resized Y (CV_8UC1) and UV (CV_8UC2) mats to fill
+ *        (dims for resizing are assumed from here)
+ *
+ * @param color - cv::Scalar
+ *        The RGB color to fill the letterbox with
+ *
+ * @param interpolation - int
+ *        The interpolation type to resize by, only cv::INTER_LINEAR is done in place
+ *
+ * @return HailoBBox
+ *         The letterbox scale
+ */
+HailoBBox crop_and_resize_letterbox_nv12(HailoMat &image, HailoROIPtr crop_roi, std::vector<cv::Mat> &resized_image_vec, cv::Scalar color, int interpolation = cv::INTER_LINEAR);
+
 __END_DECLS
 
-std::shared_ptr<HailoMat> get_mat_by_format_buffer(GstBuffer *buffer, GstVideoInfo *info, int line_thickness=1, int font_thickness=1)
+inline std::shared_ptr<HailoMat> get_mat_by_format_buffer(GstBuffer *buffer, GstVideoInfo *info, int line_thickness=1, int font_thickness=1)
 {
     std::shared_ptr<HailoMat> hmat = nullptr;
     GstVideoFrame frame;
@@ -203,7 +296,7 @@ std::shared_ptr<HailoMat> get_mat_by_format_buffer(GstBuffer *buffer, GstVideoIn
     return hmat;
 }
 
-std::shared_ptr<HailoMat> get_mat_by_format(GstVideoFrame *frame, int line_thickness=1, int font_thickness=1)
+inline std::shared_ptr<HailoMat> get_mat_by_format(GstVideoFrame *frame, int line_thickness=1, int font_thickness=1)
 {
     std::shared_ptr<HailoMat> hmat = nullptr;
     GstVideoInfo *info = &frame->info;
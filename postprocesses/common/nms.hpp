@@ -4,10 +4,26 @@
  **/
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <vector>
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #include "hailo_objects.hpp"
 #include "hailo_common.hpp"
 namespace common
 {
+    typedef enum
+    {
+        NMS_MODE_HARD,          // classic greedy NMS, suppress when IOU >= threshold
+        NMS_MODE_SOFT_LINEAR,   // soft-NMS, decay scores by (1 - IOU) when IOU >= threshold
+        NMS_MODE_SOFT_GAUSSIAN, // soft-NMS, decay scores by exp(-IOU^2 / sigma)
+        NMS_MODE_DIOU           // greedy NMS, suppress when DIOU >= threshold
+    } nms_mode_t;
 
     float iou_calc(const HailoBBox &box_1, const HailoBBox &box_2)
     {
@@ -24,6 +40,477 @@ namespace common
         return area_of_overlap / (box_1_area + box_2_area - area_of_overlap);
     }
 
+    /**
+     * @brief Structure of arrays box buffer, lets the IOU of one box against many be vectorized.
+     */
+    struct NmsBoxes
+    {
+        std::vector<float> xmin;
+        std::vector<float> ymin;
+        std::vector<float> xmax;
+        std::vector<float> ymax;
+        std::vector<float> area;
+        std::vector<float> score;
+        std::vector<float> class_id;
+
+        uint size() const { return score.size(); }
+
+        void resize(uint size)
+        {
+            xmin.resize(size);
+            ymin.resize(size);
+            xmax.resize(size);
+            ymax.resize(size);
+            area.resize(size);
+            score.resize(size);
+            class_id.resize(size);
+        }
+
+        void set(uint i, HailoDetection &detection)
+        {
+            HailoBBox bbox = detection.get_bbox();
+            set(i, bbox.xmin(), bbox.ymin(), bbox.xmax(), bbox.ymax(), detection.get_confidence(), detection.get_class_id());
+        }
+
+        void set(uint i, float box_xmin, float box_ymin, float box_xmax, float box_ymax, float box_score, int box_class_id)
+        {
+            xmin[i] = box_xmin;
+            ymin[i] = box_ymin;
+            xmax[i] = box_xmax;
+            ymax[i] = box_ymax;
+            area[i] = (ymax[i] - ymin[i]) * (xmax[i] - xmin[i]);
+            score[i] = box_score;
+            class_id[i] = box_class_id;
+        }
+
+        void swap(uint a, uint b)
+        {
+            std::swap(xmin[a], xmin[b]);
+            std::swap(ymin[a], ymin[b]);
+            std::swap(xmax[a], xmax[b]);
+            std::swap(ymax[a], ymax[b]);
+            std::swap(area[a], area[b]);
+            std::swap(score[a], score[b]);
+            std::swap(class_id[a], class_id[b]);
+        }
+    };
+
+    /**
+     * @brief IOU (or DIOU when DISTANCE is set) of one box against the boxes [begin, end), scalar version.
+     *        The IOU arithmetic is the same as iou_calc.
+     */
+    template <bool DISTANCE>
+    void iou_one_to_many_scalar(const NmsBoxes &boxes, uint index, uint begin, uint end, float *out)
+    {
+        for (uint j = begin; j < end; j++)
+        {
+            const float width_of_overlap_area = std::min(boxes.xmax[index], boxes.xmax[j]) - std::max(boxes.xmin[index], boxes.xmin[j]);
+            const float height_of_overlap_area = std::min(boxes.ymax[index], boxes.ymax[j]) - std::max(boxes.ymin[index], boxes.ymin[j]);
+            const float area_of_overlap = std::max(width_of_overlap_area, 0.0f) * std::max(height_of_overlap_area, 0.0f);
+            float iou = area_of_overlap / (boxes.area[index] + boxes.area[j] - area_of_overlap);
+            if (DISTANCE)
+            {
+                // Penalize by the squared distance of the centers, normalized by the enclosing box diagonal
+                const float center_dx = ((boxes.xmin[index] + boxes.xmax[index]) - (boxes.xmin[j] + boxes.xmax[j])) * 0.5f;
+                const float center_dy = ((boxes.ymin[index] + boxes.ymax[index]) - (boxes.ymin[j] + boxes.ymax[j])) * 0.5f;
+                const float enclosing_w = std::max(boxes.xmax[index], boxes.xmax[j]) - std::min(boxes.xmin[index], boxes.xmin[j]);
+                const float enclosing_h = std::max(boxes.ymax[index], boxes.ymax[j]) - std::min(boxes.ymin[index], boxes.ymin[j]);
+                iou -= (center_dx * center_dx + center_dy * center_dy) / (enclosing_w * enclosing_w + enclosing_h * enclosing_h + 1e-9f);
+            }
+            out[j - begin] = iou;
+        }
+    }
+
+#if defined(__aarch64__)
+    template <bool DISTANCE>
+    void iou_one_to_many_neon(const NmsBoxes &boxes, uint index, uint begin, uint end, float *out)
+    {
+        const float32x4_t xmin = vdupq_n_f32(boxes.xmin[index]);
+        const float32x4_t ymin = vdupq_n_f32(boxes.ymin[index]);
+        const float32x4_t xmax = vdupq_n_f32(boxes.xmax[index]);
+        const float32x4_t ymax = vdupq_n_f32(boxes.ymax[index]);
+        const float32x4_t area = vdupq_n_f32(boxes.area[index]);
+        const float32x4_t zero = vdupq_n_f32(0.0f);
+        uint j = begin;
+        for (; j + 4 <= end; j += 4)
+        {
+            const float32x4_t other_xmin = vld1q_f32(&boxes.xmin[j]);
+            const float32x4_t other_ymin = vld1q_f32(&boxes.ymin[j]);
+            const float32x4_t other_xmax = vld1q_f32(&boxes.xmax[j]);
+            const float32x4_t other_ymax = vld1q_f32(&boxes.ymax[j]);
+            const float32x4_t width = vmaxq_f32(vsubq_f32(vminq_f32(xmax, other_xmax), vmaxq_f32(xmin, other_xmin)), zero);
+            const float32x4_t height = vmaxq_f32(vsubq_f32(vminq_f32(ymax, other_ymax), vmaxq_f32(ymin, other_ymin)), zero);
+            const float32x4_t overlap = vmulq_f32(width, height);
+            float32x4_t iou = vdivq_f32(overlap, vsubq_f32(vaddq_f32(area, vld1q_f32(&boxes.area[j])), overlap));
+            if (DISTANCE)
+            {
+                const float32x4_t half = vdupq_n_f32(0.5f);
+                const float32x4_t dx = vmulq_f32(vsubq_f32(vaddq_f32(xmin, xmax), vaddq_f32(other_xmin, other_xmax)), half);
+                const float32x4_t dy = vmulq_f32(vsubq_f32(vaddq_f32(ymin, ymax), vaddq_f32(other_ymin, other_ymax)), half);
+                const float32x4_t cw = vsubq_f32(vmaxq_f32(xmax, other_xmax), vminq_f32(xmin, other_xmin));
+                const float32x4_t ch = vsubq_f32(vmaxq_f32(ymax, other_ymax), vminq_f32(ymin, other_ymin));
+                const float32x4_t rho = vaddq_f32(vmulq_f32(dx, dx), vmulq_f32(dy, dy));
+                const float32x4_t diag = vaddq_f32(vaddq_f32(vmulq_f32(cw, cw), vmulq_f32(ch, ch)), vdupq_n_f32(1e-9f));
+                iou = vsubq_f32(iou, vdivq_f32(rho, diag));
+            }
+            vst1q_f32(out + (j - begin), iou);
+        }
+        iou_one_to_many_scalar<DISTANCE>(boxes, index, j, end, out + (j - begin));
+    }
+#elif defined(__x86_64__) || defined(__i386__)
+    template <bool DISTANCE>
+    __attribute__((target("avx2"))) void iou_one_to_many_avx2(const NmsBoxes &boxes, uint index, uint begin, uint end, float *out)
+    {
+        const __m256 xmin = _mm256_set1_ps(boxes.xmin[index]);
+        const __m256 ymin = _mm256_set1_ps(boxes.ymin[index]);
+        const __m256 xmax = _mm256_set1_ps(boxes.xmax[index]);
+        const __m256 ymax = _mm256_set1_ps(boxes.ymax[index]);
+        const __m256 area = _mm256_set1_ps(boxes.area[index]);
+        const __m256 zero = _mm256_setzero_ps();
+        uint j = begin;
+        for (; j + 8 <= end; j += 8)
+        {
+            const __m256 other_xmin = _mm256_loadu_ps(&boxes.xmin[j]);
+            const __m256 other_ymin = _mm256_loadu_ps(&boxes.ymin[j]);
+            const __m256 other_xmax = _mm256_loadu_ps(&boxes.xmax[j]);
+            const __m256 other_ymax = _mm256_loadu_ps(&boxes.ymax[j]);
+            const __m256 width = _mm256_max_ps(_mm256_sub_ps(_mm256_min_ps(xmax, other_xmax), _mm256_max_ps(xmin, other_xmin)), zero);
+            const __m256 height = _mm256_max_ps(_mm256_sub_ps(_mm256_min_ps(ymax, other_ymax), _mm256_max_ps(ymin, other_ymin)), zero);
+            const __m256 overlap = _mm256_mul_ps(width, height);
+            __m256 iou = _mm256_div_ps(overlap, _mm256_sub_ps(_mm256_add_ps(area, _mm256_loadu_ps(&boxes.area[j])), overlap));
+            if (DISTANCE)
+            {
+                const __m256 half = _mm256_set1_ps(0.5f);
+                const __m256 dx = _mm256_mul_ps(_mm256_sub_ps(_mm256_add_ps(xmin, xmax), _mm256_add_ps(other_xmin, other_xmax)), half);
+                const __m256 dy = _mm256_mul_ps(_mm256_sub_ps(_mm256_add_ps(ymin, ymax), _mm256_add_ps(other_ymin, other_ymax)), half);
+                const __m256 cw = _mm256_sub_ps(_mm256_max_ps(xmax, other_xmax), _mm256_min_ps(xmin, other_xmin));
+                const __m256 ch = _mm256_sub_ps(_mm256_max_ps(ymax, other_ymax), _mm256_min_ps(ymin, other_ymin));
+                const __m256 rho = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+                const __m256 diag = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cw, cw), _mm256_mul_ps(ch, ch)), _mm256_set1_ps(1e-9f));
+                iou = _mm256_sub_ps(iou, _mm256_div_ps(rho, diag));
+            }
+            _mm256_storeu_ps(out + (j - begin), iou);
+        }
+        iou_one_to_many_scalar<DISTANCE>(boxes, index, j, end, out + (j - begin));
+    }
+#endif
+
+    /**
+     * @brief Compute the IOU (or DIOU) of boxes[index] against boxes [begin, end) into out.
+     *        Uses NEON on aarch64 and AVX2 on x86 when the cpu supports it.
+     */
+    template <bool DISTANCE = false>
+    void iou_one_to_many(const NmsBoxes &boxes, uint index, uint begin, uint end, float *out)
+    {
+#if defined(__aarch64__)
+        iou_one_to_many_neon<DISTANCE>(boxes, index, begin, end, out);
+#elif defined(__x86_64__) || defined(__i386__)
+        static const bool has_avx2 = __builtin_cpu_supports("avx2");
+        if (has_avx2)
+            iou_one_to_many_avx2<DISTANCE>(boxes, index, begin, end, out);
+        else
+            iou_one_to_many_scalar<DISTANCE>(boxes, index, begin, end, out);
+#else
+        iou_one_to_many_scalar<DISTANCE>(boxes, index, begin, end, out);
+#endif
+    }
+
+    /**
+     * @brief Greedy NMS engine over a set of boxes.
+     *        Candidates are visited in descending score order (sorting indices, not objects),
+     *        and each candidate is only compared against the already kept boxes of its class
+     *        that share a cell with it in a uniform grid, so distant boxes are never compared.
+     *        A candidate is suppressed iff a higher scoring kept box overlaps it above the threshold,
+     *        which is exactly the result of the pairwise greedy NMS.
+     */
+    class NmsEngine
+    {
+    private:
+        // Groups smaller than this are scanned linearly, the grid does not pay off for them
+        static constexpr uint MIN_GRID_BOXES = 32;
+        // Upper bound of cells per grid axis
+        static constexpr int MAX_GRID_CELLS = 64;
+
+        struct Grid
+        {
+            float x0;
+            float y0;
+            float inv_cell_width;
+            float inv_cell_height;
+            int cols;
+            int rows;
+            int first_cell; // offset of this grid in m_cell_heads
+        };
+
+        // The boxes, indexed like the input detections
+        NmsBoxes m_boxes;
+        std::vector<int> m_group;
+
+        std::vector<uint> m_order;
+        std::vector<uint> m_kept;
+        std::vector<Grid> m_grids;
+        std::vector<std::vector<uint>> m_group_kept; // used by groups that are too small for a grid
+        // Singly linked lists of the kept boxes per cell, stored in flat arrays
+        std::vector<int> m_cell_heads;
+        std::vector<int> m_node_next;
+        std::vector<uint> m_node_box;
+        std::vector<uint> m_visit_stamp;
+        // Scratch of load/build_grids, kept so a reused engine does not allocate
+        std::vector<int> m_class_to_group;
+        std::vector<uint> m_group_count;
+        std::vector<float> m_group_bounds; // min x, min y, max x, max y, sum w, sum h per group
+
+        float iou(uint a, uint b) const
+        {
+            float result;
+            iou_one_to_many_scalar<false>(m_boxes, a, b, b + 1, &result);
+            return result;
+        }
+
+        void load(std::vector<HailoDetection> &objects, bool should_nms_cross_classes)
+        {
+            uint size = objects.size();
+            m_boxes.resize(size);
+            for (uint i = 0; i < size; i++)
+                m_boxes.set(i, objects[i]);
+            index(should_nms_cross_classes);
+        }
+
+        // Group and order the loaded boxes
+        void index(bool should_nms_cross_classes)
+        {
+            uint size = m_boxes.size();
+            m_group.resize(size);
+
+            // Map each class to a dense group index, all boxes share one group when nms is cross classes
+            std::vector<int> &class_to_group = m_class_to_group;
+            class_to_group.clear();
+            int num_groups = 0;
+            for (uint i = 0; i < size; i++)
+            {
+                if (should_nms_cross_classes)
+                {
+                    m_group[i] = 0;
+                    num_groups = 1;
+                    continue;
+                }
+                uint class_id = std::max(int(m_boxes.class_id[i]), 0);
+                if (class_id >= class_to_group.size())
+                    class_to_group.resize(class_id + 1, -1);
+                if (class_to_group[class_id] < 0)
+                    class_to_group[class_id] = num_groups++;
+                m_group[i] = class_to_group[class_id];
+            }
+
+            // Descending score, ties by index: the order of a stable sort, without its temporary buffer
+            m_order.resize(size);
+            std::iota(m_order.begin(), m_order.end(), 0);
+            std::sort(m_order.begin(), m_order.end(),
+                      [this](uint a, uint b)
+                      {
+                          if (m_boxes.score[a] != m_boxes.score[b])
+                              return m_boxes.score[a] > m_boxes.score[b];
+                          return a < b;
+                      });
+
+            build_grids(num_groups);
+        }
+
+        void build_grids(int num_groups)
+        {
+            // Per group bounds and mean box size, the cell size follows the mean box size
+            // so a typical box spans a couple of cells.
+            std::vector<uint> &count = m_group_count;
+            count.assign(num_groups, 0);
+            m_group_bounds.resize(6 * num_groups);
+            float *min_x = m_group_bounds.data();
+            float *min_y = min_x + num_groups;
+            float *max_x = min_y + num_groups;
+            float *max_y = max_x + num_groups;
+            float *sum_w = max_y + num_groups;
+            float *sum_h = sum_w + num_groups;
+            std::fill(min_x, max_x, INFINITY);
+            std::fill(max_x, sum_w, -INFINITY);
+            std::fill(sum_w, sum_h + num_groups, 0.0f);
+            for (uint i = 0; i < m_group.size(); i++)
+            {
+                int g = m_group[i];
+                count[g]++;
+                min_x[g] = std::min(min_x[g], m_boxes.xmin[i]);
+                min_y[g] = std::min(min_y[g], m_boxes.ymin[i]);
+                max_x[g] = std::max(max_x[g], m_boxes.xmax[i]);
+                max_y[g] = std::max(max_y[g], m_boxes.ymax[i]);
+                sum_w[g] += std::max(m_boxes.xmax[i] - m_boxes.xmin[i], 0.0f);
+                sum_h[g] += std::max(m_boxes.ymax[i] - m_boxes.ymin[i], 0.0f);
+            }
+
+            m_grids.assign(num_groups, Grid{0.0f, 0.0f, 0.0f, 0.0f, 0, 0, -1});
+            m_group_kept.resize(num_groups);
+            int num_cells = 0;
+            for (int g = 0; g < num_groups; g++)
+            {
+                m_group_kept[g].clear();
+                float extent_w = max_x[g] - min_x[g];
+                float extent_h = max_y[g] - min_y[g];
+                if (count[g] < MIN_GRID_BOXES || !std::isfinite(extent_w) || !std::isfinite(extent_h) ||
+                    extent_w <= 0.0f || extent_h <= 0.0f)
+                    continue;
+                float cell_w = std::max(sum_w[g] / count[g], extent_w / MAX_GRID_CELLS);
+                float cell_h = std::max(sum_h[g] / count[g], extent_h / MAX_GRID_CELLS);
+                Grid &grid = m_grids[g];
+                grid.x0 = min_x[g];
+                grid.y0 = min_y[g];
+                grid.inv_cell_width = 1.0f / cell_w;
+                grid.inv_cell_height = 1.0f / cell_h;
+                grid.cols = std::min(MAX_GRID_CELLS, int(std::ceil(extent_w * grid.inv_cell_width)) + 1);
+                grid.rows = std::min(MAX_GRID_CELLS, int(std::ceil(extent_h * grid.inv_cell_height)) + 1);
+                grid.first_cell = num_cells;
+                num_cells += grid.cols * grid.rows;
+            }
+            m_cell_heads.assign(num_cells, -1);
+            m_node_next.clear();
+            m_node_box.clear();
+            m_visit_stamp.assign(m_group.size(), 0);
+        }
+
+        void cell_range(const Grid &grid, uint box, int &col0, int &row0, int &col1, int &row1) const
+        {
+            col0 = CLAMP(int((m_boxes.xmin[box] - grid.x0) * grid.inv_cell_width), 0, grid.cols - 1);
+            col1 = CLAMP(int((m_boxes.xmax[box] - grid.x0) * grid.inv_cell_width), 0, grid.cols - 1);
+            row0 = CLAMP(int((m_boxes.ymin[box] - grid.y0) * grid.inv_cell_height), 0, grid.rows - 1);
+            row1 = CLAMP(int((m_boxes.ymax[box] - grid.y0) * grid.inv_cell_height), 0, grid.rows - 1);
+        }
+
+        bool is_suppressed(uint candidate, float iou_thr, uint stamp)
+        {
+            int g = m_group[candidate];
+            const Grid &grid = m_grids[g];
+            if (grid.first_cell < 0)
+            {
+                for (uint kept : m_group_kept[g])
+                {
+                    if (iou(kept, candidate) >= iou_thr)
+                        return true;
+                }
+                return false;
+            }
+
+            int col0, row0, col1, row1;
+            cell_range(grid, candidate, col0, row0, col1, row1);
+            for (int row = row0; row <= row1; row++)
+            {
+                for (int col = col0; col <= col1; col++)
+                {
+                    for (int node = m_cell_heads[grid.first_cell + row * grid.cols + col]; node >= 0; node = m_node_next[node])
+                    {
+                        uint kept = m_node_box[node];
+                        // A kept box spanning several cells is only compared once per candidate
+                        if (m_visit_stamp[kept] == stamp)
+                            continue;
+                        m_visit_stamp[kept] = stamp;
+                        if (iou(kept, candidate) >= iou_thr)
+                            return true;
+                    }
+                }
+            }
+            return false;
+        }
+
+        void keep(uint box)
+        {
+            m_kept.push_back(box);
+            int g = m_group[box];
+            const Grid &grid = m_grids[g];
+            if (grid.first_cell < 0)
+            {
+                m_group_kept[g].push_back(box);
+                return;
+            }
+
+            int col0, row0, col1, row1;
+            cell_range(grid, box, col0, row0, col1, row1);
+            for (int row = row0; row <= row1; row++)
+            {
+                for (int col = col0; col <= col1; col++)
+                {
+                    int &head = m_cell_heads[grid.first_cell + row * grid.cols + col];
+                    m_node_next.push_back(head);
+                    m_node_box.push_back(box);
+                    head = m_node_box.size() - 1;
+                }
+            }
+        }
+
+    public:
+        /**
+         * @brief Run NMS and return the indices of the kept boxes, in descending score order.
+         *
+         * @param objects  -  std::vector<HailoDetection>
+         *        The detections to perform NMS on.
+         *
+         * @param iou_thr  -  float
+         *        Threshold for IOU filtration
+         *
+         * @param should_nms_cross_classes  -  bool
+         *        If true, then apply NMS regardless of class differences.
+         *
+         * @param max_output  -  uint
+         *        Stop once this many boxes were kept, 0 means no limit.
+         *
+         * @return const std::vector<uint>&
+         *         The indices (into objects) of the kept boxes.
+         */
+        const std::vector<uint> &run(std::vector<HailoDetection> &objects, const float iou_thr,
+                                     bool should_nms_cross_classes = false, uint max_output = 0)
+        {
+            load(objects, should_nms_cross_classes);
+            return suppress(iou_thr, max_output);
+        }
+
+        /**
+         * @brief The box buffer of the engine. Decoders can write their candidates straight into it
+         *        (resize it, then set each box) and call run_boxes, without building HailoDetections.
+         */
+        NmsBoxes &boxes() { return m_boxes; }
+
+        /**
+         * @brief Run NMS on the boxes written into boxes(), see run.
+         *
+         * @return const std::vector<uint>&
+         *         The indices (into boxes()) of the kept boxes.
+         */
+        const std::vector<uint> &run_boxes(const float iou_thr, bool should_nms_cross_classes = false, uint max_output = 0)
+        {
+            index(should_nms_cross_classes);
+            return suppress(iou_thr, max_output);
+        }
+
+    private:
+        const std::vector<uint> &suppress(const float iou_thr, uint max_output)
+        {
+            m_kept.clear();
+
+            // Two boxes with no overlap have an IOU of 0, so the spatial culling is only valid for a positive threshold
+            if (!(iou_thr > 0.0f))
+            {
+                for (auto &grid : m_grids)
+                    grid.first_cell = -1;
+            }
+
+            uint stamp = 0;
+            for (uint candidate : m_order)
+            {
+                if (max_output > 0 && m_kept.size() >= max_output)
+                    break;
+                if (m_boxes.score[candidate] == 0.0f)
+                    continue;
+                if (!is_suppressed(candidate, iou_thr, ++stamp))
+                    keep(candidate);
+            }
+            return m_kept;
+        }
+    };
+
     /**
      * @brief Perform IOU based NMS on a vector of HailoDetection objects
      *
@@ -35,48 +522,254 @@ namespace common
      *
      * @param should_nms_cross_classes  -  bool
      *        If true, then apply NMS regardless of class differences. Default false.
+     *
+     * @param max_output  -  uint
+     *        If not 0, stop once this many detections survived. Default 0.
      */
-    void nms(std::vector<HailoDetection> &objects, const float iou_thr, bool should_nms_cross_classes = false)
+    void nms(std::vector<HailoDetection> &objects, const float iou_thr, bool should_nms_cross_classes = false, uint max_output = 0)
     {
-        std::vector<HailoDetection> objects_after_nms;
         // The network may propose multiple detections of similar size/score,
         // which are actually the same detection. We want to filter out the lesser
         // detections with a simple nms.
-        std::sort(objects.begin(), objects.end(),
-                  [](HailoDetection a, HailoDetection b)
-                  { return a.get_confidence() > b.get_confidence(); });
+        // The engine and the output buffer are reused by the following calls of the thread.
+        thread_local NmsEngine engine;
+        thread_local std::vector<HailoDetection> objects_after_nms;
+        const std::vector<uint> &kept = engine.run(objects, iou_thr, should_nms_cross_classes, max_output);
+
+        objects_after_nms.clear();
+        objects_after_nms.reserve(kept.size());
+        for (uint index : kept)
+        {
+            objects_after_nms.emplace_back(std::move(objects[index]));
+        }
+        objects.swap(objects_after_nms);
+    }
+
+    /**
+     * @brief Load the detections into a box buffer sorted by class (unless cross classes) and then by score.
+     *
+     * @return std::vector<uint>
+     *         The start of each class range in the buffer, followed by the buffer size.
+     */
+    std::vector<uint> load_sorted_boxes(std::vector<HailoDetection> &objects, bool should_nms_cross_classes,
+                                        NmsBoxes &boxes, std::vector<uint> &order)
+    {
+        NmsBoxes unsorted;
+        unsorted.resize(objects.size());
+        for (uint i = 0; i < objects.size(); i++)
+            unsorted.set(i, objects[i]);
+
+        order.resize(objects.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(),
+                         [&unsorted, should_nms_cross_classes](uint a, uint b)
+                         {
+                             if (!should_nms_cross_classes && unsorted.class_id[a] != unsorted.class_id[b])
+                                 return unsorted.class_id[a] < unsorted.class_id[b];
+                             return unsorted.score[a] > unsorted.score[b];
+                         });
+
+        boxes.resize(objects.size());
+        std::vector<uint> ranges;
+        for (uint i = 0; i < order.size(); i++)
+        {
+            uint j = order[i];
+            boxes.xmin[i] = unsorted.xmin[j];
+            boxes.ymin[i] = unsorted.ymin[j];
+            boxes.xmax[i] = unsorted.xmax[j];
+            boxes.ymax[i] = unsorted.ymax[j];
+            boxes.area[i] = unsorted.area[j];
+            boxes.score[i] = unsorted.score[j];
+            boxes.class_id[i] = unsorted.class_id[j];
+            if (i == 0 || (!should_nms_cross_classes && boxes.class_id[i] != boxes.class_id[i - 1]))
+                ranges.push_back(i);
+        }
+        ranges.push_back(order.size());
+        return ranges;
+    }
+
+    /**
+     * @brief Keep the given (index, score) survivors in descending score order, up to max_output of them.
+     */
+    void gather_survivors(std::vector<HailoDetection> &objects, std::vector<std::pair<uint, float>> &survivors, uint max_output)
+    {
+        std::stable_sort(survivors.begin(), survivors.end(),
+                         [](const std::pair<uint, float> &a, const std::pair<uint, float> &b)
+                         { return a.second > b.second; });
+        if (max_output > 0 && survivors.size() > max_output)
+            survivors.resize(max_output);
+
+        std::vector<HailoDetection> objects_after_nms;
+        objects_after_nms.reserve(survivors.size());
+        for (auto &survivor : survivors)
+        {
+            objects_after_nms.emplace_back(std::move(objects[survivor.first]));
+            objects_after_nms.back().set_confidence(survivor.second);
+        }
+        objects.swap(objects_after_nms);
+    }
+
+    /**
+     * @brief Perform soft-NMS on a vector of HailoDetection objects.
+     *        Instead of removing overlapping detections, their score is decayed by their IOU
+     *        with the higher scoring detections, and they are removed once it drops below score_thr.
+     *
+     * @param objects  -  std::vector<HailoDetection>
+     *        The detections to perform NMS on, their confidence is updated to the decayed score.
+     *
+     * @param iou_thr  -  float
+     *        IOU threshold above which the linear decay applies.
+     *
+     * @param mode  -  nms_mode_t
+     *        NMS_MODE_SOFT_LINEAR or NMS_MODE_SOFT_GAUSSIAN.
+     *
+     * @param sigma  -  float
+     *        Sigma of the gaussian decay.
+     *
+     * @param score_thr  -  float
+     *        Detections whose decayed score drops below this threshold are removed.
+     *
+     * @param should_nms_cross_classes  -  bool
+     *        If true, then apply NMS regardless of class differences. Default false.
+     *
+     * @param max_output  -  uint
+     *        If not 0, keep at most this many detections. Default 0.
+     */
+    void soft_nms(std::vector<HailoDetection> &objects, const float iou_thr, nms_mode_t mode, const float sigma,
+                  const float score_thr, bool should_nms_cross_classes = false, uint max_output = 0)
+    {
+        NmsBoxes boxes;
+        std::vector<uint> order;
+        std::vector<uint> ranges = load_sorted_boxes(objects, should_nms_cross_classes, boxes, order);
+        std::vector<float> ious(boxes.size());
+        std::vector<std::pair<uint, float>> survivors;
 
-        for (uint index = 0; index < objects.size(); index++)
+        for (uint r = 0; r + 1 < ranges.size(); r++)
         {
-            if (objects[index].get_confidence() != 0.0f)
+            uint end = ranges[r + 1];
+            uint kept_in_range = 0;
+            for (uint i = ranges[r]; i < end; i++)
             {
-                for (uint jindex = index + 1; jindex < objects.size(); jindex++)
+                // Select the highest remaining score, scores change after every decay
+                uint best = i;
+                for (uint j = i + 1; j < end; j++)
                 {
-                    if ((should_nms_cross_classes || (objects[index].get_class_id() == objects[jindex].get_class_id())) &&
-                        objects[jindex].get_confidence() != 0.0f)
-                    {
-                        // For each detection, calculate the IOU against each following detection.
-                        float iou = iou_calc(objects[index].get_bbox(), objects[jindex].get_bbox());
-                        // If the IOU is above threshold, then we have two similar detections,
-                        // and want to delete the one.
-                        if (iou >= iou_thr)
-                        {
-                            // The detections are arranged in highest score order,
-                            // so we want to erase the latter detection.
-                            objects[jindex].set_confidence(0.0f);
-                        }
-                    }
+                    if (boxes.score[j] > boxes.score[best])
+                        best = j;
+                }
+                if (!(boxes.score[best] > 0.0f) || boxes.score[best] < score_thr)
+                    break;
+                boxes.swap(i, best);
+                std::swap(order[i], order[best]);
+                survivors.emplace_back(order[i], boxes.score[i]);
+                // Decay only lowers scores, so the selected scores of a class range never increase
+                if (max_output > 0 && ++kept_in_range >= max_output)
+                    break;
+
+                iou_one_to_many(boxes, i, i + 1, end, ious.data());
+                for (uint j = i + 1; j < end; j++)
+                {
+                    float iou = ious[j - i - 1];
+                    if (mode == NMS_MODE_SOFT_GAUSSIAN)
+                        boxes.score[j] *= std::exp(-(iou * iou) / sigma);
+                    else if (iou >= iou_thr)
+                        boxes.score[j] *= (1.0f - iou);
                 }
             }
         }
-        for (uint index = 0; index < objects.size(); index++)
+        gather_survivors(objects, survivors, max_output);
+    }
+
+    /**
+     * @brief Perform DIOU based NMS on a vector of HailoDetection objects.
+     *        Like nms, but the overlap also accounts for the distance between the box centers,
+     *        so close but distinct objects (crowds) are less likely to suppress each other.
+     *
+     * @param objects  -  std::vector<HailoDetection>
+     *        The detections to perform NMS on.
+     *
+     * @param iou_thr  -  float
+     *        Threshold for DIOU filtration
+     *
+     * @param should_nms_cross_classes  -  bool
+     *        If true, then apply NMS regardless of class differences. Default false.
+     *
+     * @param max_output  -  uint
+     *        If not 0, keep at most this many detections. Default 0.
+     */
+    void diou_nms(std::vector<HailoDetection> &objects, const float iou_thr, bool should_nms_cross_classes = false, uint max_output = 0)
+    {
+        NmsBoxes boxes;
+        std::vector<uint> order;
+        std::vector<uint> ranges = load_sorted_boxes(objects, should_nms_cross_classes, boxes, order);
+        std::vector<float> dious(boxes.size());
+        std::vector<std::pair<uint, float>> survivors;
+
+        for (uint r = 0; r + 1 < ranges.size(); r++)
         {
-            if (objects[index].get_confidence() != 0.0f)
+            uint end = ranges[r + 1];
+            uint kept_in_range = 0;
+            for (uint i = ranges[r]; i < end; i++)
             {
-                objects_after_nms.push_back(objects[index]);
+                if (boxes.score[i] == 0.0f)
+                    continue;
+                survivors.emplace_back(order[i], boxes.score[i]);
+                // Each class range is in descending score order, no more than max_output of it can survive
+                if (max_output > 0 && ++kept_in_range >= max_output)
+                    break;
+
+                iou_one_to_many<true>(boxes, i, i + 1, end, dious.data());
+                for (uint j = i + 1; j < end; j++)
+                {
+                    if (dious[j - i - 1] >= iou_thr)
+                        boxes.score[j] = 0.0f;
+                }
             }
         }
-        objects = objects_after_nms;
+        gather_survivors(objects, survivors, max_output);
+    }
+
+    /**
+     * @brief Perform NMS with the given mode on a vector of HailoDetection objects.
+     *
+     * @param objects  -  std::vector<HailoDetection>
+     *        The detections to perform NMS on.
+     *
+     * @param iou_thr  -  float
+     *        Threshold for IOU (DIOU) filtration
+     *
+     * @param mode  -  nms_mode_t
+     *        The NMS variant to apply.
+     *
+     * @param should_nms_cross_classes  -  bool
+     *        If true, then apply NMS regardless of class differences.
+     *
+     * @param max_output  -  uint
+     *        If not 0, keep at most this many detections.
+     *
+     * @param sigma  -  float
+     *        Sigma of the gaussian soft-NMS decay. Default 0.5.
+     *
+     * @param score_thr  -  float
+     *        Score under which soft-NMS removes a decayed detection. Default 0.
+     */
+    void nms_by_mode(std::vector<HailoDetection> &objects, const float iou_thr, nms_mode_t mode, bool should_nms_cross_classes,
+                     uint max_output, const float sigma = 0.5f, const float score_thr = 0.0f)
+    {
+        switch (mode)
+        {
+        case NMS_MODE_SOFT_LINEAR:
+        case NMS_MODE_SOFT_GAUSSIAN:
+            soft_nms(objects, iou_thr, mode, sigma, score_thr, should_nms_cross_classes, max_output);
+            break;
+        case NMS_MODE_DIOU:
+            diou_nms(objects, iou_thr, should_nms_cross_classes, max_output);
+            break;
+        case NMS_MODE_HARD:
+        default:
+            nms(objects, iou_thr, should_nms_cross_classes, max_output);
+            break;
+        }
     }
 
 }
\ No newline at end of file
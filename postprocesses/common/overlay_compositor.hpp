@@ -0,0 +1,379 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "hailo_common.hpp"
+#include "hailo_objects.hpp"
+#include "hailomat.hpp"
+#include "text_atlas.hpp"
+#include "thread_pool.hpp"
+
+namespace common
+{
+
+    //-------------------------------
+    // DRAW LIST
+    //-------------------------------
+
+    typedef enum
+    {
+        DRAW_RECTANGLE,
+        DRAW_ALPHA,
+        DRAW_LINE,
+        DRAW_KEYPOINT,
+        DRAW_MASK,
+    } draw_item_t;
+
+    /**
+     * @brief One drawing of an overlay, in frame pixels.
+     */
+    struct DrawItem
+    {
+        draw_item_t type;
+        cv::Scalar color;
+        cv::Rect rect;              // rectangle, or where the alpha / mask lands
+        cv::Point point1, point2;   // line ends, keypoint center
+        int thickness = 1;          // line thickness, keypoint radius
+        cv::Mat alpha;              // coverage of text and of prepared masks
+        cv::Mat confidence;         // CV_32FC1 mask, turned into alpha before drawing
+        float opacity = 1.0f;
+        int top = 0, bottom = 0;    // rows the drawing may touch
+    };
+
+    /**
+     * @brief How an overlay draws a detection: its color, and an optional text on the box.
+     */
+    struct DetectionStyle
+    {
+        bool visible = true;
+        cv::Scalar color = cv::Scalar(255, 255, 255);
+        std::string text;
+    };
+
+    using DetectionStyler = std::function<DetectionStyle(const HailoDetectionPtr &)>;
+
+    /**
+     * @brief Preload the TextAtlas with the texts of an overlay, at every font scale add_roi draws
+     *        them with (font_factor * log(box width), for boxes 2 to 8192 pixels wide).
+     *        Call once when the overlay is loaded.
+     *
+     * @param vocabulary  -  std::vector<std::string>
+     *        The texts the overlay draws, other texts are composed from the preloaded glyphs
+     *
+     * @param thickness  -  int
+     *        The font thickness of the overlay
+     *
+     * @param font_factor  -  float
+     *        The font factor given to add_roi
+     */
+    inline void preload_overlay_text(const std::vector<std::string> &vocabulary, int thickness, float font_factor)
+    {
+        TextAtlas::get().preload(vocabulary, thickness, font_factor * log(2), font_factor * log(8192));
+    }
+
+    /**
+     * @brief The texts of the numbers first to first + count - 1, like the global ids an overlay draws.
+     */
+    inline std::vector<std::string> number_texts(int first, int count)
+    {
+        std::vector<std::string> texts;
+        texts.reserve(std::max(count, 0));
+        for (int number = first; number < first + count; number++)
+            texts.emplace_back(std::to_string(number));
+        return texts;
+    }
+
+    //-------------------------------
+    // OVERLAY COMPOSITOR
+    //-------------------------------
+
+    /**
+     * @brief Draws the overlay of a frame in two steps: the ROI tree is flattened into a list
+     *        of drawings in one pass, then the frame is split into bands of rows and the
+     *        drawings of every band are drawn in parallel on a ThreadPool.
+     *        A drawing crossing bands is drawn by each of them, clipped to its rows,
+     *        and the drawings of a band keep their order, so overlaps look as if drawn serially.
+     */
+    class OverlayCompositor
+    {
+    private:
+        static constexpr int MIN_BAND_HEIGHT = 64;
+        static constexpr size_t BANDS_PER_THREAD = 2;
+
+        HailoMat &m_mat;
+        std::vector<DrawItem> m_items;
+        std::vector<size_t> m_masks;
+        std::vector<std::vector<uint32_t>> m_bands;
+
+        DrawItem &add(draw_item_t type, const cv::Scalar &color, int top, int bottom)
+        {
+            m_items.emplace_back();
+            DrawItem &item = m_items.back();
+            item.type = type;
+            item.color = color;
+            item.top = top;
+            item.bottom = bottom;
+            return item;
+        }
+
+        static cv::Rect to_pixels(const HailoBBox &bbox, const HailoBBox &region, int width, int height)
+        {
+            cv::Point bbox_min(((bbox.xmin() * region.width()) + region.xmin()) * width,
+                               ((bbox.ymin() * region.height()) + region.ymin()) * height);
+            cv::Point bbox_max(((bbox.xmax() * region.width()) + region.xmin()) * width,
+                               ((bbox.ymax() * region.height()) + region.ymin()) * height);
+            return cv::Rect(bbox_min, bbox_max);
+        }
+
+        void add_objects(HailoROIPtr roi, const HailoBBox &region, const cv::Scalar &color,
+                         const DetectionStyler &styler, float font_factor, int keypoint_radius, bool nested)
+        {
+            int width = m_mat.native_width();
+            int height = m_mat.native_height();
+            for (HailoObjectPtr &object : roi->get_objects())
+            {
+                if (!nested && object->get_type() != HAILO_DETECTION)
+                    continue;
+                // The type tells the class, no need for a dynamic cast
+                switch (object->get_type())
+                {
+                case HAILO_DETECTION:
+                {
+                    HailoDetectionPtr detection = std::static_pointer_cast<HailoDetection>(object);
+                    DetectionStyle style = styler(detection);
+                    if (!style.visible)
+                        break;
+                    HailoBBox bbox = detection->get_bbox();
+                    cv::Rect rect = to_pixels(bbox, region, width, height);
+                    add_rectangle(rect, style.color);
+                    if (!style.text.empty() && rect.width > 1)
+                    {
+                        // Calculating the font size according to the box width.
+                        float font_scale = font_factor * log(rect.width);
+                        cv::Point text_position(rect.x + log(rect.width), rect.y + rect.height - log(rect.width));
+                        add_text(style.text, text_position, font_scale, style.color);
+                    }
+                    if (!nested)
+                        break;
+                    // The objects of a detection are relative to its box
+                    HailoBBox detection_region(region.xmin() + bbox.xmin() * region.width(), region.ymin() + bbox.ymin() * region.height(),
+                                               bbox.width() * region.width(), bbox.height() * region.height());
+                    add_objects(detection, detection_region, style.color, styler, font_factor, keypoint_radius, nested);
+                    break;
+                }
+                case HAILO_LANDMARKS:
+                {
+                    HailoLandmarksPtr landmarks = std::static_pointer_cast<HailoLandmarks>(object);
+                    std::vector<HailoPoint> points = landmarks->get_points();
+                    float threshold = landmarks->get_threshold();
+                    auto to_point = [&](HailoPoint &point)
+                    {
+                        return cv::Point((point.x() * region.width() + region.xmin()) * width,
+                                         (point.y() * region.height() + region.ymin()) * height);
+                    };
+                    for (auto &pair : landmarks->get_pairs())
+                    {
+                        if (size_t(pair.first) >= points.size() || size_t(pair.second) >= points.size() ||
+                            points[pair.first].confidence() < threshold || points[pair.second].confidence() < threshold)
+                            continue;
+                        add_line(to_point(points[pair.first]), to_point(points[pair.second]), color, m_mat.line_thickness());
+                    }
+                    for (HailoPoint &point : points)
+                    {
+                        if (point.confidence() >= threshold)
+                            add_keypoint(to_point(point), keypoint_radius, color);
+                    }
+                    break;
+                }
+                case HAILO_CONF_CLASS_MASK:
+                {
+                    HailoConfClassMaskPtr mask = std::static_pointer_cast<HailoConfClassMask>(object);
+                    // The mask covers the box of its detection, and lives as long as the ROI
+                    cv::Mat confidence(mask->get_height(), mask->get_width(), CV_32FC1, mask->get_data().data());
+                    add_mask(to_pixels(HailoBBox(0.0f, 0.0f, 1.0f, 1.0f), region, width, height), confidence, color, mask->get_transparency());
+                    break;
+                }
+                default:
+                    break;
+                }
+            }
+        }
+
+        void prepare_mask(DrawItem &item)
+        {
+            if (item.rect.width <= 0 || item.rect.height <= 0 || item.confidence.empty())
+                return;
+            cv::Mat resized;
+            cv::resize(item.confidence, resized, item.rect.size(), 0, 0, cv::INTER_LINEAR);
+            resized.convertTo(item.alpha, CV_8UC1, 255.0 * item.opacity);
+        }
+
+        static void draw(HailoMat &mat, const DrawItem &item, int top)
+        {
+            cv::Point shift(0, top);
+            switch (item.type)
+            {
+            case DRAW_RECTANGLE:
+                mat.draw_rectangle(cv::Rect(item.rect.tl() - shift, item.rect.size()), item.color);
+                break;
+            case DRAW_ALPHA:
+            case DRAW_MASK:
+                if (!item.alpha.empty())
+                    mat.draw_alpha(item.alpha, item.rect.tl() - shift, item.color);
+                break;
+            case DRAW_LINE:
+                mat.draw_line(item.point1 - shift, item.point2 - shift, item.color, item.thickness, cv::LINE_8);
+                break;
+            case DRAW_KEYPOINT:
+                mat.draw_ellipse(item.point1 - shift, cv::Size(item.thickness, item.thickness), 0, 0, 360, item.color, cv::FILLED);
+                break;
+            }
+        }
+
+    public:
+        explicit OverlayCompositor(HailoMat &mat) : m_mat(mat) {}
+
+        void add_rectangle(const cv::Rect &rect, const cv::Scalar &color)
+        {
+            int margin = m_mat.line_thickness() + 2;
+            add(DRAW_RECTANGLE, color, rect.y - margin, rect.y + rect.height + margin).rect = rect;
+        }
+
+        /**
+         * @brief Add a text, rasterized now from the TextAtlas with the font thickness of the mat.
+         *
+         * @param position  -  cv::Point
+         *        The bottom-left of the text, as given to HailoMat::draw_text
+         */
+        void add_text(const std::string &text, cv::Point position, double font_scale, const cv::Scalar &color)
+        {
+            const TextBitmap &bitmap = TextAtlas::get().render(text, font_scale, m_mat.font_thickness());
+            cv::Point top_left = position - bitmap.origin;
+            DrawItem &item = add(DRAW_ALPHA, color, top_left.y, top_left.y + bitmap.alpha.rows);
+            item.rect = cv::Rect(top_left, bitmap.alpha.size());
+            item.alpha = bitmap.alpha;
+        }
+
+        void add_line(cv::Point point1, cv::Point point2, const cv::Scalar &color, int thickness)
+        {
+            int margin = thickness + 2;
+            DrawItem &item = add(DRAW_LINE, color, std::min(point1.y, point2.y) - margin, std::max(point1.y, point2.y) + margin);
+            item.point1 = point1;
+            item.point2 = point2;
+            item.thickness = thickness;
+        }
+
+        void add_keypoint(cv::Point center, int radius, const cv::Scalar &color)
+        {
+            int margin = radius + 3;
+            DrawItem &item = add(DRAW_KEYPOINT, color, center.y - margin, center.y + margin);
+            item.point1 = center;
+            item.thickness = radius;
+        }
+
+        /**
+         * @brief Add a confidence mask, blended with the color in proportion to the confidence.
+         *
+         * @param rect  -  cv::Rect
+         *        Where the mask lands in the frame, it is resized to it
+         *
+         * @param confidence  -  cv::Mat
+         *        CV_32FC1 confidence, 0 to 1, not copied: it must live until render()
+         *
+         * @param opacity  -  float
+         *        The opacity of a full confidence
+         */
+        void add_mask(const cv::Rect &rect, const cv::Mat &confidence, const cv::Scalar &color, float opacity)
+        {
+            DrawItem &item = add(DRAW_MASK, color, rect.y, rect.y + rect.height);
+            item.rect = rect;
+            item.confidence = confidence;
+            item.opacity = opacity;
+            m_masks.push_back(m_items.size() - 1);
+        }
+
+        /**
+         * @brief Flatten the ROI into drawings: a box (and text) per detection of the ROI.
+         *        With nested, the whole tree is drawn: the landmarks, masks and detections of the ROI
+         *        and, recursively, those nested in a detection, in its color.
+         *
+         * @param roi  -  HailoROIPtr
+         *        The ROI of the frame
+         *
+         * @param styler  -  DetectionStyler
+         *        The color and text of a detection, called once per detection
+         *
+         * @param font_factor  -  float
+         *        The font scale of a text is font_factor * log(box width)
+         *
+         * @param keypoint_radius  -  int
+         *        The radius of landmarks
+         *
+         * @param nested  -  bool
+         *        Draw the whole tree, by default only the detections of the ROI itself
+         */
+        void add_roi(HailoROIPtr roi, const DetectionStyler &styler, float font_factor, int keypoint_radius = 3, bool nested = false)
+        {
+            HailoBBox region = hailo_common::create_flattened_bbox(roi->get_bbox(), roi->get_scaling_bbox());
+            add_objects(roi, region, cv::Scalar(255, 255, 255), styler, font_factor, keypoint_radius, nested);
+        }
+
+        /**
+         * @brief Draw the drawings on the mat, on the pool, and clear them.
+         *
+         * @param pool  -  ThreadPool
+         *        The pool to draw on, by default the pool of the overlays
+         */
+        void render(ThreadPool &pool = ThreadPool::overlays())
+        {
+            pool.parallel_for(m_masks.size(), [this](size_t i)
+                              { prepare_mask(m_items[m_masks[i]]); });
+
+            int height = m_mat.native_height();
+            size_t bands = std::min(pool.size() * BANDS_PER_THREAD, size_t(std::max(1, height / MIN_BAND_HEIGHT)));
+            if (pool.size() <= 1 || bands <= 1 || m_items.size() <= 1)
+            {
+                for (const DrawItem &item : m_items)
+                    draw(m_mat, item, 0);
+            }
+            else
+            {
+                // Even band heights keep the chroma rows of subsampled formats inside their band
+                int band_height = ((height + int(bands) - 1) / int(bands) + 1) & ~1;
+                bands = (height + band_height - 1) / band_height;
+                m_bands.resize(bands);
+                for (std::vector<uint32_t> &band : m_bands)
+                    band.clear();
+                for (size_t i = 0; i < m_items.size(); i++)
+                {
+                    int first = std::max(m_items[i].top, 0) / band_height;
+                    int last = std::min(m_items[i].bottom, height - 1) / band_height;
+                    for (int band = first; band <= last; band++)
+                        m_bands[band].push_back(uint32_t(i));
+                }
+
+                pool.parallel_for(bands, [this, band_height, height](size_t band)
+                                  {
+                                      if (m_bands[band].empty())
+                                          return;
+                                      int top = int(band) * band_height;
+                                      std::shared_ptr<HailoMat> band_mat = m_mat.rows(top, std::min(band_height, height - top));
+                                      for (uint32_t i : m_bands[band])
+                                          draw(*band_mat, m_items[i], top); });
+            }
+            m_items.clear();
+            m_masks.clear();
+        }
+    };
+
+}
@@ -0,0 +1,143 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace common
+{
+
+    //-------------------------------
+    // QUANTIZED DOMAIN FILTERS
+    //-------------------------------
+
+    /**
+     * @brief Find the smallest quantized value whose decoded value passes a threshold,
+     *        so values can be thresholded with an integer compare instead of being decoded.
+     *        The decode (dequantization followed by transform) must be non-decreasing.
+     *
+     * @param qp_scale  -  float
+     *        The quantization scale
+     *
+     * @param qp_zp  -  float
+     *        The quantization zero point
+     *
+     * @param threshold  -  float
+     *        The threshold on the decoded value
+     *
+     * @param transform  -  Transform
+     *        Applied after dequantization (sigmoid for logits, identity otherwise)
+     *
+     * @return uint32_t
+     *         The quantized threshold, the maximal quantized value + 1 if no value passes
+     */
+    template <typename T, typename Transform>
+    uint32_t quantized_threshold(float qp_scale, float qp_zp, float threshold, Transform transform)
+    {
+        // Binary search over the quantized range, decoding exactly like the float path does
+        uint32_t low = 0;
+        uint32_t high = uint32_t(std::numeric_limits<T>::max()) + 1;
+        while (low < high)
+        {
+            uint32_t middle = (low + high) / 2;
+            if (transform((float(middle) - qp_zp) * qp_scale) >= threshold)
+                high = middle;
+            else
+                low = middle + 1;
+        }
+        return low;
+    }
+
+    template <typename T>
+    uint32_t quantized_threshold(float qp_scale, float qp_zp, float threshold)
+    {
+        return quantized_threshold<T>(qp_scale, qp_zp, threshold, [](float value)
+                                      { return value; });
+    }
+
+    /**
+     * @brief Call callback(index) for every data[index] >= threshold, in increasing index order.
+     *        Contiguous data is compared 16 bytes at a time (SSE2 compare + movemask / NEON compare),
+     *        so mostly empty buffers are rejected without a branch per value.
+     *
+     * @param data  -  const T *
+     *        uint8_t or uint16_t quantized values
+     *
+     * @param size  -  uint32_t
+     *        Number of values
+     *
+     * @param threshold  -  uint32_t
+     *        The quantized threshold (see quantized_threshold)
+     *
+     * @param callback  -  Callback
+     *        Called with the index of each value that passes
+     */
+    template <typename T, typename Callback>
+    void for_each_above_threshold(const T *data, uint32_t size, uint32_t threshold, Callback callback)
+    {
+        static_assert(std::is_same<T, uint8_t>::value || std::is_same<T, uint16_t>::value, "Only uint8 and uint16 data is supported");
+        if (threshold > std::numeric_limits<T>::max())
+            return;
+        uint32_t i = 0;
+        if (threshold > 0)
+        {
+            constexpr uint32_t lanes = 16 / sizeof(T);
+#if defined(__aarch64__)
+            for (; i + lanes <= size; i += lanes)
+            {
+                bool any;
+                if (sizeof(T) == 1)
+                    any = vmaxvq_u8(vcgeq_u8(vld1q_u8((const uint8_t *)(data + i)), vdupq_n_u8(threshold))) != 0;
+                else
+                    any = vmaxvq_u16(vcgeq_u16(vld1q_u16((const uint16_t *)(data + i)), vdupq_n_u16(threshold))) != 0;
+                if (!any)
+                    continue;
+                for (uint32_t lane = 0; lane < lanes; lane++)
+                {
+                    if (data[i + lane] >= threshold)
+                        callback(i + lane);
+                }
+            }
+#elif defined(__SSE2__)
+            for (; i + lanes <= size; i += lanes)
+            {
+                __m128i values = _mm_loadu_si128((const __m128i *)(data + i));
+                uint32_t mask;
+                if (sizeof(T) == 1)
+                {
+                    // Unsigned a >= b  <=>  max(a, b) == a
+                    __m128i thresholds = _mm_set1_epi8((char)threshold);
+                    mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(values, thresholds), values));
+                }
+                else
+                {
+                    // No unsigned 16 bit compare in SSE2, flip the sign bit and compare signed: a >= b  <=>  a > b - 1
+                    __m128i sign = _mm_set1_epi16((short)0x8000);
+                    __m128i thresholds = _mm_set1_epi16((short)((threshold - 1) ^ 0x8000));
+                    mask = _mm_movemask_epi8(_mm_cmpgt_epi16(_mm_xor_si128(values, sign), thresholds)) & 0x5555;
+                }
+                while (mask)
+                {
+                    callback(i + __builtin_ctz(mask) / sizeof(T));
+                    mask &= mask - 1;
+                }
+            }
+#endif
+        }
+        for (; i < size; i++)
+        {
+            if (data[i] >= threshold)
+                callback(i);
+        }
+    }
+
+}
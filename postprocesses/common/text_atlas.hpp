@@ -0,0 +1,391 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+namespace common
+{
+
+    //-------------------------------
+    // TEXT BITMAPS
+    //-------------------------------
+
+    /**
+     * @brief Coverage of a rasterized text, 0 (transparent) to 255 (opaque).
+     *        origin is the bottom-left of the text (the cv::putText position) inside the bitmap.
+     */
+    struct TextBitmap
+    {
+        cv::Mat alpha;
+        cv::Point origin;
+    };
+
+    /**
+     * @brief Rasterize a text in FONT_HERSHEY_SIMPLEX, anti-aliased, with room for the stroke thickness.
+     */
+    inline TextBitmap rasterize_text(const std::string &text, double font_scale, int thickness)
+    {
+        int baseline = 0;
+        cv::Size size = cv::getTextSize(text, cv::FONT_HERSHEY_SIMPLEX, font_scale, thickness, &baseline);
+        int pad = thickness + 1;
+        TextBitmap bitmap;
+        bitmap.alpha = cv::Mat::zeros(size.height + baseline + 2 * pad, size.width + 2 * pad, CV_8UC1);
+        bitmap.origin = cv::Point(pad, pad + size.height);
+        cv::putText(bitmap.alpha, text, bitmap.origin, cv::FONT_HERSHEY_SIMPLEX, font_scale, cv::Scalar(255), thickness, cv::LINE_AA);
+        return bitmap;
+    }
+
+    //-------------------------------
+    // TEXT ATLAS
+    //-------------------------------
+
+    /**
+     * @brief Pre-rasterized text of the overlays.
+     *        Font scales are quantized to SCALE_STEP, and for every quantized scale and stroke
+     *        thickness the printable ASCII glyphs are rasterized once. A text is then composed
+     *        from its glyphs, or taken whole from the vocabulary given to preload(),
+     *        so drawing it is a blit instead of a cv::putText.
+     *        Fonts and vocabulary are never dropped, so the returned bitmaps stay valid.
+     */
+    class TextAtlas
+    {
+    public:
+        static constexpr double SCALE_STEP = 0.1;
+        static constexpr int MAX_SCALE_LEVEL = 40;
+
+    private:
+        static constexpr char FIRST_GLYPH = ' ';
+        static constexpr char LAST_GLYPH = '~';
+
+        struct Font
+        {
+            std::array<TextBitmap, LAST_GLYPH - FIRST_GLYPH + 1> glyphs;
+            std::array<int, LAST_GLYPH - FIRST_GLYPH + 1> advances;
+            std::unordered_map<std::string, TextBitmap> words;
+
+            Font(double font_scale, int thickness)
+            {
+                for (char c = FIRST_GLYPH; c <= LAST_GLYPH; c++)
+                {
+                    glyphs[c - FIRST_GLYPH] = rasterize_text(std::string(1, c), font_scale, thickness);
+                    // getTextSize adds the thickness to the width, the difference is the pen advance
+                    int baseline = 0;
+                    int single = cv::getTextSize(std::string(1, c), cv::FONT_HERSHEY_SIMPLEX, font_scale, thickness, &baseline).width;
+                    int twice = cv::getTextSize(std::string(2, c), cv::FONT_HERSHEY_SIMPLEX, font_scale, thickness, &baseline).width;
+                    advances[c - FIRST_GLYPH] = twice - single;
+                }
+            }
+
+            size_t index(char c) const
+            {
+                // cv::putText draws characters it has no glyph for as '?'
+                return (c < FIRST_GLYPH || c > LAST_GLYPH) ? size_t('?' - FIRST_GLYPH) : size_t(c - FIRST_GLYPH);
+            }
+        };
+
+        std::map<std::pair<int, int>, std::unique_ptr<Font>> m_fonts;
+        std::shared_mutex m_mutex;
+
+        static int scale_level(double font_scale)
+        {
+            long level = std::lround(font_scale / SCALE_STEP);
+            return int(std::min<long>(std::max<long>(level, 1), MAX_SCALE_LEVEL));
+        }
+
+        Font &font(int level, int thickness)
+        {
+            std::pair<int, int> key(level, thickness);
+            {
+                std::shared_lock<std::shared_mutex> lock(m_mutex);
+                auto font_it = m_fonts.find(key);
+                if (font_it != m_fonts.end())
+                    return *font_it->second;
+            }
+            std::unique_lock<std::shared_mutex> lock(m_mutex);
+            std::unique_ptr<Font> &font = m_fonts[key];
+            if (!font)
+                font = std::make_unique<Font>(level * SCALE_STEP, thickness);
+            return *font;
+        }
+
+        // Lay the glyphs of the text out on the baseline, overlapping strokes keep the higher coverage
+        static void compose(const Font &font, const std::string &text, TextBitmap &bitmap)
+        {
+            int left = 0, top = 0, right = 0, bottom = 0;
+            int pen = 0;
+            for (char c : text)
+            {
+                const TextBitmap &glyph = font.glyphs[font.index(c)];
+                left = std::min(left, pen - glyph.origin.x);
+                top = std::min(top, -glyph.origin.y);
+                right = std::max(right, pen - glyph.origin.x + glyph.alpha.cols);
+                bottom = std::max(bottom, glyph.alpha.rows - glyph.origin.y);
+                pen += font.advances[font.index(c)];
+            }
+            // A new buffer every time, so a caller may keep the bitmap of the previous text
+            bitmap.alpha = cv::Mat::zeros(bottom - top, right - left, CV_8UC1);
+            bitmap.origin = cv::Point(-left, -top);
+
+            pen = 0;
+            for (char c : text)
+            {
+                const TextBitmap &glyph = font.glyphs[font.index(c)];
+                cv::Rect target(bitmap.origin.x + pen - glyph.origin.x, bitmap.origin.y - glyph.origin.y, glyph.alpha.cols, glyph.alpha.rows);
+                cv::Mat target_roi = bitmap.alpha(target);
+                cv::max(target_roi, glyph.alpha, target_roi);
+                pen += font.advances[font.index(c)];
+            }
+        }
+
+    public:
+        /**
+         * @brief Rasterize the fonts of a range of scales, and whole words of a vocabulary in them.
+         *        Call when the overlay is initialized, so that drawing never rasterizes.
+         *
+         * @param vocabulary  -  std::vector<std::string>
+         *        Texts the overlay draws often, like its labels
+         *
+         * @param thickness  -  int
+         *        The stroke thickness the overlay draws with
+         *
+         * @param min_scale, max_scale  -  double
+         *        The range of font scales the overlay draws with
+         */
+        void preload(const std::vector<std::string> &vocabulary, int thickness, double min_scale, double max_scale)
+        {
+            for (int level = scale_level(min_scale); level <= scale_level(max_scale); level++)
+            {
+                Font &level_font = font(level, thickness);
+                std::unique_lock<std::shared_mutex> lock(m_mutex);
+                for (const std::string &word : vocabulary)
+                {
+                    if (level_font.words.find(word) == level_font.words.end())
+                        level_font.words.emplace(word, rasterize_text(word, level * SCALE_STEP, thickness));
+                }
+            }
+        }
+
+        /**
+         * @brief Get the bitmap of a text, at the nearest quantized scale.
+         *
+         * @param text  -  std::string
+         *        The text
+         *
+         * @param font_scale  -  double
+         *        The font scale, as given to cv::putText
+         *
+         * @param thickness  -  int
+         *        The stroke thickness
+         *
+         * @return const TextBitmap&
+         *         The bitmap, valid until the next call of the same thread (copies of its alpha stay valid)
+         */
+        const TextBitmap &render(const std::string &text, double font_scale, int thickness)
+        {
+            thread_local TextBitmap composed;
+            const Font &text_font = font(scale_level(font_scale), thickness);
+            {
+                std::shared_lock<std::shared_mutex> lock(m_mutex);
+                auto word_it = text_font.words.find(text);
+                if (word_it != text_font.words.end())
+                    return word_it->second;
+            }
+            compose(text_font, text, composed);
+            return composed;
+        }
+
+        /**
+         * @brief The atlas shared by all the overlays of the process.
+         */
+        static TextAtlas &get()
+        {
+            static TextAtlas atlas;
+            return atlas;
+        }
+    };
+
+    //-------------------------------
+    // ALPHA BLENDING
+    //-------------------------------
+
+    // (pixel * (255 - alpha) + color * alpha) / 255, rounded, without a division
+    inline uint8_t blend_pixel(uint8_t pixel, int color, int alpha)
+    {
+        int value = pixel * (255 - alpha) + color * alpha + 128;
+        return uint8_t((value + (value >> 8)) >> 8);
+    }
+
+    /**
+     * @brief The part of a bitmap placed at top_left that falls inside a plane, in bitmap coordinates.
+     */
+    inline cv::Rect visible_rect(const cv::Mat &plane, const cv::Mat &alpha, cv::Point top_left)
+    {
+        cv::Rect placed(top_left, alpha.size());
+        cv::Rect visible = placed & cv::Rect(0, 0, plane.cols, plane.rows);
+        return visible - top_left;
+    }
+
+    /**
+     * @brief Blend a color into an interleaved 8-bit plane (1 to 4 channels) through an alpha bitmap.
+     *
+     * @param plane  -  cv::Mat
+     *        The plane to draw on
+     *
+     * @param alpha  -  cv::Mat
+     *        CV_8UC1 coverage
+     *
+     * @param top_left  -  cv::Point
+     *        Where the top-left of the bitmap lands in the plane, may be partly outside it
+     *
+     * @param color  -  cv::Scalar
+     *        The color, one value per channel of the plane
+     */
+    inline void blend_alpha(cv::Mat &plane, const cv::Mat &alpha, cv::Point top_left, const cv::Scalar &color)
+    {
+        cv::Rect visible = visible_rect(plane, alpha, top_left);
+        if (visible.empty())
+            return;
+        const int channels = plane.channels();
+        int color_values[4];
+        for (int c = 0; c < 4; c++)
+            color_values[c] = int(std::min(std::max(color[c], 0.0), 255.0));
+
+        for (int y = visible.y; y < visible.y + visible.height; y++)
+        {
+            const uint8_t *alpha_row = alpha.ptr<uint8_t>(y);
+            uint8_t *pixel = plane.ptr<uint8_t>(top_left.y + y) + size_t(top_left.x + visible.x) * channels;
+            for (int x = visible.x; x < visible.x + visible.width; x++, pixel += channels)
+            {
+                int a = alpha_row[x];
+                if (a == 0)
+                    continue;
+                for (int c = 0; c < channels; c++)
+                    pixel[c] = (a == 255) ? uint8_t(color_values[c]) : blend_pixel(pixel[c], color_values[c], a);
+            }
+        }
+    }
+
+    /**
+     * @brief Downsample an alpha bitmap to the resolution of a subsampled chroma plane.
+     *        Every chroma sample gets the average coverage of the luma samples it covers.
+     *
+     * @param alpha  -  cv::Mat
+     *        CV_8UC1 coverage at luma resolution
+     *
+     * @param top_left  -  cv::Point
+     *        Where the bitmap lands in luma samples
+     *
+     * @param vertical  -  int
+     *        Vertical subsampling, 2 for NV12 and 1 for YUY2 (horizontal subsampling is always 2)
+     *
+     * @param chroma_alpha  -  cv::Mat
+     *        The downsampled coverage
+     *
+     * @return cv::Point
+     *         Where the downsampled bitmap lands in chroma samples
+     */
+    inline cv::Point downsample_alpha(const cv::Mat &alpha, cv::Point top_left, int vertical, cv::Mat &chroma_alpha)
+    {
+        // Align to the chroma grid, an odd position starts in the middle of a chroma sample
+        int offset_x = top_left.x & 1;
+        int offset_y = (vertical == 2) ? (top_left.y & 1) : 0;
+        int cols = (alpha.cols + offset_x + 1) / 2;
+        int rows = (alpha.rows + offset_y + vertical - 1) / vertical;
+        chroma_alpha.create(rows, cols, CV_8UC1);
+        const int samples = 2 * vertical;
+
+        for (int y = 0; y < rows; y++)
+        {
+            uint8_t *chroma_row = chroma_alpha.ptr<uint8_t>(y);
+            for (int x = 0; x < cols; x++)
+            {
+                int sum = 0;
+                for (int dy = 0; dy < vertical; dy++)
+                {
+                    int source_y = y * vertical + dy - offset_y;
+                    if (source_y < 0 || source_y >= alpha.rows)
+                        continue;
+                    const uint8_t *alpha_row = alpha.ptr<uint8_t>(source_y);
+                    for (int dx = 0; dx < 2; dx++)
+                    {
+                        int source_x = x * 2 + dx - offset_x;
+                        if (source_x >= 0 && source_x < alpha.cols)
+                            sum += alpha_row[source_x];
+                    }
+                }
+                chroma_row[x] = uint8_t((sum + samples / 2) / samples);
+            }
+        }
+        return cv::Point((top_left.x - offset_x) / 2, (top_left.y - offset_y) / vertical);
+    }
+
+    /**
+     * @brief Blend a color into a packed YUY2 plane (Y0 U Y1 V, CV_8UC4 of width / 2) through an alpha bitmap.
+     *
+     * @param packed  -  cv::Mat
+     *        The YUY2 plane
+     *
+     * @param alpha  -  cv::Mat
+     *        CV_8UC1 coverage, in pixels
+     *
+     * @param top_left  -  cv::Point
+     *        Where the top-left of the bitmap lands, in pixels
+     *
+     * @param yuv_color  -  cv::Scalar
+     *        The color as (Y, U, V)
+     */
+    inline void blend_alpha_yuy2(cv::Mat &packed, const cv::Mat &alpha, cv::Point top_left, const cv::Scalar &yuv_color)
+    {
+        // The luma samples of a row are every other byte, view them as the first channel of a 2 channel plane
+        cv::Mat pixels(packed.rows, packed.cols * 2, CV_8UC2, packed.data, packed.step);
+        cv::Rect visible = visible_rect(pixels, alpha, top_left);
+        if (visible.empty())
+            return;
+        const int y_value = int(std::min(std::max(yuv_color[0], 0.0), 255.0));
+        for (int y = visible.y; y < visible.y + visible.height; y++)
+        {
+            const uint8_t *alpha_row = alpha.ptr<uint8_t>(y);
+            uint8_t *pixel = pixels.ptr<uint8_t>(top_left.y + y) + size_t(top_left.x + visible.x) * 2;
+            for (int x = visible.x; x < visible.x + visible.width; x++, pixel += 2)
+            {
+                if (alpha_row[x] != 0)
+                    pixel[0] = blend_pixel(pixel[0], y_value, alpha_row[x]);
+            }
+        }
+
+        // U and V are shared by a pair of pixels, blend them with the coverage of the pair
+        thread_local cv::Mat chroma_alpha;
+        cv::Point chroma_top_left = downsample_alpha(alpha, top_left, 1, chroma_alpha);
+        cv::Rect chroma_visible = visible_rect(packed, chroma_alpha, chroma_top_left);
+        const int u_value = int(std::min(std::max(yuv_color[1], 0.0), 255.0));
+        const int v_value = int(std::min(std::max(yuv_color[2], 0.0), 255.0));
+        for (int y = chroma_visible.y; y < chroma_visible.y + chroma_visible.height; y++)
+        {
+            const uint8_t *alpha_row = chroma_alpha.ptr<uint8_t>(y);
+            uint8_t *macropixel = packed.ptr<uint8_t>(chroma_top_left.y + y) + size_t(chroma_top_left.x + chroma_visible.x) * 4;
+            for (int x = chroma_visible.x; x < chroma_visible.x + chroma_visible.width; x++, macropixel += 4)
+            {
+                if (alpha_row[x] == 0)
+                    continue;
+                macropixel[1] = blend_pixel(macropixel[1], u_value, alpha_row[x]);
+                macropixel[3] = blend_pixel(macropixel[3], v_value, alpha_row[x]);
+            }
+        }
+    }
+
+}
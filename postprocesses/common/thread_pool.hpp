@@ -0,0 +1,194 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace common
+{
+
+    //-------------------------------
+    // THREAD POOL
+    //-------------------------------
+
+    /**
+     * @brief A persistent pool of worker threads for data parallel loops.
+     *        Several threads (streams) may run loops at the same time: their jobs are
+     *        queued and the workers take their iterations in order, while every caller
+     *        works on its own job too, so a loop always makes progress.
+     */
+    class ThreadPool
+    {
+    private:
+        struct Job
+        {
+            const std::function<void(size_t)> &task;
+            size_t count;
+            size_t next = 0;
+            size_t done = 0;
+            std::exception_ptr error;
+
+            Job(const std::function<void(size_t)> &job_task, size_t job_count) : task(job_task), count(job_count) {}
+        };
+
+        std::vector<std::thread> m_workers;
+        std::deque<std::shared_ptr<Job>> m_jobs;
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::condition_variable m_finished;
+        bool m_running = true;
+
+        // Take the next iteration of a job, called with the lock held
+        size_t claim(const std::shared_ptr<Job> &job)
+        {
+            size_t index = job->next++;
+            if (job->next == job->count)
+                m_jobs.erase(std::find(m_jobs.begin(), m_jobs.end(), job));
+            return index;
+        }
+
+        void execute(const std::shared_ptr<Job> &job, size_t index)
+        {
+            std::exception_ptr error;
+            try
+            {
+                job->task(index);
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (error && !job->error)
+                job->error = error;
+            if (++job->done == job->count)
+                m_finished.notify_all();
+        }
+
+        void run()
+        {
+            while (true)
+            {
+                std::shared_ptr<Job> job;
+                size_t index;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_wake.wait(lock, [this]
+                                { return !m_running || !m_jobs.empty(); });
+                    if (m_jobs.empty())
+                        return;
+                    job = m_jobs.front();
+                    index = claim(job);
+                }
+                execute(job, index);
+            }
+        }
+
+    public:
+        /**
+         * @param threads  -  size_t
+         *        The number of threads running a loop, including the calling thread,
+         *        so 1 runs every loop serially without workers
+         */
+        explicit ThreadPool(size_t threads)
+        {
+            for (size_t i = 1; i < threads; i++)
+                m_workers.emplace_back(&ThreadPool::run, this);
+        }
+
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_running = false;
+            }
+            m_wake.notify_all();
+            for (std::thread &worker : m_workers)
+                worker.join();
+        }
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        /**
+         * @brief The number of threads running a loop, including the calling thread.
+         */
+        size_t size() const { return m_workers.size() + 1; }
+
+        /**
+         * @brief Run task(0) ... task(count - 1) on the pool and the calling thread, and wait for all of them.
+         *        The first exception thrown by a task is rethrown once the others are done.
+         *
+         * @param count  -  size_t
+         *        The number of iterations
+         *
+         * @param task  -  std::function<void(size_t)>
+         *        The body of the loop, called with the iteration index
+         */
+        void parallel_for(size_t count, const std::function<void(size_t)> &task)
+        {
+            if (count == 0)
+                return;
+            if (m_workers.empty() || count == 1)
+            {
+                for (size_t i = 0; i < count; i++)
+                    task(i);
+                return;
+            }
+
+            auto job = std::make_shared<Job>(task, count);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_jobs.push_back(job);
+            }
+            m_wake.notify_all();
+
+            while (true)
+            {
+                size_t index;
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    if (job->next == job->count)
+                        break;
+                    index = claim(job);
+                }
+                execute(job, index);
+            }
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_finished.wait(lock, [&job]
+                            { return job->done == job->count; });
+            if (job->error)
+                std::rethrow_exception(job->error);
+        }
+
+        /**
+         * @brief The pool of the overlays, shared by all the streams of the process.
+         *        Its size is read from the OVERLAY_THREADS environment variable,
+         *        by default the number of cores.
+         *
+         * @return ThreadPool&
+         */
+        static ThreadPool &overlays()
+        {
+            static ThreadPool pool([]
+                                   {
+                                       const char *threads = std::getenv("OVERLAY_THREADS");
+                                       size_t cores = std::max(1u, std::thread::hardware_concurrency());
+                                       return threads ? std::max<size_t>(1, std::strtoul(threads, nullptr, 10)) : size_t(cores); }());
+            return pool;
+        }
+    };
+
+}
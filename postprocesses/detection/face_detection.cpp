@@ -12,6 +12,7 @@
 #include "common/math.hpp"
 #include "common/tensors.hpp"
 #include "common/nms.hpp"
+#include "common/quantization.hpp"
 #include "json_config.hpp"
 #include "face_detection.hpp"
 #include "xtensor/xadapt.hpp"
@@ -44,22 +45,6 @@
 #define RETINAFACE_WIDTH (1280)
 #define RETINAFACE_HEIGHT (736)
 
-// Supported Networks
-enum network_type
-{
-    LIGHTFACE,
-    RETINAFACE,
-};
-inline const char* ToString(network_type v)
-{
-    switch (v)
-    {
-        case LIGHTFACE:   return "lightface";
-        case RETINAFACE:  return "retinaface";
-        default:          return "[unknown]";
-    }
-}
-
 #if __GNUC__ > 8
 #include <filesystem>
 namespace fs = std::filesystem;
@@ -274,110 +259,135 @@ xt::xarray<float> get_anchors(const std::vector<std::vector<int>> &anchor_min_si
 }
 
 //******************************************************************
-// BOX/LANDMARK DECODING
+// SCORE FILTERING
 //******************************************************************
-xt::xarray<float> decode_landmarks(const xt::xarray<float> &landmark_detections,
-                                   const xt::xarray<float> &anchors,
-                                   const xt::xarray<float> &anchors_multiplier)
+/**
+ * @brief The output layers of one branch, with the number of anchors they cover.
+ */
+struct FaceDetectionBranch
+{
+    HailoTensorPtr boxes;
+    HailoTensorPtr classes;
+    HailoTensorPtr landmarks; // nullptr if the network has no landmarks
+    uint num_anchors;
+};
+
+/**
+ * @brief An anchor whose face score passed the threshold.
+ */
+struct FaceCandidate
 {
-    // Decode the boxes relative to their anchors.
-    // There are 5 landmarks paired in sets of 2 (x and y values),
-    // so we need to tile our anchors by 5
-    xt::xarray<float> landmarks = xt::tile(xt::view(anchors, xt::all(), xt::range(0, 2)), {1, 5}) + landmark_detections * xt::tile(anchors_multiplier, {1, 5});
-    return landmarks;
+    uint branch;
+    uint anchor; // index in the branch
+    uint global_anchor; // index in the pre-calculated anchors
+};
+
+inline float dequantize_value(uint8_t value, const HailoTensorPtr &tensor)
+{
+    return (float(value) - tensor->vstream_info().quant_info.qp_zp) * tensor->vstream_info().quant_info.qp_scale;
 }
 
-xt::xarray<float> decode_boxes(const xt::xarray<float> &box_detections,
-                               const xt::xarray<float> &anchors,
-                               const xt::xarray<float> &anchors_multiplier,
-                               const xt::xarray<float> &anchor_variance)
+/**
+ * @brief The face score of an anchor (class 1), decoded exactly like the whole class tensor used to be.
+ */
+float face_score(const uint8_t *class_logits, const HailoTensorPtr &classes, const int total_classes, const bool requires_softmax)
 {
-    // Decode the boxes relative to their anchors
-    xt::xarray<float> anchored_boxes_1 = xt::view(anchors, xt::all(), xt::range(0, 2)) + xt::view(box_detections, xt::all(), xt::range(0, 2)) * anchors_multiplier;
-    xt::xarray<float> anchored_boxes_2 = xt::view(anchors, xt::all(), xt::range(2, 4)) * xt::exp(xt::view(box_detections, xt::all(), xt::range(2, 4)) * anchor_variance(1));
-    xt::xarray<float> boxes = xt::concatenate(xt::xtuple(anchored_boxes_1, anchored_boxes_2), 1);
-
-    // We use view assignment to perform operations on just those slices
-    auto front_slice = xt::view(boxes, xt::all(), xt::range(0, 2));
-    front_slice -= xt::view(boxes, xt::all(), xt::range(2, 4)) / 2;
-    auto back_slice = xt::view(boxes, xt::all(), xt::range(2, 4));
-    back_slice += xt::view(boxes, xt::all(), xt::range(0, 2));
-    return boxes;
+    if (!requires_softmax)
+        return dequantize_value(class_logits[1], classes);
+    float sum = 0;
+    for (int i = 0; i < total_classes; i++)
+        sum += std::exp(dequantize_value(class_logits[i], classes));
+    return std::exp(dequantize_value(class_logits[1], classes)) / sum;
 }
 
-std::tuple<xt::xarray<float>, xt::xarray<float>, xt::xarray<float>> detect_boxes_and_landmarks(const xt::xarray<float> &box_outputs,
-                                                                                               const xt::xarray<float> &class_scores,
-                                                                                               const xt::xarray<float> &landmark_ouputs,
-                                                                                               const xt::xarray<float> &anchors,
-                                                                                               const xt::xarray<float> &anchors_multiplier,
-                                                                                               const xt::xarray<float> &anchor_variance,
-                                                                                               const float score_threshold,
-                                                                                               const network_type network)
+/**
+ * @brief Scan the class tensor of a branch in place and keep the anchors whose face score passes the threshold.
+ *        The threshold is quantized once: for softmax models softmax(l)[1] <= sigmoid(l1 - max(other l)),
+ *        so an anchor is only decoded if its quantized logit margin passes the logit of the threshold.
+ */
+void filter_face_scores(const FaceDetectionBranch &branch,
+                        const uint branch_index,
+                        const uint anchor_offset,
+                        const int total_classes,
+                        const float score_threshold,
+                        const bool requires_softmax,
+                        std::vector<FaceCandidate> &candidates,
+                        std::vector<float> &scores)
 {
-    xt::xarray<float> boxes, landmarks;
-    // Decode the boxes and get the face scores (we don't care about unlabeled scores)
-    boxes = decode_boxes(xt::squeeze(box_outputs), anchors, anchors_multiplier, anchor_variance);
-    xt::xarray<float> scores = xt::col(xt::squeeze(class_scores), 1);
-
-    // Filter out low scores
-    // Note: xt::where returns a vector of vectors (one for each dim) of indices where condition is true
-    auto higher_scores = xt::where(scores > score_threshold);
-    boxes = xt::view(boxes, xt::keep(higher_scores[0]), xt::all());
-    scores = xt::view(scores, xt::keep(higher_scores[0]));
-
-    // If landmarks are available, then decode those too.
-    if (landmark_ouputs.dimension() > 0)
+    const uint8_t *class_logits = branch.classes->data();
+    float qp_zp = branch.classes->vstream_info().quant_info.qp_zp;
+    float qp_scale = branch.classes->vstream_info().quant_info.qp_scale;
+    // One quantization step of slack, the survivors are checked against the exact score
+    float margin_threshold = std::floor(std::log(score_threshold / (1 - score_threshold)) / qp_scale) - 1;
+    uint32_t quantized_threshold = common::quantized_threshold<uint8_t>(qp_scale, qp_zp, score_threshold);
+
+    for (uint anchor = 0; anchor < branch.num_anchors; anchor++, class_logits += total_classes)
     {
-        auto cropped_landmarks = xt::view(xt::squeeze(landmark_ouputs), xt::keep(higher_scores[0]), xt::all());
-        auto cropped_anchors = xt::view(anchors, xt::keep(higher_scores[0]), xt::all());
-        auto cropped_anchors_mul = xt::view(anchors_multiplier, xt::keep(higher_scores[0]), xt::all());
-        landmarks = decode_landmarks(cropped_landmarks, cropped_anchors, cropped_anchors_mul);
-    }
+        if (requires_softmax)
+        {
+            int other_logit = 0;
+            for (int i = 0; i < total_classes; i++)
+            {
+                if (i != 1)
+                    other_logit = std::max<int>(other_logit, class_logits[i]);
+            }
+            if (float(int(class_logits[1]) - other_logit) < margin_threshold)
+                continue;
+        }
+        else if (class_logits[1] < quantized_threshold)
+            continue;
 
-    return std::tuple<xt::xarray<float>, xt::xarray<float>, xt::xarray<float>>(std::move(boxes), std::move(scores), std::move(landmarks));
+        float score = face_score(class_logits, branch.classes, total_classes, requires_softmax);
+        if (score > score_threshold)
+        {
+            candidates.push_back({branch_index, anchor, anchor_offset + anchor});
+            scores.push_back(score);
+        }
+    }
 }
 
 //******************************************************************
-// DETECTION/LANDMARKS EXTRACTION & ENCODING
+// BOX/LANDMARK DECODING
 //******************************************************************
-void encode_detections(std::vector<HailoDetection> &objects,
-                       xt::xarray<float> &detection_boxes,
-                       xt::xarray<float> &scores,
-                       xt::xarray<float> &landmarks,
-                       network_type network)
+HailoBBox decode_box(const uint8_t *box_detection,
+                     const HailoTensorPtr &boxes,
+                     const uint anchor,
+                     const xt::xarray<float> &anchors,
+                     const xt::xarray<float> &anchors_multiplier,
+                     const xt::xarray<float> &anchor_variance)
 {
-    // Here we will package the processed detections into the HailoDetection meta
-    // The detection meta will hold the following items:
-    float confidence, w, h, xmin, ymin = 0.0f;
-    // There is only 1 class in this network (face) so there is no need for label.
-    std::string label = "face";
-    // Iterate over our results
-    for (uint index = 0; index < scores.size(); ++index)
-    {
-        confidence = scores(index);                                  // Get the score for this detection
-        xmin = detection_boxes(index, 0);                            // Box xmin, relative to image size
-        ymin = detection_boxes(index, 1);                            // Box ymin, relative to image size
-        w = (detection_boxes(index, 2) - detection_boxes(index, 0)); // Box width, relative to image size
-        h = (detection_boxes(index, 3) - detection_boxes(index, 1)); // Box height, relative to image size
-
-        // Once all parameters are calculated, push them into the meta
-        // Class = 1 since centerpose only detects people
-        HailoBBox bbox(xmin, ymin, w, h);
-        HailoDetection detected_face(bbox, label, confidence);
-
-        if (landmarks.dimension() > 0)
-        {
-            xt::xarray<float> keypoints_raw = xt::row(landmarks, index);
-            // The keypoints are flatten, reshape them to 2 * num_keypoints.
-            int num_keypoints = keypoints_raw.shape(0) / 2;
-            auto face_keypoints = xt::reshape_view(keypoints_raw, {num_keypoints, 2});
-            hailo_common::add_landmarks_to_detection(detected_face, ToString(network), face_keypoints);
-        }
+    // Decode the box relative to its anchor
+    float x_center = anchors(anchor, 0) + dequantize_value(box_detection[0], boxes) * anchors_multiplier(anchor, 0);
+    float y_center = anchors(anchor, 1) + dequantize_value(box_detection[1], boxes) * anchors_multiplier(anchor, 1);
+    float w = anchors(anchor, 2) * std::exp(dequantize_value(box_detection[2], boxes) * anchor_variance(1));
+    float h = anchors(anchor, 3) * std::exp(dequantize_value(box_detection[3], boxes) * anchor_variance(1));
+    float xmin = x_center - w / 2;
+    float ymin = y_center - h / 2;
+    float xmax = w + xmin;
+    float ymax = h + ymin;
+    return HailoBBox(xmin, ymin, xmax - xmin, ymax - ymin);
+}
 
-        objects.push_back(detected_face); // Push the detection to the objects vector
+xt::xarray<float> decode_landmarks(const uint8_t *landmark_detection,
+                                   const HailoTensorPtr &landmarks,
+                                   const uint anchor,
+                                   const xt::xarray<float> &anchors,
+                                   const xt::xarray<float> &anchors_multiplier)
+{
+    // Decode the landmarks relative to their anchor.
+    // There are 5 landmarks paired in sets of 2 (x and y values)
+    xt::xarray<float> face_keypoints = xt::empty<float>({5, 2});
+    for (int i = 0; i < 5; i++)
+    {
+        face_keypoints(i, 0) = anchors(anchor, 0) + dequantize_value(landmark_detection[2 * i], landmarks) * anchors_multiplier(anchor, 0);
+        face_keypoints(i, 1) = anchors(anchor, 1) + dequantize_value(landmark_detection[2 * i + 1], landmarks) * anchors_multiplier(anchor, 1);
     }
+    return face_keypoints;
 }
 
+//******************************************************************
+// DETECTION/LANDMARKS EXTRACTION & ENCODING
+//******************************************************************
 std::vector<HailoDetection> face_detection_postprocess(std::vector<HailoTensorPtr> &tensors,
                                                        const xt::xarray<float> &anchors,
                                                        const xt::xarray<float> &anchors_multiplier,
@@ -389,124 +399,83 @@ std::vector<HailoDetection> face_detection_postprocess(std::vector<HailoTensorPt
                                                        const bool requires_softmax,
                                                        const network_type network)
 {
-    std::vector<HailoDetection> objects; // The detection meta we will eventually return
-
     //-------------------------------
     // TENSOR GATHERING
     //-------------------------------
 
     int num_outputs = tensors.size();
     int outputs_per_branch = num_outputs / num_branches;
-    // The output layers fall into hree categories: boxes, classes(scores), and lanmarks(x,y for each)
-    std::vector<xt::xarray<float>> box_layers;
-    std::vector<xt::xarray<float>> class_layers;
-    std::vector<xt::xarray<float>> landmarks_layers;
-
-    std::size_t boxes_reshaped_size = 0;
-    std::size_t landmarks_reshaped_size = 0;
-    std::size_t classes_reshaped_size = 0;
-
-    // Separate the layers by outs_per_branch steps
-    for (uint i = 0; i < tensors.size(); ++i)
+    // The output layers fall into three categories: boxes, classes(scores), and lanmarks(x,y for each)
+    // output layers are paired: boxes:classes:landmarks, boxes:classes:landmarks, boxes:classes:landmarks, etc...
+    std::vector<FaceDetectionBranch> branches(num_branches);
+    for (int i = 0; i < num_branches; i++)
     {
-        // While we're here, adapt the tensor into an xarray of float (dequantized).
-        xt::xarray<uint8_t> xdata = common::get_xtensor(tensors[i]);
-        xt::xarray<float> xdata_rescaled = common::dequantize(xdata, tensors[i]->vstream_info().quant_info.qp_scale, tensors[i]->vstream_info().quant_info.qp_zp);
-        // output layers are paired: boxes:classes:landmarks, boxes:classes:landmarks, boxes:classes:landmarks, etc...
-        if (i % outputs_per_branch == 0)
-        {
-            auto num_boxes = (int)xdata_rescaled.shape(0) * (int)xdata_rescaled.shape(1) * ((int)xdata_rescaled.shape(2) / 4);
-            auto xdata_reshaped = xt::reshape_view(xdata_rescaled, {1, num_boxes, 4}); // Resize to be by the 4 parameters for a box
-            box_layers.emplace_back(std::move(xdata_reshaped));
-            boxes_reshaped_size += num_boxes;
-        }
-        else if (i % outputs_per_branch == 1)
-        {
-            auto num_classes = (int)xdata_rescaled.shape(0) * (int)xdata_rescaled.shape(1) * ((int)xdata_rescaled.shape(2) / total_classes);
-            auto xdata_reshaped = xt::reshape_view(xdata_rescaled, {1, num_classes, total_classes}); // Resize to be by the total_classes available classes
-            class_layers.emplace_back(std::move(xdata_reshaped));
-            classes_reshaped_size += num_classes;
-        }
-        else
-        {
-            auto num_landmarks = (int)xdata_rescaled.shape(0) * (int)xdata_rescaled.shape(1) * ((int)xdata_rescaled.shape(2) / 10);
-            auto xdata_reshaped = xt::reshape_view(xdata_rescaled, {1, num_landmarks, 10}); // Resize to be by the (x,y) for each of the 5 landmarks (2*5=10)
-            landmarks_layers.emplace_back(std::move(xdata_reshaped));
-            landmarks_reshaped_size += num_landmarks;
-        }
+        FaceDetectionBranch &branch = branches[i];
+        branch.boxes = tensors[i * outputs_per_branch];
+        branch.classes = tensors[i * outputs_per_branch + 1];
+        branch.landmarks = outputs_per_branch > 2 ? tensors[i * outputs_per_branch + 2] : nullptr;
+        branch.num_anchors = branch.boxes->height() * branch.boxes->width() * (branch.boxes->features() / 4);
+        if (branch.classes->height() * branch.classes->width() * (branch.classes->features() / total_classes) != branch.num_anchors)
+            throw std::runtime_error("Face detection branch " + branch.boxes->name() + " has a different number of boxes and scores");
     }
 
-    // Sort the two sets in descending order so their order lines up with the pre-calculated anchors.
-    std::sort(box_layers.begin(), box_layers.end(), [](const auto &lhs, const auto &rhs)
-              { return rhs.shape(1) < lhs.shape(1); });
-    std::sort(class_layers.begin(), class_layers.end(), [](const auto &lhs, const auto &rhs)
-              { return rhs.shape(1) < lhs.shape(1); });
-
-    // Concatenate the different output layers together. second dim (1, N, 4) or (1, N, 2) should
-    // now match the anchors_multipler devised earlier.
-    int index = 0;
-    std::vector<std::size_t> boxes_shape = {1, boxes_reshaped_size, 4};
-    xt::xarray<float> stacked_boxes(boxes_shape);
-    for (uint i = 0; i < box_layers.size(); ++i)
-    {
-        xt::view(stacked_boxes, xt::all(), xt::range(index, index + box_layers[i].shape(1)), xt::all()) = box_layers[i];
-        index += box_layers[i].shape(1);
-    }
+    // Sort the branches in descending order so their order lines up with the pre-calculated anchors.
+    std::stable_sort(branches.begin(), branches.end(), [](const FaceDetectionBranch &lhs, const FaceDetectionBranch &rhs)
+                     { return rhs.num_anchors < lhs.num_anchors; });
+
+    //-------------------------------
+    // CALCULATION AND EXTRACTION
+    //-------------------------------
 
-    std::vector<std::size_t> classes_shape = {1, classes_reshaped_size, 2};
-    // We tell xtensor to explicitly layout the memory by rows, in order to perform math ops faster, e.g. softmax.
-    xt::xarray<float, xt::layout_type::row_major> stacked_classes(classes_shape);
-    index = 0;
-    for (uint i = 0; i < class_layers.size(); ++i)
+    // Scan the scores first, only the anchors that pass are decoded
+    thread_local std::vector<FaceCandidate> candidates;
+    thread_local std::vector<float> scores;
+    candidates.clear();
+    scores.clear();
+    uint anchor_offset = 0;
+    for (int i = 0; i < num_branches; i++)
     {
-        xt::view(stacked_classes, xt::all(), xt::range(index, index + class_layers[i].shape(1)), xt::all()) = class_layers[i];
-        index += class_layers[i].shape(1);
+        filter_face_scores(branches[i], i, anchor_offset, total_classes, score_threshold, requires_softmax, candidates, scores);
+        anchor_offset += branches[i].num_anchors;
     }
+    if (anchor_offset != anchors.shape(0))
+        throw std::runtime_error("Face detection outputs don't match the anchors of the configured image size");
 
-    // If there are landmarks, concat those too.
-    std::vector<std::size_t> landmarks_shape = {};
-    if (landmarks_reshaped_size > 0)
-        landmarks_shape = {1, landmarks_reshaped_size, 10};
-    xt::xarray<float> stacked_landmarks(landmarks_shape);
-    index = 0;
-    if (landmarks_layers.size() > 0)
+    // There is only 1 class in this network (face) so there is no need for label.
+    std::string label = "face";
+    std::vector<HailoDetection> objects;
+    objects.reserve(candidates.size());
+    for (uint i = 0; i < candidates.size(); i++)
     {
-        for (uint i = 0; i < landmarks_layers.size(); ++i)
-        {
-            xt::view(stacked_landmarks, xt::all(), xt::range(index, index + landmarks_layers[i].shape(1)), xt::all()) = landmarks_layers[i];
-            index += landmarks_layers[i].shape(1);
-        }
+        const FaceDetectionBranch &branch = branches[candidates[i].branch];
+        HailoBBox bbox = decode_box(branch.boxes->data() + candidates[i].anchor * 4, branch.boxes, candidates[i].global_anchor,
+                                    anchors, anchors_multiplier, anchor_variance);
+        objects.emplace_back(bbox, label, scores[i]);
     }
 
+    // Perform nms to throw out similar detections
+    thread_local common::NmsEngine engine;
+    const std::vector<uint> &kept = engine.run(objects, iou_threshold, false, 0);
+
     //-------------------------------
-    // CALCULATION AND EXTRACTION
+    // RESULTS ENCODING
     //-------------------------------
 
-    // Run softmax on the scores to get the relevant class
-    // xt::xarray<float> class_scores = common::softmax_xtensor(stacked_classes);
-    if (requires_softmax)
-        common::softmax_2D(stacked_classes.data(), stacked_classes.shape(1), stacked_classes.shape(2));
-
-    // Extract boxes and landmarks
-    auto boxes_and_landmarks = detect_boxes_and_landmarks(stacked_boxes, stacked_classes, stacked_landmarks,
-                                                          anchors, anchors_multiplier, anchor_variance,
-                                                          score_threshold, network);
-
-    // //-------------------------------
-    // // RESULTS ENCODING
-    // //-------------------------------
-
-    // // Encode the individual boxes/keypoints and package them into the meta
-    encode_detections(objects,
-                      std::get<0>(boxes_and_landmarks),
-                      std::get<1>(boxes_and_landmarks),
-                      std::get<2>(boxes_and_landmarks),
-                      network);
-
-    // // Perform nms to throw out similar detections
-    common::nms(objects, iou_threshold);
-
-    return objects;
+    // Package the kept detections, the landmarks are decoded only for them
+    std::vector<HailoDetection> detections;
+    detections.reserve(kept.size());
+    for (uint index : kept)
+    {
+        detections.emplace_back(std::move(objects[index]));
+        const FaceDetectionBranch &branch = branches[candidates[index].branch];
+        if (branch.landmarks)
+        {
+            xt::xarray<float> face_keypoints = decode_landmarks(branch.landmarks->data() + candidates[index].anchor * 10, branch.landmarks,
+                                                                candidates[index].global_anchor, anchors, anchors_multiplier);
+            hailo_common::add_landmarks_to_detection(detections.back(), ToString(network), face_keypoints);
+        }
+    }
+    return detections;
 }
 
 //******************************************************************
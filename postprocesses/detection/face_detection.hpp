@@ -35,6 +35,34 @@ public:
     }
 };
 
+// Supported Networks
+enum network_type
+{
+    LIGHTFACE,
+    RETINAFACE,
+};
+inline const char* ToString(network_type v)
+{
+    switch (v)
+    {
+        case LIGHTFACE:   return "lightface";
+        case RETINAFACE:  return "retinaface";
+        default:          return "[unknown]";
+    }
+}
+
+// Decode the faces of the output layers, ordered boxes:classes[:landmarks] per branch.
+std::vector<HailoDetection> face_detection_postprocess(std::vector<HailoTensorPtr> &tensors,
+                                                       const xt::xarray<float> &anchors,
+                                                       const xt::xarray<float> &anchors_multiplier,
+                                                       const xt::xarray<float> &anchor_variance,
+                                                       const float score_threshold,
+                                                       const float iou_threshold,
+                                                       const int num_branches,
+                                                       const int total_classes,
+                                                       const bool requires_softmax,
+                                                       const network_type network);
+
 __BEGIN_DECLS
 void retinaface(HailoROIPtr roi, void *params_void_ptr);
 void lightface(HailoROIPtr roi, void *params_void_ptr);
@@ -6,10 +6,14 @@
 #include <string>
 #include <iostream>
 #include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
 #include "hailo/hailort.h"
 #include "hailo_objects.hpp"
 #include "common/structures.hpp"
 #include "common/nms.hpp"
+#include "common/detection_arena.hpp"
 #include "common/labels/coco_ninety.hpp"
 #include "common/labels/coco_visdrone.hpp"
 
@@ -20,7 +24,7 @@ class HailoNMSDecode
 {
 private:
     HailoTensorPtr _nms_output_tensor;
-    std::map<uint8_t, std::string> labels_dict;
+    const common::LabelTable &_labels;
     float _detection_thr;
     uint _max_boxes;
     bool _filter_by_score;
@@ -39,18 +43,91 @@ private:
         return dequant_bbox;
     }
 
-    void parse_bbox_to_detection_object(auto dequant_bbox, uint32_t class_index, std::vector<HailoDetection> &_objects)
+    // A box of the nms buffer that passed the score filter
+    struct Candidate
     {
-        float confidence = CLAMP(dequant_bbox.score, 0.0f, 1.0f);
-        // filter score by detection threshold if needed.
-        if (!_filter_by_score || dequant_bbox.score > _detection_thr)
+        float score;
+        uint32_t class_index;
+        const uint8_t *bbox;
+    };
+
+    // The layout of a box in the buffer, uint16 outputs hold float32 boxes
+    template <typename T, typename BBoxType>
+    using BufferBBox = typename std::conditional<std::is_same<T, uint16_t>::value, hailo_bbox_float32_t, BBoxType>::type;
+
+    template <typename T, typename BBoxType>
+    static BufferBBox<T, BBoxType> read_bbox(const uint8_t *bbox_data)
+    {
+        // The boxes are packed after a 4 bytes count, memcpy avoids unaligned reads
+        BufferBBox<T, BBoxType> bbox;
+        memcpy(&bbox, bbox_data, sizeof(bbox));
+        return bbox;
+    }
+
+    /**
+     * @brief Walk the class headers of the nms buffer and collect the boxes passing the score filter.
+     *        Only the score of each box is read, the boxes themselves are parsed after the top-K selection.
+     */
+    template <typename T, typename BBoxType>
+    void collect_candidates(std::vector<Candidate> &candidates)
+    {
+        const uint32_t max_bboxes_per_class = _vstream_info.nms_shape.max_bboxes_per_class;
+        const uint32_t num_of_classes = _vstream_info.nms_shape.number_of_classes;
+        const uint8_t *buffer = _nms_output_tensor->data();
+        size_t buffer_offset = 0;
+        for (uint32_t class_id = 0; class_id < num_of_classes; class_id++)
         {
-            float32_t w, h = 0.0f;
-            // parse width and height of the box
-            std::tie(w, h) = get_shape(&dequant_bbox);
-            // create new detection object and add it to the vector of detections
-            _objects.push_back(HailoDetection(HailoBBox(dequant_bbox.x_min, dequant_bbox.y_min, w, h), class_index, labels_dict[class_index], confidence));
+            float32_t bbox_count = 0;
+            memcpy(&bbox_count, buffer + buffer_offset, sizeof(bbox_count));
+            buffer_offset += sizeof(bbox_count);
+
+            if (bbox_count == 0) // No detections
+                continue;
+            // Every count is checked before it moves the offset, so the walk never leaves the nms frame
+            if (!(bbox_count > 0) || bbox_count != std::floor(bbox_count))
+                throw std::runtime_error("Runtime error - Got an invalid bboxes count in the nms buffer");
+            if (bbox_count > max_bboxes_per_class)
+                throw std::runtime_error("Runtime error - Got more than the maximum bboxes per class in the nms buffer");
+
+            const uint32_t count = static_cast<uint32_t>(bbox_count);
+            for (uint32_t bbox_index = 0; bbox_index < count; bbox_index++)
+            {
+                const uint8_t *bbox_data = buffer + buffer_offset;
+                float score = read_bbox<T, BBoxType>(bbox_data).score;
+                // filter score by detection threshold if needed.
+                if (!_filter_by_score || score > _detection_thr)
+                    candidates.push_back(Candidate{score, class_id + 1, bbox_data});
+                buffer_offset += sizeof(BufferBBox<T, BBoxType>);
+            }
+        }
+    }
+
+    /**
+     * @brief Collect the candidates and keep the _max_boxes best of them.
+     *        Ties in score are broken by the buffer order, and the kept candidates are
+     *        always returned in the buffer order (by class), whether the cap was hit or not.
+     */
+    template <typename T, typename BBoxType>
+    std::vector<Candidate> &select_candidates()
+    {
+        thread_local std::vector<Candidate> candidates;
+        candidates.clear();
+        if (!_nms_output_tensor)
+            return candidates;
+
+        collect_candidates<T, BBoxType>(candidates);
+        if (_max_boxes > 0 && candidates.size() > _max_boxes)
+        {
+            // The box pointers increase along the buffer, so they order the candidates like the buffer does
+            std::nth_element(candidates.begin(), candidates.begin() + _max_boxes, candidates.end(),
+                             [](const Candidate &a, const Candidate &b)
+                             { return a.score > b.score || (a.score == b.score && a.bbox < b.bbox); });
+            candidates.resize(_max_boxes);
+            std::sort(candidates.begin(), candidates.end(),
+                      [](const Candidate &a, const Candidate &b)
+                      { return a.bbox < b.bbox; });
         }
+        return candidates;
     }
 
     std::pair<float, float> get_shape(auto *bbox_struct)
@@ -62,7 +139,7 @@ private:
 
 public:
     HailoNMSDecode(HailoTensorPtr tensor, std::map<uint8_t, std::string> &labels_dict, float detection_thr = DEFAULT_THRESHOLD, uint max_boxes = DEFAULT_MAX_BOXES, bool filter_by_score = false)
-        : _nms_output_tensor(tensor), labels_dict(labels_dict), _detection_thr(detection_thr), _max_boxes(max_boxes), _filter_by_score(filter_by_score), _vstream_info(tensor->vstream_info())
+        : _nms_output_tensor(tensor), _labels(common::intern_labels(labels_dict)), _detection_thr(detection_thr), _max_boxes(max_boxes), _filter_by_score(filter_by_score), _vstream_info(tensor->vstream_info())
     {
         // making sure that the network's output is indeed an NMS type, by checking the order type value included in the metadata
         if (HAILO_FORMAT_ORDER_HAILO_NMS != _vstream_info.format.order)
@@ -71,13 +148,24 @@ public:
 
     template <typename T, typename BBoxType>
     std::vector<HailoDetection> decode()
+    {
+        std::vector<HailoDetection> objects;
+        objects.reserve(_max_boxes);
+        decode<T, BBoxType>(objects);
+        return objects;
+    }
+
+    template <typename T, typename BBoxType>
+    void decode(std::vector<HailoDetection> &_objects)
     {
         /*
         NMS output decode method
         ------------------------
 
         decodes the nms buffer received from the output tensor of the network.
-        returns a vector of DetectonObject filtered by the detection threshold.
+        appends the DetectonObjects filtered by the detection threshold to _objects,
+        which can be the vector of a common::DetectionArena to reuse its storage across frames.
+        At most _max_boxes objects are added, the ones with the highest scores, in the buffer order.
 
         The data is sorted by the number of the classes.
         for each class - first comes the number of boxes in the class, then the boxes one after the other,
@@ -104,43 +192,41 @@ public:
         ymin = 0.551805 xmin = 0.389635 ymax = 0.741805 xmax = 0.561974 score = 0.95
         */
 
-        if (!_nms_output_tensor)
-            return std::vector<HailoDetection>{};
-
-        std::vector<HailoDetection> _objects;
-        _objects.reserve(_max_boxes);
-        uint32_t max_bboxes_per_class = _vstream_info.nms_shape.max_bboxes_per_class;
-        uint32_t num_of_classes = _vstream_info.nms_shape.number_of_classes;
-        size_t buffer_offset = 0;
-        uint8_t *buffer = _nms_output_tensor->data();
-        for (size_t class_id = 0; class_id < num_of_classes; class_id++)
+        for (const Candidate &candidate : select_candidates<T, BBoxType>())
         {
-            float32_t bbox_count = 0;
-            memcpy(&bbox_count, buffer + buffer_offset, sizeof(bbox_count));
-            buffer_offset += sizeof(bbox_count);
-
-            if (bbox_count == 0) // No detections
-                continue;
-            if (bbox_count > max_bboxes_per_class)
-                throw std::runtime_error("Runtime error - Got more than the maximum bboxes per class in the nms buffer");
+            auto bbox = read_bbox<T, BBoxType>(candidate.bbox);
+            float confidence = CLAMP(bbox.score, 0.0f, 1.0f);
+            float32_t w, h = 0.0f;
+            // parse width and height of the box
+            std::tie(w, h) = get_shape(&bbox);
+            // create new detection object and add it to the vector of detections
+            _objects.emplace_back(HailoBBox(bbox.x_min, bbox.y_min, w, h), candidate.class_index, _labels[candidate.class_index], confidence);
+        }
+    }
 
-            for (size_t bbox_index = 0; bbox_index < static_cast<uint32_t>(bbox_count); bbox_index++)
-            {
-                if (std::is_same<T, uint16_t>::value)
-                {
-                    // output type (T) is uint16, so we need to do dequantization before parsing
-                    hailo_bbox_float32_t *bbox = (hailo_bbox_float32_t *)(&buffer[buffer_offset]);
-                    parse_bbox_to_detection_object(*bbox, class_id + 1, _objects);
-                    buffer_offset += sizeof(hailo_bbox_float32_t);
-                }
-                else
-                {
-                    BBoxType *bbox_struct = (BBoxType *)(&buffer[buffer_offset]);
-                    parse_bbox_to_detection_object(*bbox_struct, class_id + 1, _objects);
-                    buffer_offset += sizeof(BBoxType);
-                }
-            }
+    /**
+     * @brief Decode the nms buffer into a structure of arrays instead of detection objects,
+     *        for consumers that only need the boxes (tracking, IOU kernels).
+     *        Same filtering and top-K selection as decode().
+     *
+     * @param boxes  -  common::NmsBoxes
+     *        Resized to the number of decoded boxes, class_id holds the class index
+     */
+    template <typename T, typename BBoxType>
+    void decode(common::NmsBoxes &boxes)
+    {
+        std::vector<Candidate> &candidates = select_candidates<T, BBoxType>();
+        boxes.resize(candidates.size());
+        for (uint i = 0; i < candidates.size(); i++)
+        {
+            auto bbox = read_bbox<T, BBoxType>(candidates[i].bbox);
+            boxes.xmin[i] = bbox.x_min;
+            boxes.ymin[i] = bbox.y_min;
+            boxes.xmax[i] = bbox.x_max;
+            boxes.ymax[i] = bbox.y_max;
+            boxes.area[i] = (boxes.ymax[i] - boxes.ymin[i]) * (boxes.xmax[i] - boxes.xmin[i]);
+            boxes.score[i] = CLAMP(bbox.score, 0.0f, 1.0f);
+            boxes.class_id[i] = candidates[i].class_index;
         }
-        return _objects;
     }
 };
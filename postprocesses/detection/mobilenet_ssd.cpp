@@ -10,23 +10,26 @@ static const std::string DEFAULT_SSD_OUTPUT_LAYER = "ssd_mobilenet_v1/nms1";
 
 void mobilenet_ssd(HailoROIPtr roi)
 {
+    static thread_local common::DetectionArena arena;
     auto post = HailoNMSDecode(roi->get_tensor(DEFAULT_SSD_OUTPUT_LAYER), common::coco_ninety_classes);
-    auto detections = post.decode<float32_t, common::hailo_bbox_float32_t>();
-    hailo_common::add_detections(roi, detections);
+    post.decode<float32_t, common::hailo_bbox_float32_t>(arena.begin_frame(DEFAULT_MAX_BOXES));
+    arena.add_to_roi(roi);
 }
 
 void mobilenet_ssd_merged(HailoROIPtr roi)
 {
+    static thread_local common::DetectionArena arena;
     auto post = HailoNMSDecode(roi->get_tensor("ssd_mobilenet_v1_no_alls/nms1"), common::coco_ninety_classes);
-    auto detections = post.decode<float32_t, common::hailo_bbox_float32_t>();
-    hailo_common::add_detections(roi, detections);
+    post.decode<float32_t, common::hailo_bbox_float32_t>(arena.begin_frame(DEFAULT_MAX_BOXES));
+    arena.add_to_roi(roi);
 }
 
 void mobilenet_ssd_visdrone(HailoROIPtr roi)
 {
+    static thread_local common::DetectionArena arena;
     auto post = HailoNMSDecode(roi->get_tensor("ssd_mobilenet_v1_visdrone/nms1"), common::coco_visdrone_classes);
-    auto detections = post.decode<float32_t, common::hailo_bbox_float32_t>();
-    hailo_common::add_detections(roi, detections);
+    post.decode<float32_t, common::hailo_bbox_float32_t>(arena.begin_frame(DEFAULT_MAX_BOXES));
+    arena.add_to_roi(roi);
 }
 
 void filter(HailoROIPtr roi)
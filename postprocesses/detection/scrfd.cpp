@@ -12,6 +12,7 @@
 #include "common/math.hpp"
 #include "common/tensors.hpp"
 #include "common/nms.hpp"
+#include "common/quantization.hpp"
 #include "json_config.hpp"
 #include "scrfd.hpp"
 #include "xtensor/xarray.hpp"
@@ -30,29 +31,32 @@
 #define SCRFD_HEIGHT (640)
 
 
-std::vector<std::string> BOXES_10g {"scrfd_10g/conv48",
-                                    "scrfd_10g/conv54",
-                                    "scrfd_10g/conv57"};
-std::vector<std::string> CLASSES_10g {"scrfd_10g/conv47",
-                                      "scrfd_10g/conv53",
-                                      "scrfd_10g/conv56"};
-std::vector<std::string> LANDMARKS_10g {"scrfd_10g/conv49",
-                                        "scrfd_10g/conv55",
-                                        "scrfd_10g/conv58"};
-
-std::vector<std::string> BOXES_2_5g {"scrfd_2_5g/conv47",
-                                     "scrfd_2_5g/conv53",
-                                     "scrfd_2_5g/conv56"};
-std::vector<std::string> CLASSES_2_5g {"scrfd_2_5g/conv46",
-                                       "scrfd_2_5g/conv52",
-                                       "scrfd_2_5g/conv55"};
-std::vector<std::string> LANDMARKS_2_5g {"scrfd_2_5g/conv48",
-                                         "scrfd_2_5g/conv54",
-                                         "scrfd_2_5g/conv57"};
-
-std::vector<std::string> BOXES;
-std::vector<std::string> CLASSES;
-std::vector<std::string> LANDMARKS;
+//******************************************************************
+// NETWORK LAYOUTS
+//******************************************************************
+/*
+ * The output layout of each SCRFD network, fixed at compile time: a branch per stride,
+ * ANCHORS_PER_CELL anchors per cell, and the boxes, classes and landmarks layers of each branch.
+ */
+struct Scrfd10gLayout
+{
+    static constexpr int NUM_BRANCHES = 3;
+    static constexpr int STRIDES[NUM_BRANCHES] = {8, 16, 32};
+    static constexpr int ANCHORS_PER_CELL = 2;
+    static constexpr const char *BOXES[NUM_BRANCHES] = {"scrfd_10g/conv48", "scrfd_10g/conv54", "scrfd_10g/conv57"};
+    static constexpr const char *CLASSES[NUM_BRANCHES] = {"scrfd_10g/conv47", "scrfd_10g/conv53", "scrfd_10g/conv56"};
+    static constexpr const char *LANDMARKS[NUM_BRANCHES] = {"scrfd_10g/conv49", "scrfd_10g/conv55", "scrfd_10g/conv58"};
+};
+
+struct Scrfd2_5gLayout
+{
+    static constexpr int NUM_BRANCHES = 3;
+    static constexpr int STRIDES[NUM_BRANCHES] = {8, 16, 32};
+    static constexpr int ANCHORS_PER_CELL = 2;
+    static constexpr const char *BOXES[NUM_BRANCHES] = {"scrfd_2_5g/conv47", "scrfd_2_5g/conv53", "scrfd_2_5g/conv56"};
+    static constexpr const char *CLASSES[NUM_BRANCHES] = {"scrfd_2_5g/conv46", "scrfd_2_5g/conv52", "scrfd_2_5g/conv55"};
+    static constexpr const char *LANDMARKS[NUM_BRANCHES] = {"scrfd_2_5g/conv48", "scrfd_2_5g/conv54", "scrfd_2_5g/conv57"};
+};
 
 #if __GNUC__ > 8
 #include <filesystem>
@@ -260,239 +264,148 @@ xt::xarray<float> get_anchors_scrfd(const std::vector<std::vector<int>> &anchor_
 }
 
 //******************************************************************
-// BOX/LANDMARK DECODING
+// FUSED DECODER
 //******************************************************************
-xt::xarray<float> decode_landmarks_scrfd(const xt::xarray<float> &landmark_detections,
-                                        const xt::xarray<float> &anchors)
-{
-    // Decode the boxes relative to their anchors.
-    // There are 5 landmarks paired in sets of 2 (x and y values),
-    // so we need to tile our anchors by 5
-    xt::xarray<float> landmarks = xt::tile(xt::view(anchors, xt::all(), xt::range(0, 2)), {1, 5}) + landmark_detections * xt::tile(xt::view(anchors, xt::all(), xt::range(2, 4)), {1, 5});
-    return landmarks;
-}
-
-xt::xarray<float> decode_boxes_scrfd(const xt::xarray<float> &box_detections,
-                                     const xt::xarray<float> &anchors)
-{
-    // Initalize the boxes matrix at the expected size
-    xt::xarray<float> boxes = xt::zeros<float>(box_detections.shape());
-    // Decode the boxes relative to their anchors in place
-    xt::col(boxes, 0) = xt::col(anchors, 0) - (xt::col(box_detections, 0) * xt::col(anchors, 2));
-    xt::col(boxes, 1) = xt::col(anchors, 1) - (xt::col(box_detections, 1) * xt::col(anchors, 3));
-    xt::col(boxes, 2) = xt::col(anchors, 0) + (xt::col(box_detections, 2) * xt::col(anchors, 2));
-    xt::col(boxes, 3) = xt::col(anchors, 1) + (xt::col(box_detections, 3) * xt::col(anchors, 3));
-    return boxes;
-}
-
-std::tuple<xt::xarray<float>, xt::xarray<float>, xt::xarray<float>> detect_decode_branch(std::map<std::string, HailoTensorPtr> &tensors,
-                                                                                        const xt::xarray<uint8_t> &boxes_quant,
-                                                                                        const xt::xarray<uint8_t> &classes_quant,
-                                                                                        const xt::xarray<uint8_t> &landmarks_quant,
-                                                                                        const xt::xarray<float> &anchors,
-                                                                                        const float score_threshold,
-                                                                                        const int i,
-                                                                                        const int steps)
-{
-    // Filter scores that pass threshold, quantize the score threshold
-    auto scores_quant = xt::col(classes_quant, 1);
-    xt::xarray<int> threshold_indices = xt::flatten_indices(xt::argwhere(scores_quant > tensors[CLASSES[i]]->quantize(score_threshold)));
-    
-    if (threshold_indices.shape(0) == 0)
-        return xt::xtuple(xt::empty<float>({0}), xt::empty<float>({0}), xt::empty<float>({0}));
-
-    // Filter and dequantize boxes
-    xt::xarray<uint8_t> high_boxes_quant = xt::view(boxes_quant, xt::keep(threshold_indices), xt::all());
-    auto high_boxes_dequant = common::dequantize(high_boxes_quant,
-                                                tensors[BOXES[i]]->vstream_info().quant_info.qp_scale,
-                                                tensors[BOXES[i]]->vstream_info().quant_info.qp_zp);
-    // Filter and dequantize scores
-    xt::xarray<uint8_t> high_scores_quant = xt::view(scores_quant, xt::keep(threshold_indices));
-    auto high_scores_dequant = common::dequantize(high_scores_quant,
-                                                tensors[CLASSES[i]]->vstream_info().quant_info.qp_scale,
-                                                tensors[CLASSES[i]]->vstream_info().quant_info.qp_zp);
-    // Filter and dequantize landmarks
-    xt::xarray<uint8_t> high_landmarks_quant = xt::view(landmarks_quant, xt::keep(threshold_indices), xt::all());
-    auto high_landmarks_dequant = common::dequantize(high_landmarks_quant,
-                                                    tensors[LANDMARKS[i]]->vstream_info().quant_info.qp_scale,
-                                                    tensors[LANDMARKS[i]]->vstream_info().quant_info.qp_zp);
-    // Filter anchors and use them to decode boxes/landmarks
-    auto stepped_inds = threshold_indices + steps;
-    auto high_anchors = xt::view(anchors, xt::keep(stepped_inds), xt::all());
-    xt::xarray<float> decoded_boxes = decode_boxes_scrfd(high_boxes_dequant, high_anchors);
-    xt::xarray<float> decoded_landmarks = decode_landmarks_scrfd(high_landmarks_dequant, high_anchors);
-
-    // Return boxes, scores, and landmarks
-    return xt::xtuple(decoded_boxes, high_scores_dequant, decoded_landmarks);
-}
-
-std::tuple<std::vector<xt::xarray<float>>,
-            std::vector<xt::xarray<float>>,
-            std::vector<xt::xarray<float>>>
-detect_boxes_and_landmarks(std::map<std::string, HailoTensorPtr> &tensors,
-                           const std::vector<xt::xarray<uint8_t>> &boxes_quant,
-                           const std::vector<xt::xarray<uint8_t>> &classes_quant,
-                           const std::vector<xt::xarray<uint8_t>> &landmarks_quant,
-                           const xt::xarray<float> &anchors,
-                           const float score_threshold)
+/**
+ * @brief Decodes all the strides of an SCRFD network in one pass over their quantized outputs.
+ *        The scores are compared to the quantized threshold in place, the candidates are decoded
+ *        into a preallocated structure of arrays buffer and suppressed by NMS there,
+ *        and the landmarks are decoded only for the faces that NMS keeps.
+ */
+template <typename Layout>
+class ScrfdDecoder
 {
-    std::vector<xt::xarray<float>> high_scores_dequant(CLASSES.size());
-    std::vector<xt::xarray<float>> decoded_boxes(BOXES.size());
-    std::vector<xt::xarray<float>> decoded_landmarks(LANDMARKS.size());
+private:
+    static constexpr int NUM_LANDMARKS = 5;
 
-    int steps = 0;
-    for (uint i = 0; i < CLASSES.size(); ++i)
+    struct Branch
     {
-        auto boxes_scores_landmarks = detect_decode_branch(tensors,
-                                                           boxes_quant[i],
-                                                           classes_quant[i],
-                                                           landmarks_quant[i],
-                                                           anchors, score_threshold, i, steps);
-        decoded_boxes[i] = std::get<0>(boxes_scores_landmarks);
-        high_scores_dequant[i] = std::get<1>(boxes_scores_landmarks);
-        decoded_landmarks[i] = std::get<2>(boxes_scores_landmarks);
-        steps += classes_quant[i].shape(0);
-    }
-
-    return std::tuple<std::vector<xt::xarray<float>>,
-                      std::vector<xt::xarray<float>>,
-                      std::vector<xt::xarray<float>>>(std::move(decoded_boxes),
-                                                      std::move(high_scores_dequant),
-                                                      std::move(decoded_landmarks));
-}
-
-//******************************************************************
-// DETECTION/LANDMARKS EXTRACTION & ENCODING
-//******************************************************************
-void encode_detections(std::vector<HailoDetection> &objects,
-                       std::vector<xt::xarray<float>> &detection_boxes,
-                       std::vector<xt::xarray<float>> &scores,
-                       std::vector<xt::xarray<float>> &landmarks)
-{
-    // Here we will package the processed detections into the HailoDetection meta
-    // The detection meta will hold the following items:
-    float confidence, w, h, xmin, ymin = 0.0f;
-    // There is only 1 class in this network (face) so there is no need for label.
-    std::string label = "face";
-    // Iterate over our results
-    for (uint i = 0; i < CLASSES.size(); ++i)
+        HailoTensorPtr boxes;
+        HailoTensorPtr classes;
+        HailoTensorPtr landmarks;
+        uint num_anchors;
+        uint anchor_offset; // of the branch in the anchors of the params
+    };
+
+    Branch m_branches[Layout::NUM_BRANCHES];
+    // The candidates, sized for every anchor once
+    std::vector<float> m_xmin, m_ymin, m_xmax, m_ymax, m_score;
+    std::vector<uint> m_anchor; // in the anchors of the params
+    std::vector<uint8_t> m_branch;
+    common::NmsEngine m_nms;
+
+    void gather(std::map<std::string, HailoTensorPtr> &tensors, const ScrfdParams &params)
     {
-        for (uint index = 0; index < scores[i].size(); ++index)
+        uint anchor_offset = 0;
+        for (int i = 0; i < Layout::NUM_BRANCHES; i++)
         {
-            confidence = scores[i](index);                                  // Get the score for this detection
-            xmin = detection_boxes[i](index, 0);                            // Box xmin, relative to image size
-            ymin = detection_boxes[i](index, 1);                            // Box ymin, relative to image size
-            w = (detection_boxes[i](index, 2) - detection_boxes[i](index, 0)); // Box width, relative to image size
-            h = (detection_boxes[i](index, 3) - detection_boxes[i](index, 1)); // Box height, relative to image size
-
-            // Once all parameters are calculated, push them into the meta
-            // Class = 1 since centerpose only detects people
-            HailoBBox bbox(xmin, ymin, w, h);
-            HailoDetection detected_face(bbox, label, confidence);
-
-            xt::xarray<float> keypoints_raw = xt::row(landmarks[i], index);
-            // The keypoints are flatten, reshape them to 2 * num_keypoints.
-            int num_keypoints = keypoints_raw.shape(0) / 2;
-            auto face_keypoints = xt::reshape_view(keypoints_raw, {num_keypoints, 2});
-            hailo_common::add_landmarks_to_detection(detected_face, "scrfd", face_keypoints);
-
-            objects.push_back(detected_face); // Push the detection to the objects vector
+            Branch &branch = m_branches[i];
+            branch.boxes = tensors.at(Layout::BOXES[i]);
+            branch.classes = tensors.at(Layout::CLASSES[i]);
+            branch.landmarks = tensors.at(Layout::LANDMARKS[i]);
+            branch.num_anchors = branch.classes->height() * branch.classes->width() * Layout::ANCHORS_PER_CELL;
+            branch.anchor_offset = anchor_offset;
+            if (branch.classes->features() != Layout::ANCHORS_PER_CELL ||
+                branch.boxes->features() != 4 * Layout::ANCHORS_PER_CELL ||
+                branch.landmarks->features() != 2 * NUM_LANDMARKS * Layout::ANCHORS_PER_CELL)
+                throw std::runtime_error(std::string("SCRFD output layers of stride ") + std::to_string(Layout::STRIDES[i]) + " don't match the network layout");
+            anchor_offset += branch.num_anchors;
+        }
+        if (anchor_offset != params.anchors.shape(0))
+            throw std::runtime_error("SCRFD outputs don't match the anchors of the configured image size");
+        if (m_score.size() < anchor_offset)
+        {
+            m_xmin.resize(anchor_offset);
+            m_ymin.resize(anchor_offset);
+            m_xmax.resize(anchor_offset);
+            m_ymax.resize(anchor_offset);
+            m_score.resize(anchor_offset);
+            m_anchor.resize(anchor_offset);
+            m_branch.resize(anchor_offset);
         }
     }
-}
-
-std::vector<HailoDetection> face_detection_postprocess(std::map<std::string, HailoTensorPtr> &tensors_by_name,
-                                                       const xt::xarray<float> &anchors,
-                                                       const float score_threshold,
-                                                       const float iou_threshold,
-                                                       const int num_branches,
-                                                       const int total_classes)
-{
-    std::vector<HailoDetection> objects; // The detection meta we will eventually return
-
-    //-------------------------------
-    // TENSOR GATHERING
-    //-------------------------------
-    // The output layers fall into hree categories: boxes, classes(scores), and lanmarks(x,y for each)
-    std::vector<xt::xarray<uint8_t>> box_layers_quant;
-    std::vector<xt::xarray<uint8_t>> class_layers_quant;
-    std::vector<xt::xarray<uint8_t>> landmarks_layers_quant;
 
-    for (uint i = 0; i < BOXES.size(); ++i)
+    inline float dequantize(uint8_t value, const HailoTensorPtr &tensor)
     {
-        // Extract the boxes
-        xt::xarray<uint8_t> xdata_boxes = common::get_xtensor(tensors_by_name[BOXES[i]]);
-        auto num_boxes = (int)xdata_boxes.shape(0) * (int)xdata_boxes.shape(1) * ((int)xdata_boxes.shape(2) / 4);
-        auto xdata_boxes_reshaped = xt::reshape_view(xdata_boxes, {num_boxes, 4}); // Resize to be by the 4 parameters for a box
-        box_layers_quant.emplace_back(std::move(xdata_boxes_reshaped));
-
-        // Extract the classes
-        xt::xarray<uint8_t> xdata_classes = common::get_xtensor(tensors_by_name[CLASSES[i]]);
-        auto num_classes = (int)xdata_classes.shape(0) * (int)xdata_classes.shape(1) * ((int)xdata_classes.shape(2) / total_classes);
-        auto xdata_classes_reshaped = xt::reshape_view(xdata_classes, {num_classes, total_classes}); // Resize to be by the total_classes available classes
-        class_layers_quant.emplace_back(std::move(xdata_classes_reshaped));
-
-        // Extract the landmarks
-        xt::xarray<uint8_t> xdata_landmarks = common::get_xtensor(tensors_by_name[LANDMARKS[i]]);
-        auto num_landmarks = (int)xdata_landmarks.shape(0) * (int)xdata_landmarks.shape(1) * ((int)xdata_landmarks.shape(2) / 10);
-        auto xdata_landmarks_reshaped = xt::reshape_view(xdata_landmarks, {num_landmarks, 10}); // Resize to be by the (x,y) for each of the 5 landmarks (2*5=10)
-        landmarks_layers_quant.emplace_back(std::move(xdata_landmarks_reshaped));
+        return (float(value) - tensor->vstream_info().quant_info.qp_zp) * tensor->vstream_info().quant_info.qp_scale;
     }
 
-    //-------------------------------
-    // CALCULATION AND EXTRACTION
-    //-------------------------------
-
-    // Extract boxes and landmarks
-    auto boxes_and_landmarks = detect_boxes_and_landmarks(tensors_by_name,
-                                                          box_layers_quant,
-                                                          class_layers_quant,
-                                                          landmarks_layers_quant,
-                                                          anchors,
-                                                          score_threshold);
-
-    // //-------------------------------
-    // // RESULTS ENCODING
-    // //-------------------------------
+public:
+    std::vector<HailoDetection> decode(std::map<std::string, HailoTensorPtr> &tensors, const ScrfdParams &params)
+    {
+        gather(tensors, params);
+        const xt::xarray<float> &anchors = params.anchors;
 
-    // // Encode the individual boxes/keypoints and package them into the meta
-    encode_detections(objects,
-                      std::get<0>(boxes_and_landmarks),
-                      std::get<1>(boxes_and_landmarks),
-                      std::get<2>(boxes_and_landmarks));
+        // Score filtering and box decoding of all the strides into the candidate buffer
+        uint count = 0;
+        for (int i = 0; i < Layout::NUM_BRANCHES; i++)
+        {
+            const Branch &branch = m_branches[i];
+            const uint8_t *scores = branch.classes->data();
+            const uint8_t *boxes = branch.boxes->data();
+            // A score passes when it is above the quantized threshold
+            uint32_t threshold = uint32_t(branch.classes->quantize(params.score_threshold)) + 1;
+            common::for_each_above_threshold(scores, branch.num_anchors, threshold, [&](uint32_t index)
+                                             {
+                                                 uint anchor = branch.anchor_offset + index;
+                                                 const uint8_t *box = boxes + 4 * index;
+                                                 // Decode the box relative to its anchor
+                                                 m_xmin[count] = anchors(anchor, 0) - (dequantize(box[0], branch.boxes) * anchors(anchor, 2));
+                                                 m_ymin[count] = anchors(anchor, 1) - (dequantize(box[1], branch.boxes) * anchors(anchor, 3));
+                                                 m_xmax[count] = anchors(anchor, 0) + (dequantize(box[2], branch.boxes) * anchors(anchor, 2));
+                                                 m_ymax[count] = anchors(anchor, 1) + (dequantize(box[3], branch.boxes) * anchors(anchor, 3));
+                                                 m_score[count] = dequantize(scores[index], branch.classes);
+                                                 m_anchor[count] = anchor;
+                                                 m_branch[count] = i;
+                                                 count++; });
+        }
 
-    // // Perform nms to throw out similar detections
-    common::nms(objects, iou_threshold);
+        // Perform nms to throw out similar detections
+        common::NmsBoxes &nms_boxes = m_nms.boxes();
+        nms_boxes.resize(count);
+        for (uint i = 0; i < count; i++)
+            nms_boxes.set(i, m_xmin[i], m_ymin[i], m_xmax[i], m_ymax[i], m_score[i], 0);
+        const std::vector<uint> &kept = m_nms.run_boxes(params.iou_threshold);
+
+        // Encode the kept faces, only now their landmarks are decoded
+        // There is only 1 class in this network (face) so there is no need for label.
+        std::string label = "face";
+        std::vector<HailoDetection> objects;
+        objects.reserve(kept.size());
+        for (uint i : kept)
+        {
+            HailoBBox bbox(m_xmin[i], m_ymin[i], m_xmax[i] - m_xmin[i], m_ymax[i] - m_ymin[i]);
+            HailoDetection detected_face(bbox, label, m_score[i]);
+
+            const Branch &branch = m_branches[m_branch[i]];
+            uint anchor = m_anchor[i];
+            const uint8_t *landmarks = branch.landmarks->data() + 2 * NUM_LANDMARKS * (anchor - branch.anchor_offset);
+            xt::xarray<float> face_keypoints = xt::empty<float>({NUM_LANDMARKS, 2});
+            for (int k = 0; k < NUM_LANDMARKS; k++)
+            {
+                face_keypoints(k, 0) = anchors(anchor, 0) + dequantize(landmarks[2 * k], branch.landmarks) * anchors(anchor, 2);
+                face_keypoints(k, 1) = anchors(anchor, 1) + dequantize(landmarks[2 * k + 1], branch.landmarks) * anchors(anchor, 3);
+            }
+            hailo_common::add_landmarks_to_detection(detected_face, "scrfd", face_keypoints);
 
-    return objects;
-}
+            objects.emplace_back(std::move(detected_face));
+        }
+        return objects;
+    }
+};
 
 //******************************************************************
 //  SCRFD POSTPROCESS
 //******************************************************************
+template <typename Layout>
 void scrfd(HailoROIPtr roi, void *params_void_ptr)
 {
     /*
-     *  The lightface network outputs tensors in 4 sets of 2 (totaling 8 layers).
-     *  Each set has a layer describing bounding boxes of detections, and a layer
-     *  of class scores for each corresponding box. Each set of boxes and scores
-     *  operate at a different scale of the feature set. The 4 different scales
-     *  give us decent coverage of the possible sizes objects can take in the image.
-     *  Since the detections output by the network are anchor boxes, we need to
-     *  multiply them by anchors that we determine in advanced using the parameters below.
-     */
-    /*
-     *  The retinaface operates under the same principles as the lightface network
-     *  below, however here we include a set of landmarks for each detection box.
-     *  This means that instead of sets of 2 tensors, the newtork outputs 3 sets
-     *  of 3 tensors (totalling in 9 output layers). So each set has a tensor for
-     *  boxes, corresponding scores, and corresponding landmarks. Like in lightface,
-     *  we need to trabsform the boxes using anchors determined by the parameters below.
-     */
-    /*
-     *  SCRFD is also a face detection + landmarks network like retinaface below.
-     *  It uses the same tensor scheme but different decoding stratedgy.
-     *  Overall differences lie in performance and resolution.
+     *  SCRFD is a face detection + landmarks network like retinaface.
+     *  The network outputs 3 sets of 3 tensors (totalling in 9 output layers), a set per stride.
+     *  So each set has a tensor for boxes, corresponding scores, and corresponding landmarks.
+     *  The boxes and landmarks are decoded relative to anchors determined in advance by the parameters,
+     *  the boxes as distances from the anchor center and the landmarks as offsets from it.
      */
     // Get the output layers from the hailo frame.
     ScrfdParams *params = reinterpret_cast<ScrfdParams *>(params_void_ptr);
@@ -501,32 +414,22 @@ void scrfd(HailoROIPtr roi, void *params_void_ptr)
     std::map<std::string, HailoTensorPtr> tensors_by_name = roi->get_tensors_by_name();
 
     // Extract the detection objects using the given parameters.
-    std::vector<HailoDetection> detections = face_detection_postprocess(tensors_by_name, params->anchors,
-                                                                        params->score_threshold, params->iou_threshold,
-                                                                        params->num_branches, 1);
+    // The decoder and its buffers are reused by the following frames of the thread.
+    thread_local ScrfdDecoder<Layout> decoder;
+    std::vector<HailoDetection> detections = decoder.decode(tensors_by_name, *params);
 
     // Update the frame with the found detections.
     hailo_common::add_detections(roi, detections);
 }
 
-
 void scrfd_2_5g(HailoROIPtr roi, void *params_void_ptr)
 {
-    ScrfdParams *params = reinterpret_cast<ScrfdParams *>(params_void_ptr);
-    BOXES = BOXES_2_5g;
-    CLASSES = CLASSES_2_5g;
-    LANDMARKS = LANDMARKS_2_5g;
-    scrfd(roi, params);
+    scrfd<Scrfd2_5gLayout>(roi, params_void_ptr);
 }
 
-
 void scrfd_10g(HailoROIPtr roi, void *params_void_ptr)
 {
-    ScrfdParams *params = reinterpret_cast<ScrfdParams *>(params_void_ptr);
-    BOXES = BOXES_10g;
-    CLASSES = CLASSES_10g;
-    LANDMARKS = LANDMARKS_10g;
-    scrfd(roi, params);
+    scrfd<Scrfd10gLayout>(roi, params_void_ptr);
 }
 
 //******************************************************************
@@ -535,9 +438,5 @@ void scrfd_10g(HailoROIPtr roi, void *params_void_ptr)
 void filter(HailoROIPtr roi, void *params_void_ptr)
 {
     // Default scrfd_10g
-    ScrfdParams *params = reinterpret_cast<ScrfdParams *>(params_void_ptr);
-    BOXES = BOXES_10g;
-    CLASSES = CLASSES_10g;
-    LANDMARKS = LANDMARKS_10g;
-    scrfd(roi, params);
+    scrfd<Scrfd10gLayout>(roi, params_void_ptr);
 }
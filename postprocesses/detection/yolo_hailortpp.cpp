@@ -3,10 +3,15 @@
 #include "common/labels/coco_eighty.hpp"
 #include "common/labels/fire_smoke.hpp"
 #include "common/labels/person_face.hpp"
+#include "common/event_sink.hpp"
+#include "common/file_watch.hpp"
 
 #include "byte_track/ByteTrack-cpp/include/ByteTrack/BYTETracker.h"
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
+#include <sstream>
 #include <ctime>
 #include <iomanip>
 
@@ -22,83 +27,85 @@ static const std::string DEFAULT_YOLOV8M_OUTPUT_LAYER = "yolov8m/yolov8_nms_post
 #ifdef TUANIOT
 const std::string data_roi = "data_ROI.txt";
 const std::string data_fire_warning = "data.txt";
-std::time_t last_write_time = 0;
+std::atomic<std::time_t> last_write_time{0};
 //std::string last_label = "";
 
 static const float native_width = 1920;
 static const float native_height = 1080;
-static float x_min = 0;
-static float y_min = 0;
-static float x_max = 1920;
-static float y_max = 1080;
-
-void read_txt(std::string file_name){
-    std::ifstream check_file(file_name);
-    if (!check_file.is_open()) {
+
+// The region of interest in native pixels, detections outside of it are dropped
+struct RoiBounds
+{
+    float x_min = 0;
+    float y_min = 0;
+    float x_max = native_width;
+    float y_max = native_height;
+};
+
+void read_txt(const std::string &file_name, RoiBounds &bounds){
+    std::ifstream file(file_name);
+    if (!file.is_open()) {
         return;
     }
-    std::ifstream file(file_name, std::ios::app);
-    if (file.is_open()){
-        std::string line;
-        while (std::getline(file, line)) {
-            // Process each line as needed
-            std::stringstream ss(line);
-            std::vector<float> numbers;
-            float num;
-            while (ss >> num) { // Read each number separated by space
-                if(ss.fail()){
-                    std::cout << "file data config has wrong format!" << std::endl;
-                    break;
-                }
-                numbers.push_back(num); // Store the number in the vector
-            }
-            if(numbers.size() == 4){
-                x_min = numbers[0];
-                y_min = numbers[1];
-                x_max = numbers[2];
-                y_max = numbers[3];
-                // std::cout << line << std::endl;
-            }
-            else{
+    std::string line;
+    while (std::getline(file, line)) {
+        // Process each line as needed
+        std::stringstream ss(line);
+        std::vector<float> numbers;
+        float num;
+        while (ss >> num) { // Read each number separated by space
+            if(ss.fail()){
                 std::cout << "file data config has wrong format!" << std::endl;
+                break;
             }
-            
+            numbers.push_back(num); // Store the number in the vector
+        }
+        if(numbers.size() == 4){
+            bounds.x_min = numbers[0];
+            bounds.y_min = numbers[1];
+            bounds.x_max = numbers[2];
+            bounds.y_max = numbers[3];
+            // std::cout << line << std::endl;
+        }
+        else{
+            std::cout << "file data config has wrong format!" << std::endl;
         }
-        file.close();
+        
     }
 }
 
-void write_txt(const std::string label, std::string file_name) {
+// The ROI file is parsed again only when inotify reports a change, frames just load the current bounds
+common::WatchedFile<RoiBounds> &roi_config()
+{
+    static common::WatchedFile<RoiBounds> config(data_roi, RoiBounds(), read_txt);
+    return config;
+}
+
+void write_txt(const std::string &label, const std::string &file_name) {
     std::time_t now = std::time(nullptr);
+    std::time_t last = last_write_time.load();
     //if (label == last_label && std::difftime(now, last_write_time) < 5) {
-    if (std::difftime(now, last_write_time) < 1) {
+    // Several streams share the rate limit, only the one that moves last_write_time writes
+    if (std::difftime(now, last) < 1 || !last_write_time.compare_exchange_strong(last, now)) {
         return; 
     }
 
-    std::tm* local_time = std::localtime(&now);
+    std::tm local_time;
+    localtime_r(&now, &local_time);
     char buffer[80];
 
-    std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", local_time);
+    std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &local_time);
     // Lấy phần giây thập phân (microseconds)
     auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count() % 1000000;
 
     // In ra thời gian với định dạng mong muốn
     //std::cout << buffer << "." << std::setw(6) << std::setfill('0') << microseconds << "+07:00" << std::endl;
-    
-    std::ifstream check_file(file_name);
-    if (!check_file.is_open()) {
-        std::ofstream create_file(file_name);
-        create_file.close();
-    }
-
-    std::ofstream file(file_name, std::ios::app);
-    if (file.is_open()){
-        file << label << " " << buffer << "." << std::setw(6) << std::setfill('0') << microseconds << "+00:00" << std::endl;
-        file.close();
 
-        last_write_time = now;
-        //last_label = label;
-    }
+    // The file is written by the event sink thread, never by the post-process
+    std::ostringstream line;
+    line << label << " " << buffer << "." << std::setw(6) << std::setfill('0') << microseconds << "+00:00";
+    common::EventSink::get(file_name).push(line.str());
+    //last_label = label;
 
 }
 
@@ -117,9 +124,10 @@ void yolov5(HailoROIPtr roi)
     {
         return;
     }
+    static thread_local common::DetectionArena arena;
     auto post = HailoNMSDecode(roi->get_tensor(DEFAULT_YOLOV5M_OUTPUT_LAYER), common::coco_eighty);
-    auto detections = post.decode<float32_t, common::hailo_bbox_float32_t>();
-    hailo_common::add_detections(roi, detections);
+    post.decode<float32_t, common::hailo_bbox_float32_t>(arena.begin_frame(DEFAULT_MAX_BOXES));
+    arena.add_to_roi(roi);
 }
 
 void yolov5s_nv12(HailoROIPtr roi)
@@ -128,9 +136,10 @@ void yolov5s_nv12(HailoROIPtr roi)
     {
         return;
     }
+    static thread_local common::DetectionArena arena;
     auto post = HailoNMSDecode(roi->get_tensor(DEFAULT_YOLOV5S_OUTPUT_LAYER), common::coco_eighty);
-    auto detections = post.decode<float32_t, common::hailo_bbox_float32_t>();
-    hailo_common::add_detections(roi, detections);
+    post.decode<float32_t, common::hailo_bbox_float32_t>(arena.begin_frame(DEFAULT_MAX_BOXES));
+    arena.add_to_roi(roi);
 }
 
 void yolov8s(HailoROIPtr roi)
@@ -140,9 +149,10 @@ void yolov8s(HailoROIPtr roi)
     {
         return;
     }
+    static thread_local common::DetectionArena arena;
     auto post = HailoNMSDecode(roi->get_tensor(DEFAULT_YOLOV8S_OUTPUT_LAYER), common::coco_eighty);
-    auto detections = post.decode<float32_t, common::hailo_bbox_float32_t>();
-    hailo_common::add_detections(roi, detections);
+    post.decode<float32_t, common::hailo_bbox_float32_t>(arena.begin_frame(DEFAULT_MAX_BOXES));
+    arena.add_to_roi(roi);
 
 }
 
@@ -153,27 +163,28 @@ void yolov8s_personface_in_ROI(HailoROIPtr roi)
     {
         return;
     }
+    static thread_local common::DetectionArena arena;
     auto post = HailoNMSDecode(roi->get_tensor(DEFAULT_YOLOV8S_OUTPUT_LAYER), common::person_face);
-    auto detections = post.decode<float32_t, common::hailo_bbox_float32_t>();
+    std::vector<HailoDetection> &detections = arena.begin_frame(DEFAULT_MAX_BOXES);
+    post.decode<float32_t, common::hailo_bbox_float32_t>(detections);
     //[feature] detect stranger in ROI
-    std::vector<HailoDetection> stranger_detections;
-    read_txt(data_roi);
-    
-    for(auto detection : detections){
-        HailoBBox roi_bbox = hailo_common::create_flattened_bbox(roi->get_bbox(), roi->get_scaling_bbox());
-        auto detection_bbox = detection.get_bbox();
-        auto xmin = std::clamp<int>(((detection_bbox.xmin() * roi_bbox.width()) + roi_bbox.xmin()) * native_width, 0, native_width);
-        auto ymin = std::clamp<int>(((detection_bbox.ymin() * roi_bbox.height()) + roi_bbox.ymin()) * native_height, 0, native_height);
-        auto xmax = std::clamp<int>(((detection_bbox.xmax() * roi_bbox.width()) + roi_bbox.xmin()) * native_width, 0, native_width);
-        auto ymax = std::clamp<int>(((detection_bbox.ymax() * roi_bbox.height()) + roi_bbox.ymin()) * native_height, 0, native_height);
-        if(xmin < x_min || ymin < y_min || xmax > x_max || ymax > y_max)
-            continue;
-        if(detection.get_confidence() < 0.5)
-            continue;
-        stranger_detections.push_back(detection);
-    }
+    std::shared_ptr<const RoiBounds> bounds = roi_config().get();
+    HailoBBox roi_bbox = hailo_common::create_flattened_bbox(roi->get_bbox(), roi->get_scaling_bbox());
+    detections.erase(std::remove_if(detections.begin(), detections.end(),
+                                    [&roi_bbox, &bounds](HailoDetection &detection)
+                                    {
+                                        auto detection_bbox = detection.get_bbox();
+                                        auto xmin = std::clamp<int>(((detection_bbox.xmin() * roi_bbox.width()) + roi_bbox.xmin()) * native_width, 0, native_width);
+                                        auto ymin = std::clamp<int>(((detection_bbox.ymin() * roi_bbox.height()) + roi_bbox.ymin()) * native_height, 0, native_height);
+                                        auto xmax = std::clamp<int>(((detection_bbox.xmax() * roi_bbox.width()) + roi_bbox.xmin()) * native_width, 0, native_width);
+                                        auto ymax = std::clamp<int>(((detection_bbox.ymax() * roi_bbox.height()) + roi_bbox.ymin()) * native_height, 0, native_height);
+                                        if (xmin < bounds->x_min || ymin < bounds->y_min || xmax > bounds->x_max || ymax > bounds->y_max)
+                                            return true;
+                                        return detection.get_confidence() < 0.5;
+                                    }),
+                     detections.end());
     //-----end-----------
-    hailo_common::add_detections(roi, stranger_detections);
+    arena.add_to_roi(roi);
 
 }
 
@@ -184,17 +195,16 @@ void yolov8s_fire_smoke_warning(HailoROIPtr roi)
     {
         return;
     }
+    static thread_local common::DetectionArena arena;
     auto post = HailoNMSDecode(roi->get_tensor(DEFAULT_YOLOV8S_OUTPUT_LAYER), common::fire_smoke);
-    auto detections = post.decode<float32_t, common::hailo_bbox_float32_t>();
+    std::vector<HailoDetection> &detections = arena.begin_frame(DEFAULT_MAX_BOXES);
+    post.decode<float32_t, common::hailo_bbox_float32_t>(detections);
     //[feature] filter detection has confident >= 0.75
-    std::vector<HailoDetection> high_confident_detections;
-    for(auto detection : detections){
-        if(detection.get_confidence() < 0.75)
-            continue;
-        high_confident_detections.push_back(detection);
-    }
+    detections.erase(std::remove_if(detections.begin(), detections.end(),
+                                    [](HailoDetection &detection)
+                                    { return detection.get_confidence() < 0.75; }),
+                     detections.end());
     //-----end-----------
-    hailo_common::add_detections(roi, high_confident_detections);
 
     //[feature] warning fire smoke
     /*
@@ -202,12 +212,13 @@ void yolov8s_fire_smoke_warning(HailoROIPtr roi)
         get label from detection
         use label to call function write txt 
     */
-   for(auto detection : high_confident_detections){
+   for(auto &detection : detections){
         std::string label = detection.get_label();
         
         write_txt(label, data_fire_warning);
 
    }
+    arena.add_to_roi(roi);
 
 }
 
@@ -217,41 +228,39 @@ void yolov8m(HailoROIPtr roi)
     {
         return;
     }
+    static thread_local common::DetectionArena arena;
     auto post = HailoNMSDecode(roi->get_tensor(DEFAULT_YOLOV8M_OUTPUT_LAYER), common::coco_eighty);
-    auto detections = post.decode<float32_t, common::hailo_bbox_float32_t>();
-    hailo_common::add_detections(roi, detections);
+    post.decode<float32_t, common::hailo_bbox_float32_t>(arena.begin_frame(DEFAULT_MAX_BOXES));
+    arena.add_to_roi(roi);
 }
 
 void yolox(HailoROIPtr roi)
 {
+    static thread_local common::DetectionArena arena;
     auto post = HailoNMSDecode(roi->get_tensor("yolox_nms_postprocess"), common::coco_eighty);
-    auto detections = post.decode<float32_t, common::hailo_bbox_float32_t>();
-    hailo_common::add_detections(roi, detections);
+    post.decode<float32_t, common::hailo_bbox_float32_t>(arena.begin_frame(DEFAULT_MAX_BOXES));
+    arena.add_to_roi(roi);
 }
 
 void yolov5m_vehicles(HailoROIPtr roi)
 {
+    static thread_local common::DetectionArena arena;
     auto post = HailoNMSDecode(roi->get_tensor(DEFAULT_YOLOV5M_VEHICLES_OUTPUT_LAYER), yolo_vehicles_labels);
-    auto detections = post.decode<float32_t, common::hailo_bbox_float32_t>();
-    hailo_common::add_detections(roi, detections);
+    post.decode<float32_t, common::hailo_bbox_float32_t>(arena.begin_frame(DEFAULT_MAX_BOXES));
+    arena.add_to_roi(roi);
 }
 
 void yolov5_no_persons(HailoROIPtr roi)
 {
+    static thread_local common::DetectionArena arena;
     auto post = HailoNMSDecode(roi->get_tensor(DEFAULT_YOLOV5M_OUTPUT_LAYER), common::coco_eighty);
-    auto detections = post.decode<float32_t, common::hailo_bbox_float32_t>();
-    for (auto it = detections.begin(); it != detections.end();)
-    {
-        if (it->get_label() == "person")
-        {
-            it = detections.erase(it);
-        }
-        else
-        {
-            ++it;
-        }
-    }
-    hailo_common::add_detections(roi, detections);
+    std::vector<HailoDetection> &detections = arena.begin_frame(DEFAULT_MAX_BOXES);
+    post.decode<float32_t, common::hailo_bbox_float32_t>(detections);
+    detections.erase(std::remove_if(detections.begin(), detections.end(),
+                                    [](HailoDetection &detection)
+                                    { return detection.get_label() == "person"; }),
+                     detections.end());
+    arena.add_to_roi(roi);
 }
 
 void filter(HailoROIPtr roi)
@@ -207,3 +207,133 @@ std::pair<float, float> YoloXOL::get_shape(uint row, uint col, uint anchor, uint
     h = expf(_bbox->get_full_percision(row, col, 3, _is_uint16)) / _height;
     return std::pair<float, float>(w, h);
 }
+
+void YoloOutputLayer::set_plan_source(YoloPlanSource &source, HailoTensorPtr tensor, uint channel, uint anchor_stride, bool is_uint16)
+{
+    source.tensor_ptr = tensor;
+    source.channel = channel;
+    source.anchor_stride = anchor_stride;
+    source.features = tensor->features();
+    source.is_uint16 = is_uint16;
+}
+
+void YoloOutputLayer::fill_plan_tables(YoloLayerPlan &plan)
+{
+    // One entry per quantized value, each computed the same way the getters compute it
+    auto make_table = [](YoloPlanSource &source, auto transform)
+    {
+        std::vector<float> table(source.is_uint16 ? UINT16_MAX + 1 : UINT8_MAX + 1);
+        for (uint value = 0; value < table.size(); value++)
+            table[value] = transform(source.tensor_ptr->fix_scale(value));
+        return table;
+    };
+    plan.objectness_table = make_table(plan.objectness, [this](float value)
+                                       { return _perform_sigmoid ? sigmoid(value) : value; });
+    plan.center_table = make_table(plan.center, [this](float value)
+                                   { return plan_center(value); });
+    plan.shape_table = make_table(plan.shape, [this](float value)
+                                  { return plan_shape(value); });
+    plan.class_table.resize(plan.classes.is_uint16 ? UINT16_MAX + 1 : UINT8_MAX + 1);
+    for (uint value = 0; value < plan.class_table.size(); value++)
+        plan.class_table[value] = get_class_conf(value);
+}
+
+void YoloOutputLayer::fill_plan(YoloLayerPlan &plan, uint image_width, uint image_height)
+{
+    // Single tensor layout: per anchor [x, y, w, h, objectness, classes...]
+    uint anchor_stride = _tensor->features() / NUM_ANCHORS;
+    plan.width = _width;
+    plan.height = _height;
+    plan.num_anchors = NUM_ANCHORS;
+    plan.num_classes = _num_classes;
+    plan.label_offset = label_offset;
+    set_plan_source(plan.objectness, _tensor, CONF_CHANNEL_OFFSET, anchor_stride, _is_uint16);
+    set_plan_source(plan.classes, _tensor, CLASS_CHANNEL_OFFSET, anchor_stride, _is_uint16);
+    set_plan_source(plan.center, _tensor, 0, anchor_stride, _is_uint16);
+    set_plan_source(plan.shape, _tensor, NUM_CENTERS, anchor_stride, _is_uint16);
+    plan.anchor_w.clear();
+    plan.anchor_h.clear();
+    for (uint anchor = 0; anchor < NUM_ANCHORS; anchor++)
+    {
+        plan.anchor_w.push_back(_anchors[anchor * 2]);
+        plan.anchor_h.push_back(_anchors[anchor * 2 + 1]);
+    }
+    plan.shape_divisor_w = image_width;
+    plan.shape_divisor_h = image_height;
+    fill_plan_tables(plan);
+}
+
+float Yolov5OL::plan_center(float value)
+{
+    return value * 2.0f - 0.5f;
+}
+
+float Yolov5OL::plan_shape(float value)
+{
+    return pow(2.0f * value, 2.0f);
+}
+
+float Yolov3OL::plan_center(float value)
+{
+    return sigmoid(value);
+}
+
+float TinyYolov4OL::plan_center(float value)
+{
+    return sigmoid(value) * SCALE_XY - 0.5f * (SCALE_XY - 1);
+}
+
+float Yolov4OL::plan_center(float value)
+{
+    if (_perform_sigmoid)
+        value = sigmoid(value);
+    return value * SCALE_XY - 0.5f * (SCALE_XY - 1);
+}
+
+void Yolov4OL::fill_plan(YoloLayerPlan &plan, uint image_width, uint image_height)
+{
+    // Separate centers, scales, objectness and classes tensors, class probabilities are read as uint8
+    plan.width = _width;
+    plan.height = _height;
+    plan.num_anchors = NUM_ANCHORS;
+    plan.num_classes = _num_classes;
+    plan.label_offset = label_offset;
+    set_plan_source(plan.objectness, _obj, 0, 1, _is_uint16);
+    set_plan_source(plan.classes, _cls, 0, _num_classes, false);
+    set_plan_source(plan.center, _center, 0, _center->features() / NUM_ANCHORS, _is_uint16);
+    set_plan_source(plan.shape, _scale, 0, _scale->features() / NUM_ANCHORS, _is_uint16);
+    plan.anchor_w.clear();
+    plan.anchor_h.clear();
+    for (uint anchor = 0; anchor < NUM_ANCHORS; anchor++)
+    {
+        plan.anchor_w.push_back(_anchors[anchor * 2]);
+        plan.anchor_h.push_back(_anchors[anchor * 2 + 1]);
+    }
+    plan.shape_divisor_w = image_width;
+    plan.shape_divisor_h = image_height;
+    fill_plan_tables(plan);
+}
+
+float YoloXOL::plan_center(float value)
+{
+    return value;
+}
+
+void YoloXOL::fill_plan(YoloLayerPlan &plan, uint image_width, uint image_height)
+{
+    // Anchor free: one prediction per cell, the box size is relative to the grid
+    plan.width = _width;
+    plan.height = _height;
+    plan.num_anchors = YoloXOL::NUM_ANCHORS;
+    plan.num_classes = _num_classes;
+    plan.label_offset = label_offset;
+    set_plan_source(plan.objectness, _obj, 0, 0, _is_uint16);
+    set_plan_source(plan.classes, _cls, 0, 0, false);
+    set_plan_source(plan.center, _bbox, 0, 0, _is_uint16);
+    set_plan_source(plan.shape, _bbox, NUM_CENTERS, 0, _is_uint16);
+    plan.anchor_w = {1.0f};
+    plan.anchor_h = {1.0f};
+    plan.shape_divisor_w = _width;
+    plan.shape_divisor_h = _height;
+    fill_plan_tables(plan);
+}
@@ -5,6 +5,73 @@
 #pragma once
 #include "hailo_objects.hpp"
 #include <iostream>
+#include <cmath>
+#include <vector>
+#include <string>
+
+/**
+ * @brief Where one quantity (objectness, classes, center or shape) of an output layer is read from.
+ *        The channel of anchor a is channel + a * anchor_stride.
+ */
+struct YoloPlanSource
+{
+    uint tensor = 0;        // index of the tensor in roi->get_tensors()
+    uint channel = 0;       // channel of the quantity for the first anchor
+    uint anchor_stride = 0; // channel distance between consecutive anchors
+    uint features = 0;      // number of channels of the tensor (pixel stride)
+    bool is_uint16 = false;
+    HailoTensorPtr tensor_ptr; // only set while the plan is built
+};
+
+/**
+ * @brief Decode description of one output layer: channel offsets and lookup tables indexed by the quantized values.
+ */
+struct YoloLayerPlan
+{
+    uint width = 0;
+    uint height = 0;
+    uint num_anchors = 0;
+    uint num_classes = 0;
+    int label_offset = 1;
+    YoloPlanSource objectness;
+    YoloPlanSource classes;
+    YoloPlanSource center;
+    YoloPlanSource shape;
+    std::vector<float> objectness_table; // quantized objectness -> confidence
+    std::vector<float> class_table;      // quantized class probability -> class confidence
+    std::vector<float> center_table;     // quantized center -> offset inside the grid cell
+    std::vector<float> shape_table;      // quantized scale -> scale factor of the anchor
+    // The box size is shape_table[q] * anchor_w[a] / shape_divisor_w (resp. h)
+    std::vector<float> anchor_w;
+    std::vector<float> anchor_h;
+    float shape_divisor_w = 1.0f;
+    float shape_divisor_h = 1.0f;
+    uint objectness_threshold = 0; // smallest quantized objectness that passes the detection threshold
+};
+
+/**
+ * @brief Decode plan of a whole network, built on the first frame and cached in the params.
+ */
+struct YoloDecodePlan
+{
+    size_t network = 0;                    // hash of the post-process type that built the plan
+    std::vector<std::string> tensor_names; // expected name of every tensor in roi->get_tensors()
+    std::vector<YoloLayerPlan> layers;
+    std::vector<std::string> labels; // labels by class id
+    bool valid = false;
+
+    bool matches(size_t network_hash, std::vector<HailoTensorPtr> &tensors) const
+    {
+        if (!valid || network != network_hash || tensors.size() != tensor_names.size())
+            return false;
+        for (uint i = 0; i < tensors.size(); i++)
+        {
+            if (tensors[i]->name() != tensor_names[i])
+                return false;
+        }
+        return true;
+    }
+};
 
 /**
  * @brief Base class to represent OutputLayer of Yolo networks.
@@ -80,12 +147,36 @@ public:
      * @return std::pair<float, float> pair of w,h of the shape of this prediction.
      */
     virtual std::pair<float, float> get_shape(uint row, uint col, uint anchor, uint image_width, uint image_height) = 0;
+    /**
+     * @brief Describe this layer in a decode plan, the tables give the same values as the getters above.
+     *
+     * @param plan
+     * @param image_width
+     * @param image_height
+     */
+    virtual void fill_plan(YoloLayerPlan &plan, uint image_width, uint image_height);
 
 protected:
     bool _perform_sigmoid;
     bool _is_uint16;
     HailoTensorPtr _tensor;
     float sigmoid(float x);
+    /**
+     * @brief Center offset inside the grid cell, from the dequantized center value
+     *
+     * @param value
+     * @return float
+     */
+    virtual float plan_center(float value) = 0;
+    /**
+     * @brief Scale factor of the anchor, from the dequantized shape value
+     *
+     * @param value
+     * @return float
+     */
+    virtual float plan_shape(float value) { return expf(value); }
+    void fill_plan_tables(YoloLayerPlan &plan);
+    static void set_plan_source(YoloPlanSource &source, HailoTensorPtr tensor, uint channel, uint anchor_stride, bool is_uint16);
     /**
      * @brief Get the class channel object
      *
@@ -126,6 +217,9 @@ public:
     virtual std::pair<float, float> get_center(uint row, uint col, uint anchor);
     virtual float get_class_conf(uint prob_max);
     virtual std::pair<float, float> get_shape(uint row, uint col, uint anchor, uint image_width, uint image_height);
+
+protected:
+    virtual float plan_center(float value);
 };
 
 class TinyYolov4OL : public YoloOutputLayer
@@ -147,6 +241,9 @@ public:
     virtual std::pair<float, float> get_center(uint row, uint col, uint anchor);
     virtual float get_class_conf(uint prob_max);
     virtual std::pair<float, float> get_shape(uint row, uint col, uint anchor, uint image_width, uint image_height);
+
+protected:
+    virtual float plan_center(float value);
 };
 
 class Yolov4OL : public YoloOutputLayer
@@ -176,8 +273,10 @@ public:
     virtual uint get_class_prob(uint row, uint col, uint anchor, uint channel);
     virtual float get_class_conf(uint prob_max);
     virtual std::pair<float, float> get_shape(uint row, uint col, uint anchor, uint image_width, uint image_height);
+    virtual void fill_plan(YoloLayerPlan &plan, uint image_width, uint image_height);
 
 protected:
+    virtual float plan_center(float value);
     HailoTensorPtr _center;
     HailoTensorPtr _scale;
     HailoTensorPtr _obj;
@@ -202,6 +301,10 @@ public:
     virtual float get_class_conf(uint prob_max);
     virtual std::pair<float, float> get_center(uint row, uint col, uint anchor);
     virtual std::pair<float, float> get_shape(uint row, uint col, uint anchor, uint image_width, uint image_height);
+
+protected:
+    virtual float plan_center(float value);
+    virtual float plan_shape(float value);
 };
 
 class YoloXOL : public YoloOutputLayer
@@ -227,8 +330,10 @@ public:
     virtual float get_class_conf(uint prob_max);
     virtual std::pair<float, float> get_center(uint row, uint col, uint anchor);
     virtual std::pair<float, float> get_shape(uint row, uint col, uint anchor, uint image_width, uint image_height);
+    virtual void fill_plan(YoloLayerPlan &plan, uint image_width, uint image_height);
 
 protected:
+    virtual float plan_center(float value);
     HailoTensorPtr _bbox;
     HailoTensorPtr _obj;
     HailoTensorPtr _cls;
@@ -10,6 +10,7 @@
 
 #include "yolo_postprocess.hpp"
 #include "common/nms.hpp"
+#include "common/quantization.hpp"
 #include "json_config.hpp"
 
 #include "rapidjson/document.h"
@@ -26,44 +27,28 @@ namespace fs = std::filesystem;
 namespace fs = std::experimental::filesystem;
 #endif
 
+static const std::map<std::string, common::nms_mode_t> nms_modes = {
+    {"hard", common::NMS_MODE_HARD},
+    {"soft_linear", common::NMS_MODE_SOFT_LINEAR},
+    {"soft_gaussian", common::NMS_MODE_SOFT_GAUSSIAN},
+    {"diou", common::NMS_MODE_DIOU}};
+
+/**
+ * @brief Base of the yolo post-processes: resolves the output layers of a network
+ *        and describes them in a decode plan, which is then reused by every frame.
+ */
 class YoloPost
 {
 protected:
     std::vector<std::shared_ptr<YoloOutputLayer>> _layers;
-    uint _max_boxes;
-    float _detection_thr;
-    float _iou_thr;
     uint m_image_width;
     uint m_image_height;
     std::map<uint8_t, std::string> m_dataset;
 
 public:
     virtual ~YoloPost() = default;
-    YoloPost(std::map<uint8_t, std::string> dataset,
-             float detection_threshold,
-             float iou_threshold,
-             uint max_boxes)
-        : _max_boxes(max_boxes), _detection_thr(detection_threshold),
-          _iou_thr(iou_threshold), m_dataset(dataset){};
-
-    std::vector<HailoDetection> decode()
-    {
-        std::vector<HailoDetection> objects;
-        objects.reserve(_max_boxes);
-        for (auto layer : _layers)
-        {
-            extract_boxes(layer, objects);
-        }
-        common::nms(objects, _iou_thr);
-        if (objects.size() > _max_boxes)
-        {
-            HailoBBox bbox(0, 0, 1, 1);
-            HailoDetection empty_detection(bbox, "None", 0.0);
-            objects.resize(_max_boxes, empty_detection);
-        }
-
-        return objects;
-    }
+    YoloPost(std::map<uint8_t, std::string> dataset)
+        : m_dataset(dataset){};
 
     uint get_num_classes()
     {
@@ -71,53 +56,205 @@ public:
     }
 
     /**
-     * @brief Extract the boxes of generic yolo output layer.
+     * @brief Build the decode plan of the output layers.
      *
-     * @param[in] image_size Network's input image width/height.
-     * @param[in] thr Postprocess threshold.
+     * @param[in] tensors The tensors of the roi, in roi->get_tensors() order.
+     * @param[in] network Hash of the post-process type, identifies the plan.
+     * @param[in] threshold Detection threshold, folded into the quantized objectness threshold.
+     * @return YoloDecodePlan
+     */
+    YoloDecodePlan make_plan(std::vector<HailoTensorPtr> &tensors, size_t network, float threshold);
+
+    /**
+     * @brief Extract the boxes of one output layer with its decode plan.
+     *
+     * @param[in] layer The layer plan.
+     * @param[in] plan The network plan.
+     * @param[in] tensors The tensors of the roi.
+     * @param[in] threshold Detection threshold.
      * @param[out] objects Reference to vector of detections.
      */
-    void extract_boxes(std::shared_ptr<YoloOutputLayer> layer,
-                       std::vector<HailoDetection> &objects);
+    template <typename T, typename C>
+    static void extract_boxes(const YoloLayerPlan &layer,
+                              const YoloDecodePlan &plan,
+                              std::vector<HailoTensorPtr> &tensors,
+                              float threshold,
+                              std::vector<HailoDetection> &objects);
 };
 
-void YoloPost::extract_boxes(std::shared_ptr<YoloOutputLayer> layer,
+YoloDecodePlan YoloPost::make_plan(std::vector<HailoTensorPtr> &tensors, size_t network, float threshold)
+{
+    YoloDecodePlan plan;
+    plan.network = network;
+    for (auto &tensor : tensors)
+        plan.tensor_names.push_back(tensor->name());
+
+    for (auto &layer : _layers)
+    {
+        YoloLayerPlan layer_plan;
+        layer->fill_plan(layer_plan, m_image_width, m_image_height);
+        // Resolve the tensors of the layer to their position in the roi tensors
+        for (YoloPlanSource *source : {&layer_plan.objectness, &layer_plan.classes, &layer_plan.center, &layer_plan.shape})
+        {
+            auto tensor_it = std::find_if(tensors.begin(), tensors.end(),
+                                          [source](const HailoTensorPtr &tensor)
+                                          { return tensor->name() == source->tensor_ptr->name(); });
+            if (tensor_it == tensors.end())
+                throw std::runtime_error("Yolo output layer tensor " + source->tensor_ptr->name() + " is not an output of the roi");
+            source->tensor = tensor_it - tensors.begin();
+            source->tensor_ptr = nullptr;
+        }
+        // The objectness decode (dequantize, then sigmoid or identity) is monotonic, so the detection threshold
+        // maps to the smallest passing quantized value and cells are rejected before anything is decoded
+        const std::vector<float> &objectness_table = layer_plan.objectness_table;
+        if (std::is_sorted(objectness_table.begin(), objectness_table.end()))
+            layer_plan.objectness_threshold = std::partition_point(objectness_table.begin(), objectness_table.end(),
+                                                                   [threshold](float confidence)
+                                                                   { return confidence < threshold; }) -
+                                              objectness_table.begin();
+        else
+            layer_plan.objectness_threshold = 0;
+        plan.layers.push_back(std::move(layer_plan));
+    }
+
+    // Flat labels array, so the decode loop does not look up (or insert into) the labels map
+    uint num_classes = _layers.empty() ? 0 : get_num_classes();
+    plan.labels.resize(num_classes + 1);
+    for (uint class_id = 0; class_id <= num_classes; class_id++)
+    {
+        auto label_it = m_dataset.find(class_id);
+        if (label_it != m_dataset.end())
+            plan.labels[class_id] = label_it->second;
+    }
+    plan.valid = true;
+    return plan;
+}
+
+template <typename T, typename C>
+void YoloPost::extract_boxes(const YoloLayerPlan &layer,
+                             const YoloDecodePlan &plan,
+                             std::vector<HailoTensorPtr> &tensors,
+                             float threshold,
                              std::vector<HailoDetection> &objects)
 {
-    uint class_id = 0;
-    float x, y, h, w, confidence, class_confidence = 0.0f;
-    float xmin, ymin = 0.0f;
-    for (uint row = 0; row < layer->_height; ++row)
+    const T *objectness_data = reinterpret_cast<const T *>(tensors[layer.objectness.tensor]->data()) + layer.objectness.channel;
+    const C *classes_data = reinterpret_cast<const C *>(tensors[layer.classes.tensor]->data()) + layer.classes.channel;
+    const T *center_data = reinterpret_cast<const T *>(tensors[layer.center.tensor]->data()) + layer.center.channel;
+    const T *shape_data = reinterpret_cast<const T *>(tensors[layer.shape.tensor]->data()) + layer.shape.channel;
+    const float *objectness_table = layer.objectness_table.data();
+    const float *class_table = layer.class_table.data();
+    const float *center_table = layer.center_table.data();
+    const float *shape_table = layer.shape_table.data();
+
+    const uint objectness_threshold = layer.objectness_threshold;
+
+    auto decode_candidate = [&](uint row, uint col, uint anchor)
     {
-        for (uint col = 0; col < layer->_width; ++col)
+        const uint cell = row * layer.width + col;
+        float confidence = objectness_table[objectness_data[cell * layer.objectness.features + anchor * layer.objectness.anchor_stride]];
+        if (confidence < threshold)
+            return;
+
+        // The class with the highest quantized probability
+        const C *class_probs = classes_data + cell * layer.classes.features + anchor * layer.classes.anchor_stride;
+        uint class_id = 1;
+        uint prob_max = 0;
+        for (uint class_index = layer.label_offset; class_index <= layer.num_classes; class_index++)
         {
-            for (uint anchor = 0; anchor < layer->NUM_ANCHORS; ++anchor)
+            if (class_probs[class_index - 1] > prob_max)
             {
-                confidence = layer->get_confidence(row, col, anchor);
-                if (confidence < _detection_thr)
-                    continue;
-                std::tie(class_id, class_confidence) = layer->get_class(row, col, anchor);
-                // Final confidence: box confidence * class probability
-                confidence = confidence * class_confidence;
-                if (confidence > _detection_thr)
-                {
-                    std::tie(x, y) = layer->get_center(row, col, anchor);
-                    std::tie(w, h) = layer->get_shape(row, col, anchor, m_image_width, m_image_height);
-                    // Get the top left corner of the object.
-                    xmin = (x - (w / 2.0f));
-                    ymin = (y - (h / 2.0f));
-                    objects.push_back(HailoDetection(HailoBBox(xmin, ymin, w, h), class_id, m_dataset[class_id], confidence));
-                }
+                class_id = class_index;
+                prob_max = class_probs[class_index - 1];
+            }
+        }
+        // Final confidence: box confidence * class probability
+        confidence = confidence * class_table[prob_max];
+        if (confidence > threshold)
+        {
+            const T *center = center_data + cell * layer.center.features + anchor * layer.center.anchor_stride;
+            const T *shape = shape_data + cell * layer.shape.features + anchor * layer.shape.anchor_stride;
+            float x = (center_table[center[0]] + col) / layer.width;
+            float y = (center_table[center[1]] + row) / layer.height;
+            float w = shape_table[shape[0]] * layer.anchor_w[anchor] / layer.shape_divisor_w;
+            float h = shape_table[shape[1]] * layer.anchor_h[anchor] / layer.shape_divisor_h;
+            // Get the top left corner of the object.
+            float xmin = (x - (w / 2.0f));
+            float ymin = (y - (h / 2.0f));
+            objects.emplace_back(HailoBBox(xmin, ymin, w, h), class_id, plan.labels[class_id], confidence);
+        }
+    };
+
+    // Objectness-only tensors (yolov4, yolox) hold the objectness of a row contiguously,
+    // so whole rows are scanned with SIMD compares. Otherwise the objectness is strided by the
+    // class channels and each anchor is rejected with one integer compare.
+    const bool contiguous_objectness = (layer.objectness.features == layer.num_anchors) &&
+                                       (layer.num_anchors == 1 || layer.objectness.anchor_stride == 1);
+    for (uint row = 0; row < layer.height; ++row)
+    {
+        if (contiguous_objectness)
+        {
+            const T *row_objectness = objectness_data + row * layer.width * layer.num_anchors;
+            common::for_each_above_threshold(row_objectness, layer.width * layer.num_anchors, objectness_threshold,
+                                             [&](uint index)
+                                             { decode_candidate(row, index / layer.num_anchors, index % layer.num_anchors); });
+            continue;
+        }
+        for (uint col = 0; col < layer.width; ++col)
+        {
+            const T *cell_objectness = objectness_data + (row * layer.width + col) * layer.objectness.features;
+            for (uint anchor = 0; anchor < layer.num_anchors; ++anchor)
+            {
+                if (cell_objectness[anchor * layer.objectness.anchor_stride] >= objectness_threshold)
+                    decode_candidate(row, col, anchor);
             }
         }
     }
 }
 
+/**
+ * @brief Decode the roi with the decode plan cached in the params,
+ *        the plan is (re)built by PostProcess on the first frame or when the outputs change.
+ *
+ * @param roi The roi holding the output tensors.
+ * @param params The post-process params, holding the plan.
+ * @return std::vector<HailoDetection>& The detections after NMS, stored in params->arena.
+ */
+template <typename PostProcess>
+std::vector<HailoDetection> &decode_with_plan(HailoROIPtr roi, YoloParams *params)
+{
+    std::vector<HailoDetection> &objects = params->arena.begin_frame(params->max_boxes);
+    std::vector<HailoTensorPtr> tensors = roi->get_tensors();
+    if (tensors.empty())
+        return objects;
+
+    const size_t network = typeid(PostProcess).hash_code();
+    if (!params->decode_plan.matches(network, tensors))
+    {
+        PostProcess post(roi, params);
+        params->decode_plan = post.make_plan(tensors, network, params->detection_threshold);
+    }
+
+    const YoloDecodePlan &plan = params->decode_plan;
+    for (const YoloLayerPlan &layer : plan.layers)
+    {
+        if (layer.objectness.is_uint16 && layer.classes.is_uint16)
+            YoloPost::extract_boxes<uint16_t, uint16_t>(layer, plan, tensors, params->detection_threshold, objects);
+        else if (layer.objectness.is_uint16)
+            YoloPost::extract_boxes<uint16_t, uint8_t>(layer, plan, tensors, params->detection_threshold, objects);
+        else
+            YoloPost::extract_boxes<uint8_t, uint8_t>(layer, plan, tensors, params->detection_threshold, objects);
+    }
+    // NMS stops once max_boxes detections survived, soft-NMS drops the boxes decayed under the detection threshold
+    common::nms_by_mode(objects, params->iou_threshold, nms_modes.at(params->nms_mode), false, params->max_boxes,
+                        params->soft_nms_sigma, params->detection_threshold);
+    return objects;
+}
+
 class Yolov5 : public YoloPost
 {
 public:
     Yolov5(HailoROIPtr roi, YoloParams *params)
-        : YoloPost(params->labels, params->detection_threshold, params->iou_threshold, params->max_boxes), _tensors(roi->get_tensors())
+        : YoloPost(params->labels), _tensors(roi->get_tensors())
     {
         if (_tensors.size() > 0)
         {
@@ -148,7 +285,7 @@ class Yolov3 : public YoloPost
 {
 public:
     Yolov3(HailoROIPtr roi, YoloParams *params)
-        : YoloPost(params->labels, params->detection_threshold, params->iou_threshold, params->max_boxes), _tensors(roi->get_tensors())
+        : YoloPost(params->labels), _tensors(roi->get_tensors())
     {
         if (_tensors.size() > 0)
         {
@@ -178,7 +315,7 @@ class TinyYolov4LicensePlates : public YoloPost
 {
 public:
     TinyYolov4LicensePlates(HailoROIPtr roi, YoloParams *params)
-        : YoloPost(params->labels, params->detection_threshold, params->iou_threshold, params->max_boxes), _tensors(roi->get_tensors())
+        : YoloPost(params->labels), _tensors(roi->get_tensors())
     {
         if (_tensors.size() > 0)
         {
@@ -209,7 +346,7 @@ class Yolov4 : public YoloPost
 {
 public:
     Yolov4(HailoROIPtr roi, YoloParams *params)
-        : YoloPost(params->labels, params->detection_threshold, params->iou_threshold, params->max_boxes), _roi(roi)
+        : YoloPost(params->labels), _roi(roi)
     {
         if (_roi->has_tensors())
         {
@@ -247,7 +384,7 @@ class YoloX : public YoloPost
 {
 public:
     YoloX(HailoROIPtr roi, YoloParams *params)
-        : YoloPost(params->labels, params->detection_threshold, params->iou_threshold, params->max_boxes), _roi(roi)
+        : YoloPost(params->labels), _roi(roi)
     {
         if (_roi->has_tensors())
         {
@@ -278,14 +415,13 @@ protected:
 void yolov5_no_persons(HailoROIPtr roi, void *params_void_ptr)
 {
     YoloParams *params = reinterpret_cast<YoloParams *>(params_void_ptr);
-    auto post = Yolov5(roi, params);
-    auto detections = post.decode();
+    auto &detections = decode_with_plan<Yolov5>(roi, params);
     int person_class_id = 1;
     detections.erase(std::remove_if(detections.begin(), detections.end(),
-                                    [person_class_id](HailoDetection obj)
+                                    [person_class_id](HailoDetection &obj)
                                     { return obj.get_class_id() == person_class_id; }),
                      detections.end());
-    hailo_common::add_detections(roi, detections);
+    params->arena.add_to_roi(roi);
 }
 
 void yolov5_no_faces(HailoROIPtr roi, void *params_void_ptr)
@@ -293,14 +429,13 @@ void yolov5_no_faces(HailoROIPtr roi, void *params_void_ptr)
     YoloParams *params = reinterpret_cast<YoloParams *>(params_void_ptr);
 
     // Yolov5 Postprocess for faces
-    auto post = Yolov5(roi, params);
-    auto detections = post.decode();
+    auto &detections = decode_with_plan<Yolov5>(roi, params);
 
     // yolov5_personface but no faces are added
     for (auto &det : detections)
     {
         if (det.get_label() == "person")
-            hailo_common::add_object(roi, std::make_shared<HailoDetection>(det));
+            hailo_common::add_object(roi, std::make_shared<HailoDetection>(std::move(det)));
     }
 }
 
@@ -309,8 +444,7 @@ void yolov5_no_faces_letterbox(HailoROIPtr roi, void *params_void_ptr)
     YoloParams *params = reinterpret_cast<YoloParams *>(params_void_ptr);
     HailoBBox roi_bbox = hailo_common::create_flattened_bbox(roi->get_bbox(), roi->get_scaling_bbox());
 
-    auto post = Yolov5(roi, params);
-    auto detections = post.decode();
+    auto &detections = decode_with_plan<Yolov5>(roi, params);
     for (auto &detection : detections)
     {
         if (detection.get_label() == "person")
@@ -327,7 +461,7 @@ void yolov5_no_faces_letterbox(HailoROIPtr roi, void *params_void_ptr)
         else
         {
             detections.erase(std::remove_if(detections.begin(), detections.end(),
-                                            [](HailoDetection obj)
+                                            [](HailoDetection &obj)
                                             { return obj.get_label() == "face"; }),
                              detections.end());
         }
@@ -337,7 +471,7 @@ void yolov5_no_faces_letterbox(HailoROIPtr roi, void *params_void_ptr)
     roi->clear_scaling_bbox();
 
     // Add detections to main roi.
-    hailo_common::add_detections(roi, detections);
+    params->arena.add_to_roi(roi);
 }
 
 void yolov5_personface_letterbox(HailoROIPtr roi, void *params_void_ptr)
@@ -346,8 +480,7 @@ void yolov5_personface_letterbox(HailoROIPtr roi, void *params_void_ptr)
     HailoBBox roi_bbox = hailo_common::create_flattened_bbox(roi->get_bbox(), roi->get_scaling_bbox());
 
     // Yolov5 Postprocess for faces
-    auto post = Yolov5(roi, params);
-    auto detections = post.decode();
+    auto &detections = decode_with_plan<Yolov5>(roi, params);
     for (auto &detection : detections)
     {
         auto detection_bbox = detection.get_bbox();
@@ -364,7 +497,7 @@ void yolov5_personface_letterbox(HailoROIPtr roi, void *params_void_ptr)
     roi->clear_scaling_bbox();
 
     // Add detections to main roi.
-    hailo_common::add_detections(roi, detections);
+    params->arena.add_to_roi(roi);
 }
 
 void yolov5_personface(HailoROIPtr roi, void *params_void_ptr)
@@ -372,59 +505,52 @@ void yolov5_personface(HailoROIPtr roi, void *params_void_ptr)
     YoloParams *params = reinterpret_cast<YoloParams *>(params_void_ptr);
 
     // Yolov5 Postprocess for faces
-    auto post = Yolov5(roi, params);
-    auto detections = post.decode();
+    decode_with_plan<Yolov5>(roi, params);
 
     // Add detections to main roi.
-    hailo_common::add_detections(roi, detections);
+    params->arena.add_to_roi(roi);
 }
 
 void yolov5_vehicles_only(HailoROIPtr roi, void *params_void_ptr)
 {
     YoloParams *params = reinterpret_cast<YoloParams *>(params_void_ptr);
-    auto post = Yolov5(roi, params);
-    auto detections = post.decode();
-    hailo_common::add_detections(roi, detections);
+    decode_with_plan<Yolov5>(roi, params);
+    params->arena.add_to_roi(roi);
 }
 
 void yolov5(HailoROIPtr roi, void *params_void_ptr)
 {
     YoloParams *params = reinterpret_cast<YoloParams *>(params_void_ptr);
-    auto post = Yolov5(roi, params);
-    auto detections = post.decode();
-    hailo_common::add_detections(roi, detections);
+    decode_with_plan<Yolov5>(roi, params);
+    params->arena.add_to_roi(roi);
 }
 
 void yolov3(HailoROIPtr roi, void *params_void_ptr)
 {
     YoloParams *params = reinterpret_cast<YoloParams *>(params_void_ptr);
-    auto post = Yolov3(roi, params);
-    auto detections = post.decode();
-    hailo_common::add_detections(roi, detections);
+    decode_with_plan<Yolov3>(roi, params);
+    params->arena.add_to_roi(roi);
 }
 
 void yolov4(HailoROIPtr roi, void *params_void_ptr)
 {
     YoloParams *params = reinterpret_cast<YoloParams *>(params_void_ptr);
-    auto post = Yolov4(roi, params);
-    auto detections = post.decode();
-    hailo_common::add_detections(roi, detections);
+    decode_with_plan<Yolov4>(roi, params);
+    params->arena.add_to_roi(roi);
 }
 
 void tiny_yolov4_license_plates(HailoROIPtr roi, void *params_void_ptr)
 {
     YoloParams *params = reinterpret_cast<YoloParams *>(params_void_ptr);
-    auto post = TinyYolov4LicensePlates(roi, params);
-    auto detections = post.decode();
-    hailo_common::add_detections(roi, detections);
+    decode_with_plan<TinyYolov4LicensePlates>(roi, params);
+    params->arena.add_to_roi(roi);
 }
 
 void yolox(HailoROIPtr roi, void *params_void_ptr)
 {
     YoloParams *params = reinterpret_cast<YoloParams *>(params_void_ptr);
-    auto post = YoloX(roi, params);
-    auto detections = post.decode();
-    hailo_common::add_detections(roi, detections);
+    decode_with_plan<YoloX>(roi, params);
+    params->arena.add_to_roi(roi);
 }
 
 void filter(HailoROIPtr roi, void *params_void_ptr)
@@ -485,6 +611,15 @@ YoloParams *init(const std::string config_path, const std::string function_name)
             "max_boxes": {
             "type": "integer"
             },
+            "nms_mode": {
+            "type": "string",
+            "enum": ["hard", "soft_linear", "soft_gaussian", "diou"]
+            },
+            "soft_nms_sigma": {
+            "type": "number",
+            "minimum": 0,
+            "exclusiveMinimum": true
+            },
             "anchors": {
             "type": "array",
             "items": {
@@ -553,6 +688,10 @@ YoloParams *init(const std::string config_path, const std::string function_name)
             params->output_activation = doc_config_json["output_activation"].GetString();
             params->label_offset = doc_config_json["label_offset"].GetInt();
             params->max_boxes = doc_config_json["max_boxes"].GetInt();
+            if (doc_config_json.HasMember("nms_mode"))
+                params->nms_mode = doc_config_json["nms_mode"].GetString();
+            if (doc_config_json.HasMember("soft_nms_sigma"))
+                params->soft_nms_sigma = doc_config_json["soft_nms_sigma"].GetFloat();
             if (params->output_activation != "sigmoid" && params->output_activation != "none")
             {
                 std::ostringstream oss;
@@ -560,6 +699,13 @@ YoloParams *init(const std::string config_path, const std::string function_name)
                     << params->output_activation << std::endl;
                 throw std::runtime_error(oss.str());
             }
+            if (nms_modes.count(params->nms_mode) == 0)
+            {
+                std::ostringstream oss;
+                oss << "config nms mode is not supported! nms mode: "
+                    << params->nms_mode << std::endl;
+                throw std::runtime_error(oss.str());
+            }
         }
         fclose(fp);
     }
@@ -6,6 +6,7 @@
 #include "hailo_objects.hpp"
 #include "hailo_common.hpp"
 #include "yolo_output.hpp"
+#include "common/detection_arena.hpp"
 #include "common/labels/coco_eighty.hpp"
 
 __BEGIN_DECLS
@@ -21,7 +22,11 @@ public:
     std::vector<std::vector<int>> anchors_vec;
     std::string output_activation; // can be "none" or "sigmoid"
     int label_offset;
-    YoloParams() : iou_threshold(0.45f), detection_threshold(0.3f), output_activation("none"), label_offset(1) {}
+    std::string nms_mode; // can be "hard", "soft_linear", "soft_gaussian" or "diou"
+    float soft_nms_sigma;
+    YoloDecodePlan decode_plan; // built on the first frame
+    common::DetectionArena arena; // detections of the filter, reused across frames
+    YoloParams() : iou_threshold(0.45f), detection_threshold(0.3f), output_activation("none"), label_offset(1), nms_mode("hard"), soft_nms_sigma(0.5f) {}
     void check_params_logic(uint num_classes_tensors);
 };
 
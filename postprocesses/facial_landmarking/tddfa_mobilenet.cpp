@@ -3,30 +3,31 @@
 * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
 **/
 #include <algorithm>
-#include <cmath>
-#include <iostream>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
 #include <string>
 #include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
-#include "xtensor/xio.hpp"
-#include "xtensor/xarray.hpp"
-#include "xtensor/xtensor.hpp"
-#include "xtensor/xpad.hpp"
-#include "xtensor/xshape.hpp"
-#include "xtensor/xsort.hpp"
-#include "xtensor/xstrided_view.hpp"
-#include "xtensor/xview.hpp"
-#include "xtensor/xnpy.hpp"
 #include "tddfa_mobilenet.hpp"
-#include "common/math.hpp"
-#include "common/tensors.hpp"
 #include "const_tensors.hpp"
 
-const char *output_layer_name = "tddfa_mobilenet_v1/fc1"; // there are 62 params
+// The params output (there are 62 params) of each network
+#define OUTPUT_LAYER_NAME "tddfa_mobilenet_v1/fc1"
+#define OUTPUT_LAYER_NAME_YUY2 "tddfa_mobilenet_v1_yuy2/fc1"
 #define TRANS_DIM (12)
 #define SHAPE_DIM (40)
+#define EXP_DIM (10)
+#define BASIS_DIM (SHAPE_DIM + EXP_DIM)
+#define PARAMS_DIM (TRANS_DIM + BASIS_DIM)
 #define OUTPUT_SIZE (68)
+#define VERTEX_DIM (OUTPUT_SIZE * 3)
 #define FACE_HEIGHT (120)
 #define FACE_WIDTH (FACE_HEIGHT)
 
@@ -54,164 +55,266 @@ std::string get_post_proc_data_dir()
         return post_proc_data_dir;
 
     // if not - they should exist in the workspace (x86 structure) - take it from the environment variable
-    std::string tappas_path = std::getenv("TAPPAS_WORKSPACE");
-    if (tappas_path == "")
+    const char *tappas_path = std::getenv("TAPPAS_WORKSPACE");
+    if (tappas_path == nullptr || std::string(tappas_path) == "")
         throw std::invalid_argument("TAPPAS_WORKSPACE environment variable is not set, cannot find post_processes_data directory");
 
-    return tappas_path + "/apps/h8/gstreamer/libs/post_processes/post_processes_data";
+    return std::string(tappas_path) + "/apps/h8/gstreamer/libs/post_processes/post_processes_data";
 }
 
-std::string post_proc_data_dir = get_post_proc_data_dir();
-// read large const arrays from memory
-xt::xarray<float> W_EXP_BASE =
-  xt::load_npy<float>(post_proc_data_dir + "/w_exp_base.npy");
-xt::xarray<float> W_SHP_BASE =
-  xt::load_npy<float>(post_proc_data_dir + "/w_shp_base.npy");
-xt::xarray<float> trans_bfm_u_base = xt::transpose(bfm_u_base);
-
-xt::xarray<float> calc_params_view(xt::xarray<float> face_3dmm_params)
+/**
+ * @brief Map a float32 row-major .npy matrix and copy its columns into a wider row-major matrix.
+ *        The file is mapped rather than read, so only the pages of the data are touched, once.
+ *
+ * @param path  -  std::string
+ *        The .npy file, shaped (rows, cols)
+ *
+ * @param destination  -  float *
+ *        Row r of the file is copied to destination + r * stride
+ */
+void load_npy_columns(const std::string &path, size_t rows, size_t cols, float *destination, size_t stride)
 {
-    xt::xarray<float> face_params_view = xt::view(face_3dmm_params, xt::range(0, TRANS_DIM));
-    return xt::reshape_view(face_params_view, {3, 4});
-}
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("tddfa error: cannot open " + path);
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0)
+    {
+        close(fd);
+        throw std::runtime_error("tddfa error: cannot stat " + path);
+    }
+    size_t file_size = file_stat.st_size;
+    void *mapping = file_size > 0 ? mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error("tddfa error: cannot map " + path);
 
-xt::xarray<float> calc_offset(xt::xarray<float> face_3dmm_params, xt::xarray<float> R_)
-{
-    xt::xarray<float> offset_ = xt::view(R_, xt::all(), -1);
-    xt::xarray<float> offset = xt::reshape_view(offset_, {3, 1});
-    return offset;
+    // Header: magic, version (2 bytes), header length (2 bytes in v1, 4 in v2 and up), then a python dict
+    const char *file = static_cast<const char *>(mapping);
+    std::string error;
+    size_t header_end = 0;
+    std::string header;
+    if (file_size < 10 || std::memcmp(file, "\x93NUMPY", 6) != 0)
+        error = "not a .npy file";
+    else
+    {
+        bool version_1 = file[6] == 1;
+        size_t length_bytes = version_1 ? 2 : 4;
+        size_t header_length = 0;
+        for (size_t i = 0; i < length_bytes; i++)
+            header_length |= size_t(uint8_t(file[8 + i])) << (8 * i);
+        header_end = 8 + length_bytes + header_length;
+        if (header_end > file_size)
+            error = "truncated header";
+        else
+            header.assign(file + 8 + length_bytes, header_length);
+    }
+    std::string expected_shape = "(" + std::to_string(rows) + ", " + std::to_string(cols) + ")";
+    if (error.empty() && (header.find("'<f4'") == std::string::npos ||
+                          header.find("'fortran_order': False") == std::string::npos ||
+                          header.find(expected_shape) == std::string::npos))
+        error = "expected a row-major float32 " + expected_shape + " matrix";
+    if (error.empty() && file_size - header_end < rows * cols * sizeof(float))
+        error = "truncated data";
+
+    if (error.empty())
+    {
+        for (size_t r = 0; r < rows; r++)
+            std::memcpy(destination + r * stride, file + header_end + r * cols * sizeof(float), cols * sizeof(float));
+    }
+    munmap(mapping, file_size);
+    if (!error.empty())
+        throw std::runtime_error("tddfa error: " + path + ": " + error);
 }
 
-// Compute tensor dot product along specified axes for arrays.
-// In this case along axis 1 of the first matrix and axis 0 of the second.
-xt::xarray<float> two_dim_dot_product(xt::xarray<float, xt::layout_type::row_major> matrix_1,
-                                      xt::xarray<float, xt::layout_type::row_major> matrix_2)
+/**
+ * @brief The constant part of the model: the mean face and the fused shape and expression bases.
+ *        The bases are loaded on first use, not when the library is loaded.
+ */
+struct BfmBasis
 {
-    uint axis_length = matrix_1.shape(1);
-    if (axis_length != matrix_2.shape(0))
+    // Row-major VERTEX_DIM x BASIS_DIM: row r is [w_shp_base[r], w_exp_base[r]]
+    std::vector<float> bases;
+    std::vector<float> mean_vertices;
+    std::vector<float> params_std;
+    std::vector<float> params_mean;
+
+    static const BfmBasis &get()
     {
-        throw std::invalid_argument("two_dim_dot_product error: axis don't match!");
+        static const BfmBasis basis;
+        return basis;
     }
 
-    float row_sum;
-    xt::xarray<float>::shape_type shape = {matrix_1.shape(0), matrix_2.shape(1)};
-    xt::xarray<float, xt::layout_type::row_major> product_matrix(shape);
-    for (uint i = 0; i < matrix_1.shape(0); ++i)
+private:
+    BfmBasis() : bases(VERTEX_DIM * BASIS_DIM)
     {
-        for (uint j = 0; j < matrix_2.shape(1); ++j)
-        {
-            row_sum = 0.0;
-            for (uint k = 0; k < axis_length; ++k)
-            {
-                row_sum += matrix_1(i, k) * matrix_2(k, j);
-            }
-            product_matrix(i, j) = row_sum;
-        }
+        std::string post_proc_data_dir = get_post_proc_data_dir();
+        load_npy_columns(post_proc_data_dir + "/w_shp_base.npy", VERTEX_DIM, SHAPE_DIM, bases.data(), BASIS_DIM);
+        load_npy_columns(post_proc_data_dir + "/w_exp_base.npy", VERTEX_DIM, EXP_DIM, bases.data() + SHAPE_DIM, BASIS_DIM);
+        if (bfm_u_base.size() != VERTEX_DIM || TDDFA_RESCALE_PARAMS_STD.size() != PARAMS_DIM ||
+            TDDFA_RESCALE_PARAMS_MEAN.size() != PARAMS_DIM)
+            throw std::runtime_error("tddfa error: the model constants don't match the 62 params");
+        mean_vertices.assign(bfm_u_base.begin(), bfm_u_base.end());
+        params_std.assign(TDDFA_RESCALE_PARAMS_STD.begin(), TDDFA_RESCALE_PARAMS_STD.end());
+        params_mean.assign(TDDFA_RESCALE_PARAMS_MEAN.begin(), TDDFA_RESCALE_PARAMS_MEAN.end());
     }
-    return product_matrix;
-}
+};
 
-xt::xarray<float> calc_trans_sum(xt::xarray<float> face_3dmm_params)
+static inline float basis_dot(const float *basis_row, const float *alpha)
 {
-    xt::xarray<float> raw_alpha_shp = xt::view(face_3dmm_params, xt::range(TRANS_DIM, TRANS_DIM + SHAPE_DIM));
-    xt::xarray<float> alpha_shape = xt::reshape_view(raw_alpha_shp, {40, 1});
-
-    xt::xarray<float> raw_alpha_exp = xt::view(face_3dmm_params, xt::range(TRANS_DIM + SHAPE_DIM, _));
-    xt::xarray<float> alpha_exp = xt::reshape_view(raw_alpha_exp, {10, 1});
-    xt::xarray<float> shape_mul = two_dim_dot_product(W_SHP_BASE, alpha_shape);
-    xt::xarray<float> exp_mul = two_dim_dot_product(W_EXP_BASE, alpha_exp);
-
-    xt::xarray<float> sum = trans_bfm_u_base + shape_mul + exp_mul;
-    xt::xarray<float> reshape_sum = xt::reshape_view(sum, {OUTPUT_SIZE, 3});
-    xt::xarray<float> trans_sum = xt::transpose(reshape_sum);
-    return trans_sum;
+    // Independent partial sums, so the loop vectorizes without reassociating a single sum
+    float sums[8] = {0};
+    for (int k = 0; k < BASIS_DIM / 8 * 8; k += 8)
+    {
+        for (int lane = 0; lane < 8; lane++)
+            sums[lane] += basis_row[k + lane] * alpha[k + lane];
+    }
+    float sum = 0.0f;
+    for (int k = BASIS_DIM / 8 * 8; k < BASIS_DIM; k++)
+        sum += basis_row[k] * alpha[k];
+    for (int lane = 0; lane < 8; lane++)
+        sum += sums[lane];
+    return sum;
 }
 
-xt::xarray<float> BFM(xt::xarray<float> bfm_params_xarray)
+/**
+ * @brief Solve the 68 landmarks of a batch of faces from their 3DMM params.
+ *        The vertices of all the faces are one product of the fused bases with the stacked
+ *        shape and expression coefficients, walked point by point: the three basis rows of a point
+ *        stay in cache while every face uses them, and the rotation and offset of each face are applied
+ *        as soon as its vertex is summed, so no intermediate vertex matrix is built.
+ *
+ * @param params  -  const float *
+ *        faces x 62 normalized params (as output by the network)
+ *
+ * @param faces  -  size_t
+ *        The number of faces
+ *
+ * @param landmarks  -  float *
+ *        faces x 68 x 2, the landmarks relative to each face
+ */
+void solve_landmarks(const float *params, size_t faces, float *landmarks)
 {
-    // this is the implementation of the Basel face model
-
-    // normalization:
-    xt::xarray<float> face_3dmm_params = (bfm_params_xarray * TDDFA_RESCALE_PARAMS_STD) + TDDFA_RESCALE_PARAMS_MEAN;
-    xt::xarray<float> face_params_view = calc_params_view(face_3dmm_params);
-    xt::xarray<float> offset = calc_offset(face_3dmm_params, face_params_view);
-    xt::xarray<float> transposed_sum = calc_trans_sum(face_3dmm_params);
-    xt::xarray<float> reshaped_params = xt::view(face_params_view, xt::all(), xt::range(0, 3));
-    // perform normal tensor dot operation- one the first tensor iterate the colums ({1}) and
-    // on the second tensor iterate the rows ({0})
-    xt::xarray<float> mul = two_dim_dot_product(reshaped_params, transposed_sum);
-    xt::xarray<float> trans_raw_landmarks = mul + offset;
-    return trans_raw_landmarks;
+    const BfmBasis &basis = BfmBasis::get();
+    thread_local std::vector<float> poses;
+    thread_local std::vector<float> alphas;
+    poses.resize(faces * TRANS_DIM);
+    alphas.resize(faces * BASIS_DIM);
+    for (size_t f = 0; f < faces; f++)
+    {
+        const float *face_params = params + f * PARAMS_DIM;
+        for (int i = 0; i < TRANS_DIM; i++)
+            poses[f * TRANS_DIM + i] = face_params[i] * basis.params_std[i] + basis.params_mean[i];
+        for (int i = 0; i < BASIS_DIM; i++)
+            alphas[f * BASIS_DIM + i] = face_params[TRANS_DIM + i] * basis.params_std[TRANS_DIM + i] + basis.params_mean[TRANS_DIM + i];
+    }
+
+    for (int point = 0; point < OUTPUT_SIZE; point++)
+    {
+        const float *row_x = basis.bases.data() + (point * 3) * BASIS_DIM;
+        const float *row_y = row_x + BASIS_DIM;
+        const float *row_z = row_y + BASIS_DIM;
+        const float *mean = basis.mean_vertices.data() + point * 3;
+        for (size_t f = 0; f < faces; f++)
+        {
+            const float *alpha = alphas.data() + f * BASIS_DIM;
+            float vx = mean[0] + basis_dot(row_x, alpha);
+            float vy = mean[1] + basis_dot(row_y, alpha);
+            float vz = mean[2] + basis_dot(row_z, alpha);
+            // The pose is a 3x4 [R | offset], only the x and y rows are drawn
+            const float *pose = poses.data() + f * TRANS_DIM;
+            float x = pose[0] * vx + pose[1] * vy + pose[2] * vz + pose[3];
+            float y = pose[4] * vx + pose[5] * vy + pose[6] * vz + pose[7];
+            // The original repo assumes drawing is upside down so here we need to flip it,
+            // and make the landmarks relative to the face instead of absolute
+            float *landmark = landmarks + (f * OUTPUT_SIZE + point) * 2;
+            landmark[0] = x / FACE_WIDTH;
+            landmark[1] = (FACE_HEIGHT - y) / FACE_HEIGHT;
+        }
+    }
 }
 
 //******************************************************************
 // FACE LANDMARKS SPECIFIC PARAMETERS
 //******************************************************************
 
-xt::xarray<float> calc_bfm_params_xarray(HailoTensorPtr bfm_params)
+void dequantize_bfm_params(HailoTensorPtr bfm_params, float *params)
 {
-    xt::xarray<uint8_t> bfm_params_xarray = common::get_xtensor(bfm_params);
-    xt::xarray<uint8_t> flatten_bfm_params = xt::flatten(bfm_params_xarray);
-    auto qp_zp = bfm_params->vstream_info().quant_info.qp_zp;
-    auto qp_scale = bfm_params->vstream_info().quant_info.qp_scale;
-    xt::xarray<float> bfm_params_dequantize = common::dequantize(flatten_bfm_params, qp_scale, qp_zp);
-    return bfm_params_dequantize;
+    if (bfm_params->size() < PARAMS_DIM)
+        throw std::invalid_argument("tddfa error: expected 62 params in " + bfm_params->name());
+    float qp_zp = bfm_params->vstream_info().quant_info.qp_zp;
+    float qp_scale = bfm_params->vstream_info().quant_info.qp_scale;
+    const uint8_t *data = bfm_params->data();
+    for (int i = 0; i < PARAMS_DIM; i++)
+        params[i] = (float(data[i]) - qp_zp) * qp_scale;
 }
 
-xt::xarray<float> calc_landmarks(xt::xarray<float> sum3, int face_height)
+void add_landmarks(HailoROIPtr roi, const float *landmarks)
 {
-    xt::xarray<float> landmarks_raw = xt::transpose(sum3);
-    // each row consist 3 values which are the x,y,z values of the dots that we will draw.
-    // we want to draw only in 2D - so we need only x,y values but not z.
-    // cut out the third value in each row
-    xt::xarray<float> landmarks_without_z = xt::view(landmarks_raw, xt::all(), xt::range(0, 2));
-    // construct empty array it the shape we need and modify it
-    xt::xarray<float> landmarks = xt::zeros<float>({OUTPUT_SIZE, 2});
-    xt::col(landmarks, 0) = xt::col(landmarks_without_z, 0);
-    // the original repo assumes drawing is upside down so here we need to flip it:
-    xt::col(landmarks, 1) = face_height - xt::col(landmarks_without_z, 1);
-    return landmarks;
+    std::vector<HailoPoint> points;
+    points.reserve(OUTPUT_SIZE);
+    for (int i = 0; i < OUTPUT_SIZE; i++)
+    {
+        points.emplace_back(HailoPoint(landmarks[i * 2], landmarks[i * 2 + 1]));
+    }
+    roi->add_object(std::make_shared<HailoLandmarks>("landmarks", points));
 }
 
-xt::xarray<float> facial_landmark_postprocess(HailoTensorPtr bfm_params)
+void facial_landmark(HailoROIPtr roi, const char *output_layer_name)
 {
-    xt::xarray<float> bfm_params_xarray = calc_bfm_params_xarray(bfm_params);
-    xt::xarray<float> transposed_raw_landmarks = BFM(bfm_params_xarray);
-    xt::xarray<float> landmarks = calc_landmarks(transposed_raw_landmarks, FACE_HEIGHT);
-    // Make landmarks relative to the face instead of absulute.
-    xt::view(landmarks, xt::all(), 0) = xt::view(landmarks, xt::all(), 0) / FACE_WIDTH;
-    xt::view(landmarks, xt::all(), 1) = xt::view(landmarks, xt::all(), 1) / FACE_HEIGHT;
-    return landmarks;
+    if (roi->has_tensors())
+    {
+        float params[PARAMS_DIM];
+        float landmarks[OUTPUT_SIZE * 2];
+        dequantize_bfm_params(roi->get_tensor(output_layer_name), params);
+        solve_landmarks(params, 1, landmarks);
+        add_landmarks(roi, landmarks);
+    }
 }
 
-void facial_landmark(HailoROIPtr roi)
+void facial_landmark_batch(HailoROIPtr roi, const char *output_layer_name)
 {
-    std::vector<HailoPoint> points;
-    if (roi->has_tensors())
+    thread_local std::vector<HailoROIPtr> faces;
+    thread_local std::vector<float> params;
+    thread_local std::vector<float> landmarks;
+    faces.clear();
+    for (auto obj : roi->get_objects_typed(HAILO_DETECTION))
     {
-        xt::xarray<float> landmarks = facial_landmark_postprocess(roi->get_tensor(output_layer_name));
-        points.reserve(landmarks.shape(0));
-        for (uint i = 0; i < landmarks.shape(0); i++)
-        {
-            points.emplace_back(HailoPoint(landmarks(i, 0), landmarks(i, 1)));
-        }
-        roi->add_object(std::make_shared<HailoLandmarks>("landmarks", points));
+        HailoROIPtr face = std::dynamic_pointer_cast<HailoROI>(obj);
+        if (face->has_tensors())
+            faces.push_back(face);
     }
+    params.resize(faces.size() * PARAMS_DIM);
+    landmarks.resize(faces.size() * OUTPUT_SIZE * 2);
+    for (size_t f = 0; f < faces.size(); f++)
+        dequantize_bfm_params(faces[f]->get_tensor(output_layer_name), params.data() + f * PARAMS_DIM);
+    solve_landmarks(params.data(), faces.size(), landmarks.data());
+    for (size_t f = 0; f < faces.size(); f++)
+        add_landmarks(faces[f], landmarks.data() + f * OUTPUT_SIZE * 2);
+    faces.clear();
 }
 
 void filter(HailoROIPtr roi)
 {
-    facial_landmark(roi);
+    facial_landmark(roi, OUTPUT_LAYER_NAME);
 }
 
 void facial_landmarks_merged(HailoROIPtr roi)
 {
-    output_layer_name = "tddfa_mobilenet_v1/fc1";
-    facial_landmark(roi);
+    facial_landmark(roi, OUTPUT_LAYER_NAME);
 }
 
 void facial_landmarks_yuy2(HailoROIPtr roi)
 {
-    output_layer_name = "tddfa_mobilenet_v1_yuy2/fc1";
-    facial_landmark(roi);
+    facial_landmark(roi, OUTPUT_LAYER_NAME_YUY2);
+}
+
+void facial_landmarks_batch(HailoROIPtr roi)
+{
+    facial_landmark_batch(roi, OUTPUT_LAYER_NAME);
+}
+
+void facial_landmarks_batch_yuy2(HailoROIPtr roi)
+{
+    facial_landmark_batch(roi, OUTPUT_LAYER_NAME_YUY2);
 }
@@ -6,10 +6,16 @@
 #include "hailo_objects.hpp"
 #include "hailo_common.hpp"
 
+// Solve the 68 landmarks (x, y relative to the face) of a batch of faces from their 62 normalized params.
+void solve_landmarks(const float *params, size_t faces, float *landmarks);
+
 __BEGIN_DECLS
 void filter(HailoROIPtr roi);
 // Post-process function used to add landmarks on given detection.
 // Used for Face Detection + Face Landmarks app.
 void facial_landmarks_merged(HailoROIPtr roi);
 void facial_landmarks_yuy2(HailoROIPtr roi);
+// Post-process function used to add landmarks on all the detected faces of a frame at once.
+void facial_landmarks_batch(HailoROIPtr roi);
+void facial_landmarks_batch_yuy2(HailoROIPtr roi);
 __END_DECLS
\ No newline at end of file
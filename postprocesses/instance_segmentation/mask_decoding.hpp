@@ -1,5 +1,13 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "hailo_objects.hpp"
 #include "xtensor/xmath.hpp"
 #include "xtensor/xadapt.hpp"
 
@@ -19,90 +27,275 @@ auto xtensor_sigmoid(auto &tensor)
 inline float sigmoid(float x) { return 1.0f / (1.0f + std::exp(-1.0 * x)); }
 
 /**
- * @brief  Compute tensor dot product along specified axes for arrays.
-            In this case along axis 2 of the first matrix and axis 0 of the second.
+ * @brief How the mask of an instance is attached to it.
+ *        CONFIDENCE attaches a HailoConfClassMask of sigmoid confidences (0 under the threshold).
+ *        BITS and RLE attach a HailoUserMeta whose string holds the width and height of the mask
+ *        (two little endian uint32) followed by, for BITS, the pixels row-major 8 per byte
+ *        (least significant bit first), and for RLE, little endian uint32 run lengths of the
+ *        row-major pixels, alternating between pixels under and over the threshold, starting under it.
+ *        The mask of a degenerate box is 0x0, its string is only the header.
+ */
+typedef enum
+{
+    MASK_ENCODING_CONFIDENCE,
+    MASK_ENCODING_BITS,
+    MASK_ENCODING_RLE,
+} mask_encoding_t;
+
+/**
+ * @brief The mask of one instance while it is assembled.
+ */
+struct InstanceMask
+{
+    // The box of the instance in proto cells, [min, max)
+    int xmin, ymin, xmax, ymax;
+    std::vector<float> confidence;
+    std::string encoded;
+    uint32_t bit_count = 0;
+    uint32_t run = 0;
+    bool run_above = false;
+
+    int width() const { return xmax - xmin; }
+    int height() const { return ymax - ymin; }
+};
+
+static inline void append_uint32(std::string &encoded, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        encoded.push_back(char((value >> (8 * i)) & 0xff));
+}
+
+/**
+ * @brief Write a row of logits into the mask of an instance, thresholding them first:
+ *        the sigmoid is only computed for the pixels that pass, and not at all for BITS and RLE.
+ */
+inline void emit_mask_row(InstanceMask &mask, const float *logits, float logit_threshold, mask_encoding_t encoding)
+{
+    int width = mask.width();
+    switch (encoding)
+    {
+    case MASK_ENCODING_CONFIDENCE:
+        for (int x = 0; x < width; x++)
+            mask.confidence.push_back(logits[x] >= logit_threshold ? sigmoid(logits[x]) : 0.0f);
+        break;
+    case MASK_ENCODING_BITS:
+        for (int x = 0; x < width; x++, mask.bit_count++)
+        {
+            if ((mask.bit_count & 7) == 0)
+                mask.encoded.push_back(0);
+            if (logits[x] >= logit_threshold)
+                mask.encoded.back() |= char(1 << (mask.bit_count & 7));
+        }
+        break;
+    case MASK_ENCODING_RLE:
+        for (int x = 0; x < width; x++)
+        {
+            bool above = logits[x] >= logit_threshold;
+            if (above != mask.run_above)
+            {
+                append_uint32(mask.encoded, mask.run);
+                mask.run = 0;
+                mask.run_above = above;
+            }
+            mask.run++;
+        }
+        break;
+    }
+}
+
+/**
+ * @brief Assemble the masks of all the instances of a frame in one pass over the proto tensor:
+ *        logit(instance, pixel) = coefficients(instance) . proto(pixel), evaluated only inside the box of each instance.
+ *        The coefficients of the instances are stacked into one matrix, and the proto tensor is walked
+ *        row by row: a row is dequantized once into channel planes, then every instance covering it
+ *        accumulates its row as a blocked product with the planes (vectorized over the pixels),
+ *        while the planes of the row stay in cache. Rows no instance covers are never read.
+ *
+ * @param proto  -  const T*
+ *        The quantized proto tensor, height x width x channels
+ *
+ * @param coefficients  -  std::vector<float>
+ *        The stacked coefficients, one row of channels per mask
+ *
+ * @param masks  -  std::vector<InstanceMask>
+ *        The boxes of the instances, their masks are emitted into them
  *
- * @param matrix_1 left matrix in the dot product
- * @param matrix_2 right matrix in the dot product
- * @return xt::xarray<float> the dot product result
+ * @param threshold  -  float
+ *        Pixels under this confidence are out of the mask, 0 keeps them all
  */
-xt::xarray<float> dot_product_axis_2(xt::xarray<float, xt::layout_type::row_major> matrix_1,
-                                     xt::xarray<float, xt::layout_type::row_major> matrix_2)
+template <typename T>
+void assemble_masks(const T *proto, int proto_height, int proto_width, int channels, float qp_zp, float qp_scale,
+                    const std::vector<float> &coefficients, std::vector<InstanceMask> &masks,
+                    float threshold, mask_encoding_t encoding)
 {
-    uint axis_length = matrix_1.shape(2);
-    if (axis_length != matrix_2.shape(0))
+    thread_local std::vector<float> planes;
+    thread_local std::vector<float> row;
+    thread_local std::vector<uint32_t> active;
+    planes.resize(size_t(channels) * proto_width);
+    row.resize(proto_width);
+    float logit_threshold = threshold > 0.0f ? std::log(threshold / (1.0f - threshold)) : -std::numeric_limits<float>::infinity();
+
+    int first_row = proto_height, last_row = 0;
+    for (InstanceMask &mask : masks)
     {
-        throw std::invalid_argument("dot_product_axis_2 error: axis don't match!");
+        bool empty = mask.width() <= 0 || mask.height() <= 0;
+        if (encoding != MASK_ENCODING_CONFIDENCE)
+        {
+            // A degenerate box still gets a well formed payload, of a 0x0 mask
+            append_uint32(mask.encoded, empty ? 0 : mask.width());
+            append_uint32(mask.encoded, empty ? 0 : mask.height());
+        }
+        if (empty)
+            continue;
+        first_row = std::min(first_row, mask.ymin);
+        last_row = std::max(last_row, mask.ymax);
+        if (encoding == MASK_ENCODING_CONFIDENCE)
+            mask.confidence.reserve(size_t(mask.width()) * mask.height());
     }
-    float row_sum;
-    xt::xarray<float>::shape_type shape = {matrix_1.shape(0), matrix_1.shape(1)};
-    xt::xarray<float, xt::layout_type::row_major> product_matrix(shape);
-    for (uint i = 0; i < matrix_1.shape(0); ++i)
+
+    for (int y = first_row; y < last_row; y++)
     {
-        for (uint j = 0; j < matrix_1.shape(1); ++j)
+        active.clear();
+        for (uint32_t i = 0; i < masks.size(); i++)
         {
-            row_sum = 0.0;
-            for (uint k = 0; k < axis_length; ++k)
+            if (masks[i].width() > 0 && masks[i].height() > 0 && masks[i].ymin <= y && y < masks[i].ymax)
+                active.push_back(i);
+        }
+        if (active.empty())
+            continue;
+
+        // Dequantize the row from pixel-major to channel planes
+        const T *proto_row = proto + size_t(y) * proto_width * channels;
+        for (int x = 0; x < proto_width; x++)
+        {
+            for (int c = 0; c < channels; c++)
+                planes[size_t(c) * proto_width + x] = (float(proto_row[size_t(x) * channels + c]) - qp_zp) * qp_scale;
+        }
+
+        for (uint32_t i : active)
+        {
+            InstanceMask &mask = masks[i];
+            const float *instance_coefficients = coefficients.data() + size_t(i) * channels;
+            const int xmin = mask.xmin, width = mask.width();
+            float *logits = row.data();
+            std::fill(logits, logits + width, 0.0f);
+            int c = 0;
+            // Four channels per pass over the row, so the row is loaded and stored a quarter of the times
+            for (; c + 4 <= channels; c += 4)
+            {
+                const float *p0 = planes.data() + size_t(c) * proto_width + xmin;
+                const float *p1 = p0 + proto_width;
+                const float *p2 = p1 + proto_width;
+                const float *p3 = p2 + proto_width;
+                const float c0 = instance_coefficients[c], c1 = instance_coefficients[c + 1];
+                const float c2 = instance_coefficients[c + 2], c3 = instance_coefficients[c + 3];
+                for (int x = 0; x < width; x++)
+                    logits[x] += c0 * p0[x] + c1 * p1[x] + c2 * p2[x] + c3 * p3[x];
+            }
+            for (; c < channels; c++)
             {
-                row_sum += matrix_1(i, j, k) * matrix_2(k);
+                const float *plane = planes.data() + size_t(c) * proto_width + xmin;
+                for (int x = 0; x < width; x++)
+                    logits[x] += instance_coefficients[c] * plane[x];
             }
-            product_matrix(i, j) = row_sum;
+            emit_mask_row(mask, logits, logit_threshold, encoding);
+        }
+    }
+
+    if (encoding == MASK_ENCODING_RLE)
+    {
+        for (InstanceMask &mask : masks)
+        {
+            if (mask.width() > 0 && mask.height() > 0)
+                append_uint32(mask.encoded, mask.run);
         }
     }
-    return product_matrix;
+}
+
+/**
+ * @brief Check a mask threshold when the configuration is loaded.
+ *
+ * @param threshold  -  float
+ *        A confidence in [0, 1), 0 keeps all the pixels
+ */
+inline void validate_mask_threshold(float threshold)
+{
+    if (!(threshold >= 0.0f && threshold < 1.0f))
+        throw std::invalid_argument("mask_threshold must be in [0, 1), 0 keeps all the pixels");
 }
 
 /*
- * @brief Decode the mask coefficients of yolov5seg results into a format that makes sense
- * and add it to the detected instance for future calculation of the final mask
+ * @brief Decode the mask coefficients of yolov5seg results into masks, and attach them
+ * to the detected instances (replacing the coefficients)
  *
  * @param objects vector of the detected instances
- * @param proto the 32 mask prototypes that the coefficients select portions of to form the mask
+ * @param proto the 32 mask prototypes that the coefficients select portions of to form the mask (quantized)
+ * @param threshold pixels under this confidence are out of the mask, 0 keeps them all (see validate_mask_threshold)
+ * @param encoding how the masks are attached
  */
-void decode_masks(std::vector<HailoDetection> &objects, const xt::xarray<float> &proto)
+inline void decode_masks(std::vector<HailoDetection> &objects, HailoTensorPtr proto, float threshold = 0.0f,
+                         mask_encoding_t encoding = MASK_ENCODING_CONFIDENCE)
 {
-    xt::xarray<float>::shape_type mask_shape = {proto.shape(0), proto.shape(1)};
-    int proto_width = proto.shape(0);
-    int proto_height = proto.shape(1);
-    int xmin, ymin, xmax, ymax;
+    int proto_width = proto->width();
+    int proto_height = proto->height();
+    int channels = proto->features();
+
+    std::vector<float> coefficients;
+    std::vector<InstanceMask> masks;
+    std::vector<HailoDetection *> instances;
+    coefficients.reserve(objects.size() * channels);
+    masks.reserve(objects.size());
     for (auto &instance : objects)
     {
-        // Gather the detection bounds for this instance,
-        // they are relative scale so multiply by proto size
-        HailoBBox bbox = instance.get_bbox();
-        xmin = CLAMP(bbox.xmin() * proto_width, 0, proto_width);
-        xmax = CLAMP(bbox.xmax() * proto_width, 0, proto_width);
-        ymin = CLAMP(bbox.ymin() * proto_height, 0, proto_height);
-        ymax = CLAMP(bbox.ymax() * proto_height, 0, proto_height);
-        // Crop a view of the proto layer of just this instance's detection area
-        auto cropped_proto = xt::view(proto, xt::range(ymin, ymax), xt::range(xmin, xmax));
-        HailoMatrixPtr matrix = NULL;
+        HailoMatrixPtr matrix = nullptr;
         for (auto obj : instance.get_objects())
         {
             if (obj->get_type() == HAILO_MATRIX)
             {
-                matrix = std::dynamic_pointer_cast<HailoMatrix>(obj);
+                matrix = std::static_pointer_cast<HailoMatrix>(obj);
             }
         }
-        if (matrix == NULL) // no mask attached
+        if (matrix == nullptr) // no mask attached
         {
-            return;
+            continue;
         }
-        xt::xarray<int>::shape_type shape = {matrix->height()};
-        xt::xarray<float> mask_coefficients = xt::adapt(matrix->get_data().data(), matrix->height(), xt::no_ownership(), shape);
-
-        // Calculate a matrix multiplication of the instance's coefficients and the cropped proto layer and transpose it
-        xt::xarray<float, xt::layout_type::column_major> cropped_mask = xt::transpose(dot_product_axis_2(cropped_proto, mask_coefficients));
         instance.remove_object(matrix); // not needed anymore
+        if (int(matrix->height()) != channels)
+        {
+            throw std::invalid_argument("decode_masks error: mask coefficients don't match the proto channels!");
+        }
+        // Stack the coefficients of all the instances into one matrix
+        coefficients.insert(coefficients.end(), matrix->get_data().begin(), matrix->get_data().end());
+
+        // Gather the detection bounds for this instance,
+        // they are relative scale so multiply by proto size
+        HailoBBox bbox = instance.get_bbox();
+        InstanceMask mask;
+        mask.xmin = CLAMP(bbox.xmin() * proto_width, 0, proto_width);
+        mask.xmax = CLAMP(bbox.xmax() * proto_width, 0, proto_width);
+        mask.ymin = CLAMP(bbox.ymin() * proto_height, 0, proto_height);
+        mask.ymax = CLAMP(bbox.ymax() * proto_height, 0, proto_height);
+        masks.emplace_back(std::move(mask));
+        instances.push_back(&instance);
+    }
+    if (masks.empty())
+        return;
 
-        // Calculate the sigmoid of the mask
-        cropped_mask = xtensor_sigmoid(cropped_mask);
+    float qp_zp = proto->vstream_info().quant_info.qp_zp;
+    float qp_scale = proto->vstream_info().quant_info.qp_scale;
+    if (proto->vstream_info().format.type == HAILO_FORMAT_TYPE_UINT16)
+        assemble_masks(reinterpret_cast<const uint16_t *>(proto->data()), proto_height, proto_width, channels, qp_zp, qp_scale, coefficients, masks, threshold, encoding);
+    else
+        assemble_masks(proto->data(), proto_height, proto_width, channels, qp_zp, qp_scale, coefficients, masks, threshold, encoding);
 
-        // allocate and memcpy to a new memory so it points to the right data
-        std::vector<float> data(cropped_mask.shape(0) * cropped_mask.shape(1));
-        memcpy(data.data(), cropped_mask.data(), sizeof(float) * cropped_mask.shape(0) * cropped_mask.shape(1));
-        
+    for (size_t i = 0; i < masks.size(); i++)
+    {
+        InstanceMask &mask = masks[i];
+        HailoDetection &instance = *instances[i];
         // Add the mask to the object meta
-        instance.add_object(std::make_shared<HailoConfClassMask>(std::move(data), cropped_mask.shape(0), cropped_mask.shape(1), 0.3, instance.get_class_id()));
+        if (encoding == MASK_ENCODING_CONFIDENCE)
+            instance.add_object(std::make_shared<HailoConfClassMask>(std::move(mask.confidence), std::max(mask.width(), 0), std::max(mask.height(), 0), 0.3, instance.get_class_id()));
+        else
+            instance.add_object(std::make_shared<HailoUserMeta>(int(encoding), std::move(mask.encoded), threshold));
     }
 }
@@ -34,205 +34,170 @@ namespace fs = std::experimental::filesystem;
  */
 inline float inverse_sigmoid(float y) { return std::log(y/(1-y));}
 
-/**
- * @brief  perform quantization
- */
-inline uint16_t quant(float num, float qp_zp, float qp_scale) { return uint16_t((num / qp_scale)  + qp_zp); }
-
 /**
  * @brief  perform dequantization
  */
 inline float dequant(uint16_t num, float qp_zp, float qp_scale) { return (float(num) - qp_zp) * qp_scale;}
 
-/*
- * @brief Creates the grid and the anchor grid that will be used for each decoding
- *
- * @param anchors xarray, initialized in creation of Yolov5segParams
- * @param stride
- * @param nx shape[0] of the branch
- * @param ny shape[1] of the branch
- * @param num_anchors is the number of anchors per branch / 2
+/**
+ * @brief A box that passed the score threshold, decoded to input pixels
  */
-std::tuple<xt::xarray<float>, xt::xarray<float>> make_grid(xt::xarray<float> &anchors, const int stride, const int nx, const int ny, const int num_anchors)
+struct Yolov5segCandidate
 {
-    xt::xarray<int> x = xt::arange(nx);
-    xt::xarray<int> y = xt::arange(ny);
-    auto mesh = xt::meshgrid(y, x);
-    auto yv = std::get<0>(mesh);
-    auto xv = std::get<1>(mesh);
-    // making grid
-    auto stack = xt::stack(xt::xtuple(xv, yv), 2);
-    stack.reshape({1, ny, nx, 2});
-    xt::xarray<float> grid = xt::broadcast(stack, {num_anchors, ny, nx, 2}) - 0.5;
-    xt::xarray<float> transposed_grid = xt::transpose(grid, {1, 2, 0, 3}); // num_anchors, h, w, features
-    // making anchor grid
-    anchors *= stride;
-    anchors.reshape({num_anchors, 1, 1, 2});
-    xt::xarray<float> anchor_grid = xt::broadcast(anchors, {num_anchors, ny, nx, 2});
-    xt::xarray<float> transposed_anchor_grid = xt::transpose(anchor_grid, {1, 2, 0, 3}); // num_anchors, h, w, features
-    return std::tuple<xt::xarray<float>, xt::xarray<float>>(std::move(transposed_grid), std::move(transposed_anchor_grid));
-}
+    float x, y, w, h; // x and y are the center of the box
+    float score;
+    int class_index;
+    float mask_coefficients[MASK_CO];
+};
 
 /*
- * @brief Returns a vector of indices, of detections that have: is_object * max(class_confidence) > score_threshold
+ * @brief Creates the grid and the anchor grid of a branch, flat in the order of the boxes
+ * of its output: (y, x, anchor, xy)
  *
- * @param all_scores an xview with the confidence scores for each class, for each detection
- * @param all_is_object an xview with the confidence that this detection is an object, for each detection
- * @param score_threshold float
+ * @param anchors xarray, initialized in creation of Yolov5segParams, in input pixels
+ * @param nx shape[1] of the branch
+ * @param ny shape[0] of the branch
+ * @param num_anchors is the number of anchors per branch / 2
+ * @param grid the grid, filled
+ * @param anchor_grid the anchor grid, filled
  */
-auto filter_above_threshold(auto &all_scores, auto &is_object_threshold, const float score_threshold, const uint16_t threshold_quantized, const float qp_zp, const float qp_scale)
+void make_grid(const xt::xarray<float> &anchors, const int nx, const int ny, const int num_anchors, std::vector<float> &grid, std::vector<float> &anchor_grid)
 {
-    std::vector<uint> indices;
-    std::vector<float> scores;
-    std::vector<uint> classes;
-    int this_index;
-    float conf_deq, is_object_deq;
-    uint16_t is_object;
-    for (uint i = 0; i < is_object_threshold.size(); i++)
+    grid.resize(size_t(ny) * nx * num_anchors * 2);
+    anchor_grid.resize(grid.size());
+    size_t i = 0;
+    for (int y = 0; y < ny; y++)
     {
-        // first check if the object parameter is bigger than threshold
-        is_object = is_object_threshold(i, 0);
-        if (is_object > threshold_quantized)
+        for (int x = 0; x < nx; x++)
         {
-            this_index = xt::argmax(xt::row(all_scores, i))(0) + 1;
-            // dequantize and decode
-            conf_deq = sigmoid(dequant(all_scores(i, this_index - 1), qp_zp, qp_scale));
-            is_object_deq = sigmoid(dequant(is_object, qp_zp, qp_scale));
-            if (conf_deq*is_object_deq > score_threshold)
+            for (int anchor = 0; anchor < num_anchors; anchor++, i += 2)
             {
-                indices.emplace_back(i);
-                scores.emplace_back(conf_deq * is_object_deq);
-                classes.emplace_back(this_index);
+                grid[i] = x - 0.5f;
+                grid[i + 1] = y - 0.5f;
+                anchor_grid[i] = anchors.flat(anchor * 2);
+                anchor_grid[i + 1] = anchors.flat(anchor * 2 + 1);
+            }
         }
     }
-    }
-    return std::tuple<std::vector<uint>, std::vector<float>, std::vector<uint>>(std::move(indices), std::move(scores), std::move(classes));
 }
 
 /*
- * @brief Gets the xviews of the decoded and filtered results, and adds them to a vector of HailoDetections
+ * @brief Decodes the boxes of a branch that pass the score threshold into the candidate buffer,
+ * straight from the quantized output: the objectness is compared to a quantized threshold,
+ * and only the boxes that pass it are dequantized
  *
- * @param size int representing amount of detections
- * @param boxes xview of (x, y, w, h), x and y are the center of the box
- * @param is_object an xview with the confidence that this detection is an object, for each detection
- * @param scores an xview with the confidence scores for each class, for each detection
- * @param masks an xview with 32 coefficients representing a mask per detection
- * @param objects a vecor of HailoDetections, to which the detections will be added
+ * @param tensor the output of the branch
+ * @param candidates where the candidates of the branch are written, room for all its boxes
+ * @return the number of candidates written
  *  */
-std::vector<HailoDetection> create_hailo_detections(auto &scores_vec, auto &classes_vec, auto &xy, auto wh, auto &masks, const int input_width, const int input_height)
+size_t yolov5_decoding(const HailoTensorPtr &tensor, const int stride, const std::vector<float> &grid, const std::vector<float> &anchor_grid, const int num_anchors, const float score_threshold, Yolov5segCandidate *candidates)
 {
-    int class_index;
-    float confidence, w, h, x, y = 0.0;
-    std::vector<HailoDetection> objects;
-    for (uint i = 0; i < scores_vec.size(); i++)
+    const uint16_t *output = reinterpret_cast<const uint16_t *>(tensor->data());
+    const int entry_size = tensor->features() / num_anchors; // {x, y, w, h, is_object, classes, mask coefficients}
+    const int num_classes = entry_size - BOX_CO - 1 - MASK_CO;
+    const size_t num_boxes = size_t(tensor->height()) * tensor->width() * num_anchors;
+    if (grid.size() != num_boxes * 2)
     {
-        // Get the box parameters for this box
-        x = (xy(i, 0)) / input_width;
-        y = (xy(i, 1)) / input_height;
-        w = (wh(i, 0)) / input_width;
-        h = (wh(i, 1)) / input_height;
-        // x and y represented center of box, so they need to be changed to left bottom corner
-        HailoBBox bbox(x - w / 2, y - h / 2, w, h);
-        class_index = classes_vec[i];
-        std::string label = common::coco_eighty[class_index];
-        confidence = scores_vec[i];
-        // create mask
-        xt::xarray<float> mask_coefficients = xt::squeeze(xt::view(masks, xt::keep(i), xt::all()));
-        HailoDetection detected_instance(bbox, class_index, label, confidence);
-        std::vector<float> data(mask_coefficients.shape(0));
-        memcpy(data.data(), mask_coefficients.data(), sizeof(float) * mask_coefficients.shape(0));
-        // create the detection itself
-        detected_instance.add_object((std::make_shared<HailoMatrix>(data, mask_coefficients.shape(0), 1)));
-        objects.push_back(detected_instance);
+        throw std::runtime_error("yolov5seg: the output " + tensor->name() + " doesn't match the outputs_size");
     }
-    return objects;
-}
-
-/*
- * @brief Does the decoding and the filtering for the output, and adds the results to the HailoDetections vector
- *
- *  */
-std::vector<HailoDetection> yolov5_decoding(xt::xarray<uint16_t> &output, const int stride, xt::xarray<float> &anchors, xt::xarray<float> &grid, xt::xarray<float> &anchor_grid, const int num_anchors, const float score_threshold, float qp_zp, float qp_scale, const int input_width, const int input_height)
-{
-    int h = output.shape()[0];
-    int w = output.shape()[1];
-    int num_classes = (output.shape()[2] / 3) - BOX_CO - 1 - MASK_CO;
+    float qp_zp = tensor->vstream_info().quant_info.qp_zp;
+    float qp_scale = tensor->vstream_info().quant_info.qp_scale;
 
-    // prepare data for filter function
-    auto all_decoded = xt::reshape_view(output, {num_anchors * h * w, BOX_CO + 1 + num_classes + MASK_CO}); // {number of detections, 117}
-    auto all_is_object = xt::view(all_decoded, xt::all(), xt::range(4, 5));
-    auto all_scores = xt::view(all_decoded, xt::all(), xt::range(5, num_classes + 5));
-    // quantize the score threshold + "undecode" it (do inverse of sigmoid), to avoid doing dequantization and decoding on all class scores
-    uint16_t threshold_quantized = quant(inverse_sigmoid(score_threshold), qp_zp, qp_scale);
-    auto filtered = filter_above_threshold(all_scores, all_is_object, score_threshold, threshold_quantized, qp_zp, qp_scale);
-    std::vector<uint> indices = std::get<0>(filtered);
-    std::vector<float> scores_vec = std::get<1>(filtered);
-    std::vector<uint> classes_vec = std::get<2>(filtered);
-
-    // filter xy and grid
-    auto xy = xt::view(all_decoded, xt::all(), xt::range(_, 2));
-    auto reshaped_grid = xt::reshape_view(grid, xy.shape());
-    auto filtered_xy = xt::view(xy, xt::keep(indices), xt::all());
-    auto filtered_grid = xt::view(reshaped_grid, xt::keep(indices), xt::all());
-    // dequantize and decode xy
-    xt::xarray<float> deq_xy = (filtered_xy - qp_zp) * qp_scale;
-    deq_xy = (xtensor_sigmoid(deq_xy) * 2 + filtered_grid) * stride;
-
-    // filter wh and anchor grid
-    auto wh = xt::view(all_decoded, xt::all(), xt::range(2, 4));
-    auto reshaped_anchor_grid = xt::reshape_view(anchor_grid, wh.shape());
-    auto filtered_wh = xt::view(wh, xt::keep(indices), xt::all());
-    auto filtered_anchor_grid = xt::view(reshaped_anchor_grid, xt::keep(indices), xt::all());
-    // dequantize and decode wh
-    xt::xarray<float> deq_wh = (filtered_wh - qp_zp) * qp_scale;
-    deq_wh = xt::square(xtensor_sigmoid(deq_wh) * 2) * filtered_anchor_grid;
-
-    // filter and dequantize masks
-    auto filtered_masks = xt::view(all_decoded, xt::keep(indices), xt::range(num_classes + 5, _));
-    xt::xarray<float> masks = (filtered_masks - qp_zp) * qp_scale;
+    // quantize the score threshold + "undecode" it (do inverse of sigmoid), to avoid doing dequantization and decoding on all class scores,
+    // is_object * max(class_confidence) > score_threshold requires is_object > score_threshold
+    const float threshold_quantized = std::floor(inverse_sigmoid(score_threshold) / qp_scale + qp_zp);
+    size_t count = 0;
+    for (size_t box = 0; box < num_boxes; box++)
+    {
+        const uint16_t *entry = output + box * entry_size;
+        // first check if the object parameter is bigger than threshold
+        if (float(entry[BOX_CO]) <= threshold_quantized)
+            continue;
+        // the quantization is monotonic, so the best class is the best quantized score
+        const uint16_t *scores = entry + BOX_CO + 1;
+        int class_index = std::max_element(scores, scores + num_classes) - scores;
+        float score = sigmoid(dequant(scores[class_index], qp_zp, qp_scale)) * sigmoid(dequant(entry[BOX_CO], qp_zp, qp_scale));
+        if (score <= score_threshold)
+            continue;
 
-    // create HailoDetections for the NMS and the mask decoding
-    std::vector<HailoDetection> objects = create_hailo_detections(scores_vec, classes_vec, deq_xy, deq_wh, masks, input_width, input_height);
-    return objects;
+        Yolov5segCandidate &candidate = candidates[count++];
+        candidate.x = (sigmoid(dequant(entry[0], qp_zp, qp_scale)) * 2 + grid[box * 2]) * stride;
+        candidate.y = (sigmoid(dequant(entry[1], qp_zp, qp_scale)) * 2 + grid[box * 2 + 1]) * stride;
+        float w = sigmoid(dequant(entry[2], qp_zp, qp_scale)) * 2;
+        float h = sigmoid(dequant(entry[3], qp_zp, qp_scale)) * 2;
+        candidate.w = w * w * anchor_grid[box * 2];
+        candidate.h = h * h * anchor_grid[box * 2 + 1];
+        candidate.score = score;
+        candidate.class_index = class_index + 1;
+        const uint16_t *mask_coefficients = scores + num_classes;
+        for (int i = 0; i < MASK_CO; i++)
+            candidate.mask_coefficients[i] = dequant(mask_coefficients[i], qp_zp, qp_scale);
+    }
+    return count;
 }
 
 /*
- * @brief Does dequantize and decoding for each output seperately
- *
+ * @brief Creates a HailoDetection of a candidate, with its mask coefficients for the mask decoding
  *  */
-std::vector<HailoDetection> post_per_branch(std::string branch_name, const int index, std::map<std::string, HailoTensorPtr> tensors, std::vector<xt::xarray<float>> anchor_list, std::vector<int> stride_list, const float iou_threshold, const float score_threshold, std::vector<xt::xarray<float>> grids, std::vector<xt::xarray<float>> anchor_grids, const int num_anchors, const int input_width, const int input_height)
+HailoDetection create_hailo_detection(const Yolov5segCandidate &candidate, const int input_width, const int input_height)
 {
-    auto output = common::get_xtensor_uint16(tensors[branch_name]);
-    float qp_zp = tensors[branch_name]->vstream_info().quant_info.qp_zp;
-    float qp_scale = tensors[branch_name]->vstream_info().quant_info.qp_scale;
-    return yolov5_decoding(output, stride_list[index], anchor_list[index], grids[index], anchor_grids[index], num_anchors, score_threshold, qp_zp, qp_scale, input_width, input_height);
+    float x = candidate.x / input_width;
+    float y = candidate.y / input_height;
+    float w = candidate.w / input_width;
+    float h = candidate.h / input_height;
+    // x and y represented center of box, so they need to be changed to left bottom corner
+    HailoBBox bbox(x - w / 2, y - h / 2, w, h);
+    HailoDetection detected_instance(bbox, candidate.class_index, common::coco_eighty[candidate.class_index], candidate.score);
+    std::vector<float> data(candidate.mask_coefficients, candidate.mask_coefficients + MASK_CO);
+    detected_instance.add_object(std::make_shared<HailoMatrix>(std::move(data), MASK_CO, 1));
+    return detected_instance;
 }
 
 /*
- * @brief Does dequantize and decoding for each output, and then calls nms and decode masks
+ * @brief Decodes each output seperately into one candidate buffer, and then calls nms and decode masks
  *
  *  */
-std::vector<HailoDetection> yolov5seg_post(auto &tensors, auto &anchor_list, auto &stride_list, const float iou_threshold, const float score_threshold, auto &grids, auto &anchor_grids, const int num_anchors, const int input_width, const int input_height, auto &outputs_name)
+std::vector<HailoDetection> yolov5seg_post(std::map<std::string, HailoTensorPtr> &tensors, const Yolov5segParams &params)
 {
-    auto proto_tensor = common::dequantize(common::get_xtensor(tensors[outputs_name[0]]), tensors[outputs_name[0]]->vstream_info().quant_info.qp_scale, tensors[outputs_name[0]]->vstream_info().quant_info.qp_zp);
+    // the first output is the proto tensor, the branches follow from the smallest stride
+    const size_t num_branches = params.grids.size();
+    if (params.outputs_name.size() != num_branches + 1)
+    {
+        throw std::runtime_error("yolov5seg: outputs_name doesn't match the outputs_size");
+    }
+    thread_local std::vector<Yolov5segCandidate> candidates;
+    thread_local std::vector<std::future<size_t>> branches;
+    size_t total_boxes = 0;
+    for (const std::vector<float> &grid : params.grids)
+        total_boxes += grid.size() / 2;
+    candidates.resize(total_boxes);
 
-    // run the postprocess for each branch seperately
-    std::future<std::vector<HailoDetection>> t2 = std::async(post_per_branch, outputs_name[1], 2, tensors, anchor_list, stride_list, iou_threshold, score_threshold, grids, anchor_grids, num_anchors, input_width, input_height);
-    std::future<std::vector<HailoDetection>> t1 = std::async(post_per_branch, outputs_name[2], 1, tensors, anchor_list, stride_list, iou_threshold, score_threshold, grids, anchor_grids, num_anchors, input_width, input_height);
-    std::future<std::vector<HailoDetection>> t0 = std::async(post_per_branch, outputs_name[3], 0, tensors, anchor_list, stride_list, iou_threshold, score_threshold, grids, anchor_grids, num_anchors, input_width, input_height);
-    std::vector<HailoDetection> d2 = t2.get();
-    std::vector<HailoDetection> d1 = t1.get();
-    std::vector<HailoDetection> d0 = t0.get();
+    // run the decoding for each branch seperately, each into its own part of the buffer
+    branches.clear();
+    size_t offset = 0;
+    for (size_t index = 0; index < num_branches; index++)
+    {
+        const HailoTensorPtr &tensor = tensors.at(params.outputs_name[num_branches - index]);
+        Yolov5segCandidate *branch_candidates = candidates.data() + offset;
+        branches.emplace_back(std::async(std::launch::async, [&params, &tensor, index, branch_candidates]
+                                         { return yolov5_decoding(tensor, params.strides[index], params.grids[index], params.anchor_grids[index],
+                                                                  params.num_anchors, params.score_threshold, branch_candidates); }));
+        offset += params.grids[index].size() / 2;
+    }
 
     // concatenate all detections
     std::vector<HailoDetection> all_detections;
-    all_detections.reserve(d0.size() + d1.size() + d2.size());
-    all_detections.insert(all_detections.end(), d0.begin(), d0.end());
-    all_detections.insert(all_detections.end(), d1.begin(), d1.end());
-    all_detections.insert(all_detections.end(), d2.begin(), d2.end());
+    offset = 0;
+    for (size_t index = 0; index < num_branches; index++)
+    {
+        size_t count = branches[index].get();
+        for (size_t i = 0; i < count; i++)
+            all_detections.emplace_back(create_hailo_detection(candidates[offset + i], params.input_shape[0], params.input_shape[1]));
+        offset += params.grids[index].size() / 2;
+    }
 
-    common::nms(all_detections, iou_threshold);
-    decode_masks(all_detections, proto_tensor);
+    common::nms(all_detections, params.iou_threshold);
+    decode_masks(all_detections, tensors.at(params.outputs_name[0]), params.mask_threshold, params.mask_encoding);
     return all_detections;
 }
 
@@ -288,6 +253,15 @@ Yolov5segParams *init(const std::string config_path, const std::string function_
             "items": {
                 "type": "number"
             }
+            },
+            "mask_threshold": {
+            "type": "number",
+            "minimum": 0,
+            "exclusiveMaximum": 1
+            },
+            "mask_encoding": {
+            "type": "string",
+            "enum": ["confidence", "bits", "rle"]
             }
         },
         "required": [
@@ -366,27 +340,34 @@ Yolov5segParams *init(const std::string config_path, const std::string function_
             }
             params->strides = strides_vec;
 
+            // parse the optional mask output
+            if (doc_config_json.HasMember("mask_threshold"))
+            {
+                params->mask_threshold = doc_config_json["mask_threshold"].GetFloat();
+                validate_mask_threshold(params->mask_threshold);
+            }
+            if (doc_config_json.HasMember("mask_encoding"))
+            {
+                std::string mask_encoding = doc_config_json["mask_encoding"].GetString();
+                if (mask_encoding == "bits")
+                    params->mask_encoding = MASK_ENCODING_BITS;
+                else if (mask_encoding == "rle")
+                    params->mask_encoding = MASK_ENCODING_RLE;
+                else
+                    params->mask_encoding = MASK_ENCODING_CONFIDENCE;
+            }
+
         fclose(fp);
     } }
-    std::vector<int> outputs_size = params->outputs_size;
-    std::vector<xt::xarray<float>> anchors = params->anchors;
-    std::vector<int> strides = params->strides;
-    std::vector<xt::xarray<float>> grids;
-    std::vector<xt::xarray<float>> anchor_grids;
+    // create the flat grid and anchor grid of each branch, once
+    params->grids.resize(params->outputs_size.size());
+    params->anchor_grids.resize(params->outputs_size.size());
     int num_anchors = 0;
-    // create grid and anchor grid
-    for (uint index = 0; index < outputs_size.size(); index++)
+    for (uint index = 0; index < params->outputs_size.size(); index++)
     {
-        anchors[index] /= strides[index];
-        num_anchors = floor(anchors[index].size() / 2);
-        auto both_grids = make_grid(anchors[index], strides[index], outputs_size[index], outputs_size[index], num_anchors);
-        xt::xarray<float> grid = std::get<0>(both_grids);
-        xt::xarray<float> anchor_grid = std::get<1>(both_grids);
-        grids.emplace_back(grid);
-        anchor_grids.emplace_back(anchor_grid);
+        num_anchors = floor(params->anchors[index].size() / 2);
+        make_grid(params->anchors[index], params->outputs_size[index], params->outputs_size[index], num_anchors, params->grids[index], params->anchor_grids[index]);
     }
-    params->grids = grids;
-    params->anchor_grids = anchor_grids;
     params->num_anchors = num_anchors;
     return params;
 }
@@ -406,7 +387,7 @@ void yolov5seg(HailoROIPtr roi, void *params_void_ptr)
 {
     Yolov5segParams *params = reinterpret_cast<Yolov5segParams *>(params_void_ptr);
     std::map<std::string, HailoTensorPtr> tensors = roi->get_tensors_by_name();
-    std::vector<HailoDetection> detections = yolov5seg_post(tensors, params->anchors, params->strides, params->iou_threshold, params->score_threshold, params->grids, params->anchor_grids, params->num_anchors, params->input_shape[0], params->input_shape[1], params->outputs_name);
+    std::vector<HailoDetection> detections = yolov5seg_post(tensors, *params);
     hailo_common::add_detections(roi, detections);
 }
 
@@ -6,6 +6,7 @@
 #include "hailo_objects.hpp"
 #include "xtensor/xarray.hpp"
 #include "xtensor/xio.hpp"
+#include "mask_decoding.hpp"
 
 __BEGIN_DECLS
 class Yolov5segParams
@@ -19,8 +20,11 @@ public:
     std::vector<xt::xarray<float>> anchors;
     std::vector<int> input_shape;
     std::vector<int> strides;
-    std::vector<xt::xarray<float>> grids;
-    std::vector<xt::xarray<float>> anchor_grids;
+    // flat per branch, in the order of the boxes of its output
+    std::vector<std::vector<float>> grids;
+    std::vector<std::vector<float>> anchor_grids;
+    float mask_threshold;
+    mask_encoding_t mask_encoding;
 
     Yolov5segParams() {
         iou_threshold = 0.6;
@@ -32,6 +36,8 @@ public:
                                             {10, 13, 16, 30, 33, 23} };
         input_shape = {640,640};
         strides = {32, 16, 8};
+        mask_threshold = 0.0;
+        mask_encoding = MASK_ENCODING_CONFIDENCE;
     }
 };
 
@@ -16,6 +16,7 @@
 #include "common/tensors.hpp"
 #include "common/math.hpp"
 #include "common/nms.hpp"
+#include "common/heatmap_peaks.hpp"
 
 #include "xtensor/xadapt.hpp"
 #include "xtensor/xarray.hpp"
@@ -57,181 +58,32 @@ const std::vector<std::pair<int, int>> centerpose_joint_pairs =
         {0, 1}, {1, 3}, {0, 2}, {2, 4}, {5, 6}, {5, 7}, {7, 9}, {6, 8}, {8, 10}, {5, 11}, {6, 12}, {11, 12}, {11, 13}, {12, 14}, {13, 15}, {14, 16}};
 
 /**
- * @brief This function maps column-wise array indices to true flattened indices.
+ * @brief Get the top k peaks of each channel of a heatmap
  *
- * @param array_to_map  the array to to map
- * @param row_wise_indices  indices in row-wise method
- * @return xt::xarray<int> flattened indices
+ * @param heatmap output tensor of scores
+ * @param k take k best peaks of each channel and ignore the others
+ * @param peaks the peaks, k per channel, highest first
  */
-xt::xarray<int> map_to_flat_indices(const xt::xarray<int> &array_to_map, const xt::xarray<int> &row_wise_indices)
+template <typename T>
+void top_k_heatmap_peaks(HailoTensorPtr heatmap, const int k, std::vector<common::HeatmapPeak> &peaks)
 {
-    /*
-          Example:
-          test = {{6, 2, 8, 0, 9, 3, 5, 4, 7, 1},
-                 {16,19,11,17,12,13,15,14,10,18}};
-          ind  = {{0, 1, 2},
-                  {9, 8, 7}}
-          This function would convert ind to: {{0,  1,  2},
-                                              {19, 18, 17}}
-          So that when keeping by flattened arrays, you get:
-          xt::view(xt::flatten(test), xt::keep(xt::flatten(ind))) = {6, 2, 8, 18, 10, 14}
-      */
-    int num_rows = array_to_map.shape(0);
-    int cols_per_row = array_to_map.shape(1);
-    int index_cols = row_wise_indices.shape(1);
-    // Prepare an incrementing array that steps from 0 --> number of rows
-    xt::xarray<int> pre_tile = xt::arange<int>(0, num_rows).reshape({num_rows, 1});
-    // Tile the array to number of columns in the index array, then multiple by the number of columns.
-    // This way we increment each row by row# * num_columns
-    xt::xarray<int> row_inds = xt::tile(pre_tile, {1, index_cols}) * cols_per_row + row_wise_indices;
-
-    // Return a flattened view
-    return std::move(xt::flatten(row_inds));
+    common::top_k_peaks(reinterpret_cast<const T *>(heatmap->data()), heatmap->height(), heatmap->width(), heatmap->features(), k, peaks);
 }
 
 /**
- * @brief Top K function
+ * @brief Dispatch top_k_heatmap_peaks by the data type of the layer
  *
- * @param array array
- * @param k take k best results
- * @return xt::xarray<int>
+ * @param heatmap output tensor of scores
+ * @param is_uint16 whether the layer is uint16 (if not, it is uint8)
+ * @param k take k best peaks of each channel and ignore the others
+ * @param peaks the peaks, k per channel, highest first
  */
-xt::xarray<int> nd_topk(xt::xarray<float> &array, const int k)
+void top_k_heatmap_peaks(HailoTensorPtr heatmap, const bool is_uint16, const int k, std::vector<common::HeatmapPeak> &peaks)
 {
-    // Since top_k partitions on a flattened array (xt::xnone()),
-    // for arrays of more than 1 row we must topk for each row.
-    int rows = array.shape(0);
-    int cols = array.shape(1);
-    xt::xarray<int> indices = xt::empty<int>({rows, k}); // prepare an empty array to fill
-    for (int index = 0; index < rows; index++)
-    {
-        // For each row, get the topk of the row, and add cols*index to get true flat indices
-        xt::xarray<uint8_t> expanded_row = xt::expand_dims(xt::row(array, index), 0);
-        xt::row(indices, index) = xt::flatten(common::top_k(expanded_row, k)) + (cols * index);
-    }
-    return indices;
-}
-
-xt::xarray<int> nd_topk_uint16(xt::xarray<float> &array, const int k)
-{
-    // Since top_k partitions on a flattened array (xt::xnone()),
-    // for arrays of more than 1 row we must topk for each row.
-    int rows = array.shape(0);
-    int cols = array.shape(1);
-    xt::xarray<int> indices = xt::empty<int>({rows, k}); // prepare an empty array to fill
-    for (int index = 0; index < rows; index++)
-    {
-        // For each row, get the topk of the row, and add cols*index to get true flat indices
-        xt::xarray<uint16_t> expanded_row = xt::expand_dims(xt::row(array, index), 0);
-        xt::row(indices, index) = xt::flatten(common::top_k(expanded_row, k)) + (cols * index);
-    }
-    return indices;
-}
-
-/**
- * @brief get top k centers
- *
- * @param scores output tensors of scores
- * @param k take k best scores and ignore the others
- * @return std::pair<xt::xarray<int>, xt::xarray<uint8_t>> pair of indices of scores and scores
- */
-std::pair<xt::xarray<int>, xt::xarray<uint8_t>> top_k_centers(HailoTensorPtr scores, const int k)
-{
-    // Adapt the tensor into an xarray of proper shape and size
-    auto xscores = common::get_xtensor(scores);
-
-    // Get the indices of the top k scoring cells
-    int size = scores->size();
-    xt::xarray<uint8_t> xscores_view = xt::reshape_view(xscores, {1, size});
-    xt::xarray<int> topk_score_indices = common::top_k(xscores_view, k);
-    topk_score_indices = xt::flatten(topk_score_indices);
-
-    // We want a flattened view of the scores to sort by
-    auto flat_scores = xt::flatten(xscores);
-
-    // Using the top k indices, get the top k scores
-    auto topk_scores = xt::view(flat_scores, xt::keep(topk_score_indices));
-
-    // Return the top scores and their indices
-    return std::pair<xt::xarray<int>, xt::xarray<uint8_t>>(std::move(topk_score_indices), std::move(topk_scores));
-}
-
-std::pair<xt::xarray<int>, xt::xarray<uint16_t>> top_k_centers_uint16(HailoTensorPtr scores, const int k)
-{
-    // Adapt the tensor into an xarray of proper shape and size
-    auto xscores = common::get_xtensor_uint16(scores);
-
-    // Get the indices of the top k scoring cells
-    int size = scores->size();
-    xt::xarray<uint16_t> xscores_view = xt::reshape_view(xscores, {1, size});
-    xt::xarray<int> topk_score_indices = common::top_k(xscores_view, k);
-    topk_score_indices = xt::flatten(topk_score_indices);
-
-    // We want a flattened view of the scores to sort by
-    auto flat_scores = xt::flatten(xscores);
-
-    // Using the top k indices, get the top k scores
-    auto topk_scores = xt::view(flat_scores, xt::keep(topk_score_indices));
-
-    // Return the top scores and their indices
-    return std::pair<xt::xarray<int>, xt::xarray<uint16_t>>(std::move(topk_score_indices), std::move(topk_scores));
-}
-
-/**
- * @brief get top k joints
- *
- * @param joint_scores output tensors of scores
- * @param k take k best scores and ignore the others
- * @return std::pair<xt::xarray<int>, xt::xarray<uint8_t>> pair of indices of scores and scores
- */
-std::pair<xt::xarray<int>, xt::xarray<uint8_t>> top_k_joints(HailoTensorPtr joint_scores, const int k)
-{
-    // Adapt the tensor into an xarray of proper shape and size
-    auto xjoint_scores = common::get_xtensor(joint_scores);
-    // Transpose the joints so that we lead by joint class {17, 160, 160} instead of {160, 160, 17}
-    auto transposed_scores = xt::transpose(xjoint_scores, {2, 0, 1});
-    // Create a reshape view that we can sort by {17, 160, 160} --> {17, 25600}
-    xt::xarray<float> scores_to_sort = xt::reshape_view(transposed_scores,
-                                                        {joint_scores->features(), joint_scores->width() * joint_scores->height()});
-
-    // Get the indices of the top k scoring cells
-    auto topk_score_indices = nd_topk(scores_to_sort, k);
-    auto topk_score_indices_flat = xt::flatten(topk_score_indices);
-
-    // Using the top k indices, get the top k scores
-    // We use a reshaped view of the scores from {17, 25600} to {435200} so that when we take using topk_score_indices,
-    // we take {340} (17 * 20) instead of {17, 340}. We return a reshaped view that reformats back to proper {17, 20}.
-    auto scores_to_sort_flat = xt::flatten(scores_to_sort);
-    auto topk_scores_flat = xt::view(scores_to_sort_flat, xt::keep(topk_score_indices_flat));
-    auto topk_scores = xt::reshape_view(topk_scores_flat, {(int)joint_scores->features(), k});
-
-    // Return the top scores and their indices
-    return std::pair<xt::xarray<int>, xt::xarray<uint8_t>>(std::move(topk_score_indices), std::move(topk_scores));
-}
-
-std::pair<xt::xarray<int>, xt::xarray<uint16_t>> top_k_joints_uint16(HailoTensorPtr joint_scores, const int k)
-{
-    // Adapt the tensor into an xarray of proper shape and size
-    auto xjoint_scores = common::get_xtensor_uint16(joint_scores);
-    // Transpose the joints so that we lead by joint class {17, 160, 160} instead of {160, 160, 17}
-    auto transposed_scores = xt::transpose(xjoint_scores, {2, 0, 1});
-    // Create a reshape view that we can sort by {17, 160, 160} --> {17, 25600}
-    xt::xarray<float> scores_to_sort = xt::reshape_view(transposed_scores,
-                                                        {joint_scores->features(), joint_scores->width() * joint_scores->height()});
-
-    // Get the indices of the top k scoring cells
-    auto topk_score_indices = nd_topk_uint16(scores_to_sort, k);
-    auto topk_score_indices_flat = xt::flatten(topk_score_indices);
-
-    // Using the top k indices, get the top k scores
-    // We use a reshaped view of the scores from {17, 25600} to {435200} so that when we take using topk_score_indices,
-    // we take {340} (17 * 20) instead of {17, 340}. We return a reshaped view that reformats back to proper {17, 20}.
-    auto scores_to_sort_flat = xt::flatten(scores_to_sort);
-    auto topk_scores_flat = xt::view(scores_to_sort_flat, xt::keep(topk_score_indices_flat));
-    auto topk_scores = xt::reshape_view(topk_scores_flat, {(int)joint_scores->features(), k});
-
-    // Return the top scores and their indices
-    return std::pair<xt::xarray<int>, xt::xarray<uint16_t>>(std::move(topk_score_indices), std::move(topk_scores));
+    if (is_uint16)
+        top_k_heatmap_peaks<uint16_t>(heatmap, k, peaks);
+    else
+        top_k_heatmap_peaks<uint8_t>(heatmap, k, peaks);
 }
 
 /**
@@ -362,9 +214,6 @@ std::vector<HailoDetection> centerpose_postprocess(HailoROIPtr roi,
 {
     std::vector<HailoDetection> objects; // The detection meta we will eventually return
 
-    xt::xarray<int> topk_score_indices, topk_joint_heatmap_indices, topk_scores_x_index, topk_scores_y_index;
-    xt::xarray<float> bboxes, topk_joint_score_rescaled, topk_scores_rescaled, topk_center_wh_rescaled;
-
     // Extract the 6 output tensors:
     // Center heatmap tensor with scaling and offset tensors for person detection
     HailoTensorPtr center_heatmap = roi->get_tensor(output_layers["center_heatmap"].first);
@@ -372,7 +221,6 @@ std::vector<HailoDetection> centerpose_postprocess(HailoROIPtr roi,
     HailoTensorPtr center_offset = roi->get_tensor(output_layers["center_offset"].first);
     // Joint heatmap and offset tensors for joint detection
     HailoTensorPtr joint_heatmap = roi->get_tensor(output_layers["joint_heatmap"].first);
-    HailoTensorPtr joint_offset = roi->get_tensor(output_layers["joint_offset"].first);
     // Joint center offset tensor for secondary joint detection
     HailoTensorPtr joint_center_offset = roi->get_tensor(output_layers["joint_center_offset"].first);
 
@@ -380,62 +228,35 @@ std::vector<HailoDetection> centerpose_postprocess(HailoROIPtr roi,
 
     // detection box encoding
     // From the center_heatmap tensor, we want to extract the top k centers with the highest score
-
-    if (output_layers["center_heatmap"].second) // uint16
+    std::vector<common::HeatmapPeak> center_peaks;
+    top_k_heatmap_peaks(center_heatmap, output_layers["center_heatmap"].second, k, center_peaks);
+    xt::xarray<int> topk_score_indices = xt::empty<int>({k});
+    xt::xarray<float> topk_scores = xt::empty<float>({k});
+    for (int index = 0; index < k; index++)
     {
-        auto top_scores = top_k_centers_uint16(center_heatmap, k);           // Returns both the top scores and their indices
-        topk_score_indices = top_scores.first;                               // Separate out the top score indices
-        xt::xarray<uint16_t> topk_scores = top_scores.second;                // Separate out the top scores
-        topk_scores_y_index = topk_score_indices / center_heatmap->height(); // Find the y index of the cells
-        topk_scores_x_index = topk_score_indices % center_heatmap->width();  // Find the x index of the cells
-
-        // With the top k indices in hand, we can now extract the corresponding center offsets and widths/heights
-        auto topk_center_offset = gather_features_from_tensor(center_offset, topk_score_indices);   // Use the top k indices from earlier
-        auto topk_center_wh = gather_features_from_tensor(center_width_height, topk_score_indices); // Use the top k indices from earlier
-
-        // Now that we have our top k features, we can rescale them to dequantize
-        topk_scores_rescaled = common::dequantize(topk_scores,
-                                                  center_heatmap->vstream_info().quant_info.qp_scale, center_heatmap->vstream_info().quant_info.qp_zp);
-        xt::xarray<float> topk_center_offset_rescaled = common::dequantize(topk_center_offset,
-                                                                           center_offset->vstream_info().quant_info.qp_scale, center_offset->vstream_info().quant_info.qp_zp);
-
-        topk_center_wh_rescaled = common::dequantize(topk_center_wh,
-                                                     center_width_height->vstream_info().quant_info.qp_scale, center_width_height->vstream_info().quant_info.qp_zp);
-
-        // Build up the detection boxes
-        bboxes = build_boxes_centerpose(topk_scores_rescaled,
-                                        topk_center_offset_rescaled,
-                                        topk_center_wh_rescaled,
-                                        topk_scores_x_index, topk_scores_y_index, score_threshold, image_size);
-    }
-
-    else
-    {
-        auto top_scores = top_k_centers(center_heatmap, k);                  // Returns both the top scores and their indices
-        topk_score_indices = top_scores.first;                               // Separate out the top score indices
-        xt::xarray<uint8_t> topk_scores = top_scores.second;                 // Separate out the top scores
-        topk_scores_y_index = topk_score_indices / center_heatmap->height(); // Find the y index of the cells
-        topk_scores_x_index = topk_score_indices % center_heatmap->width();  // Find the x index of the cells
-
-        // With the top k indices in hand, we can now extract the corresponding center offsets and widths/heights
-        auto topk_center_offset = gather_features_from_tensor(center_offset, topk_score_indices);   // Use the top k indices from earlier
-        auto topk_center_wh = gather_features_from_tensor(center_width_height, topk_score_indices); // Use the top k indices from earlier
-
-        // Now that we have our top k features, we can rescale them to dequantize
-        topk_scores_rescaled = common::dequantize(topk_scores,
-                                                  center_heatmap->vstream_info().quant_info.qp_scale, center_heatmap->vstream_info().quant_info.qp_zp);
-        xt::xarray<float> topk_center_offset_rescaled = common::dequantize(topk_center_offset,
-                                                                           center_offset->vstream_info().quant_info.qp_scale, center_offset->vstream_info().quant_info.qp_zp);
-
-        topk_center_wh_rescaled = common::dequantize(topk_center_wh,
-                                                     center_width_height->vstream_info().quant_info.qp_scale, center_width_height->vstream_info().quant_info.qp_zp);
-
-        // Build up the detection boxes
-        bboxes = build_boxes_centerpose(topk_scores_rescaled,
-                                        topk_center_offset_rescaled,
-                                        topk_center_wh_rescaled,
-                                        topk_scores_x_index, topk_scores_y_index, score_threshold, image_size);
+        topk_score_indices(index) = center_peaks[index].cell;
+        topk_scores(index) = center_peaks[index].value;
     }
+    xt::xarray<int> topk_scores_y_index = topk_score_indices / center_heatmap->width(); // Find the y index of the cells
+    xt::xarray<int> topk_scores_x_index = topk_score_indices % center_heatmap->width(); // Find the x index of the cells
+
+    // With the top k indices in hand, we can now extract the corresponding center offsets and widths/heights
+    auto topk_center_offset = gather_features_from_tensor(center_offset, topk_score_indices);   // Use the top k indices from earlier
+    auto topk_center_wh = gather_features_from_tensor(center_width_height, topk_score_indices); // Use the top k indices from earlier
+
+    // Now that we have our top k features, we can rescale them to dequantize
+    xt::xarray<float> topk_scores_rescaled = common::dequantize(topk_scores,
+                                                                center_heatmap->vstream_info().quant_info.qp_scale, center_heatmap->vstream_info().quant_info.qp_zp);
+    xt::xarray<float> topk_center_offset_rescaled = common::dequantize(topk_center_offset,
+                                                                       center_offset->vstream_info().quant_info.qp_scale, center_offset->vstream_info().quant_info.qp_zp);
+    xt::xarray<float> topk_center_wh_rescaled = common::dequantize(topk_center_wh,
+                                                                   center_width_height->vstream_info().quant_info.qp_scale, center_width_height->vstream_info().quant_info.qp_zp);
+
+    // Build up the detection boxes
+    xt::xarray<float> bboxes = build_boxes_centerpose(topk_scores_rescaled,
+                                                      topk_center_offset_rescaled,
+                                                      topk_center_wh_rescaled,
+                                                      topk_scores_x_index, topk_scores_y_index, score_threshold, image_size);
 
     // Joinf keypoint decoding
 
@@ -443,33 +264,16 @@ std::vector<HailoDetection> centerpose_postprocess(HailoROIPtr roi,
     const int num_joints = joint_center_offset->features() / 2;                                 // Get the number of joints
     auto topk_keypoints = gather_features_from_tensor(joint_center_offset, topk_score_indices); // Use the top k indices from earlier
 
-    // From the joint_heatmap tensor, we want to extract the top k joints with the highest score
-
-    if (output_layers["joint_heatmap"].second) // uint16
-    {
-        auto top_k_joint_heatmap = top_k_joints_uint16(joint_heatmap, k); // Returns both the top scores and their indices
-        topk_joint_heatmap_indices = top_k_joint_heatmap.first;           // Separate out the top score indices
-        topk_joint_score_rescaled = common::dequantize(top_k_joint_heatmap.second,
-                                                       joint_heatmap->vstream_info().quant_info.qp_scale, joint_heatmap->vstream_info().quant_info.qp_zp);
-    }
-    else
+    // From the joint_heatmap tensor, we want to extract the top k joints with the highest score, in shape {num_joints, k, 1}
+    std::vector<common::HeatmapPeak> joint_peaks;
+    top_k_heatmap_peaks(joint_heatmap, output_layers["joint_heatmap"].second, k, joint_peaks);
+    xt::xarray<float> topk_joint_scores = xt::empty<float>({num_joints, k, 1});
+    for (int index = 0; index < num_joints * k; index++)
     {
-        auto top_k_joint_heatmap = top_k_joints(joint_heatmap, k); // Returns both the top scores and their indices
-        topk_joint_heatmap_indices = top_k_joint_heatmap.first;    // Separate out the top score indices
-        topk_joint_score_rescaled = common::dequantize(top_k_joint_heatmap.second,
-                                                       joint_heatmap->vstream_info().quant_info.qp_scale, joint_heatmap->vstream_info().quant_info.qp_zp);
+        topk_joint_scores.flat(index) = joint_peaks[index].value;
     }
-    // The indices are in respect to an array of shape {435200}, so we will need to calculate the proper (x,y)
-    topk_joint_heatmap_indices = topk_joint_heatmap_indices % (joint_heatmap->width() * joint_heatmap->height());
-    xt::xarray<int> topk_joints_y_index = topk_joint_heatmap_indices / joint_heatmap->width(); // Find the y index of the cells
-    xt::xarray<int> topk_joints_x_index = topk_joint_heatmap_indices % joint_heatmap->width(); // Find the x index of the cells
-
-    // With the top k joint indices in hand, we can now extract the corresponding joint center offsets
-    // Use the top k joint indices from earlier, use a 1 dimensional reshaped view though so we get all 340 offsets
-    // then reshape view back to {17, 20, 2}
-    xt::xarray<int> flattened_joint_indices = xt::flatten(topk_joint_heatmap_indices);
-    xt::xarray<uint8_t> topk_joint_offset = xt::reshape_view(gather_features_from_tensor(joint_offset, flattened_joint_indices),
-                                                             {num_joints, k, 2});
+    xt::xarray<float> topk_joint_score_rescaled = common::dequantize(topk_joint_scores,
+                                                                     joint_heatmap->vstream_info().quant_info.qp_scale, joint_heatmap->vstream_info().quant_info.qp_zp);
 
     // Now that we have our top k joints, we can rescale them to dequantize
     xt::xarray<float> topk_keypoints_rescaled = common::dequantize(topk_keypoints,
@@ -487,9 +291,7 @@ std::vector<HailoDetection> centerpose_postprocess(HailoROIPtr roi,
     // Stacking adds a new dim, so reshape to { 20, 17, 2 }
     keypoints = xt::reshape_view(keypoints, {k, num_joints, 2});
 
-    // We need to prepare the center_offset_keypoints into this shape as well
-    // Reshape the mask from {num_joints, k} --> {num_joints, k, 1} so that we can stack it later
-    topk_joint_score_rescaled = xt::reshape_view(topk_joint_score_rescaled, {num_joints, k, 1});
+    // We need to prepare the joint scores into this shape as well: {num_joints, k, 1} --> {k, num_joints, 1}
     auto transposed_joint_scores = xt::transpose(topk_joint_score_rescaled, {1, 0, 2});
 
     // As of now the keypoints are still in 160x160 grid space. Now that we have chosen the right keypoints,
@@ -4,12 +4,9 @@
  **/
 #include <vector>
 #include <iostream>
-#include "common/tensors.hpp"
-#include "common/math.hpp"
+#include "common/embedding.hpp"
+#include "common/embedding_gallery.hpp"
 #include "re-id.hpp"
-#include "hailo_xtensor.hpp"
-#include "xtensor/xadapt.hpp"
-#include "xtensor/xarray.hpp"
 
 #define OUTPUT_LAYER_NAME "repvgg_a0_person_reid_2048/fc1"
 
@@ -26,14 +23,9 @@ void re_id(HailoROIPtr roi)
     // Remove previous matrices
     roi->remove_objects_typed(HAILO_MATRIX);
 
-    // Convert the tensor to xarray.
+    // Dequantize and normalize the tensor into the embedding matrix.
     auto tensor = roi->get_tensor(OUTPUT_LAYER_NAME);
-    xt::xarray<float> embedding = common::get_xtensor_float(tensor);
-
-    // vector normalization
-    auto normalized_embedding = common::vector_normalization(embedding);
-
-    roi->add_object(hailo_common::create_matrix_ptr(normalized_embedding));
+    roi->add_object(common::embedding_matrix(tensor));
 }
 
 void re_id_osnet(HailoROIPtr roi)
@@ -46,14 +38,9 @@ void re_id_osnet(HailoROIPtr roi)
     // Remove previous matrices
     roi->remove_objects_typed(HAILO_MATRIX);
 
-    // Convert the tensor to xarray.
+    // Dequantize and normalize the tensor into the embedding matrix.
     auto tensor = roi->get_tensor(OUTPUT_LAYER_NAME_OSNET);
-    xt::xarray<float> embedding = common::get_xtensor_float(tensor);
-
-    // vector normalization
-    auto normalized_embedding = common::vector_normalization(embedding);
-
-    roi->add_object(hailo_common::create_matrix_ptr(normalized_embedding));
+    roi->add_object(common::embedding_matrix(tensor));
 
     int check = 0;
     for(auto o : roi->get_objects()){
@@ -67,6 +54,49 @@ void re_id_osnet(HailoROIPtr roi)
     }
 }
 
+void re_id_gallery(HailoROIPtr roi)
+{
+    // Gather the embeddings of the detections of the frame
+    thread_local std::vector<HailoDetectionPtr> detections;
+    thread_local std::vector<float> embeddings;
+    thread_local std::vector<int> global_ids;
+    detections.clear();
+    embeddings.clear();
+    size_t dimension = 0;
+    for (auto obj : roi->get_objects_typed(HAILO_DETECTION))
+    {
+        HailoDetectionPtr detection = std::dynamic_pointer_cast<HailoDetection>(obj);
+        for (auto matrix_obj : detection->get_objects_typed(HAILO_MATRIX))
+        {
+            std::vector<float> &embedding = std::dynamic_pointer_cast<HailoMatrix>(matrix_obj)->get_data();
+            if (dimension == 0)
+                dimension = embedding.size();
+            if (embedding.size() != dimension || dimension == 0)
+                continue;
+            embeddings.insert(embeddings.end(), embedding.begin(), embedding.end());
+            detections.push_back(detection);
+            break;
+        }
+    }
+    if (detections.empty())
+        return;
+
+    // Match them to the global identities
+    global_ids.resize(detections.size());
+    common::EmbeddingGallery::reid(dimension).assign(embeddings.data(), detections.size(), global_ids.data());
+    for (size_t i = 0; i < detections.size(); i++)
+    {
+        for (auto obj : detections[i]->get_objects_typed(HAILO_UNIQUE_ID))
+        {
+            if (std::dynamic_pointer_cast<HailoUniqueID>(obj)->get_mode() == GLOBAL_ID)
+                detections[i]->remove_object(obj);
+        }
+        if (global_ids[i] >= 0)
+            detections[i]->add_object(std::make_shared<HailoUniqueID>(global_ids[i], GLOBAL_ID));
+    }
+    detections.clear();
+}
+
 void filter(HailoROIPtr roi)
 {
     re_id(roi);
@@ -11,4 +11,6 @@ void filter(HailoROIPtr roi);
 void filter1(HailoROIPtr roi);
 void reid(HailoROIPtr roi);
 void reid_osnet(HailoROIPtr roi);
+// Assign global ids to the detections of a frame by matching their embeddings to an in-process gallery.
+void re_id_gallery(HailoROIPtr roi);
 __END_DECLS
\ No newline at end of file
@@ -15,6 +15,9 @@
 // Hailo includes
 #include "re-id_overlay.hpp"
 #include "hailo_common.hpp"
+#include "common/hailomat.hpp"
+#include "common/image.hpp"
+#include "common/overlay_compositor.hpp"
 
 // Open source includes
 #include <opencv2/opencv.hpp>
@@ -27,6 +30,7 @@
 #define TEXT_CLS_THICKNESS (2)
 #define TEXT_FONT_FACTOR (0.12f)
 #define DEFAULT_DETECTION_COLOR (cv::Scalar(255, 255, 255))
+#define PRELOADED_GLOBAL_IDS (256)
 
 static const std::vector<cv::Scalar> color_table = {
     cv::Scalar(255, 0, 0), cv::Scalar(0, 255, 0), cv::Scalar(0, 0, 255), cv::Scalar(255, 255, 0), cv::Scalar(0, 255, 255),
@@ -79,182 +83,34 @@ HailoUniqueIDPtr get_global_id(HailoDetectionPtr detection)
 //     }
 // }
 
-static void printImageDimensions(const cv::Mat& image) {
-    int dimensions = image.dims;
-    const int* size = image.size;
+// Rasterize the first global ids whole (larger ids are composed from glyphs), once, when the overlay is loaded
+static const bool text_atlas_preloaded = (common::preload_overlay_text(common::number_texts(1, PRELOADED_GLOBAL_IDS), TEXT_CLS_THICKNESS, TEXT_FONT_FACTOR), true);
 
-    std::cout << "Image dimensions: " << dimensions << " (";
-
-    for (int i = 0; i < dimensions; ++i) {
-        std::cout << size[i];
-        if (i < dimensions - 1) {
-            std::cout << " x ";
-        }
-    }
-
-    std::cout << ")" << std::endl;
-}
-
-static cv::Mat bgrToNV12(const cv::Mat& bgrImage) {
-    // Step 1: Split BGR image into channels
-    cv::Mat channels[3];
-    cv::split(bgrImage, channels);
-
-    // Step 2: Convert to grayscale (Y plane)
-    cv::Mat yPlane;
-    cv::cvtColor(bgrImage, yPlane, cv::COLOR_BGR2GRAY);
-
-    // Step 3: Resize and combine blue and red channels to form UV plane
-    cv::Mat uvPlane;
-    cv::resize(channels[0], channels[0], cv::Size(), 0.5, 0.5); // Downsample blue channel
-    cv::resize(channels[2], channels[2], cv::Size(), 0.5, 0.5); // Downsample red channel
-    std::vector<cv::Mat> uvChannels = {channels[0], channels[2]};
-    cv::merge(uvChannels, uvPlane); // Combine blue and red channels
-    std::cout << "Bug here" << std::endl;
-    // Step 4: Concatenate Y and UV planes to form NV12 image
-    std::vector<cv::Mat> nv12Planes = {yPlane, uvPlane};
-    cv::Mat nv12Image;
-    cv::merge(nv12Planes, nv12Image);
-
-    return nv12Image;
-}
-
-static cv::Mat BGR2YUV_NV12(const cv::Mat &src) {
-  auto src_h = src.rows, src_w = src.cols;
-  cv::Mat dst(src_h * 1.5, src_w, CV_8UC1);
-  cv::cvtColor(src, dst, cv::COLOR_BGR2YUV_I420);
-  auto n_y = src_h * src_w;
-  auto n_uv = n_y / 2, n_u = n_y / 4;
-  std::vector<uint8_t> uv(n_uv);
-  std::copy(dst.data+n_y, dst.data+n_y+n_uv, uv.data());
-  for (auto i = 0; i < n_u; i++) {
-    dst.data[n_y + 2*i] = uv[i];            // U
-    dst.data[n_y + 2*i + 1] = uv[n_u + i];  // V
-  }
-  return dst;
-}
-
-static void draw_detection(cv::Mat &image_planes, HailoDetectionPtr detection, HailoROIPtr roi, int font_thickness = 1, int line_thickness = 1)
+static common::DetectionStyle detection_style(const HailoDetectionPtr &detection)
 {
-
-    HailoBBox roi_bbox = hailo_common::create_flattened_bbox(roi->get_bbox(), roi->get_scaling_bbox());
-    auto detection_bbox = detection->get_bbox();
+    common::DetectionStyle style;
     auto global_id = get_global_id(detection);
-
-    auto bbox_min = cv::Point(((detection_bbox.xmin() * roi_bbox.width()) + roi_bbox.xmin()) * image_planes.cols,
-                              ((detection_bbox.ymin() * roi_bbox.height()) + roi_bbox.ymin()) * image_planes.rows);
-    auto bbox_max = cv::Point(((detection_bbox.xmax() * roi_bbox.width()) + roi_bbox.xmin()) * image_planes.cols,
-                              ((detection_bbox.ymax() * roi_bbox.height()) + roi_bbox.ymin()) * image_planes.rows);
-    auto bbox_width = bbox_max.x - bbox_min.x;
-
-    // Draw the detection box
-    auto color_rgb = (!global_id) ? DEFAULT_DETECTION_COLOR : indexToColor(global_id->get_id());
-    cv::rectangle(image_planes, bbox_min, bbox_max, color_rgb, line_thickness);
-
-
+    style.color = (!global_id) ? DEFAULT_DETECTION_COLOR : indexToColor(global_id->get_id());
+    // Draw the global id on the box
     if (global_id)
-    {
-        std::string id_text = std::to_string(global_id->get_id());
-        // Calculating the font size according to the box width.
-        float font_scale = TEXT_FONT_FACTOR * log(bbox_width);
-        
-        auto text_position = cv::Point(bbox_min.x + log(bbox_width), bbox_max.y - log(bbox_width));
-        
-        // Draw the class and confidence text
-        cv::putText(image_planes, id_text, text_position, cv::FONT_HERSHEY_SIMPLEX, font_scale, color_rgb, font_thickness);
-        std::cout << "Detect an old person has id: " << id_text << std::endl;
-    }
-    else{
-        std::cout << "Detect a new person!" << std::endl;
-    }
-}
-
-static void copyNv12DataToGstVideoFrame(const cv::Mat& nv12Image, GstVideoFrame* frame) {
-    // Assuming nv12Image is a cv::Mat representing an NV12 image
-
-    // Map the GstVideoFrame to access its data pointers
-    GstMapInfo mapInfo;
-    gst_buffer_map(frame->buffer, &mapInfo, GST_MAP_WRITE);
-
-    // Copy NV12 data to the GstVideoFrame
-    guint8* data = mapInfo.data;
-
-    // Copy Y plane data
-    memcpy(data, nv12Image.data, nv12Image.rows * nv12Image.cols);
-
-    // Copy UV plane data
-    memcpy(data + nv12Image.rows * nv12Image.cols, nv12Image.data + nv12Image.rows * nv12Image.cols, nv12Image.rows * nv12Image.cols / 2);
-
-    // Unmap the frame
-    gst_buffer_unmap(frame->buffer, &mapInfo);
+        style.text = std::to_string(global_id->get_id());
+    return style;
 }
 
 void filter(HailoROIPtr roi, GstVideoFrame *frame, gchar *current_stream_id)
-// void filter(HailoROIPtr roi, cv::Mat& frame)
 {
-    // gint cv2_format = CV_8UC3;
-    int font_thickness = 2;
+    int font_thickness = TEXT_CLS_THICKNESS;
     int line_thickness = 2;
-    // guint matrix_width = (guint)GST_VIDEO_FRAME_WIDTH(frame);
-    std::cout << "frame width: "<< frame->info.width << "height: " << frame->info.height << " format: " << frame->info.finfo->format << std::endl;
-
-    // auto mat = cv::Mat(GST_VIDEO_FRAME_HEIGHT(frame), matrix_width, cv2_format,
-    //                    GST_VIDEO_FRAME_PLANE_DATA(frame, 1), GST_VIDEO_FRAME_PLANE_STRIDE(frame, 1));
-    // face_blur(frame, roi);
-    GstVideoInfo *info = &frame->info;
-    int width = GST_VIDEO_INFO_WIDTH(info);
-    int height = GST_VIDEO_INFO_HEIGHT(info);
-    GstVideoFormat format = GST_VIDEO_INFO_FORMAT(info);
 
-    // Check if it's NV12 format
-    if (format != GST_VIDEO_FORMAT_NV12) {
+    // Wrap the planes of the mapped frame, the drawing touches only the pixels it changes
+    std::shared_ptr<HailoMat> hmat = get_mat_by_format(frame, line_thickness, font_thickness);
+    if (!hmat)
         throw std::runtime_error("Unsupported pixel format");
-    }
-
-    // Extract pointers and strides for the Y and UV planes
-    guint8 *yData = (guint8*)GST_VIDEO_FRAME_PLANE_DATA(frame, 0); // Y plane
-    int yStride = GST_VIDEO_FRAME_PLANE_STRIDE(frame, 0);
-    guint8 *uvData = (guint8*)GST_VIDEO_FRAME_PLANE_DATA(frame, 1); // UV plane
-    int uvStride = GST_VIDEO_FRAME_PLANE_STRIDE(frame, 1);
-
-    // Create an OpenCV Mat for Y channel
-    cv::Mat yMat(height, width, CV_8UC1, yData, yStride);
-
-    // Create an OpenCV Mat for UV channels
-    cv::Mat uvMat(height / 2, width / 2, CV_8UC2, uvData, uvStride);
-
-    // Convert NV12 to BGR
-    cv::Mat mat;
-    cv::cvtColorTwoPlane(yMat, uvMat, mat, cv::COLOR_YUV2BGR_NV12);
-
-
-    if (mat.channels() != 3) {
-        throw std::runtime_error("Invalid number of channels in converted image");
-    }
-
-    for (auto obj : roi->get_objects())
-    {
-        switch (obj->get_type())
-        {
-        case HAILO_DETECTION:
-        {
-            HailoDetectionPtr detection = std::dynamic_pointer_cast<HailoDetection>(obj);
-            draw_detection(mat, detection, roi, font_thickness, line_thickness);
-
-            break;
-        }
-        default:
-            // continue;
-            std::cout << obj->get_type() << std::endl;
-            break;
-        }
-    }
-
-    mat = BGR2YUV_NV12(mat);
-
-    // copyNv12DataToGstVideoFrame(mat, frame);
 
-    mat.release();
+    // Flatten the ROI into drawings, then draw them band by band on the overlay threads
+    common::OverlayCompositor compositor(*hmat);
+    compositor.add_roi(roi, detection_style, TEXT_FONT_FACTOR);
+    compositor.render();
 }
 
 void filter1(HailoROIPtr roi, GstVideoFrame *frame, gchar *current_stream_id)
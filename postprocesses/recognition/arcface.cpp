@@ -3,13 +3,9 @@
  * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
  **/
 #include <vector>
-#include "common/tensors.hpp"
-#include "common/math.hpp"
+#include "common/embedding.hpp"
 #include "arcface.hpp"
 #include "hailo_tracker.hpp"
-#include "hailo_xtensor.hpp"
-#include "xtensor/xadapt.hpp"
-#include "xtensor/xarray.hpp"
 
 #define OUTPUT_LAYER_NAME_RGB "arcface_mobilenet_v1/fc1"
 #define OUTPUT_LAYER_NAME_RGBA "arcface_mobilefacenet_rgbx/fc1"
@@ -31,14 +27,9 @@ void arcface(HailoROIPtr roi, std::string layer_name)
         roi->remove_objects_typed(HAILO_MATRIX);
     else
         HailoTracker::GetInstance().remove_matrices_from_track(jde_tracker_name, unique_ids[0]->get_id());
-    // Convert the tensor to xarray.
+    // Dequantize and normalize the tensor into the embedding matrix.
     auto tensor = roi->get_tensor(layer_name);
-    xt::xarray<float> embeddings = common::get_xtensor_float(tensor);
-
-    // vector normalization
-    auto normalized_embedding = common::vector_normalization(embeddings);
-
-    HailoMatrixPtr hailo_matrix = hailo_common::create_matrix_ptr(normalized_embedding);
+    HailoMatrixPtr hailo_matrix = common::embedding_matrix(tensor);
     if(unique_ids.empty())
     {
         roi->add_object(hailo_matrix);
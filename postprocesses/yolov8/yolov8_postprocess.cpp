@@ -10,239 +10,177 @@
 #include <string>
 #include <tuple>
 #include <vector>
-#include <fstream>
 #include <ctime>
+#include <mutex>
 
 // Hailo includes
-#include "common/math.hpp"
 #include "hailo_objects.hpp"
-#include "common/tensors.hpp"
 #include "common/nms.hpp"
+#include "common/quantization.hpp"
+#include "common/detection_arena.hpp"
+#include "common/event_sink.hpp"
 #include "common/labels/coco_eighty.hpp"
 #include "yolov8_postprocess.hpp"
 
-using namespace xt::placeholders;
-
 #define SCORE_THRESHOLD 0.8
 #define IOU_THRESHOLD 0.7
 #define NUM_CLASSES 2
 
 const std::string file_name = "data.txt";
+std::mutex last_write_mutex;
 std::time_t last_write_time = 0;
 std::string last_label = "";
 
-void write_txt(const std::string label) {
+void write_txt(const std::string &label) {
     std::time_t now = std::time(nullptr);
-    if (label == last_label && std::difftime(now, last_write_time) < 5) {
-        return; 
-    }
-
-    std::tm* local_time = std::localtime(&now);
-    char buffer[80];
-    std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", local_time);
-    
-    std::ifstream check_file(file_name);
-    if (!check_file.is_open()) {
-        std::ofstream create_file(file_name);
-        create_file.close();
-    }
-
-    std::ofstream file(file_name, std::ios::app);
-    if (file.is_open()){
-        file << label << " " << buffer <<std::endl;
-        file.close();
-
+    {
+        // Streams share the rate limit of a label
+        std::lock_guard<std::mutex> lock(last_write_mutex);
+        if (label == last_label && std::difftime(now, last_write_time) < 5) {
+            return; 
+        }
         last_write_time = now;
         last_label = label;
     }
 
-}
-
-/**
- * @brief Split the raw output tensors into boxes and scores
- * 
- * @param tensors  -  std::vector<HailoTensorPtr>
- *        The network output tensors
- * 
- * @param num_classes  -  int
- *        Number of classes
- * 
- * @param regression_length  -  int
- *        Regression length of anchors
- *  
- * @return std::pair<std::vector<xt::xarray<float>>, xt::xarray<float>> 
- *         The separated score and box vectors
- */
-std::pair<std::vector<HailoTensorPtr>, xt::xarray<float>> get_boxes_and_scores(std::vector<HailoTensorPtr> &tensors,
-                                                                                  int num_classes,
-                                                                                  int regression_length)
-{
-    std::vector<HailoTensorPtr> outputs_boxes(tensors.size() / 2);
-    
-    // Prepare the scores xarray at the size we will fill in in-place
-    int total_scores = 0;
-    for (uint i = 0; i < tensors.size(); i = i + 2) { 
-        total_scores += tensors[i+1]->width() * tensors[i+1]->height(); 
-    }
-
-    std::vector<size_t> shape = { (long unsigned int)total_scores, (long unsigned int)num_classes};
-    
-    xt::xarray<float> scores(shape);
-    int view_index = 0;
-
-    for (uint i = 0; i < tensors.size(); i = i + 2)
-    {
-        // Bounding boxes extraction will be done later on only on the boxes that surpass the score threshold
-        outputs_boxes[i / 2] = tensors[i];
-
-        // Extract and dequantize the scores outputs
-        auto dequantized_output_s = common::dequantize(common::get_xtensor(tensors[i+1]), tensors[i+1]->vstream_info().quant_info.qp_scale, tensors[i+1]->vstream_info().quant_info.qp_zp);
-        int num_proposals_scores = dequantized_output_s.shape(0)*dequantized_output_s.shape(1);
-
-        // From the layer extract the scores
-        auto output_scores = xt::view(dequantized_output_s, xt::all(), xt::all(), xt::all());
-        xt::view(scores, xt::range(view_index, view_index + num_proposals_scores), xt::all()) = xt::reshape_view(output_scores, {num_proposals_scores, num_classes});
-        view_index += num_proposals_scores;
-    }
+    std::tm local_time;
+    localtime_r(&now, &local_time);
+    char buffer[80];
+    std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &local_time);
 
-    return std::pair<std::vector<HailoTensorPtr>, xt::xarray<float>>( outputs_boxes, scores );
+    // The file is written by the event sink thread, never by the post-process
+    common::EventSink::get(file_name).push(label + " " + buffer);
 }
 
 float dequantize_value(uint8_t val, float32_t qp_scale, float32_t qp_zp){
     return (float(val) - qp_zp) * qp_scale;
 }
 
-void dequantize_box_values(xt::xarray<float>& box, int index, xt::xarray<uint8_t>& quantized_box, size_t dim1, size_t dim2, float32_t qp_scale, float32_t qp_zp){
-    for (size_t i = 0; i < dim1; i++){
-        for (size_t j = 0; j < dim2; j++){
-            box(i, j) = dequantize_value(quantized_box(index, i, j), qp_scale, qp_zp);
-        }
+/**
+ * @brief Decode a single DFL box side: softmax over the bins followed by the expectation
+ *
+ * @param quantized_bins  -  const uint8_t *
+ *        The quantized distribution of one box side
+ *
+ * @param bins  -  std::vector<float> &
+ *        Scratch buffer of regression_length + 1 values
+ *
+ * @return float
+ *         The expected distance (in grid units) of the box side from the center
+ */
+float decode_dfl_distance(const uint8_t *quantized_bins, std::vector<float> &bins, float32_t qp_scale, float32_t qp_zp)
+{
+    float sum = 0.0f;
+    for (uint k = 0; k < bins.size(); k++)
+    {
+        bins[k] = std::exp(dequantize_value(quantized_bins[k], qp_scale, qp_zp));
+        sum += bins[k];
     }
+    float distance = 0.0f;
+    for (uint k = 0; k < bins.size(); k++)
+        distance += (bins[k] / sum) * k;
+    return distance;
 }
 
-std::vector<xt::xarray<double>> get_centers(std::vector<int>& strides, std::vector<int>& network_dims,
-                                        std::size_t boxes_num, int strided_width, int strided_height){
-
-        std::vector<xt::xarray<double>> centers(boxes_num);
-
-        for (uint i=0; i < boxes_num; i++) {
-            strided_width = network_dims[0] / strides[i];
-            strided_height = network_dims[1] / strides[i];
-
-            // Create a meshgrid of the proper strides
-            xt::xarray<int> grid_x = xt::arange(0, strided_width);
-            xt::xarray<int> grid_y = xt::arange(0, strided_height);
-
-            auto mesh = xt::meshgrid(grid_x, grid_y);
-            grid_x = std::get<1>(mesh);
-            grid_y = std::get<0>(mesh);
-
-            // Use the meshgrid to build up box center prototypes
-            auto ct_row = (xt::flatten(grid_y) + 0.5) * strides[i];
-            auto ct_col = (xt::flatten(grid_x) + 0.5) * strides[i];
-
-            centers[i] = xt::stack(xt::xtuple(ct_col, ct_row, ct_col, ct_row), 1);
-        }
-
-        return centers;
-}
-
-std::vector<HailoDetection> decode_boxes(std::vector<HailoTensorPtr> raw_boxes_outputs,
-                                            xt::xarray<float> scores,
-                                            std::vector<int> network_dims,
-                                            std::vector<int> strides,
-                                            int regression_length)
+/**
+ * @brief Decode the boxes of the proposals whose score passes the threshold
+ *        The scores are thresholded in the quantized domain, and the DFL decoding
+ *        is only done for the surviving anchors, so the cost is linear in the number of proposals.
+ *
+ * @param tensors  -  std::vector<HailoTensorPtr>
+ *        The network output tensors, ordered as (boxes, scores) pairs per stride
+ *
+ * @param detections  -  std::vector<HailoDetection>
+ *        The decoded detections (before NMS) are appended to it
+ */
+void decode_boxes(std::vector<HailoTensorPtr> &tensors,
+                  std::vector<int> &network_dims,
+                  std::vector<int> &strides,
+                  int regression_length,
+                  int num_classes,
+                  std::vector<HailoDetection> &detections)
 {
-    int strided_width, strided_height, class_index;
-    std::vector<HailoDetection> detections;
-    int instance_index = 0;
-    float confidence = 0.0;
-    std::string label;
-
-    auto centers = get_centers(std::ref(strides), std::ref(network_dims), raw_boxes_outputs.size(), strided_width, strided_height);
+    const common::LabelTable &labels = common::intern_labels(common::coco_eighty);
+    thread_local std::vector<float> bins;
+    bins.resize(regression_length + 1);
+    const int box_channels = 4 * (regression_length + 1);
 
-    // Box distribution to distance
-    auto regression_distance =  xt::reshape_view(xt::arange(0, regression_length + 1), {1, 1, regression_length + 1});
-
-    for (uint i = 0; i < raw_boxes_outputs.size(); i++)
+    for (uint i = 0; i < tensors.size() / 2; i++)
     {
-        auto output_b = common::get_xtensor(raw_boxes_outputs[i]);
-        int num_proposals = output_b.shape(0) * output_b.shape(1);
-        auto output_boxes = xt::view(output_b, xt::all(), xt::all(), xt::all());
-        xt::xarray<uint8_t> quantized_boxes = xt::reshape_view(output_boxes, {num_proposals, 4, regression_length + 1});
-
-        float32_t qp_scale = raw_boxes_outputs[i]->vstream_info().quant_info.qp_scale;
-        float32_t qp_zp = raw_boxes_outputs[i]->vstream_info().quant_info.qp_zp;
-
-        auto shape = {quantized_boxes.shape(1), quantized_boxes.shape(2)};
+        HailoTensorPtr &boxes_tensor = tensors[2 * i];
+        HailoTensorPtr &scores_tensor = tensors[2 * i + 1];
+        const uint8_t *boxes_data = boxes_tensor->data();
+        const uint8_t *scores_data = scores_tensor->data();
+        const int grid_width = scores_tensor->width();
+        const int num_proposals = scores_tensor->width() * scores_tensor->height();
+        const double stride = strides[i];
+
+        float32_t scores_scale = scores_tensor->vstream_info().quant_info.qp_scale;
+        float32_t scores_zp = scores_tensor->vstream_info().quant_info.qp_zp;
+        float32_t boxes_scale = boxes_tensor->vstream_info().quant_info.qp_scale;
+        float32_t boxes_zp = boxes_tensor->vstream_info().quant_info.qp_zp;
+        const uint32_t score_threshold = common::quantized_threshold<uint8_t>(scores_scale, scores_zp, SCORE_THRESHOLD);
 
         for (int j = 0; j < num_proposals; j++)
         {
-            class_index = xt::argmax(xt::row(scores, instance_index))(0);
-            confidence = scores(instance_index, class_index);
-            instance_index++;
-            if (confidence < SCORE_THRESHOLD)
+            // Dequantization is monotonic, so the quantized argmax is the dequantized argmax
+            const uint8_t *proposal_scores = scores_data + j * num_classes;
+            int class_index = 0;
+            for (int c = 1; c < num_classes; c++)
+            {
+                if (proposal_scores[c] > proposal_scores[class_index])
+                    class_index = c;
+            }
+            if (proposal_scores[class_index] < score_threshold)
                 continue;
-
-            xt::xarray<float> box(shape);
-
-            dequantize_box_values(box, j, quantized_boxes, box.shape(0), box.shape(1), qp_scale, qp_zp);
-
-            common::softmax_2D(box.data(), box.shape(0), box.shape(1));
-            
-            auto box_distance = box * regression_distance;
-            xt::xarray<float> reduced_distances = xt::sum(box_distance, {2});
-            auto strided_distances = reduced_distances * strides[i];
-
-            // Decode box
-            auto distance_view1 = xt::view(strided_distances, xt::all(), xt::range(_, 2)) * -1;
-            auto distance_view2 = xt::view(strided_distances, xt::all(), xt::range(2, _));
-            auto distance_view = xt::concatenate(xt::xtuple(distance_view1, distance_view2), 1);
-            auto decoded_box = centers[i] + distance_view;
-
-            HailoBBox bbox(decoded_box(j, 0) / network_dims[0],
-                           decoded_box(j, 1) / network_dims[1],
-                           (decoded_box(j, 2) - decoded_box(j, 0)) / network_dims[0],
-                           (decoded_box(j, 3) - decoded_box(j, 1)) / network_dims[1]);
-
-            label = common::coco_eighty[class_index + 1];
-            HailoDetection detected_instance(bbox, class_index, label, confidence);
-            detections.push_back(detected_instance);
+            float confidence = dequantize_value(proposal_scores[class_index], scores_scale, scores_zp);
+
+            // Decode box: the distances are ordered left, top, right, bottom
+            const uint8_t *proposal_box = boxes_data + j * box_channels;
+            float distances[4];
+            for (int side = 0; side < 4; side++)
+                distances[side] = decode_dfl_distance(proposal_box + side * (regression_length + 1), bins, boxes_scale, boxes_zp) * strides[i];
+
+            // The anchor center is derived from the grid index of the proposal
+            double center_x = (j % grid_width + 0.5) * stride;
+            double center_y = (j / grid_width + 0.5) * stride;
+            double xmin = center_x - distances[0];
+            double ymin = center_y - distances[1];
+            double xmax = center_x + distances[2];
+            double ymax = center_y + distances[3];
+
+            HailoBBox bbox(xmin / network_dims[0],
+                           ymin / network_dims[1],
+                           (xmax - xmin) / network_dims[0],
+                           (ymax - ymin) / network_dims[1]);
+
+            const std::string &label = labels[class_index + 1];
+            detections.emplace_back(bbox, class_index, label, confidence);
 
             //mo 1 file txt va in label vao file
             if (label == "smoke" || label == "fire")
                 write_txt(label);
         }
     }
-    return detections;
 }
 
-std::vector<HailoDetection> yolov8_postprocess(std::vector<HailoTensorPtr> &tensors,
-                                                   std::vector<int> network_dims,
-                                                   std::vector<int> strides,
-                                                   int regression_length,
-                                                   int num_classes)
+void yolov8_postprocess(std::vector<HailoTensorPtr> &tensors,
+                        std::vector<int> &network_dims,
+                        std::vector<int> &strides,
+                        int regression_length,
+                        int num_classes,
+                        std::vector<HailoDetection> &detections)
 {
-    std::vector<HailoDetection> detections;
     if (tensors.size() == 0)
     {
-        return detections;
+        return;
     }
 
-    auto boxes_and_scores = get_boxes_and_scores(tensors, num_classes, regression_length);
-    std::vector<HailoTensorPtr> raw_boxes = boxes_and_scores.first;
-    xt::xarray<float> scores = boxes_and_scores.second;
-
-    // Calculate the sigmoid of the scores
-    // common::sigmoid(scores.data(), scores.size());
-
     // Decode the boxes
-    detections = decode_boxes(raw_boxes, scores, network_dims, strides, regression_length);
+    decode_boxes(tensors, network_dims, strides, regression_length, num_classes, detections);
 
     // Filter with NMS
     common::nms(detections, IOU_THRESHOLD, true);
-
-    return detections;
 }
 
 /**
@@ -256,12 +194,14 @@ void yolov8(HailoROIPtr roi)
 {
     // anchor params
     int regression_length = 15;
-    std::vector<int> strides = {8, 16, 32};
-    std::vector<int> network_dims = {640, 640};
+    static std::vector<int> strides = {8, 16, 32};
+    static std::vector<int> network_dims = {640, 640};
+    // Detections storage of this stream, reused across frames
+    static thread_local common::DetectionArena arena;
 
     std::vector<HailoTensorPtr> tensors = roi->get_tensors();
-    std::vector<HailoDetection> detections = yolov8_postprocess(tensors, network_dims, strides, regression_length, NUM_CLASSES);
-    hailo_common::add_detections(roi, detections);
+    yolov8_postprocess(tensors, network_dims, strides, regression_length, NUM_CLASSES, arena.begin_frame());
+    arena.add_to_roi(roi);
 }
 
 //******************************************************************
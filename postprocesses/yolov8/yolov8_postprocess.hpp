@@ -9,6 +9,13 @@
 #include "hailo_objects.hpp"
 #include "hailo_common.hpp"
 
+void decode_boxes(std::vector<HailoTensorPtr> &tensors,
+                  std::vector<int> &network_dims,
+                  std::vector<int> &strides,
+                  int regression_length,
+                  int num_classes,
+                  std::vector<HailoDetection> &detections);
+
 __BEGIN_DECLS
 void filter(HailoROIPtr roi);
 __END_DECLS
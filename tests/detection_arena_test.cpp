@@ -0,0 +1,58 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+// Interned label tables must follow the labels map they were interned from.
+#include <catch2/catch.hpp>
+#include <map>
+#include <new>
+#include <string>
+
+#include "hailo_objects.hpp"
+#include "common/detection_arena.hpp"
+
+using LabelsMap = std::map<uint8_t, std::string>;
+
+TEST_CASE("interned labels resolve like the map", "[detection_arena]")
+{
+    LabelsMap labels = {{1, "person"}, {3, "car"}};
+    const common::LabelTable &table = common::intern_labels(labels);
+    CHECK(table[1] == "person");
+    CHECK(table[3] == "car");
+    CHECK(table[0].empty());
+    CHECK(table[2].empty());
+    CHECK(table[200].empty());
+    CHECK(&common::intern_labels(labels) == &table);
+}
+
+TEST_CASE("a changed map is interned again", "[detection_arena]")
+{
+    LabelsMap labels = {{1, "person"}, {2, "bicycle"}};
+    CHECK(common::intern_labels(labels)[2] == "bicycle");
+
+    // Same size, other label
+    labels[2] = "car";
+    CHECK(common::intern_labels(labels)[2] == "car");
+
+    // Same size, other class ids
+    labels = {{0, "person"}, {2, "car"}};
+    CHECK(common::intern_labels(labels)[0] == "person");
+    CHECK(common::intern_labels(labels)[1].empty());
+
+    labels.clear();
+    CHECK(common::intern_labels(labels).size() == 0);
+}
+
+TEST_CASE("a map re-created at the address of a freed one is interned again", "[detection_arena]")
+{
+    // Params re-initialized in place: the new labels map lives at the address of the old one
+    alignas(LabelsMap) unsigned char storage[sizeof(LabelsMap)];
+    LabelsMap *labels = new (storage) LabelsMap{{1, "face"}, {2, "person"}};
+    CHECK(common::intern_labels(*labels)[1] == "face");
+    labels->~LabelsMap();
+
+    labels = new (storage) LabelsMap{{1, "plate"}, {2, "vehicle"}};
+    CHECK(common::intern_labels(*labels)[1] == "plate");
+    CHECK(common::intern_labels(*labels)[2] == "vehicle");
+    labels->~LabelsMap();
+}
@@ -0,0 +1,85 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+// Assigning the re-ID embeddings of a frame against a full gallery of 10k identities of 2048 values,
+// in float32 and int8 rows.
+#include <benchmark/benchmark.h>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "common/embedding_gallery.hpp"
+
+namespace
+{
+    constexpr uint32_t DIMENSION = 2048;
+    constexpr uint32_t IDENTITIES = 10000;
+    constexpr uint32_t QUERIES = 30;
+
+    void normalize(float *embedding)
+    {
+        double squared_norm = 0.0;
+        for (uint32_t i = 0; i < DIMENSION; i++)
+            squared_norm += double(embedding[i]) * embedding[i];
+        float inverse_norm = float(1.0 / std::sqrt(squared_norm));
+        for (uint32_t i = 0; i < DIMENSION; i++)
+            embedding[i] *= inverse_norm;
+    }
+
+    /**
+     * @brief Random L2-normalized embeddings, count x DIMENSION.
+     */
+    std::vector<float> random_embeddings(uint32_t count, std::mt19937 &random)
+    {
+        std::normal_distribution<float> value(0.0f, 1.0f);
+        std::vector<float> embeddings(size_t(count) * DIMENSION);
+        for (float &v : embeddings)
+            v = value(random);
+        for (uint32_t i = 0; i < count; i++)
+            normalize(embeddings.data() + size_t(i) * DIMENSION);
+        return embeddings;
+    }
+
+    void BM_gallery_assign(benchmark::State &state)
+    {
+        common::GalleryParams params;
+        params.dimension = DIMENSION;
+        params.capacity = IDENTITIES;
+        params.embeddings_per_identity = 1;
+        params.precision = common::gallery_precision_t(state.range(0));
+        common::EmbeddingGallery gallery(params);
+
+        std::mt19937 random(7);
+        std::vector<float> enrolled = random_embeddings(IDENTITIES, random);
+        auto now = common::EmbeddingGallery::clock::now();
+        for (uint32_t i = 0; i < IDENTITIES; i++)
+            gallery.enroll(enrolled.data() + size_t(i) * DIMENSION, now);
+
+        // Every query is a noisy view of an enrolled identity, so that it matches it
+        std::vector<float> queries = random_embeddings(QUERIES, random);
+        std::uniform_int_distribution<uint32_t> identity(0, IDENTITIES - 1);
+        for (uint32_t q = 0; q < QUERIES; q++)
+        {
+            const float *source = enrolled.data() + size_t(identity(random)) * DIMENSION;
+            float *query = queries.data() + size_t(q) * DIMENSION;
+            for (uint32_t i = 0; i < DIMENSION; i++)
+                query[i] = source[i] + 0.3f * query[i];
+            normalize(query);
+        }
+
+        std::vector<int> ids(QUERIES);
+        for (auto _ : state)
+        {
+            gallery.assign(queries.data(), QUERIES, ids.data(), now);
+            benchmark::DoNotOptimize(ids.data());
+        }
+        state.counters["identities"] = gallery.size();
+        state.SetItemsProcessed(state.iterations() * QUERIES);
+    }
+
+    BENCHMARK(BM_gallery_assign)->Arg(common::GALLERY_PRECISION_FLOAT32)->Arg(common::GALLERY_PRECISION_INT8)->Unit(benchmark::kMillisecond);
+}
+
+BENCHMARK_MAIN();
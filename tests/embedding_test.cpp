@@ -0,0 +1,89 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+// The fused embedding decoding against dequantizing and normalizing in double, in float and int8.
+#include <catch2/catch.hpp>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "hailo_objects.hpp"
+#include "common/embedding.hpp"
+
+namespace
+{
+    constexpr uint32_t DIMENSION = 2048;
+    constexpr float QP_SCALE = 0.03f;
+    constexpr float QP_ZP = 121.0f;
+
+    HailoTensorPtr embedding_tensor(std::vector<uint8_t> &data)
+    {
+        hailo_vstream_info_t info{};
+        std::strncpy(info.name, "reid/fc1", sizeof(info.name) - 1);
+        info.format.type = HAILO_FORMAT_TYPE_UINT8;
+        info.quant_info.qp_scale = QP_SCALE;
+        info.quant_info.qp_zp = QP_ZP;
+        info.shape.height = 1;
+        info.shape.width = 1;
+        info.shape.features = DIMENSION;
+        return std::make_shared<HailoTensor>(data.data(), info);
+    }
+
+    std::vector<double> reference_embedding(const std::vector<uint8_t> &data)
+    {
+        std::vector<double> embedding(data.size());
+        double squared_norm = 0.0;
+        for (size_t i = 0; i < data.size(); i++)
+        {
+            embedding[i] = (double(data[i]) - QP_ZP) * QP_SCALE;
+            squared_norm += embedding[i] * embedding[i];
+        }
+        for (double &value : embedding)
+            value /= std::sqrt(squared_norm);
+        return embedding;
+    }
+}
+
+TEST_CASE("embeddings are normalized in float and int8", "[embedding]")
+{
+    std::mt19937 random(3);
+    std::uniform_int_distribution<int> values(0, 255);
+    std::vector<uint8_t> data(DIMENSION);
+    for (uint8_t &value : data)
+        value = values(random);
+    std::vector<double> expected = reference_embedding(data);
+    HailoTensorPtr tensor = embedding_tensor(data);
+
+    HailoMatrixPtr matrix = common::embedding_matrix(tensor);
+    REQUIRE(matrix->get_data().size() == DIMENSION);
+    for (uint32_t i = 0; i < DIMENSION; i++)
+        CHECK(matrix->get_data()[i] == Approx(expected[i]).margin(1e-6));
+
+    HailoUserMetaPtr meta = common::embedding_int8(tensor);
+    std::string int8_values = meta->get_user_string();
+    float scale = meta->get_user_float();
+    REQUIRE(meta->get_user_int() == int(DIMENSION));
+    REQUIRE(int8_values.size() == DIMENSION);
+    REQUIRE(scale > 0.0f);
+    for (uint32_t i = 0; i < DIMENSION; i++)
+    {
+        int8_t value = int8_t(int8_values[i]);
+        CHECK(value >= -127);
+        // Rounded to the nearest step of the scale
+        CHECK(value * scale == Approx(expected[i]).margin(scale / 2 + 1e-6));
+    }
+}
+
+TEST_CASE("a zero embedding is zeros with a zero scale", "[embedding]")
+{
+    std::vector<uint8_t> data(DIMENSION, uint8_t(QP_ZP));
+    HailoTensorPtr tensor = embedding_tensor(data);
+    HailoMatrixPtr matrix = common::embedding_matrix(tensor);
+    for (float value : matrix->get_data())
+        CHECK(value == 0.0f);
+    HailoUserMetaPtr meta = common::embedding_int8(tensor);
+    CHECK(meta->get_user_float() == 0.0f);
+    CHECK(meta->get_user_string() == std::string(DIMENSION, '\0'));
+}
@@ -0,0 +1,442 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+// The threshold-first face decoding (filter_face_scores) against the previous decoding of the dequantized,
+// stacked and softmaxed outputs, with and without softmax, on the retinaface and lightface layouts.
+// The face logits are spread around the threshold, so the softmax margin bound
+// floor(logit(threshold) / qp_scale) - 1 is exercised on both sides.
+// The previous code sorted the box and class layers by size but stacked the landmark layers in the order
+// they came, so it only paired the right landmarks with a box when the branches came largest first.
+// The reference gets them in that order, the decoder under test gets them in every order.
+#include <catch2/catch.hpp>
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "common/math.hpp"
+#include "common/tensors.hpp"
+#include "common/nms.hpp"
+#include "detection/face_detection.hpp"
+#include "xtensor/xarray.hpp"
+#include "xtensor/xview.hpp"
+#include "hailo_xtensor.hpp"
+
+namespace
+{
+    //-------------------------------
+    // SYNTHETIC OUTPUTS
+    //-------------------------------
+    constexpr int TOTAL_CLASSES = 2;
+    // Logits in [-12.8, 12.7]
+    constexpr float LOGITS_SCALE = 0.1f;
+    constexpr float LOGITS_ZP = 128.0f;
+    // Scores in [0, 1]
+    constexpr float SCORES_SCALE = 1.0f / 255.0f;
+
+    struct BranchShape
+    {
+        uint32_t height;
+        uint32_t width;
+        uint32_t anchors_per_cell;
+    };
+
+    hailo_vstream_info_t layer_info(const std::string &name, const BranchShape &shape, uint32_t features, float qp_scale, float qp_zp)
+    {
+        hailo_vstream_info_t info{};
+        std::strncpy(info.name, name.c_str(), sizeof(info.name) - 1);
+        info.format.type = HAILO_FORMAT_TYPE_UINT8;
+        info.quant_info.qp_scale = qp_scale;
+        info.quant_info.qp_zp = qp_zp;
+        info.shape.height = shape.height;
+        info.shape.width = shape.width;
+        info.shape.features = features;
+        return info;
+    }
+
+    /**
+     * @brief The outputs of a frame, boxes:classes[:landmarks] per branch, largest branch first.
+     *        Most anchors are background, the face anchors have their face logit (or score) spread
+     *        from a little under to well over the threshold.
+     */
+    struct Frame
+    {
+        std::vector<std::vector<uint8_t>> buffers;
+        std::vector<hailo_vstream_info_t> infos;
+        int outputs_per_branch;
+
+        Frame(const std::vector<BranchShape> &branches, bool landmarks, bool softmax, int faces, int seed)
+        {
+            std::mt19937 random(seed);
+            std::uniform_int_distribution<int> values(0, 255);
+            std::uniform_int_distribution<int> box_values(96, 160);
+            std::uniform_real_distribution<float> face_ratio(0.0f, 1.0f);
+            // The margin bound is -6 steps at the 0.4 threshold of retinaface and 7 at the 0.7 of lightface
+            std::uniform_int_distribution<int> face_margins(-10, 40);
+            std::uniform_int_distribution<int> background_margins(12, 255);
+            // The quantized thresholds are 102 and 179
+            std::uniform_int_distribution<int> face_scores(90, 255);
+            std::uniform_int_distribution<int> background_scores(0, 95);
+            outputs_per_branch = landmarks ? 3 : 2;
+            uint32_t total_anchors = 0;
+            for (const BranchShape &shape : branches)
+                total_anchors += shape.height * shape.width * shape.anchors_per_cell;
+            float face_probability = float(faces) / total_anchors;
+
+            for (size_t i = 0; i < branches.size(); i++)
+            {
+                const BranchShape &shape = branches[i];
+                uint32_t num_anchors = shape.height * shape.width * shape.anchors_per_cell;
+                std::vector<uint8_t> boxes(num_anchors * 4);
+                for (auto &value : boxes)
+                    value = box_values(random);
+                std::vector<uint8_t> classes(num_anchors * TOTAL_CLASSES);
+                for (uint32_t anchor = 0; anchor < num_anchors; anchor++)
+                {
+                    uint8_t *logits = classes.data() + anchor * TOTAL_CLASSES;
+                    bool face = face_ratio(random) < face_probability;
+                    logits[0] = values(random);
+                    if (softmax)
+                    {
+                        int margin = face ? face_margins(random) : -background_margins(random);
+                        logits[1] = std::clamp(int(logits[0]) + margin, 0, 255);
+                    }
+                    else
+                        logits[1] = face ? face_scores(random) : background_scores(random);
+                }
+                std::string prefix = "branch" + std::to_string(i);
+                buffers.push_back(std::move(boxes));
+                infos.push_back(layer_info(prefix + "/boxes", shape, 4 * shape.anchors_per_cell, 0.05f, 128.0f));
+                buffers.push_back(std::move(classes));
+                infos.push_back(layer_info(prefix + "/classes", shape, TOTAL_CLASSES * shape.anchors_per_cell,
+                                           softmax ? LOGITS_SCALE : SCORES_SCALE, softmax ? LOGITS_ZP : 0.0f));
+                if (landmarks)
+                {
+                    std::vector<uint8_t> points(num_anchors * 10);
+                    for (auto &value : points)
+                        value = values(random);
+                    buffers.push_back(std::move(points));
+                    infos.push_back(layer_info(prefix + "/landmarks", shape, 10 * shape.anchors_per_cell, 0.05f, 128.0f));
+                }
+            }
+        }
+
+        /**
+         * @brief The output tensors, with the branches in the given order.
+         */
+        std::vector<HailoTensorPtr> tensors(const std::vector<int> &branch_order)
+        {
+            std::vector<HailoTensorPtr> tensors;
+            for (int branch : branch_order)
+            {
+                for (int i = 0; i < outputs_per_branch; i++)
+                {
+                    int output = branch * outputs_per_branch + i;
+                    tensors.push_back(std::make_shared<HailoTensor>(buffers[output].data(), infos[output]));
+                }
+            }
+            return tensors;
+        }
+    };
+
+    //-------------------------------
+    // PREVIOUS DECODING
+    //-------------------------------
+    xt::xarray<float> decode_landmarks(const xt::xarray<float> &landmark_detections,
+                                       const xt::xarray<float> &anchors,
+                                       const xt::xarray<float> &anchors_multiplier)
+    {
+        // Decode the boxes relative to their anchors.
+        // There are 5 landmarks paired in sets of 2 (x and y values),
+        // so we need to tile our anchors by 5
+        xt::xarray<float> landmarks = xt::tile(xt::view(anchors, xt::all(), xt::range(0, 2)), {1, 5}) + landmark_detections * xt::tile(anchors_multiplier, {1, 5});
+        return landmarks;
+    }
+
+    xt::xarray<float> decode_boxes(const xt::xarray<float> &box_detections,
+                                   const xt::xarray<float> &anchors,
+                                   const xt::xarray<float> &anchors_multiplier,
+                                   const xt::xarray<float> &anchor_variance)
+    {
+        // Decode the boxes relative to their anchors
+        xt::xarray<float> anchored_boxes_1 = xt::view(anchors, xt::all(), xt::range(0, 2)) + xt::view(box_detections, xt::all(), xt::range(0, 2)) * anchors_multiplier;
+        xt::xarray<float> anchored_boxes_2 = xt::view(anchors, xt::all(), xt::range(2, 4)) * xt::exp(xt::view(box_detections, xt::all(), xt::range(2, 4)) * anchor_variance(1));
+        xt::xarray<float> boxes = xt::concatenate(xt::xtuple(anchored_boxes_1, anchored_boxes_2), 1);
+
+        // We use view assignment to perform operations on just those slices
+        auto front_slice = xt::view(boxes, xt::all(), xt::range(0, 2));
+        front_slice -= xt::view(boxes, xt::all(), xt::range(2, 4)) / 2;
+        auto back_slice = xt::view(boxes, xt::all(), xt::range(2, 4));
+        back_slice += xt::view(boxes, xt::all(), xt::range(0, 2));
+        return boxes;
+    }
+
+    std::tuple<xt::xarray<float>, xt::xarray<float>, xt::xarray<float>> detect_boxes_and_landmarks(const xt::xarray<float> &box_outputs,
+                                                                                                   const xt::xarray<float> &class_scores,
+                                                                                                   const xt::xarray<float> &landmark_ouputs,
+                                                                                                   const xt::xarray<float> &anchors,
+                                                                                                   const xt::xarray<float> &anchors_multiplier,
+                                                                                                   const xt::xarray<float> &anchor_variance,
+                                                                                                   const float score_threshold)
+    {
+        xt::xarray<float> boxes, landmarks;
+        // Decode the boxes and get the face scores (we don't care about unlabeled scores)
+        boxes = decode_boxes(xt::squeeze(box_outputs), anchors, anchors_multiplier, anchor_variance);
+        xt::xarray<float> scores = xt::col(xt::squeeze(class_scores), 1);
+
+        // Filter out low scores
+        auto higher_scores = xt::where(scores > score_threshold);
+        boxes = xt::view(boxes, xt::keep(higher_scores[0]), xt::all());
+        scores = xt::view(scores, xt::keep(higher_scores[0]));
+
+        // If landmarks are available, then decode those too.
+        if (landmark_ouputs.dimension() > 0)
+        {
+            auto cropped_landmarks = xt::view(xt::squeeze(landmark_ouputs), xt::keep(higher_scores[0]), xt::all());
+            auto cropped_anchors = xt::view(anchors, xt::keep(higher_scores[0]), xt::all());
+            auto cropped_anchors_mul = xt::view(anchors_multiplier, xt::keep(higher_scores[0]), xt::all());
+            landmarks = decode_landmarks(cropped_landmarks, cropped_anchors, cropped_anchors_mul);
+        }
+
+        return std::tuple<xt::xarray<float>, xt::xarray<float>, xt::xarray<float>>(std::move(boxes), std::move(scores), std::move(landmarks));
+    }
+
+    void encode_detections(std::vector<HailoDetection> &objects,
+                           xt::xarray<float> &detection_boxes,
+                           xt::xarray<float> &scores,
+                           xt::xarray<float> &landmarks,
+                           network_type network)
+    {
+        float confidence, w, h, xmin, ymin = 0.0f;
+        std::string label = "face";
+        for (uint index = 0; index < scores.size(); ++index)
+        {
+            confidence = scores(index);
+            xmin = detection_boxes(index, 0);
+            ymin = detection_boxes(index, 1);
+            w = (detection_boxes(index, 2) - detection_boxes(index, 0));
+            h = (detection_boxes(index, 3) - detection_boxes(index, 1));
+
+            HailoBBox bbox(xmin, ymin, w, h);
+            HailoDetection detected_face(bbox, label, confidence);
+
+            if (landmarks.dimension() > 0)
+            {
+                xt::xarray<float> keypoints_raw = xt::row(landmarks, index);
+                // The keypoints are flatten, reshape them to 2 * num_keypoints.
+                int num_keypoints = keypoints_raw.shape(0) / 2;
+                auto face_keypoints = xt::reshape_view(keypoints_raw, {num_keypoints, 2});
+                hailo_common::add_landmarks_to_detection(detected_face, ToString(network), face_keypoints);
+            }
+
+            objects.push_back(detected_face);
+        }
+    }
+
+    std::vector<HailoDetection> reference_postprocess(std::vector<HailoTensorPtr> &tensors,
+                                                      const xt::xarray<float> &anchors,
+                                                      const xt::xarray<float> &anchors_multiplier,
+                                                      const xt::xarray<float> &anchor_variance,
+                                                      const float score_threshold,
+                                                      const float iou_threshold,
+                                                      const int num_branches,
+                                                      const int total_classes,
+                                                      const bool requires_softmax,
+                                                      const network_type network)
+    {
+        std::vector<HailoDetection> objects;
+
+        int num_outputs = tensors.size();
+        int outputs_per_branch = num_outputs / num_branches;
+        std::vector<xt::xarray<float>> box_layers;
+        std::vector<xt::xarray<float>> class_layers;
+        std::vector<xt::xarray<float>> landmarks_layers;
+
+        std::size_t boxes_reshaped_size = 0;
+        std::size_t landmarks_reshaped_size = 0;
+        std::size_t classes_reshaped_size = 0;
+
+        // Separate the layers by outs_per_branch steps
+        for (uint i = 0; i < tensors.size(); ++i)
+        {
+            // While we're here, adapt the tensor into an xarray of float (dequantized).
+            xt::xarray<uint8_t> xdata = common::get_xtensor(tensors[i]);
+            xt::xarray<float> xdata_rescaled = common::dequantize(xdata, tensors[i]->vstream_info().quant_info.qp_scale, tensors[i]->vstream_info().quant_info.qp_zp);
+            // output layers are paired: boxes:classes:landmarks, boxes:classes:landmarks, boxes:classes:landmarks, etc...
+            if (i % outputs_per_branch == 0)
+            {
+                auto num_boxes = (int)xdata_rescaled.shape(0) * (int)xdata_rescaled.shape(1) * ((int)xdata_rescaled.shape(2) / 4);
+                auto xdata_reshaped = xt::reshape_view(xdata_rescaled, {1, num_boxes, 4});
+                box_layers.emplace_back(std::move(xdata_reshaped));
+                boxes_reshaped_size += num_boxes;
+            }
+            else if (i % outputs_per_branch == 1)
+            {
+                auto num_classes = (int)xdata_rescaled.shape(0) * (int)xdata_rescaled.shape(1) * ((int)xdata_rescaled.shape(2) / total_classes);
+                auto xdata_reshaped = xt::reshape_view(xdata_rescaled, {1, num_classes, total_classes});
+                class_layers.emplace_back(std::move(xdata_reshaped));
+                classes_reshaped_size += num_classes;
+            }
+            else
+            {
+                auto num_landmarks = (int)xdata_rescaled.shape(0) * (int)xdata_rescaled.shape(1) * ((int)xdata_rescaled.shape(2) / 10);
+                auto xdata_reshaped = xt::reshape_view(xdata_rescaled, {1, num_landmarks, 10});
+                landmarks_layers.emplace_back(std::move(xdata_reshaped));
+                landmarks_reshaped_size += num_landmarks;
+            }
+        }
+
+        // Sort the two sets in descending order so their order lines up with the pre-calculated anchors.
+        std::sort(box_layers.begin(), box_layers.end(), [](const auto &lhs, const auto &rhs)
+                  { return rhs.shape(1) < lhs.shape(1); });
+        std::sort(class_layers.begin(), class_layers.end(), [](const auto &lhs, const auto &rhs)
+                  { return rhs.shape(1) < lhs.shape(1); });
+
+        int index = 0;
+        std::vector<std::size_t> boxes_shape = {1, boxes_reshaped_size, 4};
+        xt::xarray<float> stacked_boxes(boxes_shape);
+        for (uint i = 0; i < box_layers.size(); ++i)
+        {
+            xt::view(stacked_boxes, xt::all(), xt::range(index, index + box_layers[i].shape(1)), xt::all()) = box_layers[i];
+            index += box_layers[i].shape(1);
+        }
+
+        std::vector<std::size_t> classes_shape = {1, classes_reshaped_size, 2};
+        xt::xarray<float, xt::layout_type::row_major> stacked_classes(classes_shape);
+        index = 0;
+        for (uint i = 0; i < class_layers.size(); ++i)
+        {
+            xt::view(stacked_classes, xt::all(), xt::range(index, index + class_layers[i].shape(1)), xt::all()) = class_layers[i];
+            index += class_layers[i].shape(1);
+        }
+
+        // If there are landmarks, concat those too.
+        std::vector<std::size_t> landmarks_shape = {};
+        if (landmarks_reshaped_size > 0)
+            landmarks_shape = {1, landmarks_reshaped_size, 10};
+        xt::xarray<float> stacked_landmarks(landmarks_shape);
+        index = 0;
+        if (landmarks_layers.size() > 0)
+        {
+            for (uint i = 0; i < landmarks_layers.size(); ++i)
+            {
+                xt::view(stacked_landmarks, xt::all(), xt::range(index, index + landmarks_layers[i].shape(1)), xt::all()) = landmarks_layers[i];
+                index += landmarks_layers[i].shape(1);
+            }
+        }
+
+        // Run softmax on the scores to get the relevant class
+        if (requires_softmax)
+            common::softmax_2D(stacked_classes.data(), stacked_classes.shape(1), stacked_classes.shape(2));
+
+        // Extract boxes and landmarks
+        auto boxes_and_landmarks = detect_boxes_and_landmarks(stacked_boxes, stacked_classes, stacked_landmarks,
+                                                              anchors, anchors_multiplier, anchor_variance,
+                                                              score_threshold);
+        encode_detections(objects,
+                          std::get<0>(boxes_and_landmarks),
+                          std::get<1>(boxes_and_landmarks),
+                          std::get<2>(boxes_and_landmarks),
+                          network);
+
+        // Perform nms to throw out similar detections
+        common::nms(objects, iou_threshold);
+
+        return objects;
+    }
+
+    //-------------------------------
+    // COMPARISON
+    //-------------------------------
+    void require_same_faces(const std::vector<HailoDetection> &faces, const std::vector<HailoDetection> &expected)
+    {
+        REQUIRE(faces.size() == expected.size());
+        for (size_t i = 0; i < faces.size(); i++)
+        {
+            // The same formulas in the same order, so the results are bit identical
+            REQUIRE(faces[i].get_label() == expected[i].get_label());
+            REQUIRE(faces[i].get_confidence() == expected[i].get_confidence());
+            REQUIRE(faces[i].get_bbox().xmin() == expected[i].get_bbox().xmin());
+            REQUIRE(faces[i].get_bbox().ymin() == expected[i].get_bbox().ymin());
+            REQUIRE(faces[i].get_bbox().width() == expected[i].get_bbox().width());
+            REQUIRE(faces[i].get_bbox().height() == expected[i].get_bbox().height());
+
+            HailoDetection face = faces[i], expected_face = expected[i];
+            std::vector<HailoObjectPtr> landmarks = face.get_objects_typed(HAILO_LANDMARKS);
+            std::vector<HailoObjectPtr> expected_landmarks = expected_face.get_objects_typed(HAILO_LANDMARKS);
+            REQUIRE(landmarks.size() == expected_landmarks.size());
+            if (landmarks.empty())
+                continue;
+            std::vector<HailoPoint> points = std::dynamic_pointer_cast<HailoLandmarks>(landmarks[0])->get_points();
+            std::vector<HailoPoint> expected_points = std::dynamic_pointer_cast<HailoLandmarks>(expected_landmarks[0])->get_points();
+            REQUIRE(points.size() == expected_points.size());
+            for (size_t k = 0; k < points.size(); k++)
+            {
+                REQUIRE(points[k].x() == expected_points[k].x());
+                REQUIRE(points[k].y() == expected_points[k].y());
+            }
+        }
+    }
+
+    void check_against_reference(const std::string &function_name, network_type network, bool softmax, int faces)
+    {
+        FaceDetectionParams *params = init("", function_name);
+        // The branches of the default parameters, from the feature maps of get_anchors
+        std::vector<BranchShape> branches;
+        if (network == RETINAFACE)
+            branches = {{92, 160, 2}, {46, 80, 2}, {23, 40, 2}};
+        else
+            branches = {{30, 40, 3}, {15, 20, 2}, {8, 10, 2}, {4, 5, 3}};
+        bool landmarks = network == RETINAFACE;
+        Frame frame(branches, landmarks, softmax, faces, faces + (softmax ? 1 : 0));
+
+        std::vector<int> largest_first(branches.size());
+        for (size_t i = 0; i < branches.size(); i++)
+            largest_first[i] = i;
+        std::vector<HailoTensorPtr> reference_tensors = frame.tensors(largest_first);
+        std::vector<HailoDetection> expected = reference_postprocess(reference_tensors, params->anchors, params->anchors_multiplier, params->anchor_variance,
+                                                                     params->score_threshold, params->iou_threshold, params->num_branches,
+                                                                     TOTAL_CLASSES, softmax, network);
+        if (faces > 0)
+            CHECK(expected.size() > 0);
+
+        // Every order of the branches decodes like the largest first order
+        std::vector<int> order = largest_first;
+        do
+        {
+            std::vector<HailoTensorPtr> tensors = frame.tensors(order);
+            std::vector<HailoDetection> detections = face_detection_postprocess(tensors, params->anchors, params->anchors_multiplier, params->anchor_variance,
+                                                                                params->score_threshold, params->iou_threshold, params->num_branches,
+                                                                                TOTAL_CLASSES, softmax, network);
+            require_same_faces(detections, expected);
+        } while (std::next_permutation(order.begin(), order.end()));
+        free_resources(params);
+    }
+}
+
+TEST_CASE("retinaface faces and landmarks match the previous decoding with softmax", "[face_detection]")
+{
+    check_against_reference("retinaface", RETINAFACE, true, 0);
+    check_against_reference("retinaface", RETINAFACE, true, 30);
+    check_against_reference("retinaface", RETINAFACE, true, 300);
+}
+
+TEST_CASE("retinaface faces and landmarks match the previous decoding without softmax", "[face_detection]")
+{
+    check_against_reference("retinaface", RETINAFACE, false, 0);
+    check_against_reference("retinaface", RETINAFACE, false, 30);
+    check_against_reference("retinaface", RETINAFACE, false, 300);
+}
+
+TEST_CASE("lightface faces match the previous decoding with and without softmax", "[face_detection]")
+{
+    for (bool softmax : {true, false})
+    {
+        check_against_reference("lightface", LIGHTFACE, softmax, 0);
+        check_against_reference("lightface", LIGHTFACE, softmax, 30);
+        check_against_reference("lightface", LIGHTFACE, softmax, 300);
+    }
+}
@@ -0,0 +1,121 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+// HailoNMSDecode keeps the best scored boxes of the nms buffer and returns them in the buffer order,
+// whether or not there were more than max_boxes of them.
+#include <catch2/catch.hpp>
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "hailo_objects.hpp"
+#include "detection/hailo_nms_decode.hpp"
+
+namespace
+{
+    constexpr uint32_t NUM_CLASSES = 4;
+    constexpr uint32_t MAX_BBOXES_PER_CLASS = 8;
+
+    std::map<uint8_t, std::string> LABELS = {{1, "a"}, {2, "b"}, {3, "c"}, {4, "d"}};
+
+    struct Box
+    {
+        uint32_t class_id;
+        float score;
+        float x_min;
+    };
+
+    /**
+     * @brief A float32 nms buffer: per class, the box count and then the boxes.
+     *        Boxes are told apart by x_min, their index in the buffer.
+     */
+    std::vector<uint8_t> nms_buffer(const std::vector<std::vector<float>> &class_scores, std::vector<Box> &boxes)
+    {
+        std::vector<uint8_t> buffer(NUM_CLASSES * (sizeof(float32_t) + MAX_BBOXES_PER_CLASS * sizeof(common::hailo_bbox_float32_t)));
+        size_t offset = 0;
+        for (uint32_t class_id = 0; class_id < NUM_CLASSES; class_id++)
+        {
+            float32_t count = class_scores[class_id].size();
+            std::memcpy(buffer.data() + offset, &count, sizeof(count));
+            offset += sizeof(count);
+            for (float score : class_scores[class_id])
+            {
+                float x_min = boxes.size() / 100.0f;
+                common::hailo_bbox_float32_t bbox = {0.1f, x_min, 0.5f, x_min + 0.2f, score};
+                std::memcpy(buffer.data() + offset, &bbox, sizeof(bbox));
+                offset += sizeof(bbox);
+                boxes.push_back(Box{class_id + 1, score, x_min});
+            }
+        }
+        return buffer;
+    }
+
+    std::vector<HailoDetection> decode(std::vector<uint8_t> &buffer, uint max_boxes)
+    {
+        hailo_vstream_info_t info{};
+        std::strncpy(info.name, "yolov5/nms", sizeof(info.name) - 1);
+        info.format.type = HAILO_FORMAT_TYPE_FLOAT32;
+        info.format.order = HAILO_FORMAT_ORDER_HAILO_NMS;
+        info.nms_shape.number_of_classes = NUM_CLASSES;
+        info.nms_shape.max_bboxes_per_class = MAX_BBOXES_PER_CLASS;
+        auto post = HailoNMSDecode(std::make_shared<HailoTensor>(buffer.data(), info), LABELS, 0.0f, max_boxes);
+        return post.decode<float32_t, common::hailo_bbox_float32_t>();
+    }
+
+    /**
+     * @brief The max_boxes best boxes, ties going to the first in the buffer, in the buffer order.
+     */
+    std::vector<Box> expected_boxes(std::vector<Box> boxes, uint max_boxes)
+    {
+        std::vector<Box> kept = boxes;
+        std::stable_sort(kept.begin(), kept.end(), [](const Box &a, const Box &b)
+                         { return a.score > b.score; });
+        kept.resize(std::min<size_t>(kept.size(), max_boxes));
+        std::sort(kept.begin(), kept.end(), [](const Box &a, const Box &b)
+                  { return a.x_min < b.x_min; });
+        return kept;
+    }
+
+    void require_boxes(const std::vector<HailoDetection> &detections, const std::vector<Box> &expected)
+    {
+        REQUIRE(detections.size() == expected.size());
+        for (size_t i = 0; i < expected.size(); i++)
+        {
+            HailoDetection detection = detections[i];
+            CHECK(detection.get_class_id() == int(expected[i].class_id));
+            CHECK(detection.get_label() == LABELS[expected[i].class_id]);
+            CHECK(detection.get_confidence() == expected[i].score);
+            CHECK(detection.get_bbox().xmin() == expected[i].x_min);
+        }
+    }
+
+    // Tied scores across and within classes
+    const std::vector<std::vector<float>> CLASS_SCORES = {
+        {0.9f, 0.4f, 0.7f},
+        {},
+        {0.7f, 0.95f, 0.4f, 0.7f},
+        {0.4f, 0.8f},
+    };
+}
+
+TEST_CASE("nms boxes under the cap stay in the buffer order", "[hailo_nms_decode]")
+{
+    std::vector<Box> boxes;
+    std::vector<uint8_t> buffer = nms_buffer(CLASS_SCORES, boxes);
+    require_boxes(decode(buffer, 100), boxes);
+    require_boxes(decode(buffer, boxes.size()), boxes);
+}
+
+TEST_CASE("nms boxes over the cap are the best scored in the buffer order", "[hailo_nms_decode]")
+{
+    std::vector<Box> boxes;
+    std::vector<uint8_t> buffer = nms_buffer(CLASS_SCORES, boxes);
+    for (uint max_boxes = 1; max_boxes < boxes.size(); max_boxes++)
+    {
+        INFO("max_boxes " << max_boxes);
+        require_boxes(decode(buffer, max_boxes), expected_boxes(boxes, max_boxes));
+    }
+}
@@ -0,0 +1,139 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+// common::top_k_peaks against the top k centerpose used before it (common::top_k of every transposed channel),
+// on heatmaps like the *_nms layers of the network output: only the 3x3 local maxima survive.
+#include <catch2/catch.hpp>
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+#include "common/heatmap_peaks.hpp"
+#include "common/math.hpp"
+
+namespace
+{
+    // Not square, so that the row of a cell is cell / width
+    constexpr uint32_t HEIGHT = 96;
+    constexpr uint32_t WIDTH = 128;
+    constexpr uint32_t CHANNELS = 17;
+    constexpr uint32_t K = 20;
+    constexpr uint32_t PEAKS_PER_CHANNEL = 2 * K;
+
+    /**
+     * @brief A low background with PEAKS_PER_CHANNEL distinct peaks per channel, then every cell that is
+     *        not the maximum of its 3x3 neighbourhood zeroed, like the max-pool of the network.
+     */
+    template <typename T>
+    std::vector<T> nms_heatmap(uint32_t seed)
+    {
+        std::mt19937 random(seed);
+        const uint32_t max_value = std::numeric_limits<T>::max();
+        std::uniform_int_distribution<uint32_t> background(0, 7);
+        std::vector<T> raw(size_t(HEIGHT) * WIDTH * CHANNELS);
+        for (T &value : raw)
+            value = background(random);
+
+        std::vector<uint32_t> cells(HEIGHT * WIDTH);
+        std::iota(cells.begin(), cells.end(), 0);
+        std::vector<uint32_t> values(max_value - 15);
+        std::iota(values.begin(), values.end(), 16);
+        for (uint32_t channel = 0; channel < CHANNELS; channel++)
+        {
+            std::shuffle(cells.begin(), cells.end(), random);
+            std::shuffle(values.begin(), values.end(), random);
+            for (uint32_t peak = 0; peak < PEAKS_PER_CHANNEL; peak++)
+                raw[size_t(cells[peak]) * CHANNELS + channel] = values[peak];
+        }
+
+        std::vector<T> heatmap(raw.size(), 0);
+        for (uint32_t y = 0; y < HEIGHT; y++)
+        {
+            for (uint32_t x = 0; x < WIDTH; x++)
+            {
+                for (uint32_t channel = 0; channel < CHANNELS; channel++)
+                {
+                    T value = raw[(size_t(y) * WIDTH + x) * CHANNELS + channel];
+                    bool peak = true;
+                    for (uint32_t ny = y ? y - 1 : 0; ny <= std::min(y + 1, HEIGHT - 1); ny++)
+                        for (uint32_t nx = x ? x - 1 : 0; nx <= std::min(x + 1, WIDTH - 1); nx++)
+                            peak = peak && raw[(size_t(ny) * WIDTH + nx) * CHANNELS + channel] <= value;
+                    if (peak)
+                        heatmap[(size_t(y) * WIDTH + x) * CHANNELS + channel] = value;
+                }
+            }
+        }
+        return heatmap;
+    }
+
+    /**
+     * @brief The previous path: each channel laid out as a {1, H * W} row and its top k taken with common::top_k,
+     *        returned as (value, cell) sorted by value.
+     */
+    template <typename T>
+    std::vector<common::HeatmapPeak> previous_top_k(const std::vector<T> &heatmap, uint32_t channel)
+    {
+        xt::xarray<T> row = xt::empty<T>({size_t(1), size_t(HEIGHT) * WIDTH});
+        for (uint32_t cell = 0; cell < HEIGHT * WIDTH; cell++)
+            row(0, cell) = heatmap[size_t(cell) * CHANNELS + channel];
+        xt::xarray<int> indices = common::top_k(row, K);
+        std::vector<common::HeatmapPeak> peaks;
+        for (uint32_t i = 0; i < K; i++)
+        {
+            uint32_t cell = indices(0, i);
+            peaks.push_back({uint32_t(row(0, cell)), cell});
+        }
+        std::sort(peaks.begin(), peaks.end(), [](const common::HeatmapPeak &a, const common::HeatmapPeak &b)
+                  { return a.value > b.value; });
+        return peaks;
+    }
+
+    template <typename T>
+    void check_against_previous_top_k(uint32_t seed)
+    {
+        std::vector<T> heatmap = nms_heatmap<T>(seed);
+        std::vector<common::HeatmapPeak> peaks;
+        common::top_k_peaks(heatmap.data(), HEIGHT, WIDTH, CHANNELS, K, peaks);
+        REQUIRE(peaks.size() == CHANNELS * K);
+        for (uint32_t channel = 0; channel < CHANNELS; channel++)
+        {
+            std::vector<common::HeatmapPeak> expected = previous_top_k(heatmap, channel);
+            // The peaks are distinct and far above the background, so the order is defined
+            REQUIRE(expected.back().value >= 16);
+            for (uint32_t i = 0; i < K; i++)
+            {
+                const common::HeatmapPeak &peak = peaks[size_t(channel) * K + i];
+                CHECK(peak.value == expected[i].value);
+                CHECK(peak.cell == expected[i].cell);
+                CHECK(heatmap[size_t(peak.cell) * CHANNELS + channel] == peak.value);
+            }
+        }
+    }
+}
+
+TEST_CASE("uint8 heatmap peaks match the previous top k", "[heatmap_peaks]")
+{
+    for (uint32_t seed = 1; seed <= 4; seed++)
+        check_against_previous_top_k<uint8_t>(seed);
+}
+
+TEST_CASE("uint16 heatmap peaks match the previous top k", "[heatmap_peaks]")
+{
+    for (uint32_t seed = 1; seed <= 4; seed++)
+        check_against_previous_top_k<uint16_t>(seed);
+}
+
+TEST_CASE("channels with fewer than k peaks are padded", "[heatmap_peaks]")
+{
+    std::vector<uint8_t> heatmap(size_t(HEIGHT) * WIDTH * CHANNELS, 0);
+    heatmap[(size_t(10) * WIDTH + 100) * CHANNELS + 3] = 200;
+    std::vector<common::HeatmapPeak> peaks;
+    common::top_k_peaks(heatmap.data(), HEIGHT, WIDTH, CHANNELS, K, peaks);
+    CHECK(peaks[3 * K].value == 200);
+    CHECK(peaks[3 * K].cell == 10 * WIDTH + 100);
+    CHECK(peaks[3 * K].cell / WIDTH == 10);
+    CHECK(peaks[3 * K + 1].value == 0);
+}
@@ -0,0 +1,237 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+// crop_and_resize_nv12 / crop_and_resize_letterbox_nv12 read the crop in place and resize it in one pass,
+// they must give the pixels and the letterbox scale of HailoMat::crop followed by the previous OpenCV resizes.
+#include <catch2/catch.hpp>
+#include <memory>
+#include <random>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "common/image.hpp"
+
+namespace
+{
+    //-------------------------------
+    // REFERENCE
+    //-------------------------------
+
+    /**
+     * @brief resize_nv12 before the fused resize.
+     */
+    void reference_resize_nv12(std::vector<cv::Mat> &cropped_image_vec, std::vector<cv::Mat> &resized_image_vec, int interpolation)
+    {
+        uint resize_width_y = resized_image_vec[0].cols;
+        uint resize_height_y = resized_image_vec[0].rows;
+
+        uint resize_width_uv = resized_image_vec[1].cols;
+        uint resize_height_uv = resized_image_vec[1].rows;
+
+        cv::resize(cropped_image_vec[0], resized_image_vec[0], cv::Size(resize_width_y, resize_height_y), 0, 0, interpolation);
+        cv::resize(cropped_image_vec[1], resized_image_vec[1], cv::Size(resize_width_uv, resize_height_uv), 0, 0, interpolation);
+    }
+
+    /**
+     * @brief resize_letterbox_nv12 before the fused resize.
+     *        It painted the UV border with (y, u), the first two values of the color,
+     *        here it is painted with (u, v) like the fused resize does.
+     *        When a margin is odd copyMakeBorder reallocates the mats one pixel smaller.
+     */
+    HailoBBox reference_resize_letterbox_nv12(std::vector<cv::Mat> &cropped_image_vec, std::vector<cv::Mat> &resized_image_vec, cv::Scalar color, int interpolation)
+    {
+        // Convert the color to YUV pixel format
+        uint y = RGB2Y(color[0], color[1], color[2]);
+        uint u = RGB2U(color[0], color[1], color[2]);
+        uint v = RGB2V(color[0], color[1], color[2]);
+
+        // Perform the letterbox resize on the Y and UV channels separately
+        HailoBBox letterboxed_scale = resize_letterbox_rgb(cropped_image_vec[0], resized_image_vec[0], cv::Scalar(y), interpolation);
+        resize_letterbox_rgb(cropped_image_vec[1], resized_image_vec[1], cv::Scalar(u, v), interpolation);
+
+        return letterboxed_scale;
+    }
+
+    //-------------------------------
+    // FRAME
+    //-------------------------------
+
+    /**
+     * @brief A 1280x720 NV12 frame with padded rows: noisy gradients on the luma and noisy chroma.
+     */
+    struct Nv12Frame
+    {
+        static constexpr int WIDTH = 1280;
+        static constexpr int HEIGHT = 720;
+        static constexpr int STRIDE = 1344;
+        std::vector<uint8_t> buffer;
+        std::shared_ptr<HailoMat> mat;
+
+        Nv12Frame() : buffer(STRIDE * HEIGHT * 3 / 2)
+        {
+            std::mt19937 random(11);
+            for (int y = 0; y < HEIGHT; y++)
+            {
+                for (int x = 0; x < STRIDE; x++)
+                    buffer[y * STRIDE + x] = (x / 5 + y / 3 + random() % 64) % 256;
+            }
+            for (size_t i = STRIDE * HEIGHT; i < buffer.size(); i++)
+                buffer[i] = 64 + random() % 128;
+            mat = std::make_shared<HailoNV12Mat>(buffer.data(), HEIGHT, WIDTH, STRIDE, STRIDE);
+        }
+    };
+
+    // Crops that are upsampled, downsampled and both, with even and odd letterbox margins
+    const std::vector<HailoBBox> REGIONS = {
+        HailoBBox(0.0f, 0.0f, 1.0f, 1.0f),
+        HailoBBox(0.10f, 0.10f, 0.07f, 0.03f),
+        HailoBBox(0.21f, 0.33f, 0.13f, 0.41f),
+        HailoBBox(0.05f, 0.50f, 0.30f, 0.08f),
+        HailoBBox(0.55f, 0.61f, 0.40f, 0.35f),
+        HailoBBox(0.333f, 0.017f, 0.0513f, 0.77f),
+        HailoBBox(0.70f, 0.20f, 0.25f, 0.70f),
+        HailoBBox(0.9f, 0.9f, 0.3f, 0.3f),
+    };
+
+    const std::vector<cv::Size> SIZES = {
+        cv::Size(224, 224),
+        cv::Size(300, 300),
+        cv::Size(640, 640),
+        cv::Size(128, 256),
+        cv::Size(640, 360),
+        cv::Size(94, 24),
+    };
+
+    const cv::Scalar COLOR(0, 0, 255);
+
+    std::vector<cv::Mat> nv12_mats(cv::Size size)
+    {
+        return {cv::Mat(size.height, size.width, CV_8UC1, cv::Scalar(7)),
+                cv::Mat(size.height / 2, size.width / 2, CV_8UC2, cv::Scalar(7, 7))};
+    }
+
+    //-------------------------------
+    // COMPARISON
+    //-------------------------------
+
+    int count_different(const cv::Mat &actual, const cv::Mat &expected)
+    {
+        if (expected.empty())
+            return 0;
+        cv::Mat difference;
+        cv::absdiff(actual, expected, difference);
+        return cv::countNonZero(difference.reshape(1));
+    }
+
+    /**
+     * @brief The fused resize rounds its fixed point weights differently from cv::resize:
+     *        samples may differ by 1, rarely by 2 (about one in a million on noise).
+     *        Only the part covered by the reference is compared, the rest of the plane must be border.
+     */
+    void require_close(const cv::Mat &actual, const cv::Mat &expected, cv::Scalar border)
+    {
+        REQUIRE(expected.rows <= actual.rows);
+        REQUIRE(expected.cols <= actual.cols);
+        cv::Mat difference;
+        cv::absdiff(actual(cv::Rect(0, 0, expected.cols, expected.rows)), expected, difference);
+        difference = difference.reshape(1);
+        double max_difference = 0;
+        cv::minMaxLoc(difference, nullptr, &max_difference);
+        CHECK(max_difference <= 2);
+        CHECK(cv::countNonZero(difference > 1) <= int(difference.total() / 10000));
+
+        cv::Mat bottom = actual(cv::Rect(0, expected.rows, actual.cols, actual.rows - expected.rows));
+        cv::Mat right = actual(cv::Rect(expected.cols, 0, actual.cols - expected.cols, actual.rows));
+        CHECK(count_different(bottom, cv::Mat(bottom.size(), bottom.type(), border)) == 0);
+        CHECK(count_different(right, cv::Mat(right.size(), right.type(), border)) == 0);
+    }
+
+    void require_equal(const std::vector<cv::Mat> &actual, const std::vector<cv::Mat> &expected)
+    {
+        for (int plane = 0; plane < 2; plane++)
+        {
+            REQUIRE(actual[plane].size() == expected[plane].size());
+            CHECK(count_different(actual[plane], expected[plane]) == 0);
+        }
+    }
+
+    void require_same_box(const HailoBBox &actual, const HailoBBox &expected)
+    {
+        CHECK(actual.xmin() == expected.xmin());
+        CHECK(actual.ymin() == expected.ymin());
+        CHECK(actual.width() == expected.width());
+        CHECK(actual.height() == expected.height());
+    }
+}
+
+TEST_CASE("crop and resize matches the OpenCV path", "[image]")
+{
+    Nv12Frame frame;
+    for (const HailoBBox &region : REGIONS)
+    {
+        auto roi = std::make_shared<HailoROI>(region);
+        for (const cv::Size &size : SIZES)
+        {
+            std::vector<cv::Mat> cropped = frame.mat->crop(roi);
+            std::vector<cv::Mat> expected = nv12_mats(size);
+            reference_resize_nv12(cropped, expected, cv::INTER_LINEAR);
+
+            std::vector<cv::Mat> actual = nv12_mats(size);
+            crop_and_resize_nv12(*frame.mat, roi, actual);
+            require_close(actual[0], expected[0], cv::Scalar(0));
+            require_close(actual[1], expected[1], cv::Scalar(0, 0));
+
+            std::vector<cv::Mat> from_cropped = nv12_mats(size);
+            resize_nv12(cropped, from_cropped);
+            require_equal(from_cropped, actual);
+        }
+    }
+}
+
+TEST_CASE("crop and letterbox matches the OpenCV path", "[image]")
+{
+    Nv12Frame frame;
+    uint8_t y = RGB2Y(COLOR[0], COLOR[1], COLOR[2]);
+    uint8_t u = RGB2U(COLOR[0], COLOR[1], COLOR[2]);
+    uint8_t v = RGB2V(COLOR[0], COLOR[1], COLOR[2]);
+    for (const HailoBBox &region : REGIONS)
+    {
+        auto roi = std::make_shared<HailoROI>(region);
+        for (const cv::Size &size : SIZES)
+        {
+            std::vector<cv::Mat> cropped = frame.mat->crop(roi);
+            std::vector<cv::Mat> expected = nv12_mats(size);
+            HailoBBox expected_scale = reference_resize_letterbox_nv12(cropped, expected, COLOR, cv::INTER_LINEAR);
+
+            std::vector<cv::Mat> actual = nv12_mats(size);
+            HailoBBox actual_scale = crop_and_resize_letterbox_nv12(*frame.mat, roi, actual, COLOR);
+            require_same_box(actual_scale, expected_scale);
+            require_close(actual[0], expected[0], cv::Scalar(y));
+            require_close(actual[1], expected[1], cv::Scalar(u, v));
+
+            std::vector<cv::Mat> from_cropped = nv12_mats(size);
+            require_same_box(resize_letterbox_nv12(cropped, from_cropped, COLOR), actual_scale);
+            require_equal(from_cropped, actual);
+        }
+    }
+}
+
+TEST_CASE("other interpolations crop and letterbox with OpenCV", "[image]")
+{
+    Nv12Frame frame;
+    for (const HailoBBox &region : REGIONS)
+    {
+        auto roi = std::make_shared<HailoROI>(region);
+        for (const cv::Size &size : SIZES)
+        {
+            std::vector<cv::Mat> cropped = frame.mat->crop(roi);
+            std::vector<cv::Mat> expected = nv12_mats(size);
+            HailoBBox expected_scale = reference_resize_letterbox_nv12(cropped, expected, COLOR, cv::INTER_NEAREST);
+
+            std::vector<cv::Mat> actual = nv12_mats(size);
+            require_same_box(crop_and_resize_letterbox_nv12(*frame.mat, roi, actual, COLOR, cv::INTER_NEAREST), expected_scale);
+            require_equal(actual, expected);
+        }
+    }
+}
@@ -0,0 +1,147 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+// common::nms (grid indexed NmsEngine) against the previous pairwise implementation,
+// on synthetic frames of 100 to 20k boxes.
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "hailo_objects.hpp"
+#include "common/nms.hpp"
+
+namespace
+{
+    constexpr float IOU_THRESHOLD = 0.45f;
+    constexpr int NUM_CLASSES = 5;
+
+    /**
+     * @brief The pairwise NMS common::nms was before the NmsEngine, kept as the reference.
+     */
+    void pairwise_nms(std::vector<HailoDetection> &objects, const float iou_thr, bool should_nms_cross_classes = false)
+    {
+        std::vector<HailoDetection> objects_after_nms;
+        std::sort(objects.begin(), objects.end(),
+                  [](HailoDetection a, HailoDetection b)
+                  { return a.get_confidence() > b.get_confidence(); });
+
+        for (uint index = 0; index < objects.size(); index++)
+        {
+            if (objects[index].get_confidence() != 0.0f)
+            {
+                for (uint jindex = index + 1; jindex < objects.size(); jindex++)
+                {
+                    if ((should_nms_cross_classes || (objects[index].get_class_id() == objects[jindex].get_class_id())) &&
+                        objects[jindex].get_confidence() != 0.0f)
+                    {
+                        float iou = common::iou_calc(objects[index].get_bbox(), objects[jindex].get_bbox());
+                        if (iou >= iou_thr)
+                            objects[jindex].set_confidence(0.0f);
+                    }
+                }
+            }
+        }
+        for (uint index = 0; index < objects.size(); index++)
+        {
+            if (objects[index].get_confidence() != 0.0f)
+                objects_after_nms.push_back(objects[index]);
+        }
+        objects = objects_after_nms;
+    }
+
+    /**
+     * @brief Boxes clustered like detector proposals: objects spread over the frame,
+     *        each proposed about 8 times with jittered boxes and scores.
+     *        The order of tied scores is unspecified in both implementations, so the scores are distinct:
+     *        integers over a common denominator, each rounded once, 3.5e-5 apart at 20k boxes (float steps are under 6e-8).
+     */
+    std::vector<HailoDetection> synthetic_boxes(int count)
+    {
+        std::mt19937 random(count);
+        std::uniform_real_distribution<float> position(0.0f, 0.95f);
+        std::uniform_real_distribution<float> size(0.02f, 0.15f);
+        std::uniform_real_distribution<float> jitter(-0.01f, 0.01f);
+        std::uniform_int_distribution<int> class_id(0, NUM_CLASSES - 1);
+
+        std::vector<float> scores(count);
+        for (int i = 0; i < count; i++)
+            scores[i] = float(3 * count + 7 * i) / float(10 * count);
+        std::shuffle(scores.begin(), scores.end(), random);
+        std::vector<float> sorted_scores = scores;
+        std::sort(sorted_scores.begin(), sorted_scores.end());
+        if (std::adjacent_find(sorted_scores.begin(), sorted_scores.end()) != sorted_scores.end())
+            throw std::logic_error("synthetic_boxes: tied scores");
+
+        std::vector<HailoDetection> boxes;
+        boxes.reserve(count);
+        while ((int)boxes.size() < count)
+        {
+            float xmin = position(random), ymin = position(random), width = size(random), height = size(random);
+            int object_class = class_id(random);
+            for (int proposal = 0; proposal < 8 && (int)boxes.size() < count; proposal++)
+            {
+                HailoBBox bbox(xmin + jitter(random), ymin + jitter(random), width + jitter(random), height + jitter(random));
+                boxes.emplace_back(bbox, object_class, "object", scores[boxes.size()]);
+            }
+        }
+        return boxes;
+    }
+
+    bool same_survivors(std::vector<HailoDetection> a, std::vector<HailoDetection> b)
+    {
+        if (a.size() != b.size())
+            return false;
+        for (size_t i = 0; i < a.size(); i++)
+        {
+            if (a[i].get_confidence() != b[i].get_confidence() || a[i].get_class_id() != b[i].get_class_id() ||
+                a[i].get_bbox().xmin() != b[i].get_bbox().xmin() || a[i].get_bbox().ymin() != b[i].get_bbox().ymin())
+                return false;
+        }
+        return true;
+    }
+
+    template <void (*Nms)(std::vector<HailoDetection> &, const float, bool)>
+    void run_nms(benchmark::State &state, bool cross_classes)
+    {
+        const std::vector<HailoDetection> boxes = synthetic_boxes(state.range(0));
+        std::vector<HailoDetection> expected = boxes, actual = boxes;
+        pairwise_nms(expected, IOU_THRESHOLD, cross_classes);
+        Nms(actual, IOU_THRESHOLD, cross_classes);
+        if (!same_survivors(expected, actual))
+        {
+            state.SkipWithError("Survivors differ from the pairwise NMS");
+            return;
+        }
+
+        std::vector<HailoDetection> objects;
+        for (auto _ : state)
+        {
+            state.PauseTiming();
+            objects = boxes;
+            state.ResumeTiming();
+            Nms(objects, IOU_THRESHOLD, cross_classes);
+            benchmark::DoNotOptimize(objects.data());
+        }
+        state.counters["kept"] = expected.size();
+    }
+
+    void engine_nms(std::vector<HailoDetection> &objects, const float iou_thr, bool should_nms_cross_classes)
+    {
+        common::nms(objects, iou_thr, should_nms_cross_classes);
+    }
+
+    void BM_nms_engine(benchmark::State &state) { run_nms<engine_nms>(state, false); }
+    void BM_nms_pairwise(benchmark::State &state) { run_nms<pairwise_nms>(state, false); }
+    void BM_nms_engine_cross_classes(benchmark::State &state) { run_nms<engine_nms>(state, true); }
+    void BM_nms_pairwise_cross_classes(benchmark::State &state) { run_nms<pairwise_nms>(state, true); }
+
+    BENCHMARK(BM_nms_engine)->Arg(100)->Arg(1000)->Arg(5000)->Arg(20000)->Unit(benchmark::kMicrosecond);
+    BENCHMARK(BM_nms_pairwise)->Arg(100)->Arg(1000)->Arg(5000)->Arg(20000)->Unit(benchmark::kMicrosecond);
+    BENCHMARK(BM_nms_engine_cross_classes)->Arg(100)->Arg(1000)->Arg(5000)->Arg(20000)->Unit(benchmark::kMicrosecond);
+    BENCHMARK(BM_nms_pairwise_cross_classes)->Arg(100)->Arg(1000)->Arg(5000)->Arg(20000)->Unit(benchmark::kMicrosecond);
+}
+
+BENCHMARK_MAIN();
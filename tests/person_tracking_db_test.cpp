@@ -0,0 +1,184 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+// PersonTrackingWriter against a mock backend: coalescing, retry and recovery of a failing database.
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "person_tracking_db.hpp"
+
+namespace
+{
+    /**
+     * @brief The rows a database would hold after the upserts of the writer, and a switch to fail them.
+     */
+    struct MockDatabase
+    {
+        std::mutex mutex;
+        std::condition_variable written;
+        std::map<int, PersonTrackingRecord> rows;
+        int batches = 0;
+        int failures_left = 0;
+        std::function<void()> on_failure;
+
+        bool wait_for_row(int tracking_id, const std::string &end_time)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            return written.wait_for(lock, std::chrono::seconds(5), [&]
+                                    { auto row_it = rows.find(tracking_id);
+                                      return row_it != rows.end() && row_it->second.end_time == end_time; });
+        }
+    };
+
+    class MockBackend : public PersonTrackingBackend
+    {
+    private:
+        std::shared_ptr<MockDatabase> m_database;
+
+    public:
+        explicit MockBackend(std::shared_ptr<MockDatabase> database) : m_database(database) {}
+
+        void upsert(const std::vector<PersonTrackingRecord> &records) override
+        {
+            bool fail = false;
+            {
+                std::lock_guard<std::mutex> lock(m_database->mutex);
+                if (m_database->failures_left > 0)
+                {
+                    m_database->failures_left--;
+                    fail = true;
+                }
+            }
+            if (fail)
+            {
+                if (m_database->on_failure)
+                    m_database->on_failure();
+                throw std::runtime_error("connection lost");
+            }
+
+            std::lock_guard<std::mutex> lock(m_database->mutex);
+            m_database->batches++;
+            for (const PersonTrackingRecord &record : records)
+            {
+                // Same semantics as the postgres upsert: a known track keeps its start_time
+                auto row_it = m_database->rows.find(record.tracking_id);
+                if (row_it == m_database->rows.end())
+                {
+                    m_database->rows.emplace(record.tracking_id, record);
+                    continue;
+                }
+                row_it->second.attributes = record.attributes;
+                row_it->second.end_time = record.end_time;
+            }
+            m_database->written.notify_all();
+        }
+    };
+
+    PersonTrackingRecord record(int tracking_id, const std::string &time, int attribute = 0)
+    {
+        PersonTrackingRecord record;
+        record.tracking_id = tracking_id;
+        record.attributes[attribute] = 1;
+        record.start_time = time;
+        record.end_time = time;
+        return record;
+    }
+
+    // Long enough for a test to submit everything before the first flush
+    const std::chrono::milliseconds SLOW_FLUSH(60 * 60 * 1000);
+    const std::chrono::milliseconds FAST_FLUSH(5);
+}
+
+TEST_CASE("coalesced records keep the earliest start time", "[person_tracking_db]")
+{
+    auto database = std::make_shared<MockDatabase>();
+    {
+        PersonTrackingWriter writer(std::make_unique<MockBackend>(database), 16, SLOW_FLUSH);
+        REQUIRE(writer.submit(record(1, "2024-01-01 10:00:00", 0)));
+        REQUIRE(writer.submit(record(2, "2024-01-01 10:00:01", 0)));
+        REQUIRE(writer.submit(record(1, "2024-01-01 10:00:02", 5)));
+        REQUIRE(writer.submit(record(1, "2024-01-01 10:00:03", 7)));
+        // The writer flushes its pending records when it is destroyed
+    }
+
+    REQUIRE(database->batches == 1);
+    REQUIRE(database->rows.size() == 2);
+    const PersonTrackingRecord &row = database->rows.at(1);
+    CHECK(row.start_time == "2024-01-01 10:00:00");
+    CHECK(row.end_time == "2024-01-01 10:00:03");
+    CHECK(row.attributes[7] == 1);
+    CHECK(row.attributes[0] == 0);
+    CHECK(database->rows.at(2).start_time == "2024-01-01 10:00:01");
+}
+
+TEST_CASE("records of new tracks are dropped when the queue is full", "[person_tracking_db]")
+{
+    auto database = std::make_shared<MockDatabase>();
+    {
+        PersonTrackingWriter writer(std::make_unique<MockBackend>(database), 2, SLOW_FLUSH);
+        REQUIRE(writer.submit(record(1, "2024-01-01 10:00:00")));
+        REQUIRE(writer.submit(record(2, "2024-01-01 10:00:00")));
+        CHECK_FALSE(writer.submit(record(3, "2024-01-01 10:00:00")));
+        // Pending tracks are still updated
+        CHECK(writer.submit(record(2, "2024-01-01 10:00:01")));
+        CHECK(writer.dropped() == 1);
+    }
+    CHECK(database->rows.size() == 2);
+    CHECK(database->rows.count(3) == 0);
+    CHECK(database->rows.at(2).end_time == "2024-01-01 10:00:01");
+}
+
+TEST_CASE("a failed batch is retried until the database recovers", "[person_tracking_db]")
+{
+    auto database = std::make_shared<MockDatabase>();
+    database->failures_left = 3;
+    PersonTrackingWriter writer(std::make_unique<MockBackend>(database), 16, FAST_FLUSH);
+    writer.submit(record(1, "2024-01-01 10:00:00"));
+    writer.submit(record(2, "2024-01-01 10:00:00"));
+
+    REQUIRE(database->wait_for_row(1, "2024-01-01 10:00:00"));
+    REQUIRE(database->wait_for_row(2, "2024-01-01 10:00:00"));
+    std::lock_guard<std::mutex> lock(database->mutex);
+    CHECK(database->failures_left == 0);
+}
+
+TEST_CASE("a record submitted while its batch fails takes over the start time", "[person_tracking_db]")
+{
+    auto database = std::make_shared<MockDatabase>();
+    PersonTrackingWriter *writer_ptr = nullptr;
+    database->failures_left = 1;
+    // The track is updated while the writer is waiting for the failing database
+    database->on_failure = [&]
+    { writer_ptr->submit(record(1, "2024-01-01 10:00:05", 3)); };
+
+    PersonTrackingWriter writer(std::make_unique<MockBackend>(database), 16, FAST_FLUSH);
+    writer_ptr = &writer;
+    writer.submit(record(1, "2024-01-01 10:00:00", 0));
+
+    REQUIRE(database->wait_for_row(1, "2024-01-01 10:00:05"));
+    std::lock_guard<std::mutex> lock(database->mutex);
+    const PersonTrackingRecord &row = database->rows.at(1);
+    CHECK(row.start_time == "2024-01-01 10:00:00");
+    CHECK(row.attributes[3] == 1);
+}
+
+TEST_CASE("updates of a written track only move its end time", "[person_tracking_db]")
+{
+    auto database = std::make_shared<MockDatabase>();
+    PersonTrackingWriter writer(std::make_unique<MockBackend>(database), 16, FAST_FLUSH);
+    writer.submit(record(1, "2024-01-01 10:00:00"));
+    REQUIRE(database->wait_for_row(1, "2024-01-01 10:00:00"));
+    writer.submit(record(1, "2024-01-01 10:00:09"));
+    REQUIRE(database->wait_for_row(1, "2024-01-01 10:00:09"));
+
+    std::lock_guard<std::mutex> lock(database->mutex);
+    CHECK(database->rows.at(1).start_time == "2024-01-01 10:00:00");
+}
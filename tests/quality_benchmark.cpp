@@ -0,0 +1,46 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+// Cost of a crop quality score: common::luma_sharpness against the OpenCV path it replaced.
+#include <benchmark/benchmark.h>
+
+#include "quality.hpp"
+#include "quality_reference.hpp"
+
+namespace
+{
+    const HailoBBox PLATE(0.40f, 0.60f, 0.12f, 0.05f);  // 152x36, upsampled to 200x40
+    const HailoBBox PERSON(0.20f, 0.10f, 0.15f, 0.70f); // 192x504, resized to 128x256
+
+    void BM_plate_luma_sharpness(benchmark::State &state)
+    {
+        reference::Nv12Frame frame;
+        for (auto _ : state)
+            benchmark::DoNotOptimize(common::luma_sharpness(frame.mat, PLATE, cv::Size(200, 40), cv::INTER_AREA, true, true));
+    }
+    void BM_plate_opencv_sharpness(benchmark::State &state)
+    {
+        reference::Nv12Frame frame;
+        for (auto _ : state)
+            benchmark::DoNotOptimize(reference::opencv_sharpness(frame.mat, PLATE, cv::Size(200, 40), cv::INTER_AREA, true, true));
+    }
+    void BM_person_luma_sharpness(benchmark::State &state)
+    {
+        reference::Nv12Frame frame;
+        for (auto _ : state)
+            benchmark::DoNotOptimize(common::luma_sharpness(frame.mat, PERSON, cv::Size(128, 256), cv::INTER_LINEAR, false, false));
+    }
+    void BM_person_opencv_sharpness(benchmark::State &state)
+    {
+        reference::Nv12Frame frame;
+        for (auto _ : state)
+            benchmark::DoNotOptimize(reference::opencv_sharpness(frame.mat, PERSON, cv::Size(128, 256), cv::INTER_LINEAR, false, false));
+    }
+    BENCHMARK(BM_plate_luma_sharpness)->Unit(benchmark::kMicrosecond);
+    BENCHMARK(BM_plate_opencv_sharpness)->Unit(benchmark::kMicrosecond);
+    BENCHMARK(BM_person_luma_sharpness)->Unit(benchmark::kMicrosecond);
+    BENCHMARK(BM_person_opencv_sharpness)->Unit(benchmark::kMicrosecond);
+}
+
+BENCHMARK_MAIN();
@@ -0,0 +1,78 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+// The OpenCV sharpness score the croppers used before common::luma_sharpness, and a synthetic NV12 frame to measure it on.
+#pragma once
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "hailo_objects.hpp"
+#include "hailomat.hpp"
+
+namespace reference
+{
+    /**
+     * @brief Crop, convert to BGR, resize, optionally blur, convert to gray, optionally normalize,
+     *        and take the variance of the Laplacian (lpr_croppers and re_id before luma_sharpness).
+     */
+    inline float opencv_sharpness(std::shared_ptr<HailoMat> hailo_mat, const HailoBBox &bbox, cv::Size size, int interpolation,
+                                  bool blur, bool normalize)
+    {
+        std::vector<cv::Mat> cropped_image_vec = hailo_mat->crop(std::make_shared<HailoROI>(bbox));
+        cv::Mat full_mat = cv::Mat(cropped_image_vec[0].rows + cropped_image_vec[1].rows, cropped_image_vec[0].cols, CV_8UC1);
+        for (int row = 0; row < cropped_image_vec[0].rows; row++)
+            std::memcpy(full_mat.ptr(row), cropped_image_vec[0].ptr(row), cropped_image_vec[0].cols);
+        for (int row = 0; row < cropped_image_vec[1].rows; row++)
+            std::memcpy(full_mat.ptr(cropped_image_vec[0].rows + row), cropped_image_vec[1].ptr(row), cropped_image_vec[0].cols);
+        cv::Mat bgr_image;
+        cv::cvtColor(full_mat, bgr_image, cv::COLOR_YUV2BGR_NV12);
+
+        cv::Mat resized_image;
+        cv::resize(bgr_image, resized_image, size, 0, 0, interpolation);
+        if (blur)
+            cv::GaussianBlur(resized_image, resized_image, cv::Size(3, 3), 0);
+        cv::Mat gray_image;
+        cv::cvtColor(resized_image, gray_image, cv::COLOR_BGR2GRAY);
+        if (normalize)
+            cv::normalize(gray_image, gray_image, 255, 0, cv::NORM_INF);
+
+        cv::Mat laplacian_image;
+        cv::Laplacian(gray_image, laplacian_image, CV_64F);
+        cv::Scalar mean, stddev;
+        cv::meanStdDev(laplacian_image, mean, stddev, cv::Mat());
+        return stddev.val[0] * stddev.val[0];
+    }
+
+    /**
+     * @brief A 1280x720 NV12 frame: noisy background, sharp diagonal bars on the left half,
+     *        blurred bars on the right half, and noisy chroma.
+     */
+    struct Nv12Frame
+    {
+        static constexpr int WIDTH = 1280;
+        static constexpr int HEIGHT = 720;
+        std::vector<uint8_t> buffer;
+        std::shared_ptr<HailoMat> mat;
+
+        Nv12Frame() : buffer(WIDTH * HEIGHT * 3 / 2)
+        {
+            std::mt19937 random(7);
+            for (int y = 0; y < HEIGHT; y++)
+            {
+                for (int x = 0; x < WIDTH; x++)
+                {
+                    int value = 60 + random() % 40 + (((x / 7 + y / 11) % 3 == 0) ? 120 : 0);
+                    if (x >= WIDTH / 2)
+                        value = (value + 3 * (100 + x % 50)) / 4;
+                    buffer[y * WIDTH + x] = std::min(value, 235);
+                }
+            }
+            for (size_t i = WIDTH * HEIGHT; i < buffer.size(); i++)
+                buffer[i] = 108 + random() % 40;
+            mat = std::make_shared<HailoNV12Mat>(buffer.data(), HEIGHT, WIDTH, WIDTH, WIDTH);
+        }
+    };
+}
@@ -0,0 +1,52 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+// common::luma_sharpness must keep the scale of the OpenCV scores the quality thresholds were tuned on.
+#include <catch2/catch.hpp>
+#include <vector>
+
+#include "quality.hpp"
+#include "quality_reference.hpp"
+
+namespace
+{
+    // Regions that are upsampled, downsampled and both (one axis each way) to the measured size
+    const std::vector<HailoBBox> REGIONS = {
+        HailoBBox(0.10f, 0.10f, 0.07f, 0.03f), // 88x20
+        HailoBBox(0.20f, 0.30f, 0.12f, 0.05f), // 152x36
+        HailoBBox(0.05f, 0.50f, 0.30f, 0.08f), // 384x56
+        HailoBBox(0.55f, 0.60f, 0.40f, 0.15f), // 512x108
+        HailoBBox(0.05f, 0.05f, 0.40f, 0.60f), // 512x432
+        HailoBBox(0.30f, 0.20f, 0.10f, 0.45f), // 128x324
+        HailoBBox(0.70f, 0.20f, 0.25f, 0.70f), // 320x504
+    };
+}
+
+TEST_CASE("license plate sharpness matches the OpenCV path", "[quality]")
+{
+    reference::Nv12Frame frame;
+    for (const HailoBBox &region : REGIONS)
+    {
+        float expected = reference::opencv_sharpness(frame.mat, region, cv::Size(200, 40), cv::INTER_AREA, true, true);
+        float actual = common::luma_sharpness(frame.mat, region, cv::Size(200, 40), cv::INTER_AREA, true, true);
+        CHECK(actual == Approx(expected).epsilon(0.03));
+    }
+}
+
+TEST_CASE("re-id sharpness matches the OpenCV path", "[quality]")
+{
+    reference::Nv12Frame frame;
+    for (const HailoBBox &region : REGIONS)
+    {
+        float expected = reference::opencv_sharpness(frame.mat, region, cv::Size(128, 256), cv::INTER_LINEAR, false, false);
+        float actual = common::luma_sharpness(frame.mat, region, cv::Size(128, 256), cv::INTER_LINEAR, false, false);
+        CHECK(actual == Approx(expected).epsilon(0.03));
+    }
+}
+
+TEST_CASE("an empty region has no sharpness", "[quality]")
+{
+    reference::Nv12Frame frame;
+    CHECK(common::luma_sharpness(frame.mat, HailoBBox(0.5f, 0.5f, 0.0f, 0.0f), cv::Size(200, 40), cv::INTER_AREA, true, true) == -1.0f);
+}
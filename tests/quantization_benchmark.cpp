@@ -0,0 +1,106 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+// Rejecting the empty cells of a yolo objectness layer: quantized threshold + SIMD scan
+// against dequantizing and applying the sigmoid to every cell.
+#include <benchmark/benchmark.h>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+#include "common/quantization.hpp"
+
+namespace
+{
+    constexpr float DETECTION_THRESHOLD = 0.3f;
+
+    float sigmoid(float value)
+    {
+        return 1.0f / (1.0f + std::exp(-value));
+    }
+
+    template <typename T>
+    float layer_scale()
+    {
+        return std::is_same<T, uint8_t>::value ? 0.08f : 0.0003f;
+    }
+
+    template <typename T>
+    float layer_zp()
+    {
+        return std::is_same<T, uint8_t>::value ? 120.0f : 32768.0f;
+    }
+
+    /**
+     * @brief An 80x80x3 objectness layer of mostly negative logits, with the requested number of objects.
+     */
+    template <typename T>
+    std::vector<T> objectness_layer(int objects)
+    {
+        const uint32_t size = 80 * 80 * 3;
+        const float scale = layer_scale<T>();
+        const float zp = layer_zp<T>();
+        std::mt19937 random(objects);
+        std::uniform_real_distribution<float> background(-8.0f, -2.0f);
+        std::uniform_int_distribution<uint32_t> cell(0, size - 1);
+        std::vector<T> layer(size);
+        for (auto &value : layer)
+            value = T(std::lround(background(random) / scale + zp));
+        for (int k = 0; k < objects; k++)
+            layer[cell(random)] = T(std::lround(2.0f / scale + zp));
+        return layer;
+    }
+
+    template <typename T>
+    void BM_reject_dequantized(benchmark::State &state)
+    {
+        const std::vector<T> layer = objectness_layer<T>(state.range(0));
+        const float scale = layer_scale<T>();
+        const float zp = layer_zp<T>();
+        uint32_t candidates = 0;
+        for (auto _ : state)
+        {
+            candidates = 0;
+            for (uint32_t i = 0; i < layer.size(); i++)
+            {
+                if (sigmoid((float(layer[i]) - zp) * scale) >= DETECTION_THRESHOLD)
+                    candidates++;
+            }
+            benchmark::DoNotOptimize(candidates);
+        }
+        state.counters["candidates"] = candidates;
+    }
+
+    template <typename T>
+    void BM_reject_quantized(benchmark::State &state)
+    {
+        const std::vector<T> layer = objectness_layer<T>(state.range(0));
+        const uint32_t threshold = common::quantized_threshold<T>(layer_scale<T>(), layer_zp<T>(), DETECTION_THRESHOLD, sigmoid);
+        uint32_t candidates = 0;
+        for (auto _ : state)
+        {
+            candidates = 0;
+            common::for_each_above_threshold(layer.data(), layer.size(), threshold, [&](uint32_t)
+                                             { candidates++; });
+            benchmark::DoNotOptimize(candidates);
+        }
+        state.counters["candidates"] = candidates;
+    }
+
+    BENCHMARK_TEMPLATE(BM_reject_dequantized, uint8_t)->Arg(0)->Arg(20)->Arg(300);
+    BENCHMARK_TEMPLATE(BM_reject_quantized, uint8_t)->Arg(0)->Arg(20)->Arg(300);
+    BENCHMARK_TEMPLATE(BM_reject_dequantized, uint16_t)->Arg(0)->Arg(20)->Arg(300);
+    BENCHMARK_TEMPLATE(BM_reject_quantized, uint16_t)->Arg(0)->Arg(20)->Arg(300);
+
+    void BM_quantized_threshold(benchmark::State &state)
+    {
+        for (auto _ : state)
+            benchmark::DoNotOptimize(common::quantized_threshold<uint16_t>(layer_scale<uint16_t>(), layer_zp<uint16_t>(), DETECTION_THRESHOLD, sigmoid));
+    }
+    BENCHMARK(BM_quantized_threshold);
+}
+
+BENCHMARK_MAIN();
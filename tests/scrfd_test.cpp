@@ -0,0 +1,415 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+// The fused SCRFD decoder against the per-branch xtensor decoding it replaced, for the 10g and 2.5g layouts.
+// The previous code is kept below as it was, with one exception: it read the score of an anchor as
+// xt::col(classes_quant, 1) of an N x 1 view, which is the byte of the next anchor. The reference reads
+// xt::col(classes_quant, 0), the score of the anchor itself, as the fused decoder does.
+#include <catch2/catch.hpp>
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "common/math.hpp"
+#include "common/tensors.hpp"
+#include "common/nms.hpp"
+#include "detection/scrfd.hpp"
+#include "xtensor/xarray.hpp"
+#include "xtensor/xio.hpp"
+#include "xtensor/xpad.hpp"
+#include "xtensor/xview.hpp"
+#include "hailo_xtensor.hpp"
+
+namespace
+{
+    //-------------------------------
+    // SYNTHETIC OUTPUTS
+    //-------------------------------
+    constexpr int IMAGE_SIZE = 640;
+    constexpr int STRIDES[] = {8, 16, 32};
+    constexpr int ANCHORS_PER_CELL = 2;
+    // Scores decode to [0, 1] in steps of 1/255, the default score threshold 0.4 quantizes to about 102
+    constexpr float SCORES_SCALE = 1.0f / 255.0f;
+    constexpr int LOW_SCORE = 100;
+    constexpr int FIRST_PASSING_SCORE = 104;
+
+    const std::vector<std::string> BOXES_10g{"scrfd_10g/conv48", "scrfd_10g/conv54", "scrfd_10g/conv57"};
+    const std::vector<std::string> CLASSES_10g{"scrfd_10g/conv47", "scrfd_10g/conv53", "scrfd_10g/conv56"};
+    const std::vector<std::string> LANDMARKS_10g{"scrfd_10g/conv49", "scrfd_10g/conv55", "scrfd_10g/conv58"};
+    const std::vector<std::string> BOXES_2_5g{"scrfd_2_5g/conv47", "scrfd_2_5g/conv53", "scrfd_2_5g/conv56"};
+    const std::vector<std::string> CLASSES_2_5g{"scrfd_2_5g/conv46", "scrfd_2_5g/conv52", "scrfd_2_5g/conv55"};
+    const std::vector<std::string> LANDMARKS_2_5g{"scrfd_2_5g/conv48", "scrfd_2_5g/conv54", "scrfd_2_5g/conv57"};
+
+    std::vector<std::string> BOXES;
+    std::vector<std::string> CLASSES;
+    std::vector<std::string> LANDMARKS;
+
+    hailo_vstream_info_t layer_info(const std::string &name, uint32_t grid, uint32_t features, float qp_scale, float qp_zp)
+    {
+        hailo_vstream_info_t info{};
+        std::strncpy(info.name, name.c_str(), sizeof(info.name) - 1);
+        info.format.type = HAILO_FORMAT_TYPE_UINT8;
+        info.quant_info.qp_scale = qp_scale;
+        info.quant_info.qp_zp = qp_zp;
+        info.shape.height = grid;
+        info.shape.width = grid;
+        info.shape.features = features;
+        return info;
+    }
+
+    /**
+     * @brief The outputs of a frame with the requested number of anchors over the score threshold,
+     *        with distinct scores (so the order of the faces is defined), random boxes and landmarks.
+     *        Both anchors of a cell share their center, so faces of the same cell often overlap and NMS has work.
+     */
+    struct Frame
+    {
+        std::vector<std::vector<uint8_t>> buffers;
+        std::vector<hailo_vstream_info_t> infos;
+
+        Frame(int faces, const std::vector<std::string> &boxes_names, const std::vector<std::string> &classes_names,
+              const std::vector<std::string> &landmarks_names)
+        {
+            std::mt19937 random(faces + 1);
+            std::uniform_int_distribution<int> values(0, 255);
+            std::uniform_int_distribution<int> low_scores(0, LOW_SCORE);
+            std::uniform_int_distribution<int> distances(16, 96);
+
+            std::vector<uint32_t> branch_anchors;
+            uint32_t total_anchors = 0;
+            for (int stride : STRIDES)
+            {
+                uint32_t grid = IMAGE_SIZE / stride;
+                branch_anchors.push_back(grid * grid * ANCHORS_PER_CELL);
+                total_anchors += branch_anchors.back();
+            }
+            std::vector<uint32_t> anchors(total_anchors);
+            for (uint32_t i = 0; i < total_anchors; i++)
+                anchors[i] = i;
+            std::shuffle(anchors.begin(), anchors.end(), random);
+            anchors.resize(faces);
+            std::vector<int> passing_scores(256 - FIRST_PASSING_SCORE);
+            for (size_t i = 0; i < passing_scores.size(); i++)
+                passing_scores[i] = FIRST_PASSING_SCORE + i;
+            std::shuffle(passing_scores.begin(), passing_scores.end(), random);
+
+            uint32_t offset = 0;
+            for (int i = 0; i < 3; i++)
+            {
+                uint32_t grid = IMAGE_SIZE / STRIDES[i];
+                std::vector<uint8_t> scores(branch_anchors[i]);
+                for (auto &value : scores)
+                    value = low_scores(random);
+                for (int face = 0; face < faces; face++)
+                {
+                    if (anchors[face] >= offset && anchors[face] < offset + branch_anchors[i])
+                        scores[anchors[face] - offset] = passing_scores[face];
+                }
+                std::vector<uint8_t> boxes(branch_anchors[i] * 4);
+                for (auto &value : boxes)
+                    value = distances(random);
+                std::vector<uint8_t> landmarks(branch_anchors[i] * 10);
+                for (auto &value : landmarks)
+                    value = values(random);
+                offset += branch_anchors[i];
+
+                buffers.push_back(std::move(boxes));
+                infos.push_back(layer_info(boxes_names[i], grid, 4 * ANCHORS_PER_CELL, 1.0f / 32.0f, 0.0f));
+                buffers.push_back(std::move(scores));
+                infos.push_back(layer_info(classes_names[i], grid, ANCHORS_PER_CELL, SCORES_SCALE, 0.0f));
+                buffers.push_back(std::move(landmarks));
+                infos.push_back(layer_info(landmarks_names[i], grid, 10 * ANCHORS_PER_CELL, 0.05f, 128.0f));
+            }
+        }
+
+        HailoROIPtr roi()
+        {
+            auto roi = std::make_shared<HailoROI>(HailoBBox(0.0f, 0.0f, 1.0f, 1.0f));
+            for (size_t i = 0; i < buffers.size(); i++)
+                roi->add_tensor(std::make_shared<HailoTensor>(buffers[i].data(), infos[i]));
+            return roi;
+        }
+    };
+
+    //-------------------------------
+    // PREVIOUS DECODING
+    //-------------------------------
+    /**
+     * @brief The pairwise NMS common::nms was before the NmsEngine.
+     */
+    void pairwise_nms(std::vector<HailoDetection> &objects, const float iou_thr)
+    {
+        std::vector<HailoDetection> objects_after_nms;
+        std::sort(objects.begin(), objects.end(),
+                  [](HailoDetection a, HailoDetection b)
+                  { return a.get_confidence() > b.get_confidence(); });
+
+        for (uint index = 0; index < objects.size(); index++)
+        {
+            if (objects[index].get_confidence() != 0.0f)
+            {
+                for (uint jindex = index + 1; jindex < objects.size(); jindex++)
+                {
+                    if ((objects[index].get_class_id() == objects[jindex].get_class_id()) &&
+                        objects[jindex].get_confidence() != 0.0f)
+                    {
+                        float iou = common::iou_calc(objects[index].get_bbox(), objects[jindex].get_bbox());
+                        if (iou >= iou_thr)
+                            objects[jindex].set_confidence(0.0f);
+                    }
+                }
+            }
+        }
+        for (uint index = 0; index < objects.size(); index++)
+        {
+            if (objects[index].get_confidence() != 0.0f)
+                objects_after_nms.push_back(objects[index]);
+        }
+        objects = objects_after_nms;
+    }
+
+    xt::xarray<float> decode_landmarks_scrfd(const xt::xarray<float> &landmark_detections,
+                                            const xt::xarray<float> &anchors)
+    {
+        // Decode the boxes relative to their anchors.
+        // There are 5 landmarks paired in sets of 2 (x and y values),
+        // so we need to tile our anchors by 5
+        xt::xarray<float> landmarks = xt::tile(xt::view(anchors, xt::all(), xt::range(0, 2)), {1, 5}) + landmark_detections * xt::tile(xt::view(anchors, xt::all(), xt::range(2, 4)), {1, 5});
+        return landmarks;
+    }
+
+    xt::xarray<float> decode_boxes_scrfd(const xt::xarray<float> &box_detections,
+                                         const xt::xarray<float> &anchors)
+    {
+        // Initalize the boxes matrix at the expected size
+        xt::xarray<float> boxes = xt::zeros<float>(box_detections.shape());
+        // Decode the boxes relative to their anchors in place
+        xt::col(boxes, 0) = xt::col(anchors, 0) - (xt::col(box_detections, 0) * xt::col(anchors, 2));
+        xt::col(boxes, 1) = xt::col(anchors, 1) - (xt::col(box_detections, 1) * xt::col(anchors, 3));
+        xt::col(boxes, 2) = xt::col(anchors, 0) + (xt::col(box_detections, 2) * xt::col(anchors, 2));
+        xt::col(boxes, 3) = xt::col(anchors, 1) + (xt::col(box_detections, 3) * xt::col(anchors, 3));
+        return boxes;
+    }
+
+    std::tuple<xt::xarray<float>, xt::xarray<float>, xt::xarray<float>> detect_decode_branch(std::map<std::string, HailoTensorPtr> &tensors,
+                                                                                            const xt::xarray<uint8_t> &boxes_quant,
+                                                                                            const xt::xarray<uint8_t> &classes_quant,
+                                                                                            const xt::xarray<uint8_t> &landmarks_quant,
+                                                                                            const xt::xarray<float> &anchors,
+                                                                                            const float score_threshold,
+                                                                                            const int i,
+                                                                                            const int steps)
+    {
+        // Filter scores that pass threshold, quantize the score threshold
+        // (column 0: the previous code read column 1 of this N x 1 view, the score of the next anchor)
+        auto scores_quant = xt::col(classes_quant, 0);
+        xt::xarray<int> threshold_indices = xt::flatten_indices(xt::argwhere(scores_quant > tensors[CLASSES[i]]->quantize(score_threshold)));
+
+        if (threshold_indices.shape(0) == 0)
+            return xt::xtuple(xt::empty<float>({0}), xt::empty<float>({0}), xt::empty<float>({0}));
+
+        // Filter and dequantize boxes
+        xt::xarray<uint8_t> high_boxes_quant = xt::view(boxes_quant, xt::keep(threshold_indices), xt::all());
+        auto high_boxes_dequant = common::dequantize(high_boxes_quant,
+                                                    tensors[BOXES[i]]->vstream_info().quant_info.qp_scale,
+                                                    tensors[BOXES[i]]->vstream_info().quant_info.qp_zp);
+        // Filter and dequantize scores
+        xt::xarray<uint8_t> high_scores_quant = xt::view(scores_quant, xt::keep(threshold_indices));
+        auto high_scores_dequant = common::dequantize(high_scores_quant,
+                                                    tensors[CLASSES[i]]->vstream_info().quant_info.qp_scale,
+                                                    tensors[CLASSES[i]]->vstream_info().quant_info.qp_zp);
+        // Filter and dequantize landmarks
+        xt::xarray<uint8_t> high_landmarks_quant = xt::view(landmarks_quant, xt::keep(threshold_indices), xt::all());
+        auto high_landmarks_dequant = common::dequantize(high_landmarks_quant,
+                                                        tensors[LANDMARKS[i]]->vstream_info().quant_info.qp_scale,
+                                                        tensors[LANDMARKS[i]]->vstream_info().quant_info.qp_zp);
+        // Filter anchors and use them to decode boxes/landmarks
+        auto stepped_inds = threshold_indices + steps;
+        auto high_anchors = xt::view(anchors, xt::keep(stepped_inds), xt::all());
+        xt::xarray<float> decoded_boxes = decode_boxes_scrfd(high_boxes_dequant, high_anchors);
+        xt::xarray<float> decoded_landmarks = decode_landmarks_scrfd(high_landmarks_dequant, high_anchors);
+
+        // Return boxes, scores, and landmarks
+        return xt::xtuple(decoded_boxes, high_scores_dequant, decoded_landmarks);
+    }
+
+    std::tuple<std::vector<xt::xarray<float>>,
+               std::vector<xt::xarray<float>>,
+               std::vector<xt::xarray<float>>>
+    detect_boxes_and_landmarks(std::map<std::string, HailoTensorPtr> &tensors,
+                               const std::vector<xt::xarray<uint8_t>> &boxes_quant,
+                               const std::vector<xt::xarray<uint8_t>> &classes_quant,
+                               const std::vector<xt::xarray<uint8_t>> &landmarks_quant,
+                               const xt::xarray<float> &anchors,
+                               const float score_threshold)
+    {
+        std::vector<xt::xarray<float>> high_scores_dequant(CLASSES.size());
+        std::vector<xt::xarray<float>> decoded_boxes(BOXES.size());
+        std::vector<xt::xarray<float>> decoded_landmarks(LANDMARKS.size());
+
+        int steps = 0;
+        for (uint i = 0; i < CLASSES.size(); ++i)
+        {
+            auto boxes_scores_landmarks = detect_decode_branch(tensors,
+                                                               boxes_quant[i],
+                                                               classes_quant[i],
+                                                               landmarks_quant[i],
+                                                               anchors, score_threshold, i, steps);
+            decoded_boxes[i] = std::get<0>(boxes_scores_landmarks);
+            high_scores_dequant[i] = std::get<1>(boxes_scores_landmarks);
+            decoded_landmarks[i] = std::get<2>(boxes_scores_landmarks);
+            steps += classes_quant[i].shape(0);
+        }
+
+        return std::tuple<std::vector<xt::xarray<float>>,
+                          std::vector<xt::xarray<float>>,
+                          std::vector<xt::xarray<float>>>(std::move(decoded_boxes),
+                                                          std::move(high_scores_dequant),
+                                                          std::move(decoded_landmarks));
+    }
+
+    void encode_detections(std::vector<HailoDetection> &objects,
+                           std::vector<xt::xarray<float>> &detection_boxes,
+                           std::vector<xt::xarray<float>> &scores,
+                           std::vector<xt::xarray<float>> &landmarks)
+    {
+        float confidence, w, h, xmin, ymin = 0.0f;
+        std::string label = "face";
+        for (uint i = 0; i < CLASSES.size(); ++i)
+        {
+            for (uint index = 0; index < scores[i].size(); ++index)
+            {
+                confidence = scores[i](index);
+                xmin = detection_boxes[i](index, 0);
+                ymin = detection_boxes[i](index, 1);
+                w = (detection_boxes[i](index, 2) - detection_boxes[i](index, 0));
+                h = (detection_boxes[i](index, 3) - detection_boxes[i](index, 1));
+
+                HailoBBox bbox(xmin, ymin, w, h);
+                HailoDetection detected_face(bbox, label, confidence);
+
+                xt::xarray<float> keypoints_raw = xt::row(landmarks[i], index);
+                // The keypoints are flatten, reshape them to 2 * num_keypoints.
+                int num_keypoints = keypoints_raw.shape(0) / 2;
+                auto face_keypoints = xt::reshape_view(keypoints_raw, {num_keypoints, 2});
+                hailo_common::add_landmarks_to_detection(detected_face, "scrfd", face_keypoints);
+
+                objects.push_back(detected_face);
+            }
+        }
+    }
+
+    std::vector<HailoDetection> face_detection_postprocess(std::map<std::string, HailoTensorPtr> &tensors_by_name,
+                                                           const xt::xarray<float> &anchors,
+                                                           const float score_threshold,
+                                                           const float iou_threshold,
+                                                           const int total_classes)
+    {
+        std::vector<HailoDetection> objects;
+        std::vector<xt::xarray<uint8_t>> box_layers_quant;
+        std::vector<xt::xarray<uint8_t>> class_layers_quant;
+        std::vector<xt::xarray<uint8_t>> landmarks_layers_quant;
+
+        for (uint i = 0; i < BOXES.size(); ++i)
+        {
+            xt::xarray<uint8_t> xdata_boxes = common::get_xtensor(tensors_by_name[BOXES[i]]);
+            auto num_boxes = (int)xdata_boxes.shape(0) * (int)xdata_boxes.shape(1) * ((int)xdata_boxes.shape(2) / 4);
+            auto xdata_boxes_reshaped = xt::reshape_view(xdata_boxes, {num_boxes, 4});
+            box_layers_quant.emplace_back(std::move(xdata_boxes_reshaped));
+
+            xt::xarray<uint8_t> xdata_classes = common::get_xtensor(tensors_by_name[CLASSES[i]]);
+            auto num_classes = (int)xdata_classes.shape(0) * (int)xdata_classes.shape(1) * ((int)xdata_classes.shape(2) / total_classes);
+            auto xdata_classes_reshaped = xt::reshape_view(xdata_classes, {num_classes, total_classes});
+            class_layers_quant.emplace_back(std::move(xdata_classes_reshaped));
+
+            xt::xarray<uint8_t> xdata_landmarks = common::get_xtensor(tensors_by_name[LANDMARKS[i]]);
+            auto num_landmarks = (int)xdata_landmarks.shape(0) * (int)xdata_landmarks.shape(1) * ((int)xdata_landmarks.shape(2) / 10);
+            auto xdata_landmarks_reshaped = xt::reshape_view(xdata_landmarks, {num_landmarks, 10});
+            landmarks_layers_quant.emplace_back(std::move(xdata_landmarks_reshaped));
+        }
+
+        auto boxes_and_landmarks = detect_boxes_and_landmarks(tensors_by_name,
+                                                              box_layers_quant,
+                                                              class_layers_quant,
+                                                              landmarks_layers_quant,
+                                                              anchors,
+                                                              score_threshold);
+        encode_detections(objects,
+                          std::get<0>(boxes_and_landmarks),
+                          std::get<1>(boxes_and_landmarks),
+                          std::get<2>(boxes_and_landmarks));
+        pairwise_nms(objects, iou_threshold);
+        return objects;
+    }
+
+    //-------------------------------
+    // COMPARISON
+    //-------------------------------
+    void check_against_reference(int faces, bool ten_g)
+    {
+        BOXES = ten_g ? BOXES_10g : BOXES_2_5g;
+        CLASSES = ten_g ? CLASSES_10g : CLASSES_2_5g;
+        LANDMARKS = ten_g ? LANDMARKS_10g : LANDMARKS_2_5g;
+        Frame frame(faces, BOXES, CLASSES, LANDMARKS);
+        ScrfdParams *params = init("", "scrfd");
+
+        HailoROIPtr reference_roi = frame.roi();
+        std::map<std::string, HailoTensorPtr> tensors_by_name = reference_roi->get_tensors_by_name();
+        std::vector<HailoDetection> expected = face_detection_postprocess(tensors_by_name, params->anchors,
+                                                                          params->score_threshold, params->iou_threshold, 1);
+        HailoROIPtr roi = frame.roi();
+        if (ten_g)
+            scrfd_10g(roi, params);
+        else
+            scrfd_2_5g(roi, params);
+        free_resources(params);
+
+        std::vector<HailoObjectPtr> objects = roi->get_objects_typed(HAILO_DETECTION);
+        REQUIRE(objects.size() == expected.size());
+        if (faces > 0)
+            CHECK(expected.size() > 0);
+        for (size_t i = 0; i < objects.size(); i++)
+        {
+            HailoDetectionPtr detection = std::dynamic_pointer_cast<HailoDetection>(objects[i]);
+            HailoDetection &reference = expected[i];
+            // The same formulas in the same order, so the results are bit identical
+            REQUIRE(detection->get_label() == reference.get_label());
+            REQUIRE(detection->get_confidence() == reference.get_confidence());
+            REQUIRE(detection->get_bbox().xmin() == reference.get_bbox().xmin());
+            REQUIRE(detection->get_bbox().ymin() == reference.get_bbox().ymin());
+            REQUIRE(detection->get_bbox().width() == reference.get_bbox().width());
+            REQUIRE(detection->get_bbox().height() == reference.get_bbox().height());
+
+            std::vector<HailoObjectPtr> landmarks = detection->get_objects_typed(HAILO_LANDMARKS);
+            std::vector<HailoObjectPtr> reference_landmarks = reference.get_objects_typed(HAILO_LANDMARKS);
+            REQUIRE(landmarks.size() == 1);
+            REQUIRE(reference_landmarks.size() == 1);
+            std::vector<HailoPoint> points = std::dynamic_pointer_cast<HailoLandmarks>(landmarks[0])->get_points();
+            std::vector<HailoPoint> reference_points = std::dynamic_pointer_cast<HailoLandmarks>(reference_landmarks[0])->get_points();
+            REQUIRE(points.size() == reference_points.size());
+            for (size_t k = 0; k < points.size(); k++)
+            {
+                REQUIRE(points[k].x() == reference_points[k].x());
+                REQUIRE(points[k].y() == reference_points[k].y());
+            }
+        }
+    }
+}
+
+TEST_CASE("scrfd_10g faces match the previous per branch decoding", "[scrfd]")
+{
+    check_against_reference(0, true);
+    check_against_reference(20, true);
+    check_against_reference(120, true);
+}
+
+TEST_CASE("scrfd_2_5g faces match the previous per branch decoding", "[scrfd]")
+{
+    check_against_reference(0, false);
+    check_against_reference(20, false);
+    check_against_reference(120, false);
+}
@@ -0,0 +1,314 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+// The fused-bases 3DDFA landmark solver against the previous Basel face model computation
+// (two_dim_dot_product over the shape and expression bases, then the pose), on generated .npy bases.
+// The solver sums in another order, so the landmarks are compared with a tolerance.
+#include <catch2/catch.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+#include "hailo_objects.hpp"
+#include "facial_landmarking/tddfa_mobilenet.hpp"
+#include "xtensor/xarray.hpp"
+#include "xtensor/xnpy.hpp"
+#include "xtensor/xview.hpp"
+
+// The model constants of the library (const_tensors.hpp defines them, so it is not included twice)
+extern xt::xarray<float> TDDFA_RESCALE_PARAMS_MEAN;
+extern xt::xarray<float> TDDFA_RESCALE_PARAMS_STD;
+extern xt::xarray<float> bfm_u_base;
+
+namespace
+{
+    constexpr int TRANS_DIM = 12;
+    constexpr int SHAPE_DIM = 40;
+    constexpr int EXP_DIM = 10;
+    constexpr int PARAMS_DIM = TRANS_DIM + SHAPE_DIM + EXP_DIM;
+    constexpr int OUTPUT_SIZE = 68;
+    constexpr int VERTEX_DIM = OUTPUT_SIZE * 3;
+    constexpr int FACE_HEIGHT = 120;
+    constexpr int FACE_WIDTH = FACE_HEIGHT;
+    // The landmarks are relative to the face, of the order of 1
+    constexpr double TOLERANCE = 1e-5;
+
+    //-------------------------------
+    // GENERATED BASES
+    //-------------------------------
+    void write_npy(const std::string &path, int rows, int cols, const std::vector<float> &data)
+    {
+        std::string header = "{'descr': '<f4', 'fortran_order': False, 'shape': (" + std::to_string(rows) + ", " + std::to_string(cols) + "), }";
+        // The magic, version and length take 10 bytes, the header is padded to 64 bytes and ends with a newline
+        header.append(63 - (10 + header.size()) % 64, ' ');
+        header += '\n';
+        std::FILE *file = std::fopen(path.c_str(), "wb");
+        REQUIRE(file != nullptr);
+        const char preamble[8] = {'\x93', 'N', 'U', 'M', 'P', 'Y', 1, 0};
+        uint16_t header_length = header.size();
+        std::fwrite(preamble, 1, sizeof(preamble), file);
+        std::fwrite(&header_length, sizeof(header_length), 1, file);
+        std::fwrite(header.data(), 1, header.size(), file);
+        std::fwrite(data.data(), sizeof(float), data.size(), file);
+        std::fclose(file);
+    }
+
+    std::vector<float> random_values(size_t size, float low, float high, std::mt19937 &random)
+    {
+        std::uniform_real_distribution<float> values(low, high);
+        std::vector<float> data(size);
+        for (auto &value : data)
+            value = values(random);
+        return data;
+    }
+
+    /**
+     * @brief The post_processes_data directory the library reads the bases from.
+     *        Unless the installed one exists, it is created under a temporary TAPPAS_WORKSPACE
+     *        with generated shape and expression bases, about the magnitude of the mean face over the params std.
+     */
+    std::string data_dir()
+    {
+        static std::string dir;
+        if (!dir.empty())
+            return dir;
+        struct stat buffer;
+        std::string installed = "/usr/lib/hailo-post-processes/post_processes_data";
+        if (stat(installed.c_str(), &buffer) == 0)
+            return dir = installed;
+
+        char workspace[] = "/tmp/tddfa_test_XXXXXX";
+        REQUIRE(mkdtemp(workspace) != nullptr);
+        std::string path = workspace;
+        for (const char *part : {"/apps", "/h8", "/gstreamer", "/libs", "/post_processes", "/post_processes_data"})
+        {
+            path += part;
+            REQUIRE(mkdir(path.c_str(), 0755) == 0);
+        }
+        std::mt19937 random(62);
+        write_npy(path + "/w_shp_base.npy", VERTEX_DIM, SHAPE_DIM, random_values(VERTEX_DIM * SHAPE_DIM, -0.1f, 0.1f, random));
+        write_npy(path + "/w_exp_base.npy", VERTEX_DIM, EXP_DIM, random_values(VERTEX_DIM * EXP_DIM, -0.1f, 0.1f, random));
+        setenv("TAPPAS_WORKSPACE", workspace, 1);
+        return dir = path;
+    }
+
+    //-------------------------------
+    // PREVIOUS COMPUTATION
+    //-------------------------------
+    xt::xarray<float> W_EXP_BASE;
+    xt::xarray<float> W_SHP_BASE;
+    xt::xarray<float> trans_bfm_u_base;
+
+    void load_bases()
+    {
+        W_EXP_BASE = xt::load_npy<float>(data_dir() + "/w_exp_base.npy");
+        W_SHP_BASE = xt::load_npy<float>(data_dir() + "/w_shp_base.npy");
+        trans_bfm_u_base = xt::transpose(bfm_u_base);
+    }
+
+    xt::xarray<float> calc_params_view(xt::xarray<float> face_3dmm_params)
+    {
+        xt::xarray<float> face_params_view = xt::view(face_3dmm_params, xt::range(0, TRANS_DIM));
+        return xt::reshape_view(face_params_view, {3, 4});
+    }
+
+    xt::xarray<float> calc_offset(xt::xarray<float> face_3dmm_params, xt::xarray<float> R_)
+    {
+        xt::xarray<float> offset_ = xt::view(R_, xt::all(), -1);
+        xt::xarray<float> offset = xt::reshape_view(offset_, {3, 1});
+        return offset;
+    }
+
+    // Compute tensor dot product along specified axes for arrays.
+    // In this case along axis 1 of the first matrix and axis 0 of the second.
+    xt::xarray<float> two_dim_dot_product(xt::xarray<float, xt::layout_type::row_major> matrix_1,
+                                          xt::xarray<float, xt::layout_type::row_major> matrix_2)
+    {
+        uint axis_length = matrix_1.shape(1);
+        if (axis_length != matrix_2.shape(0))
+        {
+            throw std::invalid_argument("two_dim_dot_product error: axis don't match!");
+        }
+
+        float row_sum;
+        xt::xarray<float>::shape_type shape = {matrix_1.shape(0), matrix_2.shape(1)};
+        xt::xarray<float, xt::layout_type::row_major> product_matrix(shape);
+        for (uint i = 0; i < matrix_1.shape(0); ++i)
+        {
+            for (uint j = 0; j < matrix_2.shape(1); ++j)
+            {
+                row_sum = 0.0;
+                for (uint k = 0; k < axis_length; ++k)
+                {
+                    row_sum += matrix_1(i, k) * matrix_2(k, j);
+                }
+                product_matrix(i, j) = row_sum;
+            }
+        }
+        return product_matrix;
+    }
+
+    xt::xarray<float> calc_trans_sum(xt::xarray<float> face_3dmm_params)
+    {
+        xt::xarray<float> raw_alpha_shp = xt::view(face_3dmm_params, xt::range(TRANS_DIM, TRANS_DIM + SHAPE_DIM));
+        xt::xarray<float> alpha_shape = xt::reshape_view(raw_alpha_shp, {40, 1});
+
+        xt::xarray<float> raw_alpha_exp = xt::view(face_3dmm_params, xt::range(TRANS_DIM + SHAPE_DIM, PARAMS_DIM));
+        xt::xarray<float> alpha_exp = xt::reshape_view(raw_alpha_exp, {10, 1});
+        xt::xarray<float> shape_mul = two_dim_dot_product(W_SHP_BASE, alpha_shape);
+        xt::xarray<float> exp_mul = two_dim_dot_product(W_EXP_BASE, alpha_exp);
+
+        xt::xarray<float> sum = trans_bfm_u_base + shape_mul + exp_mul;
+        xt::xarray<float> reshape_sum = xt::reshape_view(sum, {OUTPUT_SIZE, 3});
+        xt::xarray<float> trans_sum = xt::transpose(reshape_sum);
+        return trans_sum;
+    }
+
+    xt::xarray<float> BFM(xt::xarray<float> bfm_params_xarray)
+    {
+        // this is the implementation of the Basel face model
+
+        // normalization:
+        xt::xarray<float> face_3dmm_params = (bfm_params_xarray * TDDFA_RESCALE_PARAMS_STD) + TDDFA_RESCALE_PARAMS_MEAN;
+        xt::xarray<float> face_params_view = calc_params_view(face_3dmm_params);
+        xt::xarray<float> offset = calc_offset(face_3dmm_params, face_params_view);
+        xt::xarray<float> transposed_sum = calc_trans_sum(face_3dmm_params);
+        xt::xarray<float> reshaped_params = xt::view(face_params_view, xt::all(), xt::range(0, 3));
+        xt::xarray<float> mul = two_dim_dot_product(reshaped_params, transposed_sum);
+        xt::xarray<float> trans_raw_landmarks = mul + offset;
+        return trans_raw_landmarks;
+    }
+
+    xt::xarray<float> calc_landmarks(xt::xarray<float> sum3, int face_height)
+    {
+        xt::xarray<float> landmarks_raw = xt::transpose(sum3);
+        xt::xarray<float> landmarks_without_z = xt::view(landmarks_raw, xt::all(), xt::range(0, 2));
+        xt::xarray<float> landmarks = xt::zeros<float>({OUTPUT_SIZE, 2});
+        xt::col(landmarks, 0) = xt::col(landmarks_without_z, 0);
+        // the original repo assumes drawing is upside down so here we need to flip it:
+        xt::col(landmarks, 1) = face_height - xt::col(landmarks_without_z, 1);
+        return landmarks;
+    }
+
+    xt::xarray<float> facial_landmark_postprocess(xt::xarray<float> bfm_params_xarray)
+    {
+        xt::xarray<float> transposed_raw_landmarks = BFM(bfm_params_xarray);
+        xt::xarray<float> landmarks = calc_landmarks(transposed_raw_landmarks, FACE_HEIGHT);
+        // Make landmarks relative to the face instead of absulute.
+        xt::view(landmarks, xt::all(), 0) = xt::view(landmarks, xt::all(), 0) / FACE_WIDTH;
+        xt::view(landmarks, xt::all(), 1) = xt::view(landmarks, xt::all(), 1) / FACE_HEIGHT;
+        return landmarks;
+    }
+
+    //-------------------------------
+    // COMPARISON
+    //-------------------------------
+    /**
+     * @brief Normalized network outputs: the params are standardized, so about N(0, 1).
+     */
+    std::vector<float> random_params(size_t faces)
+    {
+        std::mt19937 random(faces);
+        std::normal_distribution<float> values(0.0f, 1.0f);
+        std::vector<float> params(faces * PARAMS_DIM);
+        for (auto &value : params)
+            value = values(random);
+        return params;
+    }
+
+    void check_against_reference(size_t faces)
+    {
+        data_dir();
+        load_bases();
+        std::vector<float> params = random_params(faces);
+        std::vector<float> landmarks(faces * OUTPUT_SIZE * 2);
+        solve_landmarks(params.data(), faces, landmarks.data());
+
+        for (size_t f = 0; f < faces; f++)
+        {
+            xt::xarray<float> face_params = xt::zeros<float>({PARAMS_DIM});
+            for (int i = 0; i < PARAMS_DIM; i++)
+                face_params(i) = params[f * PARAMS_DIM + i];
+            xt::xarray<float> expected = facial_landmark_postprocess(face_params);
+            for (int point = 0; point < OUTPUT_SIZE; point++)
+            {
+                REQUIRE(landmarks[(f * OUTPUT_SIZE + point) * 2] == Approx(expected(point, 0)).margin(TOLERANCE));
+                REQUIRE(landmarks[(f * OUTPUT_SIZE + point) * 2 + 1] == Approx(expected(point, 1)).margin(TOLERANCE));
+            }
+        }
+    }
+
+    hailo_vstream_info_t params_layer_info(const std::string &name)
+    {
+        hailo_vstream_info_t info{};
+        std::strncpy(info.name, name.c_str(), sizeof(info.name) - 1);
+        info.format.type = HAILO_FORMAT_TYPE_UINT8;
+        info.quant_info.qp_scale = 0.05f;
+        info.quant_info.qp_zp = 128.0f;
+        info.shape.height = 1;
+        info.shape.width = 1;
+        info.shape.features = PARAMS_DIM;
+        return info;
+    }
+}
+
+TEST_CASE("tddfa solve_landmarks of one face matches the previous BFM computation", "[tddfa]")
+{
+    check_against_reference(1);
+}
+
+TEST_CASE("tddfa solve_landmarks of a batch matches the previous BFM computation", "[tddfa]")
+{
+    check_against_reference(2);
+    check_against_reference(7);
+}
+
+TEST_CASE("tddfa batch post-processes read the params layer of their network", "[tddfa]")
+{
+    data_dir();
+    std::mt19937 random(3);
+    std::uniform_int_distribution<int> values(0, 255);
+    std::vector<uint8_t> data(PARAMS_DIM);
+    for (auto &value : data)
+        value = values(random);
+    std::vector<float> params(PARAMS_DIM);
+    for (int i = 0; i < PARAMS_DIM; i++)
+        params[i] = (float(data[i]) - 128.0f) * 0.05f;
+    std::vector<float> expected(OUTPUT_SIZE * 2);
+    solve_landmarks(params.data(), 1, expected.data());
+
+    for (bool yuy2 : {false, true})
+    {
+        auto frame = std::make_shared<HailoROI>(HailoBBox(0.0f, 0.0f, 1.0f, 1.0f));
+        auto face = std::make_shared<HailoDetection>(HailoBBox(0.2f, 0.2f, 0.3f, 0.3f), "face", 0.9f);
+        face->add_tensor(std::make_shared<HailoTensor>(data.data(), params_layer_info(yuy2 ? "tddfa_mobilenet_v1_yuy2/fc1" : "tddfa_mobilenet_v1/fc1")));
+        frame->add_object(face);
+        // A per-face post-process of the other network doesn't change which layer the batch reads
+        auto other_face = std::make_shared<HailoROI>(HailoBBox(0.0f, 0.0f, 1.0f, 1.0f));
+        if (yuy2)
+            facial_landmarks_merged(other_face);
+        else
+            facial_landmarks_yuy2(other_face);
+
+        if (yuy2)
+            facial_landmarks_batch_yuy2(frame);
+        else
+            facial_landmarks_batch(frame);
+
+        std::vector<HailoObjectPtr> landmarks = face->get_objects_typed(HAILO_LANDMARKS);
+        REQUIRE(landmarks.size() == 1);
+        std::vector<HailoPoint> points = std::dynamic_pointer_cast<HailoLandmarks>(landmarks[0])->get_points();
+        REQUIRE(points.size() == OUTPUT_SIZE);
+        for (int point = 0; point < OUTPUT_SIZE; point++)
+        {
+            REQUIRE(points[point].x() == expected[point * 2]);
+            REQUIRE(points[point].y() == expected[point * 2 + 1]);
+        }
+    }
+}
@@ -0,0 +1,6 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch.hpp>
@@ -0,0 +1,38 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+// Per-frame cost of the yolov5seg post-process (decoding, NMS and masks) for frames with 0, 10 and 50 instances.
+#include <benchmark/benchmark.h>
+
+#include "instance_segmentation/yolov5seg.hpp"
+#include "yolov5seg_frame.hpp"
+
+namespace
+{
+    void run_frames(benchmark::State &state, mask_encoding_t encoding)
+    {
+        yolov5seg_frame::Frame frame(state.range(0));
+        Yolov5segParams *params = init("", "yolov5seg");
+        params->mask_encoding = encoding;
+        size_t detections = 0;
+        for (auto _ : state)
+        {
+            HailoROIPtr roi = frame.roi();
+            filter(roi, params);
+            detections = roi->get_objects().size();
+            benchmark::DoNotOptimize(detections);
+        }
+        free_resources(params);
+        state.counters["detections"] = detections;
+        state.counters["frames/s"] = benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+    }
+
+    void BM_yolov5seg_frame(benchmark::State &state) { run_frames(state, MASK_ENCODING_CONFIDENCE); }
+    void BM_yolov5seg_frame_rle(benchmark::State &state) { run_frames(state, MASK_ENCODING_RLE); }
+
+    BENCHMARK(BM_yolov5seg_frame)->Arg(0)->Arg(10)->Arg(50)->Unit(benchmark::kMicrosecond);
+    BENCHMARK(BM_yolov5seg_frame_rle)->Arg(0)->Arg(10)->Arg(50)->Unit(benchmark::kMicrosecond);
+}
+
+BENCHMARK_MAIN();
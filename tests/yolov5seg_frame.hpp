@@ -0,0 +1,108 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+// Deterministic yolov5seg outputs for the default Yolov5segParams (yolov5n_seg, 640x640, 80 classes).
+// The tree has no recorded network outputs, so the tensors are synthetic: a background that never passes
+// the score threshold, and the requested number of instances with distinct scores and random boxes and masks.
+#pragma once
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "hailo_objects.hpp"
+
+namespace yolov5seg_frame
+{
+    constexpr int NUM_ANCHORS = 3;
+    constexpr int NUM_CLASSES = 80;
+    constexpr int MASK_COEFFICIENTS = 32;
+    constexpr int ENTRY_SIZE = 4 + 1 + NUM_CLASSES + MASK_COEFFICIENTS;
+    constexpr int PROTO_SIZE = 160;
+    constexpr int STRIDES[] = {32, 16, 8};
+    constexpr int GRIDS[] = {20, 40, 80};
+    // outputs_name of the defaults: the proto, then the branches from the smallest grid
+    const char *const PROTO_NAME = "yolov5n_seg/conv63";
+    const char *const BRANCH_NAMES[] = {"yolov5n_seg/conv61", "yolov5n_seg/conv55", "yolov5n_seg/conv48"};
+
+    constexpr float BRANCH_SCALE = 0.002f;
+    constexpr float BRANCH_ZP = 32768.0f;
+    constexpr float PROTO_SCALE = 0.02f;
+    constexpr float PROTO_ZP = 128.0f;
+
+    inline hailo_vstream_info_t layer_info(const std::string &name, uint32_t height, uint32_t width, uint32_t features,
+                                           hailo_format_type_t type, float qp_scale, float qp_zp)
+    {
+        hailo_vstream_info_t info{};
+        std::strncpy(info.name, name.c_str(), sizeof(info.name) - 1);
+        info.format.type = type;
+        info.quant_info.qp_scale = qp_scale;
+        info.quant_info.qp_zp = qp_zp;
+        info.shape.height = height;
+        info.shape.width = width;
+        info.shape.features = features;
+        return info;
+    }
+
+    inline uint16_t quantize(float value)
+    {
+        return uint16_t(std::lround(value / BRANCH_SCALE + BRANCH_ZP));
+    }
+
+    struct Frame
+    {
+        std::vector<uint8_t> proto;
+        std::vector<std::vector<uint16_t>> branches;
+
+        explicit Frame(int instances)
+        {
+            std::mt19937 random(instances + 1);
+            std::uniform_int_distribution<int> proto_values(0, 255);
+            std::uniform_real_distribution<float> box_logits(-2.0f, 2.0f);
+            std::uniform_real_distribution<float> mask_logits(-1.5f, 1.5f);
+            std::uniform_int_distribution<int> class_ids(0, NUM_CLASSES - 1);
+
+            proto.resize(size_t(PROTO_SIZE) * PROTO_SIZE * MASK_COEFFICIENTS);
+            for (uint8_t &value : proto)
+                value = proto_values(random);
+
+            for (int grid : GRIDS)
+            {
+                std::vector<uint16_t> branch(size_t(grid) * grid * NUM_ANCHORS * ENTRY_SIZE);
+                for (size_t entry = 0; entry < branch.size(); entry += ENTRY_SIZE)
+                {
+                    for (int i = 0; i < 4; i++)
+                        branch[entry + i] = quantize(box_logits(random));
+                    branch[entry + 4] = quantize(-8.0f);
+                    for (int i = 0; i < NUM_CLASSES; i++)
+                        branch[entry + 5 + i] = quantize(-6.0f);
+                    for (int i = 0; i < MASK_COEFFICIENTS; i++)
+                        branch[entry + 5 + NUM_CLASSES + i] = quantize(mask_logits(random));
+                }
+                branches.push_back(std::move(branch));
+            }
+
+            // Every instance in its own entry, with its own objectness, so no two scores tie
+            for (int k = 0; k < instances; k++)
+            {
+                std::vector<uint16_t> &branch = branches[k % 3];
+                size_t entries = branch.size() / ENTRY_SIZE;
+                size_t entry = (size_t(k / 3) * 7919 + k) % entries * ENTRY_SIZE;
+                branch[entry + 4] = quantize(0.5f + 0.05f * k);
+                branch[entry + 5 + class_ids(random)] = quantize(3.0f);
+            }
+        }
+
+        HailoROIPtr roi()
+        {
+            auto roi = std::make_shared<HailoROI>(HailoBBox(0.0f, 0.0f, 1.0f, 1.0f));
+            roi->add_tensor(std::make_shared<HailoTensor>(proto.data(), layer_info(PROTO_NAME, PROTO_SIZE, PROTO_SIZE, MASK_COEFFICIENTS,
+                                                                                   HAILO_FORMAT_TYPE_UINT8, PROTO_SCALE, PROTO_ZP)));
+            for (int i = 0; i < 3; i++)
+                roi->add_tensor(std::make_shared<HailoTensor>(reinterpret_cast<uint8_t *>(branches[i].data()),
+                                                              layer_info(BRANCH_NAMES[i], GRIDS[i], GRIDS[i], NUM_ANCHORS * ENTRY_SIZE,
+                                                                         HAILO_FORMAT_TYPE_UINT16, BRANCH_SCALE, BRANCH_ZP)));
+            return roi;
+        }
+    };
+}
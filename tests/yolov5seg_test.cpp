@@ -0,0 +1,183 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+// yolov5seg against the decoding it replaced (xtensor views per branch, the pairwise NMS, then one dot
+// product and sigmoid per instance), transcribed here as plain loops with the same formulas and order.
+#include <catch2/catch.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "hailo_common.hpp"
+#include "common/labels/coco_eighty.hpp"
+#include "instance_segmentation/yolov5seg.hpp"
+#include "yolov5seg_frame.hpp"
+
+using namespace yolov5seg_frame;
+
+namespace
+{
+    constexpr float SCORE_THRESHOLD = 0.25f;
+    constexpr float IOU_THRESHOLD = 0.6f;
+    constexpr int INPUT_SIZE = 640;
+    const float ANCHORS[3][6] = {{116, 90, 156, 198, 373, 326}, {30, 61, 62, 45, 59, 119}, {10, 13, 16, 30, 33, 23}};
+
+    float reference_sigmoid(float x) { return 1.0f / (1.0f + std::exp(-1.0 * x)); }
+    float dequantize_branch(uint16_t value) { return (float(value) - BRANCH_ZP) * BRANCH_SCALE; }
+
+    float iou(const HailoBBox &a, const HailoBBox &b)
+    {
+        float overlap_width = std::max(0.0f, std::min(a.xmax(), b.xmax()) - std::max(a.xmin(), b.xmin()));
+        float overlap_height = std::max(0.0f, std::min(a.ymax(), b.ymax()) - std::max(a.ymin(), b.ymin()));
+        float overlap = overlap_width * overlap_height;
+        return overlap / (a.width() * a.height() + b.width() * b.height() - overlap);
+    }
+
+    // The NMS of the class of each detection, highest score first (the scores of the frame never tie)
+    void pairwise_nms(std::vector<HailoDetection> &objects)
+    {
+        std::sort(objects.begin(), objects.end(), [](HailoDetection &a, HailoDetection &b)
+                  { return a.get_confidence() > b.get_confidence(); });
+        std::vector<bool> suppressed(objects.size(), false);
+        std::vector<HailoDetection> survivors;
+        for (size_t i = 0; i < objects.size(); i++)
+        {
+            if (suppressed[i])
+                continue;
+            survivors.push_back(objects[i]);
+            for (size_t j = i + 1; j < objects.size(); j++)
+            {
+                if (objects[i].get_class_id() == objects[j].get_class_id() && iou(objects[i].get_bbox(), objects[j].get_bbox()) >= IOU_THRESHOLD)
+                    suppressed[j] = true;
+            }
+        }
+        objects = survivors;
+    }
+
+    struct ReferenceInstance
+    {
+        HailoDetection detection;
+        int mask_width, mask_height;
+        std::vector<float> mask;
+    };
+
+    std::vector<ReferenceInstance> reference_decoding(const Frame &frame)
+    {
+        std::vector<HailoDetection> detections;
+        std::vector<std::vector<float>> coefficients;
+        for (int branch = 0; branch < 3; branch++)
+        {
+            const std::vector<uint16_t> &output = frame.branches[branch];
+            // The quantized objectness threshold truncated to uint16, as yolov5_decoding used to
+            uint16_t threshold_quantized = uint16_t(std::log(SCORE_THRESHOLD / (1 - SCORE_THRESHOLD)) / BRANCH_SCALE + BRANCH_ZP);
+            int grid = GRIDS[branch];
+            for (int y = 0; y < grid; y++)
+            {
+                for (int x = 0; x < grid; x++)
+                {
+                    for (int anchor = 0; anchor < NUM_ANCHORS; anchor++)
+                    {
+                        const uint16_t *entry = output.data() + ((size_t(y) * grid + x) * NUM_ANCHORS + anchor) * ENTRY_SIZE;
+                        if (!(entry[4] > threshold_quantized))
+                            continue;
+                        int best = 0;
+                        for (int i = 1; i < NUM_CLASSES; i++)
+                            if (entry[5 + i] > entry[5 + best])
+                                best = i;
+                        float score = reference_sigmoid(dequantize_branch(entry[5 + best])) * reference_sigmoid(dequantize_branch(entry[4]));
+                        if (!(score > SCORE_THRESHOLD))
+                            continue;
+                        float cx = (reference_sigmoid(dequantize_branch(entry[0])) * 2 + (x - 0.5f)) * STRIDES[branch];
+                        float cy = (reference_sigmoid(dequantize_branch(entry[1])) * 2 + (y - 0.5f)) * STRIDES[branch];
+                        float w = std::pow(reference_sigmoid(dequantize_branch(entry[2])) * 2, 2) * ANCHORS[branch][anchor * 2];
+                        float h = std::pow(reference_sigmoid(dequantize_branch(entry[3])) * 2, 2) * ANCHORS[branch][anchor * 2 + 1];
+                        cx /= INPUT_SIZE, cy /= INPUT_SIZE, w /= INPUT_SIZE, h /= INPUT_SIZE;
+                        HailoDetection detection(HailoBBox(cx - w / 2, cy - h / 2, w, h), best + 1, common::coco_eighty[best + 1], score);
+                        std::vector<float> instance_coefficients(MASK_COEFFICIENTS);
+                        for (int i = 0; i < MASK_COEFFICIENTS; i++)
+                            instance_coefficients[i] = dequantize_branch(entry[5 + NUM_CLASSES + i]);
+                        // Carry the coefficients through the NMS like the detection did
+                        detection.add_object(std::make_shared<HailoMatrix>(instance_coefficients, MASK_COEFFICIENTS, 1));
+                        detections.push_back(detection);
+                    }
+                }
+            }
+        }
+        pairwise_nms(detections);
+
+        std::vector<ReferenceInstance> instances;
+        for (HailoDetection &detection : detections)
+        {
+            HailoMatrixPtr matrix = std::static_pointer_cast<HailoMatrix>(detection.get_objects()[0]);
+            detection.remove_object(matrix);
+            HailoBBox bbox = detection.get_bbox();
+            int xmin = CLAMP(bbox.xmin() * PROTO_SIZE, 0, PROTO_SIZE);
+            int xmax = CLAMP(bbox.xmax() * PROTO_SIZE, 0, PROTO_SIZE);
+            int ymin = CLAMP(bbox.ymin() * PROTO_SIZE, 0, PROTO_SIZE);
+            int ymax = CLAMP(bbox.ymax() * PROTO_SIZE, 0, PROTO_SIZE);
+            ReferenceInstance instance{detection, xmax - xmin, ymax - ymin, {}};
+            for (int y = ymin; y < ymax; y++)
+            {
+                for (int x = xmin; x < xmax; x++)
+                {
+                    float sum = 0.0f;
+                    for (int k = 0; k < MASK_COEFFICIENTS; k++)
+                        sum += (float(frame.proto[(size_t(y) * PROTO_SIZE + x) * MASK_COEFFICIENTS + k]) - PROTO_ZP) * PROTO_SCALE * matrix->get_data()[k];
+                    instance.mask.push_back(1 / (1 + std::exp(-sum)));
+                }
+            }
+            instances.push_back(std::move(instance));
+        }
+        return instances;
+    }
+
+    void check_against_reference(int instances)
+    {
+        Frame frame(instances);
+        std::vector<ReferenceInstance> expected = reference_decoding(frame);
+        Yolov5segParams *params = init("", "yolov5seg");
+        HailoROIPtr roi = frame.roi();
+        filter(roi, params);
+        free_resources(params);
+
+        std::vector<HailoObjectPtr> objects = roi->get_objects();
+        REQUIRE(objects.size() == expected.size());
+        for (size_t i = 0; i < objects.size(); i++)
+        {
+            HailoDetectionPtr detection = std::dynamic_pointer_cast<HailoDetection>(objects[i]);
+            REQUIRE(detection);
+            HailoDetection &reference = expected[i].detection;
+            CHECK(detection->get_class_id() == reference.get_class_id());
+            CHECK(detection->get_label() == reference.get_label());
+            CHECK(detection->get_confidence() == Approx(reference.get_confidence()).margin(1e-6));
+            CHECK(detection->get_bbox().xmin() == Approx(reference.get_bbox().xmin()).margin(1e-5));
+            CHECK(detection->get_bbox().ymin() == Approx(reference.get_bbox().ymin()).margin(1e-5));
+            CHECK(detection->get_bbox().width() == Approx(reference.get_bbox().width()).margin(1e-5));
+            CHECK(detection->get_bbox().height() == Approx(reference.get_bbox().height()).margin(1e-5));
+
+            std::vector<HailoObjectPtr> masks = detection->get_objects_typed(HAILO_CONF_CLASS_MASK);
+            REQUIRE(masks.size() == 1);
+            HailoConfClassMaskPtr mask = std::dynamic_pointer_cast<HailoConfClassMask>(masks[0]);
+            REQUIRE(int(mask->get_width()) == expected[i].mask_width);
+            REQUIRE(int(mask->get_height()) == expected[i].mask_height);
+            REQUIRE(mask->get_data().size() == expected[i].mask.size());
+            float max_difference = 0.0f;
+            for (size_t pixel = 0; pixel < expected[i].mask.size(); pixel++)
+                max_difference = std::max(max_difference, std::abs(mask->get_data()[pixel] - expected[i].mask[pixel]));
+            // The dot products are summed in blocks of 4 channels instead of one by one
+            CHECK(max_difference < 1e-5f);
+        }
+    }
+}
+
+TEST_CASE("yolov5seg of an empty frame has no detections", "[yolov5seg]")
+{
+    check_against_reference(0);
+}
+
+TEST_CASE("yolov5seg detections and masks match the previous decoding", "[yolov5seg]")
+{
+    check_against_reference(5);
+    check_against_reference(40);
+}
@@ -0,0 +1,33 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+// Per-frame cost of the yolov8 post-process for frames with 0, 10 and 300 detections.
+#include <benchmark/benchmark.h>
+#include <vector>
+
+#include "hailo_objects.hpp"
+#include "yolov8/yolov8_postprocess.hpp"
+#include "yolov8_frame.hpp"
+
+using namespace yolov8_frame;
+
+namespace
+{
+    void BM_yolov8_frame(benchmark::State &state)
+    {
+        Frame frame(state.range(0));
+        for (auto _ : state)
+        {
+            HailoROIPtr roi = frame.roi();
+            filter(roi);
+            benchmark::DoNotOptimize(roi->get_objects());
+        }
+        HailoROIPtr roi = frame.roi();
+        filter(roi);
+        state.counters["detections"] = roi->get_objects().size();
+    }
+    BENCHMARK(BM_yolov8_frame)->Arg(0)->Arg(10)->Arg(300)->Unit(benchmark::kMicrosecond);
+}
+
+BENCHMARK_MAIN();
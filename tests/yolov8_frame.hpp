@@ -0,0 +1,108 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+// Deterministic yolov8 outputs (640x640, 2 classes, strides 8, 16 and 32), as (boxes, scores) pairs per stride.
+// The tree has no recorded network outputs, so the tensors are synthetic: random box distributions, scores
+// under SCORE_THRESHOLD, and the requested number of anchors with a score over it (and a random second class).
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "hailo_objects.hpp"
+
+namespace yolov8_frame
+{
+    constexpr int NETWORK_SIZE = 640;
+    constexpr int NUM_CLASSES = 2;
+    constexpr int REGRESSION_LENGTH = 15;
+    constexpr int STRIDES[] = {8, 16, 32};
+
+    // Scores decode to [0, 1] in steps of 1/255, the first passing SCORE_THRESHOLD (0.8) is 204
+    constexpr float SCORES_SCALE = 1.0f / 255.0f;
+    constexpr float SCORES_ZP = 0.0f;
+    constexpr float BOXES_SCALE = 0.05f;
+    constexpr float BOXES_ZP = 128.0f;
+
+    inline hailo_vstream_info_t layer_info(const std::string &name, uint32_t grid, uint32_t features, float qp_scale, float qp_zp)
+    {
+        hailo_vstream_info_t info{};
+        std::strncpy(info.name, name.c_str(), sizeof(info.name) - 1);
+        info.format.type = HAILO_FORMAT_TYPE_UINT8;
+        info.quant_info.qp_scale = qp_scale;
+        info.quant_info.qp_zp = qp_zp;
+        info.shape.height = grid;
+        info.shape.width = grid;
+        info.shape.features = features;
+        return info;
+    }
+
+    struct Frame
+    {
+        std::vector<std::vector<uint8_t>> buffers;
+        std::vector<hailo_vstream_info_t> infos;
+
+        /**
+         * @brief The output layers of a frame with the requested number of passing anchors, spread over the strides.
+         */
+        explicit Frame(int detections)
+        {
+            std::mt19937 random(detections);
+            std::uniform_int_distribution<int> bins(0, 255);
+            std::uniform_int_distribution<int> low_scores(0, 203);
+            std::uniform_int_distribution<int> passing_scores(204, 255);
+            std::uniform_int_distribution<int> any_scores(0, 255);
+            std::uniform_int_distribution<int> classes(0, NUM_CLASSES - 1);
+            int placed = 0;
+            for (int stride : STRIDES)
+            {
+                uint32_t grid = NETWORK_SIZE / stride;
+                uint32_t cells = grid * grid;
+                std::vector<uint8_t> boxes(cells * 4 * (REGRESSION_LENGTH + 1));
+                for (auto &value : boxes)
+                    value = bins(random);
+                std::vector<uint8_t> scores(cells * NUM_CLASSES);
+                for (auto &value : scores)
+                    value = low_scores(random);
+                int layer_detections = (stride == STRIDES[2]) ? detections - placed : detections / 3;
+                std::vector<uint32_t> anchors(cells);
+                for (uint32_t i = 0; i < cells; i++)
+                    anchors[i] = i;
+                std::shuffle(anchors.begin(), anchors.end(), random);
+                for (int k = 0; k < layer_detections; k++)
+                {
+                    uint8_t *anchor_scores = scores.data() + anchors[k] * NUM_CLASSES;
+                    // The other classes may pass too, or tie with it
+                    for (int c = 0; c < NUM_CLASSES; c++)
+                        anchor_scores[c] = any_scores(random);
+                    anchor_scores[classes(random)] = passing_scores(random);
+                }
+                placed += layer_detections;
+
+                std::string prefix = "yolov8/conv" + std::to_string(stride);
+                buffers.push_back(std::move(boxes));
+                infos.push_back(layer_info(prefix + "_boxes", grid, 4 * (REGRESSION_LENGTH + 1), BOXES_SCALE, BOXES_ZP));
+                buffers.push_back(std::move(scores));
+                infos.push_back(layer_info(prefix + "_scores", grid, NUM_CLASSES, SCORES_SCALE, SCORES_ZP));
+            }
+        }
+
+        std::vector<HailoTensorPtr> tensors()
+        {
+            std::vector<HailoTensorPtr> tensors;
+            for (size_t i = 0; i < buffers.size(); i++)
+                tensors.push_back(std::make_shared<HailoTensor>(buffers[i].data(), infos[i]));
+            return tensors;
+        }
+
+        HailoROIPtr roi()
+        {
+            auto roi = std::make_shared<HailoROI>(HailoBBox(0.0f, 0.0f, 1.0f, 1.0f));
+            for (HailoTensorPtr &tensor : tensors())
+                roi->add_tensor(tensor);
+            return roi;
+        }
+    };
+}
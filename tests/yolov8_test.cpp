@@ -0,0 +1,204 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+// yolov8 decode_boxes, thresholding the quantized scores first, against the decoding it replaced:
+// the scores of all the strides dequantized into one xtensor, and the boxes of the passing anchors
+// decoded with xtensor from centers of the whole grid. The previous code is kept below as it was,
+// without its event file writes.
+#include <catch2/catch.hpp>
+#include <string>
+#include <vector>
+
+#include "hailo_objects.hpp"
+#include "common/math.hpp"
+#include "common/tensors.hpp"
+#include "common/labels/coco_eighty.hpp"
+#include "yolov8/yolov8_postprocess.hpp"
+#include "yolov8_frame.hpp"
+
+using namespace xt::placeholders;
+using namespace yolov8_frame;
+
+namespace
+{
+    constexpr double SCORE_THRESHOLD = 0.8;
+
+    std::pair<std::vector<HailoTensorPtr>, xt::xarray<float>> get_boxes_and_scores(std::vector<HailoTensorPtr> &tensors,
+                                                                                      int num_classes,
+                                                                                      int regression_length)
+    {
+        std::vector<HailoTensorPtr> outputs_boxes(tensors.size() / 2);
+
+        // Prepare the scores xarray at the size we will fill in in-place
+        int total_scores = 0;
+        for (uint i = 0; i < tensors.size(); i = i + 2) { 
+            total_scores += tensors[i+1]->width() * tensors[i+1]->height(); 
+        }
+
+        std::vector<size_t> shape = { (long unsigned int)total_scores, (long unsigned int)num_classes};
+
+        xt::xarray<float> scores(shape);
+        int view_index = 0;
+
+        for (uint i = 0; i < tensors.size(); i = i + 2)
+        {
+            // Bounding boxes extraction will be done later on only on the boxes that surpass the score threshold
+            outputs_boxes[i / 2] = tensors[i];
+
+            // Extract and dequantize the scores outputs
+            auto dequantized_output_s = common::dequantize(common::get_xtensor(tensors[i+1]), tensors[i+1]->vstream_info().quant_info.qp_scale, tensors[i+1]->vstream_info().quant_info.qp_zp);
+            int num_proposals_scores = dequantized_output_s.shape(0)*dequantized_output_s.shape(1);
+
+            // From the layer extract the scores
+            auto output_scores = xt::view(dequantized_output_s, xt::all(), xt::all(), xt::all());
+            xt::view(scores, xt::range(view_index, view_index + num_proposals_scores), xt::all()) = xt::reshape_view(output_scores, {num_proposals_scores, num_classes});
+            view_index += num_proposals_scores;
+        }
+
+        return std::pair<std::vector<HailoTensorPtr>, xt::xarray<float>>( outputs_boxes, scores );
+    }
+
+    float reference_dequantize_value(uint8_t val, float32_t qp_scale, float32_t qp_zp){
+        return (float(val) - qp_zp) * qp_scale;
+    }
+
+    void dequantize_box_values(xt::xarray<float>& box, int index, xt::xarray<uint8_t>& quantized_box, size_t dim1, size_t dim2, float32_t qp_scale, float32_t qp_zp){
+        for (size_t i = 0; i < dim1; i++){
+            for (size_t j = 0; j < dim2; j++){
+                box(i, j) = reference_dequantize_value(quantized_box(index, i, j), qp_scale, qp_zp);
+            }
+        }
+    }
+
+    std::vector<xt::xarray<double>> get_centers(std::vector<int>& strides, std::vector<int>& network_dims,
+                                            std::size_t boxes_num, int strided_width, int strided_height){
+
+            std::vector<xt::xarray<double>> centers(boxes_num);
+
+            for (uint i=0; i < boxes_num; i++) {
+                strided_width = network_dims[0] / strides[i];
+                strided_height = network_dims[1] / strides[i];
+
+                // Create a meshgrid of the proper strides
+                xt::xarray<int> grid_x = xt::arange(0, strided_width);
+                xt::xarray<int> grid_y = xt::arange(0, strided_height);
+
+                auto mesh = xt::meshgrid(grid_x, grid_y);
+                grid_x = std::get<1>(mesh);
+                grid_y = std::get<0>(mesh);
+
+                // Use the meshgrid to build up box center prototypes
+                auto ct_row = (xt::flatten(grid_y) + 0.5) * strides[i];
+                auto ct_col = (xt::flatten(grid_x) + 0.5) * strides[i];
+
+                centers[i] = xt::stack(xt::xtuple(ct_col, ct_row, ct_col, ct_row), 1);
+            }
+
+            return centers;
+    }
+
+    std::vector<HailoDetection> reference_decode_boxes(std::vector<HailoTensorPtr> raw_boxes_outputs,
+                                                       xt::xarray<float> scores,
+                                                       std::vector<int> network_dims,
+                                                       std::vector<int> strides,
+                                                       int regression_length)
+    {
+        int strided_width, strided_height, class_index;
+        std::vector<HailoDetection> detections;
+        int instance_index = 0;
+        float confidence = 0.0;
+        std::string label;
+
+        auto centers = get_centers(std::ref(strides), std::ref(network_dims), raw_boxes_outputs.size(), strided_width, strided_height);
+
+        // Box distribution to distance
+        auto regression_distance =  xt::reshape_view(xt::arange(0, regression_length + 1), {1, 1, regression_length + 1});
+
+        for (uint i = 0; i < raw_boxes_outputs.size(); i++)
+        {
+            auto output_b = common::get_xtensor(raw_boxes_outputs[i]);
+            int num_proposals = output_b.shape(0) * output_b.shape(1);
+            auto output_boxes = xt::view(output_b, xt::all(), xt::all(), xt::all());
+            xt::xarray<uint8_t> quantized_boxes = xt::reshape_view(output_boxes, {num_proposals, 4, regression_length + 1});
+
+            float32_t qp_scale = raw_boxes_outputs[i]->vstream_info().quant_info.qp_scale;
+            float32_t qp_zp = raw_boxes_outputs[i]->vstream_info().quant_info.qp_zp;
+
+            auto shape = {quantized_boxes.shape(1), quantized_boxes.shape(2)};
+
+            for (int j = 0; j < num_proposals; j++)
+            {
+                class_index = xt::argmax(xt::row(scores, instance_index))(0);
+                confidence = scores(instance_index, class_index);
+                instance_index++;
+                if (confidence < SCORE_THRESHOLD)
+                    continue;
+
+                xt::xarray<float> box(shape);
+
+                dequantize_box_values(box, j, quantized_boxes, box.shape(0), box.shape(1), qp_scale, qp_zp);
+
+                common::softmax_2D(box.data(), box.shape(0), box.shape(1));
+
+                auto box_distance = box * regression_distance;
+                xt::xarray<float> reduced_distances = xt::sum(box_distance, {2});
+                auto strided_distances = reduced_distances * strides[i];
+
+                // Decode box
+                auto distance_view1 = xt::view(strided_distances, xt::all(), xt::range(_, 2)) * -1;
+                auto distance_view2 = xt::view(strided_distances, xt::all(), xt::range(2, _));
+                auto distance_view = xt::concatenate(xt::xtuple(distance_view1, distance_view2), 1);
+                auto decoded_box = centers[i] + distance_view;
+
+                HailoBBox bbox(decoded_box(j, 0) / network_dims[0],
+                               decoded_box(j, 1) / network_dims[1],
+                               (decoded_box(j, 2) - decoded_box(j, 0)) / network_dims[0],
+                               (decoded_box(j, 3) - decoded_box(j, 1)) / network_dims[1]);
+
+                label = common::coco_eighty[class_index + 1];
+                HailoDetection detected_instance(bbox, class_index, label, confidence);
+                detections.push_back(detected_instance);
+            }
+        }
+        return detections;
+    }
+
+    void check_against_reference(int passing_anchors)
+    {
+        Frame frame(passing_anchors);
+        std::vector<int> network_dims = {NETWORK_SIZE, NETWORK_SIZE};
+        std::vector<int> strides(std::begin(STRIDES), std::end(STRIDES));
+
+        std::vector<HailoTensorPtr> tensors = frame.tensors();
+        auto boxes_and_scores = get_boxes_and_scores(tensors, NUM_CLASSES, REGRESSION_LENGTH);
+        std::vector<HailoDetection> expected = reference_decode_boxes(boxes_and_scores.first, boxes_and_scores.second, network_dims, strides, REGRESSION_LENGTH);
+        REQUIRE(int(expected.size()) == passing_anchors);
+
+        std::vector<HailoDetection> detections;
+        decode_boxes(tensors, network_dims, strides, REGRESSION_LENGTH, NUM_CLASSES, detections);
+        REQUIRE(detections.size() == expected.size());
+        for (size_t i = 0; i < detections.size(); i++)
+        {
+            // Same formulas in the same order, so the results are bit identical
+            REQUIRE(detections[i].get_class_id() == expected[i].get_class_id());
+            REQUIRE(detections[i].get_label() == expected[i].get_label());
+            REQUIRE(detections[i].get_confidence() == expected[i].get_confidence());
+            REQUIRE(detections[i].get_bbox().xmin() == expected[i].get_bbox().xmin());
+            REQUIRE(detections[i].get_bbox().ymin() == expected[i].get_bbox().ymin());
+            REQUIRE(detections[i].get_bbox().width() == expected[i].get_bbox().width());
+            REQUIRE(detections[i].get_bbox().height() == expected[i].get_bbox().height());
+        }
+    }
+}
+
+TEST_CASE("yolov8 boxes of a frame without passing anchors", "[yolov8]")
+{
+    check_against_reference(0);
+}
+
+TEST_CASE("yolov8 boxes match the previous full tensor decoding", "[yolov8]")
+{
+    check_against_reference(10);
+    check_against_reference(300);
+}